@@ -106,10 +106,23 @@ int abis_nm_sw_act_req_ack(struct gsm_bts *bts, uint8_t obj_class, uint8_t i1,
 int abis_nm_raw_msg(struct gsm_bts *bts, int len, uint8_t *msg);
 int abis_nm_event_reports(struct gsm_bts *bts, int on);
 int abis_nm_reset_resource(struct gsm_bts *bts);
+/* progress of the software load into a BTS */
+struct abis_nm_sw_progress {
+	unsigned int segs_total;
+	unsigned int segs_sent;
+	unsigned int segs_acked;
+	/* number of windows acknowledged by the BTS */
+	unsigned int windows;
+	unsigned long bytes_total;
+	unsigned long bytes_acked;
+};
+
 int abis_nm_software_load(struct gsm_bts *bts, int trx_nr, const char *fname,
 			  uint8_t win_size, int forced,
 			  gsm_cbfn *cbfn, void *cb_data);
 int abis_nm_software_load_status(struct gsm_bts *bts);
+int abis_nm_software_load_progress(struct gsm_bts *bts,
+				   struct abis_nm_sw_progress *progress);
 int abis_nm_software_activate(struct gsm_bts *bts, const char *fname,
 			      gsm_cbfn *cbfn, void *cb_data);
 
@@ -47,6 +47,7 @@ struct nat_sccp_connection;
 struct bsc_nat_parsed;
 struct bsc_nat;
 struct bsc_nat_ussd_con;
+struct bsc_nat_ussd_gw;
 struct nat_rewrite_rule;
 
 /*
@@ -302,12 +303,9 @@ struct bsc_nat {
 
 	/* USSD messages  we want to match */
 	char *ussd_lst_name;
-	char *ussd_query;
-	regex_t ussd_query_re;
-	char *ussd_token;
 	char *ussd_local;
 	struct osmo_fd ussd_listen;
-	struct bsc_nat_ussd_con *ussd_con;
+	struct llist_head ussd_gws;
 
 	/* for maintainenance */
 	int blocked;
@@ -319,9 +317,42 @@ struct bsc_nat {
 	struct ctrl_handle *ctrl;
 };
 
+enum bsc_nat_ussd_gw_ctr {
+	USSD_GW_CTR_CONN,
+	USSD_GW_CTR_SESSIONS,
+	USSD_GW_CTR_MSG_TX,
+	USSD_GW_CTR_MSG_RX,
+	USSD_GW_CTR_BUSY,
+	USSD_GW_CTR_DROPPED,
+};
+
+/*
+ * A USSD provider. The token authenticates its connection and the
+ * query selects the service codes it handles. The gateway configured
+ * by ussd-token and ussd-query is named "default".
+ */
+struct bsc_nat_ussd_gw {
+	struct llist_head entry;
+	struct bsc_nat *nat;
+	int nr;
+
+	char *name;
+	char *token;
+	char *query;
+	regex_t query_re;
+
+	/* messages waiting for the provider before new sessions bypass it */
+#define USSD_GW_DEFAULT_QUEUE	100
+	int max_queue;
+
+	struct bsc_nat_ussd_con *con;
+	struct rate_ctr_group *ctrg;
+};
+
 struct bsc_nat_ussd_con {
 	struct osmo_wqueue queue;
 	struct bsc_nat *nat;
+	struct bsc_nat_ussd_gw *gw;
 	int authorized;
 
 	struct msgb *pending_msg;
@@ -396,6 +427,11 @@ int bsc_do_write(struct osmo_wqueue *queue, struct msgb *msg, int id);
 int bsc_write_msg(struct osmo_wqueue *queue, struct msgb *msg);
 int bsc_write_cb(struct osmo_fd *bfd, struct msgb *msg);
 
+/* release a connection towards the BSC */
+struct msgb *nat_creat_clrc(struct nat_sccp_connection *conn, uint8_t cause);
+int nat_send_clrc_bsc(struct nat_sccp_connection *conn);
+void nat_send_rlsd_bsc(struct nat_sccp_connection *conn);
+
 int bsc_nat_msc_is_connected(struct bsc_nat *nat);
 
 int bsc_conn_type_to_ctr(struct nat_sccp_connection *conn);
@@ -405,7 +441,12 @@ struct gsm48_hdr *bsc_unpack_dtap(struct bsc_nat_parsed *parsed, struct msgb *ms
 /** USSD filtering */
 int bsc_ussd_init(struct bsc_nat *nat);
 int bsc_ussd_check(struct nat_sccp_connection *con, struct bsc_nat_parsed *parsed, struct msgb *msg);
-int bsc_ussd_close_connections(struct bsc_nat *nat);
+int bsc_ussd_close_connections(struct bsc_nat *nat, struct bsc_nat_ussd_gw *gw);
+void bsc_ussd_close_connection(struct nat_sccp_connection *con);
+struct bsc_nat_ussd_gw *bsc_ussd_gw_find(struct bsc_nat *nat, const char *name);
+struct bsc_nat_ussd_gw *bsc_ussd_gw_alloc(struct bsc_nat *nat, const char *name);
+void bsc_ussd_gw_free(struct bsc_nat_ussd_gw *gw);
+void bsc_ussd_gw_disconnect(struct bsc_nat_ussd_gw *gw);
 
 struct msgb *bsc_nat_rewrite_msg(struct bsc_nat *nat, struct msgb *msg, struct bsc_nat_parsed *, const char *imsi);
 
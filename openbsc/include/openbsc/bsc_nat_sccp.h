@@ -87,8 +87,9 @@ struct nat_sccp_connection {
 	uint16_t lac;
 	uint16_t ci;
 
-	/* remember which Transactions we run over the bypass */
+	/* remember which Transactions we run over the bypass and where to */
 	char ussd_ti[8];
+	struct bsc_nat_ussd_gw *ussd_gw;
 
 	/*
 	 * audio handling. Remember if we have ever send a CRCX,
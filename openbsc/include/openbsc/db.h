@@ -35,6 +35,13 @@ struct gsm_subscriber;
 int db_init(const char *name);
 int db_prepare(void);
 int db_fini(void);
+int db_set_journal_mode(const char *mode);
+int db_set_synchronous(const char *mode);
+
+/* group several writes, e.g. the counter sync, into one commit */
+int db_begin_transaction(void);
+int db_commit_transaction(void);
+int db_rollback_transaction(void);
 
 /* subscriber management */
 struct gsm_subscriber *db_create_subscriber(const char *imsi, uint64_t smin,
@@ -68,6 +75,11 @@ int db_sms_store(struct gsm_sms *sms);
 struct gsm_sms *db_sms_get(struct gsm_network *net, unsigned long long id);
 struct gsm_sms *db_sms_get_unsent(struct gsm_network *net, unsigned long long min_id);
 struct gsm_sms *db_sms_get_unsent_by_subscr(struct gsm_network *net, unsigned long long min_subscr_id, unsigned int failed);
+int db_sms_get_unsent_by_subscr_batch(struct gsm_network *net,
+			unsigned long long min_subscr_id, unsigned int failed,
+			unsigned int max, void *priv,
+			void (*callback)(void *priv, struct gsm_sms *sms,
+					 unsigned long long subscr_id));
 struct gsm_sms *db_sms_get_unsent_for_subscr(struct gsm_subscriber *subscr);
 int db_sms_mark_delivered(struct gsm_sms *sms);
 int db_sms_inc_deliver_attempts(struct gsm_sms *sms);
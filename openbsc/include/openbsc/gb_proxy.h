@@ -119,13 +119,34 @@ struct gbproxy_config {
 	struct gbproxy_match matches[GBPROX_MATCH_LAST];
 };
 
+/* Keys under which a link_info can be found, see gb_proxy_tlli.c */
+enum gbproxy_link_key {
+	GBPROX_KEY_TLLI,
+	GBPROX_KEY_TLLI_ASSIGNED,
+	GBPROX_KEY_PTMSI,
+	GBPROX_KEY_SGSN_TLLI,
+	GBPROX_KEY_SGSN_TLLI_ASSIGNED,
+	GBPROX_KEY_IMSI,
+	GBPROX_KEY_LAST
+};
+
+#define GBPROXY_LINK_HASH_BITS	8
+#define GBPROXY_LINK_HASH_SIZE	(1 << GBPROXY_LINK_HASH_BITS)
+
 struct gbproxy_patch_state {
 	int local_mnc;
 	int local_mcc;
 
-	/* List of TLLIs for which patching is enabled */
+	/* List of TLLIs for which patching is enabled, most recently used
+	 * first. Since every use moves an entry to the head, the list is
+	 * sorted by timestamp and expiry only needs to look at the tail. */
 	struct llist_head logical_links;
 	int logical_link_count;
+	/* Incremented on every attach, orders the entries of the list */
+	uint64_t link_seq;
+
+	/* Hash indexes over the logical_links, one per key */
+	struct llist_head link_hash[GBPROX_KEY_LAST][GBPROXY_LINK_HASH_SIZE];
 };
 
 struct gbproxy_peer {
@@ -161,6 +182,9 @@ struct gbproxy_tlli_state {
 
 struct gbproxy_link_info {
 	struct llist_head list;
+	/* Entries in the patch_state hash indexes, self-linked if unset */
+	struct llist_head hash_list[GBPROX_KEY_LAST];
+	uint64_t seq;
 
 	struct gbproxy_tlli_state tlli;
 	struct gbproxy_tlli_state sgsn_tlli;
@@ -218,8 +242,11 @@ void gbproxy_link_info_discard_messages(struct gbproxy_link_info *link_info);
 
 void gbproxy_attach_link_info(struct gbproxy_peer *peer, time_t now,
 			      struct gbproxy_link_info *link_info);
-void gbproxy_update_link_info(struct gbproxy_link_info *link_info,
+void gbproxy_update_link_info(struct gbproxy_peer *peer,
+			      struct gbproxy_link_info *link_info,
 			      const uint8_t *imsi, size_t imsi_len);
+void gbproxy_reindex_link_info(struct gbproxy_peer *peer,
+			       struct gbproxy_link_info *link_info);
 void gbproxy_detach_link_info(struct gbproxy_peer *peer,
 			      struct gbproxy_link_info *link_info);
 struct gbproxy_link_info *gbproxy_link_info_alloc( struct gbproxy_peer *peer);
@@ -53,6 +53,9 @@ enum gprs_mm_ctr {
 	GMM_CTR_PAGING_PS,
 	GMM_CTR_PAGING_CS,
 	GMM_CTR_RA_UPDATE,
+	GMM_CTR_DL_BUF_QUEUED,
+	GMM_CTR_DL_BUF_FLUSHED,
+	GMM_CTR_DL_BUF_DROPPED,
 };
 
 enum gprs_pdp_ctx {
@@ -203,6 +206,10 @@ struct sgsn_mm_ctx {
 
 	struct llist_head	pdp_list;
 
+	/* Downlink N-PDUs kept while the MS is paged */
+	struct llist_head	dl_buf;
+	unsigned int		dl_buf_bytes;
+
 	struct rate_ctr_group	*ctrg;
 	struct osmo_timer_list	timer;
 	unsigned int		T;		/* Txxxx number */
@@ -250,6 +257,11 @@ struct sgsn_mm_ctx *sgsn_mm_ctx_alloc_iu(void *uectx);
 
 void sgsn_mm_ctx_cleanup_free(struct sgsn_mm_ctx *ctx);
 
+int sgsn_mm_ctx_dl_enqueue(struct sgsn_mm_ctx *mm, uint8_t nsapi,
+			   const uint8_t *data, unsigned int len);
+unsigned int sgsn_mm_ctx_dl_flush(struct sgsn_mm_ctx *mm, int nsapi);
+void sgsn_mm_ctx_dl_purge(struct sgsn_mm_ctx *mm);
+
 struct sgsn_ggsn_ctx *sgsn_mm_ctx_find_ggsn_ctx(struct sgsn_mm_ctx *mmctx,
 						struct tlv_parsed *tp,
 						enum gsm48_gsm_cause *gsm_cause,
@@ -399,10 +411,23 @@ struct sgsn_subscriber_pdp_data {
 	size_t			qos_subscribed_len;
 };
 
+enum sgsn_auth_prefetch_state {
+	SGSN_AUTH_PREFETCH_NONE,
+	SGSN_AUTH_PREFETCH_QUEUED,
+	SGSN_AUTH_PREFETCH_PENDING,
+};
+
 struct sgsn_subscriber_data {
+	struct gsm_subscriber	*subscr;
 	struct sgsn_mm_ctx	*mm;
 	struct gsm_auth_tuple	auth_triplets[5];
 	int			auth_triplets_updated;
+
+	/* background refill of auth_triplets, see sgsn_auth.c */
+	enum sgsn_auth_prefetch_state prefetch_state;
+	struct llist_head	prefetch_entry;
+	struct llist_head	spare_entry;
+
 	struct llist_head	pdp_list;
 	int			error_cause;
 
@@ -434,6 +459,10 @@ enum sgsn_auth_state sgsn_auth_state(struct sgsn_mm_ctx *mm);
 void sgsn_auth_update(struct sgsn_mm_ctx *mm);
 struct gsm_auth_tuple *sgsn_auth_get_tuple(struct sgsn_mm_ctx *mmctx,
 					   unsigned key_seq);
+void sgsn_auth_prefetch_done(struct gsm_subscriber *subscr,
+			     const struct osmo_auth_vector *vec, size_t num_vec);
+void sgsn_auth_prefetch_release(struct sgsn_subscriber_data *sdata);
+unsigned int sgsn_auth_prefetch_pending(void);
 
 /*
  * GPRS subscriber data
@@ -458,6 +487,7 @@ struct gsm_subscriber *gprs_subscr_get_by_imsi(const char *imsi);
 void gprs_subscr_cancel(struct gsm_subscriber *subscr);
 void gprs_subscr_update(struct gsm_subscriber *subscr);
 void gprs_subscr_update_auth_info(struct gsm_subscriber *subscr);
+int gprs_subscr_query_auth_info(struct gsm_subscriber *subscr);
 int gprs_subscr_rx_gsup_message(struct msgb *msg);
 
 /* Called on subscriber data updates */
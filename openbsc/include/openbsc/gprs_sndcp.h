@@ -4,7 +4,16 @@
 #include <stdint.h>
 #include <osmocom/core/linuxlist.h>
 
-/* A fragment queue header, maintaining list of fragments for one N-PDU */
+/* The segment number is a 4 bit field */
+#define SNDCP_MAX_SEGMENTS 16
+
+/* Where a received segment is kept in the reassembly buffer */
+struct defrag_segment {
+	unsigned int offset;
+	unsigned int len;
+};
+
+/* A fragment queue header, maintaining the fragments for one N-PDU */
 struct defrag_state {
 	/* PDU number for which the defragmentation state applies */
 	uint16_t npdu;
@@ -17,8 +26,14 @@ struct defrag_state {
 	/* total length of all segments together */
 	unsigned int tot_len;
 
-	/* linked list of defrag_queue_entry: one for each fragment  */
-	struct llist_head frag_list;
+	/* The segments, indexed by segment number, valid if set in seg_have */
+	struct defrag_segment seg[SNDCP_MAX_SEGMENTS];
+	/* Reassembly buffer, segments are appended in order of arrival. It
+	 * stays allocated and is reused for the next N-PDU. */
+	uint8_t *buf;
+	unsigned int buf_size;
+	/* do the segments in buf follow each other by segment number? */
+	unsigned int in_order;
 
 	struct osmo_timer_list timer;
 
@@ -56,6 +71,9 @@ struct gprs_sndcp_entity {
 	enum sndcp_rx_state rx_state;
 	/* The defragmentation queue */
 	struct defrag_state defrag;
+	/* Received N-PDUs are decompressed into this buffer, allocated
+	 * on first use, see gprs_sndcp_comp_expand() */
+	uint8_t *expnd;
 };
 
 extern struct llist_head gprs_sndcp_entities;
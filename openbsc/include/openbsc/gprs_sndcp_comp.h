@@ -44,8 +44,22 @@ struct gprs_sndcp_comp {
 	int algo;		/* Algorithm type (see gprs_sndcp_xid.h) */
 	int compclass;		/* See gprs_sndcp_xid.h/c */
 	void *state;		/* Algorithm status and parameters */
+
+	/* Working buffer for the algorithm, so that compressing or expanding
+	 * a packet does not need any allocations */
+	uint8_t *scratch;
+	unsigned int scratch_len;
 };
 
+/* Size of the working buffer: An N-PDU (an IP packet of up to 1500 octets)
+ * plus some headroom. Longer N-PDUs are sent without compression. */
+#define SNDCP_COMP_SCRATCH_LEN 1600
+
+/* Size of the buffer received N-PDUs are expanded into, an N-PDU of up to
+ * SNDCP_COMP_SCRATCH_LEN octets fully decompressed */
+#define SNDCP_EXPND_BUF_LEN \
+	(SNDCP_COMP_SCRATCH_LEN * MAX_DATADECOMPR_FAC + MAX_HDRDECOMPR_INCR)
+
 #define MAX_COMP 16	/* Maximum number of possible pcomp/dcomp values */
 #define MAX_NSAPI 11	/* Maximum number usable NSAPIs */
 
@@ -80,3 +94,11 @@ uint8_t gprs_sndcp_comp_get_idx(const struct gprs_sndcp_comp *comp_entity,
 /* Find a pcomp/dcomp value for a given comp_index */
 uint8_t gprs_sndcp_comp_get_comp(const struct gprs_sndcp_comp *comp_entity,
 			         uint8_t comp_index);
+
+/* Expand a received N-PDU into a buffer that is allocated on first use
+ * and then reused (returns the expanded length) */
+int gprs_sndcp_comp_expand(const void *ctx, uint8_t **buf,
+			   const uint8_t *npdu, unsigned int len,
+			   uint8_t pcomp, uint8_t dcomp,
+			   const struct llist_head *proto_entities,
+			   const struct llist_head *data_entities);
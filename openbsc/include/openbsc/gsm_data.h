@@ -26,6 +26,12 @@ struct gsm_subscriber_group;
 
 #define OBSC_LINKID_CB(__msgb)	(__msgb)->cb[3]
 
+/* number of buckets of the transaction lookup hashes, power of two */
+#define GSM_TRANS_HASH_SIZE	2048
+
+/* default limit of primitives queued towards the MNCC socket */
+#define MNCC_SOCK_QUEUE_DEFAULT	1024
+
 enum gsm_security_event {
 	GSM_SECURITY_NOAVAIL,
 	GSM_SECURITY_AUTH_FAILED,
@@ -102,6 +108,13 @@ struct neigh_meas_proc {
 	uint8_t rxlev[MAX_WIN_NEIGH_AVG];
 	unsigned int rxlev_cnt;
 	uint8_t last_seen_nr;
+	/* sum of the last rxlev_win values in rxlev[] */
+	unsigned int rxlev_sum;
+	unsigned int rxlev_win;
+	/* no handover to this cell before this time (monotonic seconds) */
+	time_t penalty_until;
+	/* a handover to this cell has been started */
+	int ho_started;
 };
 
 /* active radio connection of a mobile subscriber */
@@ -137,6 +150,9 @@ struct gsm_subscriber_connection {
 	/* back pointers */
 	struct gsm_network *network;
 
+	/* transactions using this connection (libmsc) */
+	struct llist_head trans_list;
+
 	int in_release;
 	struct gsm_lchan *lchan; /* BSC */
 	struct gsm_lchan *ho_lchan; /* BSC */
@@ -219,6 +235,8 @@ enum {
 	MSC_CTR_CALL_ACTIVE,
 	MSC_CTR_CALL_COMPLETE,
 	MSC_CTR_CALL_INCOMPLETE,
+	MSC_CTR_MNCC_QUEUE_DROP,
+	MSC_CTR_MNCC_QUEUE_REJECT,
 };
 
 static const struct rate_ctr_desc msc_ctr_description[] = {
@@ -242,6 +260,8 @@ static const struct rate_ctr_desc msc_ctr_description[] = {
 	[MSC_CTR_CALL_ACTIVE] =			{"call.active", "Count total amount of calls that ever reached active state."},
 	[MSC_CTR_CALL_COMPLETE] = 		{"call.complete", "Count total amount of calls which got terminated by disconnect req or ind after reaching active state."},
 	[MSC_CTR_CALL_INCOMPLETE] = 		{"call.incomplete", "Count total amount of call which got terminated by any other reason after reaching active state."},
+	[MSC_CTR_MNCC_QUEUE_DROP] =		{"mncc.queue_drop", "Voice frames dropped because the MNCC socket queue was full."},
+	[MSC_CTR_MNCC_QUEUE_REJECT] =		{"mncc.queue_reject", "New calls rejected because the MNCC socket queue was full."},
 };
 
 
@@ -308,6 +328,8 @@ struct gsm_network {
 		unsigned int pwr_hysteresis;	/* dBm */
 		/* maximum distacne before we try a handover */
 		unsigned int max_distance;	/* TA values */
+		/* how long a cell is passed over after a failed handover */
+		unsigned int penalty_time;	/* seconds */
 	} handover;
 
 	struct rate_ctr_group *bsc_ctrs;
@@ -318,7 +340,15 @@ struct gsm_network {
 	struct mncc_sock_state *mncc_state;
 	mncc_recv_cb_t mncc_recv;
 	struct llist_head upqueue;
+	/* soft limit of the MNCC socket upqueue, 0 for unlimited. Only voice
+	 * frames and new calls are held back by it. */
+	unsigned int mncc_sock_queue_max;
+	/* hand several queued primitives to the kernel at once */
+	bool mncc_sock_batch;
 	struct llist_head trans_list;
+	/* lookup indexes into trans_list, see transaction.c */
+	struct llist_head trans_callref_hash[GSM_TRANS_HASH_SIZE];
+	struct llist_head trans_id_hash[GSM_TRANS_HASH_SIZE];
 	struct bsc_api *bsc_api;
 
 	unsigned int num_bts;
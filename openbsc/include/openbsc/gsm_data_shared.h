@@ -88,6 +88,8 @@ struct gsm_mncc;
 struct osmo_rtp_socket;
 struct rtp_socket;
 struct bsc_api;
+struct bsc_handover;
+struct abis_nm_sw;
 
 /* Network Management State */
 struct gsm_nm_state {
@@ -261,6 +263,10 @@ struct gsm_lchan {
 
 	/* table of neighbor cell measurements */
 	struct neigh_meas_proc neigh_meas[MAX_NEIGH_MEAS];
+	/* latest report of this lchan in the batch being decided on */
+	struct gsm_meas_rep *ho_dec_mr;
+	/* the handover this lchan is the old or the new lchan of */
+	struct bsc_handover *ho;
 
 	/* cache of last measurement reports on this lchan */
 	struct gsm_meas_rep meas_rep[6];
@@ -654,6 +660,8 @@ struct gsm_bts {
 
 	/* Abis network management O&M handle */
 	struct abis_nm_h *nmh;
+	/* software load into this BTS, allocated on first use */
+	struct abis_nm_sw *sw_load;
 
 	struct gsm_abis_mo mo;
 
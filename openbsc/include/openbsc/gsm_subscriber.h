@@ -72,6 +72,9 @@ struct gsm_subscriber {
 	/* pending requests */
 	int is_paging;
 	struct llist_head requests;
+	/* gsm_paging_request entries, one per BTS the subscriber is
+	 * being paged on */
+	struct llist_head paging_requests;
 
 	/* GPRS/SGSN related fields */
 	struct sgsn_subscriber_data *sgsn_data;
@@ -22,11 +22,20 @@
 #pragma once
 
 #include <osmocom/core/timer.h>
+#include <osmocom/core/linuxlist.h>
 
 #include <openbsc/oap_client.h>
 
+#include <stdint.h>
+
 #define GSUP_CLIENT_RECONNECT_INTERVAL 10
 #define GSUP_CLIENT_PING_INTERVAL 20
+/* requests awaiting their answer on one connection */
+#define GSUP_CLIENT_MAX_INFLIGHT 64
+/* requests waiting for a connection with room */
+#define GSUP_CLIENT_MAX_QUEUED 4096
+/* seconds until an unanswered request is failed */
+#define GSUP_CLIENT_REQ_TIMEOUT 10
 
 struct msgb;
 struct ipa_client_conn;
@@ -36,10 +45,11 @@ struct gsup_client;
 typedef int (*gsup_client_read_cb_t)(struct gsup_client *gsupc,
 				     struct msgb *msg);
 
-struct gsup_client {
+/* One IPA connection to an HLR */
+struct gsup_client_conn {
+	struct llist_head list;
+	struct gsup_client *gsupc;
 	struct ipa_client_conn *link;
-	gsup_client_read_cb_t read_cb;
-	void *data;
 
 	struct oap_client_state oap_state;
 
@@ -47,14 +57,63 @@ struct gsup_client {
 	struct osmo_timer_list connect_timer;
 	int is_connected;
 	int got_ipa_pong;
+
+	/* requests sent on this connection and not answered yet */
+	unsigned int num_inflight;
+};
+
+struct gsup_client_stats {
+	uint64_t sent;
+	uint64_t answered;
+	uint64_t queued;
+	uint64_t timeouts;
+	uint64_t dropped;
+	/* results and errors that match no outstanding request */
+	uint64_t unmatched;
+};
+
+struct gsup_client {
+	/* connections to one or more HLRs, requests go to the connected
+	 * one with the fewest outstanding requests */
+	struct llist_head conns;
+	unsigned int num_conns;
+	gsup_client_read_cb_t read_cb;
+	void *data;
+
+	struct oap_client_config *oap_config;
+
+	/* Requests awaiting their answer, oldest first. GSUP has no
+	 * transaction id, an answer belongs to the oldest request of the
+	 * same type for the same IMSI. */
+	struct llist_head inflight;
+	unsigned int num_inflight;
+	/* requests waiting for room on a connection */
+	struct llist_head queue;
+	unsigned int num_queued;
+
+	/* per connection */
+	unsigned int max_inflight;
+	/* for the whole client, across all connections */
+	unsigned int max_queued;
+	/* seconds */
+	unsigned int req_timeout;
+
+	uint32_t next_req_id;
+	struct gsup_client_stats stats;
+
+	/* the connection the message being handed to read_cb came in on,
+	 * answers to requests from the HLR go back there */
+	struct gsup_client_conn *rx_conn;
 };
 
 struct gsup_client *gsup_client_create(const char *ip_addr,
 				       unsigned int tcp_port,
 				       gsup_client_read_cb_t read_cb,
 				       struct oap_client_config *oap_config);
+int gsup_client_add_conn(struct gsup_client *gsupc, const char *ip_addr,
+			 unsigned int tcp_port);
+int gsup_client_is_connected(struct gsup_client *gsupc);
 
 void gsup_client_destroy(struct gsup_client *gsupc);
 int gsup_client_send(struct gsup_client *gsupc, struct msgb *msg);
 struct msgb *gsup_client_msgb_alloc(void);
-
@@ -204,6 +204,11 @@ void expiry_init(struct expiry *exq, int expiry_in_seconds);
  * mapping. */
 void expiry_add(struct expiry *exq, struct expiring_item *item, time_t now);
 
+/* Add or move an item with an absolute expiry time, keeping the queue sorted.
+ * Cheapest when called in ascending order of expiry. */
+void expiry_add_at(struct expiry *exq, struct expiring_item *item,
+		   time_t expiry);
+
 /* Initialize to all-empty; must be called before using the item in any way. */
 void expiring_item_init(struct expiring_item *item);
 
@@ -257,6 +262,11 @@ void expiry_clear(struct expiry *exq);
  * was submitted at. expiry_tick() needs to be called regularly for each expiry
  * queue.
  *
+ * Besides the chronological list, a map hashes its mappings both by (origin,
+ * orig) and by repl, so that nr_map_get() and nr_map_get_inv() don't need to
+ * visit every mapping. The hash tables double in size whenever there are more
+ * mappings than buckets, and are freed when the last mapping is removed.
+ *
  * A nr_mapping can be embedded in a larger struct: each mapping can have a
  * distinct destructor (del_cb), and each del_cb can figure out the container
  * struct's address and free that upon expiry or manual deletion. So in expiry
@@ -281,8 +291,13 @@ struct nr_pool {
 	nr_t nr_max;
 };
 
+struct nr_map;
+
 struct nr_mapping {
 	struct llist_head entry;
+	struct llist_head hash_entry; /* hashed by (origin, orig) */
+	struct llist_head inv_hash_entry; /* hashed by repl */
+	struct nr_map *map; /* the map this mapping was added to, or NULL */
 	struct expiring_item expiry_entry;
 
 	void *origin;
@@ -290,10 +305,17 @@ struct nr_mapping {
 	nr_t repl;
 };
 
+#define NR_MAP_HASH_BITS_MIN 4
+#define NR_MAP_HASH_BITS_MAX 20
+
 struct nr_map {
 	struct nr_pool *pool; /* multiple nr_maps can share a nr_pool. */
 	struct expiry *add_items_to_expiry;
 	struct llist_head mappings;
+	unsigned int count; /* number of mappings */
+	unsigned int hash_bits; /* 0 while the map is empty */
+	struct llist_head *hash; /* 1 << hash_bits chains */
+	struct llist_head *inv_hash;
 };
 
 
@@ -391,19 +413,27 @@ struct gtphub_peer_port {
 	unsigned int ref_count; /* references from other peers' seq_maps */
 	struct osmo_sockaddr sa; /* a "cache" for (peer_addr->addr, port) */
 	int last_restart_count; /* 0..255 = valid, all else means unknown */
+	unsigned int snapshot_id; /* only valid while writing a snapshot */
 
 	struct rate_ctr_group *counters_io;
 };
 
+struct gtphub_tunnel;
+
 struct gtphub_tunnel_endpoint {
 	struct gtphub_peer_port *peer;
 	uint32_t tei_orig; /* from/to peer */
 
+	struct gtphub_tunnel *tun;
+	struct llist_head tei_orig_entry; /* in gtphub.tunnels_by_tei_orig */
+
 	struct rate_ctr_group *counters_io;
 };
 
 struct gtphub_tunnel {
 	struct llist_head entry;
+	struct llist_head tei_entry; /* in gtphub.tunnels_by_tei */
+	struct gtphub *hub; /* set once the tunnel is indexed */
 	struct expiring_item expiry_entry;
 
 	uint32_t tei_repl; /* unique TEI to replace peers' TEIs */
@@ -449,6 +479,13 @@ struct gtphub {
 	struct nr_pool tei_pool;
 
 	struct llist_head tunnels; /* struct gtphub_tunnel */
+	unsigned int tunnels_count;
+	/* The same tunnels hashed by tei_repl, and their endpoints hashed by
+	 * (side, plane, tei_orig). Like in a nr_map, the tables grow with the
+	 * number of tunnels and are freed when the last tunnel is gone. */
+	unsigned int tunnels_hash_bits;
+	struct llist_head *tunnels_by_tei;
+	struct llist_head *tunnels_by_tei_orig;
 	struct llist_head pending_deletes; /* opaque (gtphub.c) */
 
 	struct llist_head ggsn_lookups; /* opaque (gtphub_ares.c) */
@@ -481,6 +518,15 @@ void gtphub_stop(struct gtphub *hub);
 
 time_t gtphub_now(void);
 
+/* Write tunnels, peers, sequence number maps and the restart counter to path,
+ * atomically replacing an existing file. Return 0 on success. */
+int gtphub_snapshot_save(struct gtphub *hub, const char *path, time_t now);
+
+/* Restore the state saved by gtphub_snapshot_save() into a freshly started
+ * hub, before any packets are handled. On error, nothing is restored and a
+ * negative errno is returned (-ENOENT if there is no snapshot). */
+int gtphub_snapshot_load(struct gtphub *hub, const char *path, time_t now);
+
 /* Remove expired items, empty peers, ... */
 void gtphub_gc(struct gtphub *hub, time_t now);
 
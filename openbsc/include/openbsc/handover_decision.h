@@ -1,7 +1,11 @@
 #ifndef _HANDOVER_DECISION_H
 #define _HANDOVER_DECISION_H
 
+struct gsm_meas_rep;
+
 void on_dso_load_ho_dec(void);
 
+void ho_dec_meas_reps(struct gsm_meas_rep **mrs, unsigned int num);
+
 #endif /* _HANDOVER_DECISION_H */
 
@@ -2,6 +2,8 @@
 #define _OPENBSC_MEAS_FEED_H
 
 #include <stdint.h>
+#include <string.h>
+#include <errno.h>
 
 #include <openbsc/meas_rep.h>
 
@@ -37,5 +39,83 @@ enum meas_feed_msgtype {
 
 #define MEAS_FEED_VERSION	1
 
+/*
+ * A datagram of the feed carries one or more meas_feed_meas records
+ * back to back, each with its own header.
+ */
+#define MEAS_FEED_MAX_BATCH	32
+
+/*
+ * The shared memory ring. The NITB is the only writer, readers map it
+ * read-only and follow the head at their own pace. A slot holds the
+ * sequence number of the record in it plus one, zero while the record
+ * is being written. A reader that falls more than num_slots behind
+ * loses the records in between.
+ */
+#define MEAS_FEED_RING_MAGIC	0x4d465231	/* "MFR1" */
+
+struct meas_feed_ring_slot {
+	uint64_t seq;
+	struct meas_feed_meas mfm;
+};
+
+struct meas_feed_ring {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t rec_size;
+	/* a power of two */
+	uint32_t num_slots;
+	uint32_t reserved;
+	/* number of records written so far */
+	uint64_t head;
+	struct meas_feed_ring_slot slots[0];
+};
+
+static inline size_t meas_feed_ring_size(uint32_t num_slots)
+{
+	return sizeof(struct meas_feed_ring) +
+		num_slots * sizeof(struct meas_feed_ring_slot);
+}
+
+static inline int meas_feed_ring_valid(const struct meas_feed_ring *ring)
+{
+	return ring->magic == MEAS_FEED_RING_MAGIC &&
+		ring->version == MEAS_FEED_VERSION &&
+		ring->rec_size == sizeof(struct meas_feed_meas);
+}
+
+/*
+ * Copy the record at *pos to mfm. Returns 1 for a record, 0 when the
+ * reader has caught up and -EAGAIN when the record was overwritten
+ * before it could be copied. *pos is advanced past what was consumed
+ * or lost. A new reader starts at the head.
+ */
+static inline int meas_feed_ring_read(const struct meas_feed_ring *ring,
+				      uint64_t *pos, struct meas_feed_meas *mfm)
+{
+	const struct meas_feed_ring_slot *slot;
+	uint64_t head, seq;
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	if (*pos >= head)
+		return 0;
+	if (head - *pos > ring->num_slots)
+		*pos = head - ring->num_slots;
+
+	slot = &ring->slots[*pos & (ring->num_slots - 1)];
+	seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+	if (seq != *pos + 1) {
+		*pos += 1;
+		return -EAGAIN;
+	}
+
+	memcpy(mfm, &slot->mfm, sizeof(*mfm));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	*pos += 1;
+	if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+		return -EAGAIN;
+	return 1;
+}
+
 
 #endif
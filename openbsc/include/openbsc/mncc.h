@@ -36,6 +36,8 @@ struct msgb;
 /* One end of a call */
 struct gsm_call {
 	struct llist_head entry;
+	/* entry in the callref hash of mncc_builtin.c */
+	struct llist_head hash_entry;
 
 	/* network handle */
 	void *net;
@@ -6,6 +6,8 @@
 #include "bsc_api.h"
 #include "bsc_msg_filter.h"
 
+#include <sys/time.h>
+
 #define BSS_SEND_USSD 1
 
 enum bsc_con {
@@ -36,6 +38,8 @@ struct osmo_bsc_sccp_con {
 	struct osmo_msc_data *msc;
 	struct osmo_timer_list sccp_it_timeout;
 	struct osmo_timer_list sccp_cc_timeout;
+	/* when the connection request was sent */
+	struct timeval cr_time;
 
 	struct llist_head sccp_queue;
 	unsigned int sccp_queue_size;
@@ -43,6 +43,18 @@ enum {
 	MSC_CON_TYPE_LOCAL,
 };
 
+/* NRI values are at most 10 bits, 3GPP TS 23.236 */
+#define MSC_ROUTE_NRI_MAX	1024
+
+enum {
+	MSC_ROUTE_CTR_NRI,
+	MSC_ROUTE_CTR_IMSI,
+	MSC_ROUTE_CTR_LOAD,
+	MSC_ROUTE_CTR_PAGING,
+	MSC_ROUTE_CTR_FULL,
+	MSC_ROUTE_CTR_CC_TIMEOUT,
+};
+
 struct osmo_msc_data {
 	struct llist_head entry;
 
@@ -97,6 +109,18 @@ struct osmo_msc_data {
 	char *ussd_grace_txt;
 
 	char *acc_lst_name;
+
+	/* routing of new connections, see osmo_bsc_route.c */
+	struct {
+		/* open SCCP connections, and their limit. 0 is no limit */
+		unsigned int num_conns;
+		unsigned int max_conns;
+		/* smoothed time from connection request to confirm, in ms */
+		unsigned int cc_delay_ms;
+		/* NRI values of the TMSIs this MSC allocates */
+		uint8_t nri[MSC_ROUTE_NRI_MAX / 8];
+		struct rate_ctr_group *ctrg;
+	} route;
 };
 
 /*
@@ -119,6 +143,9 @@ struct osmo_bsc_data {
 	char *ussd_no_msc_txt;
 
 	char *acc_lst_name;
+
+	/* length of the NRI in the TMSI, 0 disables routing by NRI */
+	int nri_bitlen;
 };
 
 
@@ -132,5 +159,15 @@ int osmo_bsc_audio_init(struct gsm_network *network);
 struct osmo_msc_data *osmo_msc_data_find(struct gsm_network *, int);
 struct osmo_msc_data *osmo_msc_data_alloc(struct gsm_network *, int);
 
+struct msgb;
+struct timeval;
+
+void osmo_bsc_route_msc_init(struct osmo_msc_data *msc);
+struct osmo_msc_data *osmo_bsc_route_msc(struct osmo_bsc_data *bsc,
+					 struct msgb *msg, int is_emerg);
+void osmo_bsc_route_cc_delay(struct osmo_msc_data *msc,
+			     const struct timeval *cr_time);
+void osmo_bsc_route_cc_timeout(struct osmo_msc_data *msc);
+
 
 #endif
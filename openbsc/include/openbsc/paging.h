@@ -34,6 +34,8 @@
 struct gsm_paging_request {
 	/* list_head for list of all paging requests */
 	struct llist_head entry;
+	/* list_head for the requests of the same subscriber on all BTS */
+	struct llist_head subscr_entry;
 	/* the subscriber which we're paging. Later gsm_paging_request
 	 * should probably become a part of the gsm_subscriber struct? */
 	struct gsm_subscriber *subscr;
@@ -12,6 +12,7 @@
 
 struct gprs_gsup_client;
 struct hostent;
+struct sgsn_ares_cache;
 
 enum sgsn_auth_policy {
 	SGSN_AUTH_POLICY_OPEN,
@@ -46,13 +47,37 @@ enum sgsn_rate_ctr_keys {
 	CTR_PDP_DL_DEACTIVATE_ACCEPT,
 	CTR_PDP_UL_DEACTIVATE_REQUEST,
 	CTR_PDP_UL_DEACTIVATE_ACCEPT,
+	/* authentication tuples */
+	CTR_AUTH_TUPLE_WAIT,
+	CTR_AUTH_PREFETCH_REQUEST,
+	CTR_AUTH_PREFETCH_TUPLES,
+	CTR_AUTH_PREFETCH_EVICTED,
 };
 
+#define SGSN_CDR_BUFFER_DEFAULT	(256 * 1024)
+
 struct sgsn_cdr {
 	char *filename;
 	int interval;
+	/* enum sgsn_cdr_format */
+	int format;
+	/* rotation by size in bytes and age in seconds, 0 disables */
+	unsigned int rotate_size;
+	unsigned int rotate_interval;
+	/* CDRs are buffered in memory and written by a separate thread */
+	unsigned int buffer_size;
 };
 
+#define SGSN_AUTH_PREFETCH_LOW_WATER	2
+#define SGSN_AUTH_PREFETCH_PENDING	32
+#define SGSN_AUTH_PREFETCH_SUBSCRIBERS	10000
+
+/* further HLRs besides gsup remote-ip */
+#define SGSN_GSUP_MAX_SERVERS		4
+
+#define SGSN_PAGING_BUFFER_BYTES	(64 * 1024)
+#define SGSN_PAGING_BUFFER_AGE		10
+
 struct sgsn_config {
 	/* parsed from config file */
 
@@ -68,13 +93,47 @@ struct sgsn_config {
 
 	struct sockaddr_in gsup_server_addr;
 	int gsup_server_port;
+	struct {
+		struct sockaddr_in addr[SGSN_GSUP_MAX_SERVERS];
+		unsigned int num;
+	} gsup_extra_servers;
+	/* IPA connections to each HLR */
+	unsigned int gsup_connections;
+	/* requests outstanding per connection */
+	unsigned int gsup_max_inflight;
+	/* seconds */
+	unsigned int gsup_req_timeout;
 
 	int require_authentication;
 	int require_update_location;
 
+	/* Background refill of authentication tuples */
+	struct {
+		/* refill at this many unused tuples, 0 disables */
+		unsigned int low_water;
+		/* refills outstanding at the HLR */
+		unsigned int max_pending;
+		/* subscribers keeping unused tuples */
+		unsigned int max_subscribers;
+	} auth_prefetch;
+
 	/* CDR configuration */
 	struct sgsn_cdr cdr;
 
+	/* Downlink buffering while an MS is paged */
+	struct {
+		/* per MM context, 0 disables buffering */
+		unsigned int max_bytes;
+		/* seconds */
+		unsigned int max_age;
+	} paging_buffer;
+
+	/* Caching of GRX DNS answers, in seconds */
+	struct {
+		unsigned int max_ttl;
+		unsigned int neg_ttl;
+	} dns_cache;
+
 	struct {
 		int T3312;
 		int T3322;
@@ -132,6 +191,7 @@ struct sgsn_instance {
 	struct llist_head ares_fds;
 	ares_channel ares_channel;
 	struct ares_addr_node *ares_servers;
+	struct sgsn_ares_cache *ares_cache;
 
 	struct rate_ctr_group *rate_ctrs;
 };
@@ -155,6 +215,8 @@ struct sgsn_pdp_ctx *sgsn_create_pdp_ctx(struct sgsn_ggsn_ctx *ggsn,
 					 struct tlv_parsed *tp);
 int sgsn_delete_pdp_ctx(struct sgsn_pdp_ctx *pctx);
 void sgsn_pdp_upd_gtp_u(struct sgsn_pdp_ctx *pdp, void *addr, size_t alen);
+int sgsn_pdp_tx_dl(struct sgsn_pdp_ctx *pdp, const uint8_t *data,
+		   unsigned int len);
 
 /* gprs_sndcp.c */
 
@@ -174,7 +236,10 @@ int sndcp_llunitdata_ind(struct msgb *msg, struct gprs_llc_lle *lle,
 /*
  * CDR related functionality
  */
+struct sgsn_cdr_writer_stats;
 int sgsn_cdr_init(struct sgsn_instance *sgsn);
+void sgsn_cdr_flush(void);
+int sgsn_cdr_stats(struct sgsn_cdr_writer_stats *stats);
 
 
 /*
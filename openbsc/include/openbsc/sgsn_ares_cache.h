@@ -0,0 +1,86 @@
+/* Caching of GRX DNS answers in front of c-ares */
+
+#pragma once
+
+#include <osmocom/core/linuxlist.h>
+#include <osmocom/core/timer.h>
+
+#include <netinet/in.h>
+#include <time.h>
+#include <ares.h>
+
+#define SGSN_ARES_CACHE_MAX_ADDRS	4
+#define SGSN_ARES_CACHE_MAX_ENTRIES	1024
+/* seconds, upper bound for the TTL of a positive answer */
+#define SGSN_ARES_CACHE_MAX_TTL		3600
+/* seconds, how long a name that does not exist is remembered */
+#define SGSN_ARES_CACHE_NEG_TTL		60
+
+enum sgsn_ares_cache_ctr {
+	ARES_CACHE_CTR_HIT,
+	ARES_CACHE_CTR_NEG_HIT,
+	ARES_CACHE_CTR_MISS,
+	ARES_CACHE_CTR_COALESCED,
+	ARES_CACHE_CTR_EXPIRED,
+	ARES_CACHE_CTR_EVICTED,
+};
+
+struct sgsn_ares_cache;
+struct sgsn_ares_cache_entry;
+
+/* Start resolving entry->name. The answer is handed back through
+ * sgsn_ares_cache_complete(), which may be called before this returns. */
+typedef int (*sgsn_ares_cache_resolve_t)(struct sgsn_ares_cache *cache,
+					 struct sgsn_ares_cache_entry *entry);
+
+struct sgsn_ares_cache_entry {
+	struct llist_head list;
+	struct sgsn_ares_cache *cache;
+	char *name;
+
+	/* a query for this name is outstanding */
+	int pending;
+	/* callers waiting for the outstanding query */
+	struct llist_head waiters;
+
+	/* the cached answer, status is an ARES_* code */
+	int status;
+	struct in_addr addrs[SGSN_ARES_CACHE_MAX_ADDRS];
+	unsigned int num_addrs;
+	time_t expires;
+};
+
+struct sgsn_ares_cache {
+	/* entries in least recently used order, the oldest first */
+	struct llist_head entries;
+	unsigned int num_entries;
+	unsigned int max_entries;
+
+	/* seconds, 0 disables caching of the respective answers */
+	unsigned int max_ttl;
+	unsigned int neg_ttl;
+
+	sgsn_ares_cache_resolve_t resolve;
+	void *resolve_data;
+
+	/* answers are always delivered from the main loop, never from
+	 * within sgsn_ares_cache_query() */
+	struct llist_head deliver;
+	struct osmo_timer_list deliver_timer;
+
+	/* monotonic seconds, can be replaced for testing */
+	time_t (*now)(void);
+
+	struct rate_ctr_group *ctrg;
+};
+
+struct sgsn_ares_cache *sgsn_ares_cache_alloc(void *ctx,
+					      sgsn_ares_cache_resolve_t resolve,
+					      void *resolve_data);
+void sgsn_ares_cache_free(struct sgsn_ares_cache *cache);
+int sgsn_ares_cache_query(struct sgsn_ares_cache *cache, const char *name,
+			  ares_host_callback cb, void *data);
+void sgsn_ares_cache_complete(struct sgsn_ares_cache_entry *entry,
+			      int status, int timeouts,
+			      const struct in_addr *addrs, unsigned int num_addrs,
+			      unsigned int ttl);
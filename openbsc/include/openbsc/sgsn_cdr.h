@@ -0,0 +1,104 @@
+/* GPRS SGSN CDR records and the CDR file writer */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/* Output format of the CDR file */
+enum sgsn_cdr_format {
+	SGSN_CDR_FMT_CSV,
+	SGSN_CDR_FMT_BINARY,
+};
+
+/* The events a CDR is written for, their names appear in the CSV output */
+enum sgsn_cdr_event {
+	SGSN_CDR_EV_ATTACH,
+	SGSN_CDR_EV_UPDATE,
+	SGSN_CDR_EV_DETACH,
+	SGSN_CDR_EV_FREE,
+	SGSN_CDR_EV_PDP_ACT,
+	SGSN_CDR_EV_PDP_DEACT,
+	SGSN_CDR_EV_PDP_TERMINATE,
+	SGSN_CDR_EV_PDP_FREE,
+	SGSN_CDR_EV_PDP_PERIODIC,
+	_NUM_SGSN_CDR_EV
+};
+
+const char *sgsn_cdr_event_name(enum sgsn_cdr_event ev);
+
+#define SGSN_CDR_STR_LEN	64
+
+/* One CDR, independent of the output format. The strings are copied in
+ * so that the record does not refer to any MM or PDP context. */
+struct sgsn_cdr_rec {
+	/* set for PDP context related events */
+	int is_pdp;
+	enum sgsn_cdr_event ev;
+	/* UTC, in milliseconds since the epoch */
+	uint64_t timestamp_ms;
+
+	char imsi[SGSN_CDR_STR_LEN];
+	char imei[SGSN_CDR_STR_LEN];
+	char msisdn[SGSN_CDR_STR_LEN];
+	char hlr[SGSN_CDR_STR_LEN];
+	int cell_id;
+	int lac;
+
+	/* only for PDP events */
+	uint32_t duration;
+	char ggsn_addr[SGSN_CDR_STR_LEN];
+	char sgsn_addr[SGSN_CDR_STR_LEN];
+	char apni[SGSN_CDR_STR_LEN * 2];
+	char eua_addr[SGSN_CDR_STR_LEN];
+	uint64_t vol_in;
+	uint64_t vol_out;
+	uint32_t charging_id;
+};
+
+/* The binary format: a file starts with SGSN_CDR_BIN_MAGIC, followed by
+ * records. Each record starts with its total length as a 16 bit value,
+ * all integers are in network byte order and strings are prefixed with
+ * an 8 bit length. */
+#define SGSN_CDR_BIN_MAGIC	"OCDR\x01"
+#define SGSN_CDR_BIN_MAGIC_LEN	5
+#define SGSN_CDR_BIN_MAX_LEN	1024
+
+extern const char sgsn_cdr_csv_header[];
+
+int sgsn_cdr_rec_to_csv(const struct sgsn_cdr_rec *rec, char *buf, size_t len);
+int sgsn_cdr_rec_encode(const struct sgsn_cdr_rec *rec, uint8_t *buf, size_t len);
+int sgsn_cdr_rec_decode(struct sgsn_cdr_rec *rec, const uint8_t *buf, size_t len);
+
+/* Writes CDRs to a file from a separate thread. Records are formatted
+ * into an in-memory ring by the caller, the thread drains the ring and
+ * rotates the file by size and age. */
+struct sgsn_cdr_writer;
+
+struct sgsn_cdr_writer_cfg {
+	const char *filename;
+	enum sgsn_cdr_format format;
+	/* rotate once the file reaches this many bytes, 0 to disable */
+	unsigned int rotate_size;
+	/* rotate once the file is this many seconds old, 0 to disable */
+	unsigned int rotate_interval;
+};
+
+struct sgsn_cdr_writer_stats {
+	uint64_t records;
+	uint64_t dropped;
+	uint64_t bytes_written;
+	uint64_t rotations;
+	uint64_t write_errors;
+};
+
+struct sgsn_cdr_writer *sgsn_cdr_writer_alloc(void *ctx, size_t ring_size);
+void sgsn_cdr_writer_free(struct sgsn_cdr_writer *w);
+int sgsn_cdr_writer_configure(struct sgsn_cdr_writer *w,
+			      const struct sgsn_cdr_writer_cfg *cfg);
+int sgsn_cdr_writer_add(struct sgsn_cdr_writer *w,
+			const struct sgsn_cdr_rec *rec);
+void sgsn_cdr_writer_flush(struct sgsn_cdr_writer *w);
+void sgsn_cdr_writer_stats(struct sgsn_cdr_writer *w,
+			   struct sgsn_cdr_writer_stats *stats);
@@ -100,6 +100,7 @@ enum signal_lchan {
 	S_LCHAN_HANDOVER_FAIL,		/* 04.08 Handover Failed */
 	S_LCHAN_HANDOVER_DETECT,	/* 08.58 Handover Detect */
 	S_LCHAN_MEAS_REP,		/* 08.58 Measurement Report */
+	S_LCHAN_HANDOVER_TIMEOUT,	/* T3103 expired on the old lchan */
 };
 
 /* SS_CHALLOC signals */
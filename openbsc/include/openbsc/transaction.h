@@ -13,6 +13,12 @@
 struct gsm_trans {
 	/* Entry in list of all transactions */
 	struct llist_head entry;
+	/* Entry in the network's callref hash (unhashed for callref 0) */
+	struct llist_head callref_entry;
+	/* Entry in the network's (subscr, protocol, transaction_id) hash */
+	struct llist_head id_entry;
+	/* Entry in the list of transactions of conn */
+	struct llist_head conn_entry;
 
 	/* Back pointer to the network struct */
 	struct gsm_network *net;
@@ -49,6 +55,7 @@ struct gsm_trans {
 			int T308_second;	/* used to send release again */
 			struct osmo_timer_list timer;
 			struct gsm_mncc msg;	/* stores setup/disconnect/release message */
+			int mncc_refused;	/* never announced to MNCC, send it nothing */
 		} cc;
 		struct {
 			struct gsm411_smc_inst smc_inst;
@@ -72,6 +79,11 @@ struct gsm_trans *trans_alloc(struct gsm_network *net,
 			      uint32_t callref);
 void trans_free(struct gsm_trans *trans);
 
+void trans_set_callref(struct gsm_trans *trans, uint32_t callref);
+void trans_set_trans_id(struct gsm_trans *trans, uint8_t trans_id);
+void trans_set_conn(struct gsm_trans *trans,
+		    struct gsm_subscriber_connection *conn);
+
 int trans_assign_trans_id(struct gsm_network *net, struct gsm_subscriber *subscr,
 			  uint8_t protocol, uint8_t ti_flag);
 int trans_has_conn(const struct gsm_subscriber_connection *conn);
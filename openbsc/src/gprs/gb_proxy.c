@@ -80,6 +80,10 @@ static int gbprox_relay2peer(struct msgb *old_msg, struct gbproxy_peer *peer,
 			  uint16_t ns_bvci);
 static int gbprox_relay2sgsn(struct gbproxy_config *cfg, struct msgb *old_msg,
 			     uint16_t ns_bvci, uint16_t sgsn_nsei);
+static int gbprox_tx2peer(struct msgb *msg, struct gbproxy_peer *peer,
+			  uint16_t ns_bvci);
+static int gbprox_tx2sgsn(struct gbproxy_config *cfg, struct msgb *msg,
+			  uint16_t ns_bvci, uint16_t sgsn_nsei);
 static void gbproxy_reset_imsi_acquisition(struct gbproxy_link_info* link_info);
 
 static int check_peer_nsei(struct gbproxy_peer *peer, uint16_t nsei)
@@ -102,6 +106,35 @@ static void strip_ns_hdr(struct msgb *msg)
 	msgb_pull(msg, strip_len);
 }
 
+/* Create a copy of the BSSGP PDU that can be handed to gprs_ns_sendmsg(),
+ * as the received msgb is owned and freed by the NS layer after
+ * gbprox_rcvmsg() returns. Only the PDU and room for the new NS header
+ * are allocated and copied instead of the whole receive buffer. */
+static struct msgb *gbprox_msgb_copy_pdu(const struct msgb *old_msg,
+					 const char *name)
+{
+	size_t len = msgb_bssgp_len(old_msg);
+	struct msgb *msg;
+
+	msg = msgb_alloc_headroom(NS_ALLOC_HEADROOM + len, NS_ALLOC_HEADROOM,
+				  name);
+	if (!msg)
+		return NULL;
+
+	msgb_bssgph(msg) = msgb_put(msg, len);
+	memcpy(msgb_bssgph(msg), msgb_bssgph(old_msg), len);
+	msgb_nsei(msg) = msgb_nsei(old_msg);
+	msgb_bvci(msg) = msgb_bvci(old_msg);
+
+	return msg;
+}
+
+static int gbproxy_patching_enabled(struct gbproxy_config *cfg)
+{
+	return cfg->core_mcc || cfg->core_mnc || cfg->core_apn ||
+		cfg->acquire_imsi || cfg->patch_ptmsi || cfg->route_to_sgsn2;
+}
+
 /* Transmit Chapter 9.2.10 Identity Request */
 static void gprs_put_identity_req(struct msgb *msg, uint8_t id_type)
 {
@@ -357,8 +390,8 @@ static int gbproxy_flush_stored_messages(struct gbproxy_peer *peer,
 			return -1;
 		}
 
-		rc = gbprox_relay2sgsn(peer->cfg, stored_msg,
-				       msgb_bvci(msg), link_info->sgsn_nsei);
+		rc = gbprox_tx2sgsn(peer->cfg, stored_msg,
+				    msgb_bvci(msg), link_info->sgsn_nsei);
 
 		if (rc < 0)
 			LOGP(DLLC, LOGL_ERROR,
@@ -367,7 +400,6 @@ static int gbproxy_flush_stored_messages(struct gbproxy_peer *peer,
 			     msgb_nsei(msg),
 			     parse_ctx->llc_msg_name ?
 			     parse_ctx->llc_msg_name : "BSSGP");
-		msgb_free(stored_msg);
 	}
 
 	return 0;
@@ -388,8 +420,7 @@ static int gbproxy_gsm48_to_peer(struct gbproxy_peer *peer,
 	link_info->vu_gen_tx_bss = (link_info->vu_gen_tx_bss + 1) % 512;
 
 	gprs_push_bssgp_dl_unitdata(msg, link_info->tlli.current);
-	rc = gbprox_relay2peer(msg, peer, bvci);
-	msgb_free(msg);
+	rc = gbprox_tx2peer(msg, peer, bvci);
 	return rc;
 }
 
@@ -558,8 +589,7 @@ static int gbprox_process_bssgp_ul(struct gbproxy_config *cfg,
 	struct gbproxy_link_info *link_info = NULL;
 	uint32_t sgsn_nsei = cfg->nsip_sgsn_nsei;
 
-	if (!cfg->core_mcc && !cfg->core_mnc && !cfg->core_apn &&
-	    !cfg->acquire_imsi && !cfg->patch_ptmsi && !cfg->route_to_sgsn2)
+	if (!gbproxy_patching_enabled(cfg))
 		return 1;
 
 	parse_ctx.to_bss = 0;
@@ -676,8 +706,7 @@ static void gbprox_process_bssgp_dl(struct gbproxy_config *cfg,
 	struct timespec ts = {0,};
 	struct gbproxy_link_info *link_info = NULL;
 
-	if (!cfg->core_mcc && !cfg->core_mnc && !cfg->core_apn &&
-	    !cfg->acquire_imsi && !cfg->patch_ptmsi && !cfg->route_to_sgsn2)
+	if (!gbproxy_patching_enabled(cfg))
 		return;
 
 	parse_ctx.to_bss = 1;
@@ -754,13 +783,10 @@ static void gbprox_process_bssgp_dl(struct gbproxy_config *cfg,
 	return;
 }
 
-/* feed a message down the NS-VC associated with the specified peer */
-static int gbprox_relay2sgsn(struct gbproxy_config *cfg, struct msgb *old_msg,
-			     uint16_t ns_bvci, uint16_t sgsn_nsei)
+/* feed a message down the NS-VC towards the SGSN, takes msg ownership */
+static int gbprox_tx2sgsn(struct gbproxy_config *cfg, struct msgb *msg,
+			  uint16_t ns_bvci, uint16_t sgsn_nsei)
 {
-	/* create a copy of the message so the old one can
-	 * be free()d safely when we return from gbprox_rcvmsg() */
-	struct msgb *msg = gprs_msgb_copy(old_msg, "msgb_relay2sgsn");
 	int rc;
 
 	DEBUGP(DGPRS, "NSEI=%u proxying BTS->SGSN (NS_BVCI=%u, NSEI=%u)\n",
@@ -778,13 +804,23 @@ static int gbprox_relay2sgsn(struct gbproxy_config *cfg, struct msgb *old_msg,
 	return rc;
 }
 
-/* feed a message down the NS-VC associated with the specified peer */
-static int gbprox_relay2peer(struct msgb *old_msg, struct gbproxy_peer *peer,
+/* feed a received message down the NS-VC towards the SGSN */
+static int gbprox_relay2sgsn(struct gbproxy_config *cfg, struct msgb *old_msg,
+			     uint16_t ns_bvci, uint16_t sgsn_nsei)
+{
+	struct msgb *msg = gbprox_msgb_copy_pdu(old_msg, "msgb_relay2sgsn");
+
+	if (!msg)
+		return -ENOMEM;
+
+	return gbprox_tx2sgsn(cfg, msg, ns_bvci, sgsn_nsei);
+}
+
+/* feed a message down the NS-VC associated with the specified peer, takes
+ * msg ownership */
+static int gbprox_tx2peer(struct msgb *msg, struct gbproxy_peer *peer,
 			  uint16_t ns_bvci)
 {
-	/* create a copy of the message so the old one can
-	 * be free()d safely when we return from gbprox_rcvmsg() */
-	struct msgb *msg = gprs_msgb_copy(old_msg, "msgb_relay2peer");
 	int rc;
 
 	DEBUGP(DGPRS, "NSEI=%u proxying SGSN->BSS (NS_BVCI=%u, NSEI=%u)\n",
@@ -803,6 +839,19 @@ static int gbprox_relay2peer(struct msgb *old_msg, struct gbproxy_peer *peer,
 	return rc;
 }
 
+/* feed a received message down the NS-VC associated with the specified
+ * peer */
+static int gbprox_relay2peer(struct msgb *old_msg, struct gbproxy_peer *peer,
+			  uint16_t ns_bvci)
+{
+	struct msgb *msg = gbprox_msgb_copy_pdu(old_msg, "msgb_relay2peer");
+
+	if (!msg)
+		return -ENOMEM;
+
+	return gbprox_tx2peer(msg, peer, ns_bvci);
+}
+
 static int block_unblock_peer(struct gbproxy_config *cfg, uint16_t ptp_bvci, uint8_t pdu_type)
 {
 	struct gbproxy_peer *peer;
@@ -1179,8 +1228,14 @@ static int gbprox_rx_sig_from_sgsn(struct gbproxy_config *cfg,
 		return bssgp_tx_status(BSSGP_CAUSE_PROTO_ERR_UNSPEC, NULL, orig_msg);
 	}
 
-	msg = gprs_msgb_copy(orig_msg, "rx_sig_from_sgsn");
-	gbprox_process_bssgp_dl(cfg, msg, NULL);
+	/* Patching modifies the message, but orig_msg is still needed for
+	 * the STATUS messages below. Don't copy if nothing is patched. */
+	if (gbproxy_patching_enabled(cfg)) {
+		msg = gprs_msgb_copy(orig_msg, "rx_sig_from_sgsn");
+		gbprox_process_bssgp_dl(cfg, msg, NULL);
+	} else {
+		msg = orig_msg;
+	}
 	/* Update message info */
 	bgph = (struct bssgp_normal_hdr *) msgb_bssgph(msg);
 	data_len = msgb_bssgp_len(orig_msg) - sizeof(*bgph);
@@ -1274,7 +1329,8 @@ static int gbprox_rx_sig_from_sgsn(struct gbproxy_config *cfg,
 		break;
 	}
 
-	msgb_free(msg);
+	if (msg != orig_msg)
+		msgb_free(msg);
 
 	return rc;
 err_mand_ie:
@@ -1282,13 +1338,15 @@ err_mand_ie:
 		nsei);
 	rate_ctr_inc(&cfg->ctrg->
 		     ctr[GBPROX_GLOB_CTR_PROTO_ERR_SGSN]);
-	msgb_free(msg);
+	if (msg != orig_msg)
+		msgb_free(msg);
 	return bssgp_tx_status(BSSGP_CAUSE_MISSING_MAND_IE, NULL, orig_msg);
 err_no_peer:
 	LOGP(DGPRS, LOGL_ERROR, "NSEI=%u(SGSN) cannot find peer based on RAI\n",
 		nsei);
 	rate_ctr_inc(&cfg->ctrg-> ctr[GBPROX_GLOB_CTR_INV_RAI]);
-	msgb_free(msg);
+	if (msg != orig_msg)
+		msgb_free(msg);
 	return bssgp_tx_status(BSSGP_CAUSE_INV_MAND_INF, NULL, orig_msg);
 }
 
@@ -170,6 +170,7 @@ struct gbproxy_peer *gbproxy_peer_by_bssgp_tlv(struct gbproxy_config *cfg,
 struct gbproxy_peer *gbproxy_peer_alloc(struct gbproxy_config *cfg, uint16_t bvci)
 {
 	struct gbproxy_peer *peer;
+	int key, i;
 
 	peer = talloc_zero(tall_bsc_ctx, struct gbproxy_peer);
 	if (!peer)
@@ -182,6 +183,9 @@ struct gbproxy_peer *gbproxy_peer_alloc(struct gbproxy_config *cfg, uint16_t bvc
 	llist_add(&peer->list, &cfg->bts_peers);
 
 	INIT_LLIST_HEAD(&peer->patch_state.logical_links);
+	for (key = 0; key < GBPROX_KEY_LAST; key++)
+		for (i = 0; i < GBPROXY_LINK_HASH_SIZE; i++)
+			INIT_LLIST_HEAD(&peer->patch_state.link_hash[key][i]);
 
 	return peer;
 }
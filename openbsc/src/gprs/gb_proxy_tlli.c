@@ -32,38 +32,143 @@
 #include <osmocom/core/rate_ctr.h>
 #include <osmocom/core/talloc.h>
 
+static unsigned int gbproxy_hash_u32(uint32_t value)
+{
+	/* Fibonacci hashing, local TLLIs and P-TMSIs share their upper bits */
+	return (value * 2654435761U) >> (32 - GBPROXY_LINK_HASH_BITS);
+}
+
+static unsigned int gbproxy_hash_imsi(const uint8_t *imsi, size_t imsi_len)
+{
+	uint32_t hash = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < imsi_len; i++)
+		hash = (hash ^ imsi[i]) * 16777619U;
+
+	return gbproxy_hash_u32(hash);
+}
+
+static struct gbproxy_link_info *gbproxy_hash_entry(struct llist_head *entry,
+						    enum gbproxy_link_key key)
+{
+	return llist_entry(entry - key, struct gbproxy_link_info, hash_list[0]);
+}
+
+/* Returns the key value and whether it is set at all */
+static int gbproxy_link_key_value(struct gbproxy_link_info *link_info,
+				  enum gbproxy_link_key key, uint32_t *value)
+{
+	switch (key) {
+	case GBPROX_KEY_TLLI:
+		*value = link_info->tlli.current;
+		return *value != 0;
+	case GBPROX_KEY_TLLI_ASSIGNED:
+		*value = link_info->tlli.assigned;
+		return *value != 0;
+	case GBPROX_KEY_PTMSI:
+		*value = link_info->tlli.ptmsi;
+		return *value != GSM_RESERVED_TMSI;
+	case GBPROX_KEY_SGSN_TLLI:
+		*value = link_info->sgsn_tlli.current;
+		return *value != 0;
+	case GBPROX_KEY_SGSN_TLLI_ASSIGNED:
+		*value = link_info->sgsn_tlli.assigned;
+		return *value != 0;
+	default:
+		return 0;
+	}
+}
+
+static void gbproxy_unhash_link_info(struct gbproxy_link_info *link_info)
+{
+	int key;
+
+	for (key = 0; key < GBPROX_KEY_LAST; key++)
+		llist_del_init(&link_info->hash_list[key]);
+}
+
+static void gbproxy_hash_link_info(struct gbproxy_peer *peer,
+				   struct gbproxy_link_info *link_info)
+{
+	struct gbproxy_patch_state *state = &peer->patch_state;
+	unsigned int bucket;
+	uint32_t value;
+	int key;
+
+	for (key = 0; key < GBPROX_KEY_IMSI; key++) {
+		if (!gbproxy_link_key_value(link_info, key, &value))
+			continue;
+		bucket = gbproxy_hash_u32(value);
+		llist_add(&link_info->hash_list[key],
+			  &state->link_hash[key][bucket]);
+	}
+
+	if (link_info->imsi_len > 0) {
+		bucket = gbproxy_hash_imsi(link_info->imsi, link_info->imsi_len);
+		llist_add(&link_info->hash_list[GBPROX_KEY_IMSI],
+			  &state->link_hash[GBPROX_KEY_IMSI][bucket]);
+	}
+}
+
+/* Must be called whenever one of the keys of an attached link_info has been
+ * modified */
+void gbproxy_reindex_link_info(struct gbproxy_peer *peer,
+			       struct gbproxy_link_info *link_info)
+{
+	gbproxy_unhash_link_info(link_info);
+	gbproxy_hash_link_info(peer, link_info);
+}
+
+/* Several entries may carry the same key (e.g. a TLLI that is current for
+ * one MS and assigned to another). Like a walk over logical_links, return the
+ * most recently used one. */
+static struct gbproxy_link_info *gbproxy_hash_lookup(
+	struct gbproxy_peer *peer, enum gbproxy_link_key key, uint32_t value,
+	int check_nsei, uint32_t sgsn_nsei, struct gbproxy_link_info *best)
+{
+	struct llist_head *bucket, *entry;
+	struct gbproxy_link_info *link_info;
+	uint32_t link_value;
+
+	bucket = &peer->patch_state.link_hash[key][gbproxy_hash_u32(value)];
+
+	llist_for_each(entry, bucket) {
+		link_info = gbproxy_hash_entry(entry, key);
+		gbproxy_link_key_value(link_info, key, &link_value);
+		if (link_value != value)
+			continue;
+		if (check_nsei && link_info->sgsn_nsei != sgsn_nsei)
+			continue;
+		if (!best || link_info->seq > best->seq)
+			best = link_info;
+	}
+
+	return best;
+}
+
 struct gbproxy_link_info *gbproxy_link_info_by_tlli(struct gbproxy_peer *peer,
 					    uint32_t tlli)
 {
 	struct gbproxy_link_info *link_info;
-	struct gbproxy_patch_state *state = &peer->patch_state;
 
 	if (!tlli)
 		return NULL;
 
-	llist_for_each_entry(link_info, &state->logical_links, list)
-		if (link_info->tlli.current == tlli ||
-		    link_info->tlli.assigned == tlli)
-			return link_info;
-
-	return NULL;
+	link_info = gbproxy_hash_lookup(peer, GBPROX_KEY_TLLI, tlli,
+					0, 0, NULL);
+	return gbproxy_hash_lookup(peer, GBPROX_KEY_TLLI_ASSIGNED, tlli,
+				   0, 0, link_info);
 }
 
 struct gbproxy_link_info *gbproxy_link_info_by_ptmsi(
 	struct gbproxy_peer *peer,
 	uint32_t ptmsi)
 {
-	struct gbproxy_link_info *link_info;
-	struct gbproxy_patch_state *state = &peer->patch_state;
-
 	if (ptmsi == GSM_RESERVED_TMSI)
 		return NULL;
 
-	llist_for_each_entry(link_info, &state->logical_links, list)
-		if (link_info->tlli.ptmsi == ptmsi)
-			return link_info;
-
-	return NULL;
+	return gbproxy_hash_lookup(peer, GBPROX_KEY_PTMSI, ptmsi, 0, 0, NULL);
 }
 
 struct gbproxy_link_info *gbproxy_link_info_by_any_sgsn_tlli(
@@ -71,18 +176,15 @@ struct gbproxy_link_info *gbproxy_link_info_by_any_sgsn_tlli(
 	uint32_t tlli)
 {
 	struct gbproxy_link_info *link_info;
-	struct gbproxy_patch_state *state = &peer->patch_state;
 
 	if (!tlli)
 		return NULL;
 
 	/* Don't care about the NSEI */
-	llist_for_each_entry(link_info, &state->logical_links, list)
-		if (link_info->sgsn_tlli.current == tlli ||
-		     link_info->sgsn_tlli.assigned == tlli)
-			return link_info;
-
-	return NULL;
+	link_info = gbproxy_hash_lookup(peer, GBPROX_KEY_SGSN_TLLI, tlli,
+					0, 0, NULL);
+	return gbproxy_hash_lookup(peer, GBPROX_KEY_SGSN_TLLI_ASSIGNED, tlli,
+				   0, 0, link_info);
 }
 
 struct gbproxy_link_info *gbproxy_link_info_by_sgsn_tlli(
@@ -90,18 +192,14 @@ struct gbproxy_link_info *gbproxy_link_info_by_sgsn_tlli(
 	uint32_t tlli, uint32_t sgsn_nsei)
 {
 	struct gbproxy_link_info *link_info;
-	struct gbproxy_patch_state *state = &peer->patch_state;
 
 	if (!tlli)
 		return NULL;
 
-	llist_for_each_entry(link_info, &state->logical_links, list)
-		if ((link_info->sgsn_tlli.current == tlli ||
-		     link_info->sgsn_tlli.assigned == tlli) &&
-		    link_info->sgsn_nsei == sgsn_nsei)
-			return link_info;
-
-	return NULL;
+	link_info = gbproxy_hash_lookup(peer, GBPROX_KEY_SGSN_TLLI, tlli,
+					1, sgsn_nsei, NULL);
+	return gbproxy_hash_lookup(peer, GBPROX_KEY_SGSN_TLLI_ASSIGNED, tlli,
+				   1, sgsn_nsei, link_info);
 }
 
 struct gbproxy_link_info *gbproxy_link_info_by_imsi(
@@ -109,22 +207,26 @@ struct gbproxy_link_info *gbproxy_link_info_by_imsi(
 	const uint8_t *imsi,
 	size_t imsi_len)
 {
-	struct gbproxy_link_info *link_info;
-	struct gbproxy_patch_state *state = &peer->patch_state;
+	struct gbproxy_link_info *link_info, *best = NULL;
+	struct llist_head *bucket, *entry;
 
 	if (!gprs_is_mi_imsi(imsi, imsi_len))
 		return NULL;
 
-	llist_for_each_entry(link_info, &state->logical_links, list) {
+	bucket = &peer->patch_state.link_hash[GBPROX_KEY_IMSI]
+		[gbproxy_hash_imsi(imsi, imsi_len)];
+
+	llist_for_each(entry, bucket) {
+		link_info = gbproxy_hash_entry(entry, GBPROX_KEY_IMSI);
 		if (link_info->imsi_len != imsi_len)
 			continue;
 		if (memcmp(link_info->imsi, imsi, imsi_len) != 0)
 			continue;
-
-		return link_info;
+		if (!best || link_info->seq > best->seq)
+			best = link_info;
 	}
 
-	return NULL;
+	return best;
 }
 
 void gbproxy_link_info_discard_messages(struct gbproxy_link_info *link_info)
@@ -144,6 +246,7 @@ void gbproxy_delete_link_info(struct gbproxy_peer *peer,
 
 	gbproxy_link_info_discard_messages(link_info);
 
+	gbproxy_unhash_link_info(link_info);
 	llist_del(&link_info->list);
 	talloc_free(link_info);
 	state->logical_link_count -= 1;
@@ -170,13 +273,18 @@ void gbproxy_attach_link_info(struct gbproxy_peer *peer, time_t now,
 	struct gbproxy_patch_state *state = &peer->patch_state;
 
 	link_info->timestamp = now;
+	link_info->seq = ++state->link_seq;
 	llist_add(&link_info->list, &state->logical_links);
 	state->logical_link_count += 1;
+	gbproxy_hash_link_info(peer, link_info);
 
 	peer->ctrg->ctr[GBPROX_PEER_CTR_TLLI_CACHE_SIZE].current =
 		state->logical_link_count;
 }
 
+/* The logical_links are kept in LRU order, so both the excess entries and the
+ * expired ones are taken from the tail and the sweep stops at the first entry
+ * that is still young enough. */
 int gbproxy_remove_stale_link_infos(struct gbproxy_peer *peer, time_t now)
 {
 	struct gbproxy_patch_state *state = &peer->patch_state;
@@ -233,6 +341,7 @@ int gbproxy_remove_stale_link_infos(struct gbproxy_peer *peer, time_t now)
 struct gbproxy_link_info *gbproxy_link_info_alloc( struct gbproxy_peer *peer)
 {
 	struct gbproxy_link_info *link_info;
+	int key;
 
 	link_info = talloc_zero(peer, struct gbproxy_link_info);
 	link_info->tlli.ptmsi = GSM_RESERVED_TMSI;
@@ -240,7 +349,10 @@ struct gbproxy_link_info *gbproxy_link_info_alloc( struct gbproxy_peer *peer)
 
 	link_info->vu_gen_tx_bss = GBPROXY_INIT_VU_GEN_TX;
 
+	INIT_LLIST_HEAD(&link_info->list);
 	INIT_LLIST_HEAD(&link_info->stored_msgs);
+	for (key = 0; key < GBPROX_KEY_LAST; key++)
+		INIT_LLIST_HEAD(&link_info->hash_list[key]);
 
 	return link_info;
 }
@@ -251,7 +363,8 @@ void gbproxy_detach_link_info(
 {
 	struct gbproxy_patch_state *state = &peer->patch_state;
 
-	llist_del(&link_info->list);
+	gbproxy_unhash_link_info(link_info);
+	llist_del_init(&link_info->list);
 	OSMO_ASSERT(state->logical_link_count > 0);
 	state->logical_link_count -= 1;
 
@@ -259,9 +372,13 @@ void gbproxy_detach_link_info(
 		state->logical_link_count;
 }
 
-void gbproxy_update_link_info(struct gbproxy_link_info *link_info,
+void gbproxy_update_link_info(struct gbproxy_peer *peer,
+			      struct gbproxy_link_info *link_info,
 			      const uint8_t *imsi, size_t imsi_len)
 {
+	struct gbproxy_patch_state *state = &peer->patch_state;
+	unsigned int bucket;
+
 	if (!gprs_is_mi_imsi(imsi, imsi_len))
 		return;
 
@@ -270,6 +387,15 @@ void gbproxy_update_link_info(struct gbproxy_link_info *link_info,
 		talloc_realloc_size(link_info, link_info->imsi, imsi_len);
 	OSMO_ASSERT(link_info->imsi != NULL);
 	memcpy(link_info->imsi, imsi, imsi_len);
+
+	/* Only attached entries are indexed */
+	if (llist_empty(&link_info->list))
+		return;
+
+	bucket = gbproxy_hash_imsi(imsi, imsi_len);
+	llist_del(&link_info->hash_list[GBPROX_KEY_IMSI]);
+	llist_add(&link_info->hash_list[GBPROX_KEY_IMSI],
+		  &state->link_hash[GBPROX_KEY_IMSI][bucket]);
 }
 
 void gbproxy_reassign_tlli(struct gbproxy_tlli_state *tlli_state,
@@ -366,6 +492,7 @@ static int gbproxy_unregister_link_info(struct gbproxy_peer *peer,
 	link_info->tlli.assigned = 0;
 	link_info->sgsn_tlli.current = 0;
 	link_info->sgsn_tlli.assigned = 0;
+	gbproxy_reindex_link_info(peer, link_info);
 
 	link_info->is_deregistered = 1;
 
@@ -412,7 +539,7 @@ void gbproxy_assign_imsi(struct gbproxy_peer *peer,
 	}
 
 	/* Update the IMSI field */
-	gbproxy_update_link_info(link_info,
+	gbproxy_update_link_info(peer, link_info,
 				 parse_ctx->imsi, parse_ctx->imsi_len);
 
 	/* Check, whether the IMSI matches */
@@ -449,7 +576,9 @@ static void gbproxy_remove_matching_link_infos(
 	struct gbproxy_link_info *info, *nxt;
 	struct gbproxy_patch_state *state = &peer->patch_state;
 
-	/* Make sure that there is no second entry with the same P-TMSI or TLLI */
+	/* Make sure that there is no second entry with the same P-TMSI or TLLI.
+	 * The SGSN P-TMSI is not indexed, but this is only done when a new
+	 * P-TMSI is assigned. */
 	llist_for_each_entry_safe(info, nxt, &state->logical_links, list) {
 		if (info == link_info)
 			continue;
@@ -527,6 +656,7 @@ struct gbproxy_link_info *gbproxy_update_link_state_ul(
 							   parse_ctx->tlli);
 			link_info->sgsn_tlli.current = sgsn_tlli;
 			link_info->tlli.current = parse_ctx->tlli;
+			gbproxy_reindex_link_info(peer, link_info);
 		} else if (!tlli_is_valid) {
 			/* New TLLI (info found by IMSI or P-TMSI) */
 			link_info->tlli.current = parse_ctx->tlli;
@@ -610,6 +740,7 @@ struct gbproxy_link_info *gbproxy_update_link_state_dl(
 		/* Setup PTMSIs */
 		link_info->sgsn_tlli.ptmsi = new_sgsn_ptmsi;
 		link_info->tlli.ptmsi = new_bss_ptmsi;
+		gbproxy_reindex_link_info(peer, link_info);
 	} else if (parse_ctx->tlli_enc && parse_ctx->new_ptmsi_enc && !link_info &&
 		   !peer->cfg->patch_ptmsi) {
 		/* A new P-TMSI has been signalled in the message with an unknown
@@ -641,6 +772,7 @@ struct gbproxy_link_info *gbproxy_update_link_state_dl(
 		/* Setup TLLIs */
 		link_info->sgsn_tlli.current = parse_ctx->tlli;
 		link_info->tlli.current = parse_ctx->tlli;
+		gbproxy_reindex_link_info(peer, link_info);
 
 		if (!parse_ctx->new_ptmsi_enc)
 			return link_info;
@@ -652,6 +784,7 @@ struct gbproxy_link_info *gbproxy_update_link_state_dl(
 		/* Setup P-TMSIs */
 		link_info->sgsn_tlli.ptmsi = new_ptmsi;
 		link_info->tlli.ptmsi = new_ptmsi;
+		gbproxy_reindex_link_info(peer, link_info);
 	} else if (parse_ctx->tlli_enc && parse_ctx->llc && link_info) {
 		uint32_t bss_tlli = gbproxy_map_tlli(parse_ctx->tlli,
 						     link_info, 1);
@@ -712,6 +845,7 @@ int gbproxy_update_link_state_after(
 				      peer, new_sgsn_tlli);
 		gbproxy_reassign_tlli(&link_info->tlli,
 				      peer, new_bss_tlli);
+		gbproxy_reindex_link_info(peer, link_info);
 		gbproxy_remove_matching_link_infos(peer, link_info);
 	}
 
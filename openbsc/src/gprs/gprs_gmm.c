@@ -1555,6 +1555,7 @@ static int gsm48_rx_gmm_ra_upd_req(struct sgsn_mm_ctx *mmctx, struct msgb *msg,
 #else
 	/* Make sure we are NORMAL (i.e. not SUSPENDED anymore) */
 	mmctx->mm_state = GMM_REGISTERED_NORMAL;
+	sgsn_mm_ctx_dl_flush(mmctx, -1);
 
 	memset(&sig_data, 0, sizeof(sig_data));
 	sig_data.mm = mmctx;
@@ -1854,6 +1855,7 @@ static int gsm0408_rcv_gmm(struct sgsn_mm_ctx *mmctx, struct msgb *msg,
 		}
 		mmctx->mm_state = GMM_REGISTERED_NORMAL;
 		mmctx_set_pmm_state(mmctx, PMM_CONNECTED);
+		sgsn_mm_ctx_dl_flush(mmctx, -1);
 		rc = 0;
 
 		memset(&sig_data, 0, sizeof(sig_data));
@@ -2710,6 +2712,7 @@ int gprs_gmm_rx_resume(struct gprs_ra_id *raid, uint32_t tlli,
 
 	/* Transition from SUSPENDED to NORMAL */
 	mmctx->mm_state = GMM_REGISTERED_NORMAL;
+	sgsn_mm_ctx_dl_flush(mmctx, -1);
 	return 0;
 }
 
@@ -68,6 +68,9 @@ static const struct rate_ctr_desc mmctx_ctr_description[] = {
 	{ "paging.ps",		"Paging Packet Switched   " },
 	{ "paging.cs",		"Paging Circuit Switched  " },
 	{ "ra_update",		"Routing Area Update      " },
+	{ "dl_buffer.queued",	"DL N-PDUs kept for paging" },
+	{ "dl_buffer.flushed",	"DL N-PDUs sent after page" },
+	{ "dl_buffer.dropped",	"DL N-PDUs lost in paging " },
 };
 
 static const struct rate_ctr_group_desc mmctx_ctrg_desc = {
@@ -117,6 +120,10 @@ static const struct rate_ctr_desc sgsn_ctr_description[] = {
 	{ "pdp.dl_deactivate_accepted", "Sent deactivate accepted" },
 	{ "pdp.ul_deactivate_requested", "Received deactivate requests" },
 	{ "pdp.ul_deactivate_accepted", "Received deactivate accepts" },
+	{ "auth.tuple_wait", "Authentications waiting for tuples from the HLR" },
+	{ "auth.prefetch_requested", "Background requests for auth tuples" },
+	{ "auth.prefetch_tuples", "Auth tuples stored by background requests" },
+	{ "auth.prefetch_evicted", "Subscribers that lost their unused tuples" },
 };
 
 static const struct rate_ctr_group_desc sgsn_ctrg_desc = {
@@ -227,6 +234,7 @@ struct sgsn_mm_ctx *sgsn_mm_ctx_alloc(uint32_t tlli,
 	ctx->ciph_algo = sgsn->cfg.cipher;
 	ctx->ctrg = rate_ctr_group_alloc(ctx, &mmctx_ctrg_desc, tlli);
 	INIT_LLIST_HEAD(&ctx->pdp_list);
+	INIT_LLIST_HEAD(&ctx->dl_buf);
 
 	llist_add(&ctx->list, &sgsn_mm_ctxts);
 
@@ -254,12 +262,137 @@ struct sgsn_mm_ctx *sgsn_mm_ctx_alloc_iu(void *uectx)
 	ctx->ra = ctx->iu.ue_ctx->ra_id;
 
 	INIT_LLIST_HEAD(&ctx->pdp_list);
+	INIT_LLIST_HEAD(&ctx->dl_buf);
 
 	llist_add(&ctx->list, &sgsn_mm_ctxts);
 
 	return ctx;
 }
 
+/* A downlink N-PDU waiting for the paging response */
+struct dl_buf_entry {
+	struct llist_head list;
+	time_t queued;
+	uint8_t nsapi;
+	unsigned int len;
+	uint8_t data[0];
+};
+
+static time_t dl_buf_now(void)
+{
+	struct timespec tp;
+
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return tp.tv_sec;
+}
+
+static void dl_buf_drop(struct sgsn_mm_ctx *mm, struct dl_buf_entry *e)
+{
+	llist_del(&e->list);
+	mm->dl_buf_bytes -= e->len;
+	talloc_free(e);
+}
+
+/* Drop what has been waiting for too long, entries are in arrival order */
+static void dl_buf_expire(struct sgsn_mm_ctx *mm, time_t now)
+{
+	struct dl_buf_entry *e, *e2;
+
+	if (!sgsn->cfg.paging_buffer.max_age)
+		return;
+
+	llist_for_each_entry_safe(e, e2, &mm->dl_buf, list) {
+		if (now - e->queued < sgsn->cfg.paging_buffer.max_age)
+			break;
+		dl_buf_drop(mm, e);
+		rate_ctr_inc(&mm->ctrg->ctr[GMM_CTR_DL_BUF_DROPPED]);
+	}
+}
+
+/*! \brief Keep a downlink N-PDU until the MS answers the paging
+ *
+ * The buffer is bounded by the configured number of bytes per MM context
+ * and by the age of its entries, N-PDUs beyond that are dropped.
+ * \returns 1 if nothing was waiting before, i.e. paging should be
+ * started, 0 otherwise */
+int sgsn_mm_ctx_dl_enqueue(struct sgsn_mm_ctx *mm, uint8_t nsapi,
+			   const uint8_t *data, unsigned int len)
+{
+	struct dl_buf_entry *e;
+	time_t now = dl_buf_now();
+	int was_empty;
+
+	dl_buf_expire(mm, now);
+	was_empty = llist_empty(&mm->dl_buf);
+
+	if (mm->dl_buf_bytes + len > sgsn->cfg.paging_buffer.max_bytes) {
+		rate_ctr_inc(&mm->ctrg->ctr[GMM_CTR_DL_BUF_DROPPED]);
+		return was_empty;
+	}
+
+	e = talloc_size(mm, sizeof(*e) + len);
+	if (!e) {
+		rate_ctr_inc(&mm->ctrg->ctr[GMM_CTR_DL_BUF_DROPPED]);
+		return was_empty;
+	}
+	talloc_set_name_const(e, "dl_buf_entry");
+	e->queued = now;
+	e->nsapi = nsapi;
+	e->len = len;
+	memcpy(e->data, data, len);
+
+	llist_add_tail(&e->list, &mm->dl_buf);
+	mm->dl_buf_bytes += len;
+	rate_ctr_inc(&mm->ctrg->ctr[GMM_CTR_DL_BUF_QUEUED]);
+
+	return was_empty;
+}
+
+/*! \brief Send what was kept during paging, in the order it arrived
+ *  \param[in] nsapi only send N-PDUs of this NSAPI, or all if < 0
+ *  \returns the number of N-PDUs sent */
+unsigned int sgsn_mm_ctx_dl_flush(struct sgsn_mm_ctx *mm, int nsapi)
+{
+	struct dl_buf_entry *e, *e2;
+	unsigned int sent = 0;
+
+	if (llist_empty(&mm->dl_buf))
+		return 0;
+
+	dl_buf_expire(mm, dl_buf_now());
+
+	llist_for_each_entry_safe(e, e2, &mm->dl_buf, list) {
+		struct sgsn_pdp_ctx *pdp;
+
+		if (nsapi >= 0 && e->nsapi != nsapi)
+			continue;
+
+		pdp = sgsn_pdp_ctx_by_nsapi(mm, e->nsapi);
+		if (pdp && sgsn_pdp_tx_dl(pdp, e->data, e->len) >= 0) {
+			rate_ctr_inc(&mm->ctrg->ctr[GMM_CTR_DL_BUF_FLUSHED]);
+			sent += 1;
+		} else
+			rate_ctr_inc(&mm->ctrg->ctr[GMM_CTR_DL_BUF_DROPPED]);
+		dl_buf_drop(mm, e);
+	}
+
+	if (sent)
+		LOGMMCTXP(LOGL_INFO, mm, "Sent %u downlink N-PDUs kept "
+			  "during paging\n", sent);
+	return sent;
+}
+
+/*! \brief Drop everything that was kept during paging */
+void sgsn_mm_ctx_dl_purge(struct sgsn_mm_ctx *mm)
+{
+	struct dl_buf_entry *e, *e2;
+
+	llist_for_each_entry_safe(e, e2, &mm->dl_buf, list) {
+		dl_buf_drop(mm, e);
+		rate_ctr_inc(&mm->ctrg->ctr[GMM_CTR_DL_BUF_DROPPED]);
+	}
+}
+
 
 /* this is a hard _free_ function, it doesn't clean up the PDP contexts
  * in libgtp! */
@@ -274,6 +407,7 @@ static void sgsn_mm_ctx_free(struct sgsn_mm_ctx *mm)
 	llist_for_each_entry_safe(pdp, pdp2, &mm->pdp_list, list)
 		sgsn_pdp_ctx_free(pdp);
 
+	sgsn_mm_ctx_dl_purge(mm);
 	rate_ctr_group_free(mm->ctrg);
 
 	talloc_free(mm);
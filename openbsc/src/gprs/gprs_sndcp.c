@@ -190,17 +190,6 @@ struct sndcp_udata_hdr {
 
 static void *tall_sndcp_ctx;
 
-/* A fragment queue entry, containing one framgent of a N-PDU */
-struct defrag_queue_entry {
-	struct llist_head list;
-	/* segment number of this fragment */
-	uint32_t seg_nr;
-	/* length of the data area of this fragment */
-	uint32_t data_len;
-	/* pointer to the data of this fragment */
-	uint8_t *data;
-};
-
 LLIST_HEAD(gprs_sndcp_entities);
 
 /* Check if any compression parameters are set in the sgsn configuration */
@@ -212,32 +201,75 @@ static inline int any_pcomp_or_dcomp_active(struct sgsn_instance *sgsn) {
 		return false;
 }
 
+/* Forget all segments received so far */
+static void defrag_reset(struct gprs_sndcp_entity *sne)
+{
+	sne->defrag.no_more = sne->defrag.highest_seg = sne->defrag.seg_have = 0;
+	sne->defrag.tot_len = 0;
+	sne->defrag.in_order = 1;
+}
+
+/* Decompress a received N-PDU, *out is npdu itself if it was sent
+ * uncompressed, or the decompression buffer of the entity */
+static int sndcp_expand(struct gprs_sndcp_entity *sne, uint8_t *npdu,
+			int npdu_len, uint8_t **out)
+{
+	int rc;
+
+	if (!any_pcomp_or_dcomp_active(sgsn)
+	    || (sne->defrag.pcomp == 0 && sne->defrag.dcomp == 0)) {
+		*out = npdu;
+		return npdu_len;
+	}
+
+	rc = gprs_sndcp_comp_expand(sne, &sne->expnd, npdu, npdu_len,
+				    sne->defrag.pcomp, sne->defrag.dcomp,
+				    sne->defrag.proto, sne->defrag.data);
+	*out = sne->expnd;
+	return rc;
+}
+
 /* Enqueue a fragment into the defragment queue */
 static int defrag_enqueue(struct gprs_sndcp_entity *sne, uint8_t seg_nr,
 			  uint8_t *data, uint32_t data_len)
 {
-	struct defrag_queue_entry *dqe;
+	struct defrag_state *defrag = &sne->defrag;
+	unsigned int need;
 
-	dqe = talloc_zero(tall_sndcp_ctx, struct defrag_queue_entry);
-	if (!dqe)
-		return -ENOMEM;
-	dqe->data = talloc_zero_size(dqe, data_len);
-	if (!dqe->data) {
-		talloc_free(dqe);
-		return -ENOMEM;
+	OSMO_ASSERT(seg_nr < SNDCP_MAX_SEGMENTS);
+
+	if (defrag->seg_have & (1 << seg_nr)) {
+		LOGP(DSNDCP, LOGL_INFO, "TLLI=0x%08x NSAPI=%u: Ignoring "
+		     "duplicate segment %u of SN-PDU %u\n",
+		     sne->lle->llme->tlli, sne->nsapi, seg_nr, defrag->npdu);
+		return 0;
 	}
-	dqe->seg_nr = seg_nr;
-	dqe->data_len = data_len;
 
-	llist_add(&dqe->list, &sne->defrag.frag_list);
+	/* Grow the reassembly buffer if needed, it is kept for the next
+	 * N-PDU so that this rarely happens */
+	need = defrag->tot_len + data_len;
+	if (need > defrag->buf_size) {
+		uint8_t *buf = talloc_realloc_size(sne, defrag->buf, need);
+		if (!buf)
+			return -ENOMEM;
+		defrag->buf = buf;
+		defrag->buf_size = need;
+	}
+
+	/* Segments are appended as they arrive. As long as they arrive in
+	 * order, buf already holds the N-PDU in one piece. */
+	if (defrag->seg_have != (1 << seg_nr) - 1)
+		defrag->in_order = 0;
 
-	if (seg_nr > sne->defrag.highest_seg)
-		sne->defrag.highest_seg = seg_nr;
+	defrag->seg[seg_nr].offset = defrag->tot_len;
+	defrag->seg[seg_nr].len = data_len;
+	memcpy(defrag->buf + defrag->tot_len, data, data_len);
 
-	sne->defrag.seg_have |= (1 << seg_nr);
-	sne->defrag.tot_len += data_len;
+	if (seg_nr > defrag->highest_seg)
+		defrag->highest_seg = seg_nr;
 
-	memcpy(dqe->data, data, data_len);
+	defrag->seg_have |= (1 << seg_nr);
+	defrag->tot_len += data_len;
 
 	return 0;
 }
@@ -258,24 +290,11 @@ static int defrag_have_all_segments(struct gprs_sndcp_entity *sne)
 	return 0;
 }
 
-static struct defrag_queue_entry *defrag_get_seg(struct gprs_sndcp_entity *sne,
-						 uint32_t seg_nr)
-{
-	struct defrag_queue_entry *dqe;
-
-	llist_for_each_entry(dqe, &sne->defrag.frag_list, list) {
-		if (dqe->seg_nr == seg_nr) {
-			llist_del(&dqe->list);
-			return dqe;
-		}
-	}
-	return NULL;
-}
-
 /* Perform actual defragmentation and create an output packet */
-static int defrag_segments(struct gprs_sndcp_entity *sne)
+static int defrag_segments(struct gprs_sndcp_entity *sne, struct msgb *llc_msg)
 {
-	struct msgb *msg;
+	struct defrag_state *defrag = &sne->defrag;
+	struct msgb *msg = NULL;
 	unsigned int seg_nr;
 	uint8_t *npdu;
 	int npdu_len;
@@ -284,34 +303,29 @@ static int defrag_segments(struct gprs_sndcp_entity *sne)
 
 	LOGP(DSNDCP, LOGL_DEBUG, "TLLI=0x%08x NSAPI=%u: Defragment output PDU %u "
 		"num_seg=%u tot_len=%u\n", sne->lle->llme->tlli, sne->nsapi,
-		sne->defrag.npdu, sne->defrag.highest_seg, sne->defrag.tot_len);
-	msg = msgb_alloc_headroom(sne->defrag.tot_len+256, 128, "SNDCP Defrag");
-	if (!msg)
-		return -ENOMEM;
-
-	/* FIXME: message headers + identifiers */
-
-	npdu = msg->data;
-
-	for (seg_nr = 0; seg_nr <= sne->defrag.highest_seg; seg_nr++) {
-		struct defrag_queue_entry *dqe;
-		uint8_t *data;
+		defrag->npdu, defrag->highest_seg, defrag->tot_len);
 
-		dqe = defrag_get_seg(sne, seg_nr);
-		if (!dqe) {
-			LOGP(DSNDCP, LOGL_ERROR, "Segment %u missing\n", seg_nr);
-			msgb_free(msg);
-			return -EIO;
+	if (defrag->in_order) {
+		/* The common case: the N-PDU is already in one piece */
+		npdu = defrag->buf;
+	} else {
+		/* Gather the segments in order of their segment number */
+		msg = msgb_alloc_headroom(defrag->tot_len+256, 128,
+					  "SNDCP Defrag");
+		if (!msg)
+			return -ENOMEM;
+
+		npdu = msg->data;
+
+		for (seg_nr = 0; seg_nr <= defrag->highest_seg; seg_nr++) {
+			struct defrag_segment *seg = &defrag->seg[seg_nr];
+			memcpy(msgb_put(msg, seg->len),
+			       defrag->buf + seg->offset, seg->len);
 		}
-		/* actually append the segment to the N-PDU */
-		data = msgb_put(msg, dqe->data_len);
-		memcpy(data, dqe->data, dqe->data_len);
-
-		/* release memory for the fragment queue entry */
-		talloc_free(dqe);
 	}
 
-	npdu_len = sne->defrag.tot_len;
+	npdu_len = defrag->tot_len;
+	defrag_reset(sne);
 
 	/* FIXME: cancel timer */
 
@@ -324,37 +338,12 @@ static int defrag_segments(struct gprs_sndcp_entity *sne)
 	DEBUGP(DSNDCP, ":::::::::::::::::::::::::::::::::::::::::::::::::::\n");
 	DEBUGP(DSNDCP, "===================================================\n");
 #endif
-	if (any_pcomp_or_dcomp_active(sgsn)) {
-
-		expnd = talloc_zero_size(msg, npdu_len * MAX_DATADECOMPR_FAC +
-					 MAX_HDRDECOMPR_INCR);
-		memcpy(expnd, npdu, npdu_len);
-
-		/* Apply data decompression */
-		rc = gprs_sndcp_dcomp_expand(expnd, npdu_len, sne->defrag.dcomp,
-					     sne->defrag.data);
-		if (rc < 0) {
-			LOGP(DSNDCP, LOGL_ERROR,
-			     "Data decompression failed!\n");
-			talloc_free(expnd);
-			return -EIO;
-		}
-
-		/* Apply header decompression */
-		rc = gprs_sndcp_pcomp_expand(expnd, rc, sne->defrag.pcomp,
-					     sne->defrag.proto);
-		if (rc < 0) {
-			LOGP(DSNDCP, LOGL_ERROR,
-			     "TCP/IP Header decompression failed!\n");
-			talloc_free(expnd);
-			return -EIO;
-		}
-
-		/* Modify npu length, expnd is handed directly handed
-		 * over to gsn_rx_sndcp_ud_ind(), see below */
-		npdu_len = rc;
-	} else
-		expnd = npdu;
+	rc = sndcp_expand(sne, npdu, npdu_len, &expnd);
+	if (rc < 0) {
+		rc = -EIO;
+		goto out;
+	}
+	npdu_len = rc;
 #if DEBUG_IP_PACKETS == 1
 	debug_ip_packet(expnd, npdu_len, 1, "defrag_segments()");
 	DEBUGP(DSNDCP, "===================================================\n");
@@ -364,11 +353,12 @@ static int defrag_segments(struct gprs_sndcp_entity *sne)
 
 	/* Hand off packet to gtp */
 	rc = sgsn_rx_sndcp_ud_ind(&sne->ra_id, sne->lle->llme->tlli,
-				  sne->nsapi, msg, npdu_len, expnd);
-
-	if (any_pcomp_or_dcomp_active(sgsn))
-		talloc_free(expnd);
+				  sne->nsapi, llc_msg, npdu_len, expnd);
 
+out:
+	/* gtp_data_req() has copied the N-PDU */
+	if (msg)
+		msgb_free(msg);
 	return rc;
 }
 
@@ -398,23 +388,17 @@ static int defrag_input(struct gprs_sndcp_entity *sne, struct msgb *msg,
 	if (sch->first) {
 		/* first segment of a new packet.  Discard all leftover fragments of
 		 * previous packet */
-		if (!llist_empty(&sne->defrag.frag_list)) {
-			struct defrag_queue_entry *dqe, *dqe2;
+		if (sne->defrag.seg_have) {
 			LOGP(DSNDCP, LOGL_INFO, "TLLI=0x%08x NSAPI=%u: Dropping "
 			     "SN-PDU %u due to insufficient segments (%04x)\n",
 			     sne->lle->llme->tlli, sne->nsapi, sne->defrag.npdu,
 			     sne->defrag.seg_have);
-			llist_for_each_entry_safe(dqe, dqe2, &sne->defrag.frag_list, list) {
-				llist_del(&dqe->list);
-				talloc_free(dqe);
-			}
 		}
 		/* store the currently de-fragmented PDU number */
 		sne->defrag.npdu = npdu_num;
 
 		/* Re-set fragmentation state */
-		sne->defrag.no_more = sne->defrag.highest_seg = sne->defrag.seg_have = 0;
-		sne->defrag.tot_len = 0;
+		defrag_reset(sne);
 		/* FIXME: (re)start timer */
 	}
 
@@ -424,7 +408,6 @@ static int defrag_input(struct gprs_sndcp_entity *sne, struct msgb *msg,
 		/* FIXME */
 	}
 
-	/* FIXME: check if seg_nr already exists */
 	/* make sure to subtract length of SNDCP header from 'len' */
 	rc = defrag_enqueue(sne, suh->seg_nr, data, len - (data - hdr));
 	if (rc < 0)
@@ -440,7 +423,7 @@ static int defrag_input(struct gprs_sndcp_entity *sne, struct msgb *msg,
 		/* we have already received the last segment before, let's check
 		 * if all the previous segments exist */
 		if (defrag_have_all_segments(sne))
-			return defrag_segments(sne);
+			return defrag_segments(sne, msg);
 	}
 
 	return 0;
@@ -472,7 +455,7 @@ static struct gprs_sndcp_entity *gprs_sndcp_entity_alloc(struct gprs_llc_lle *ll
 	sne->defrag.timer.data = sne;
 	//sne->fqueue.timer.cb = FIXME;
 	sne->rx_state = SNDCP_RX_S_FIRST;
-	INIT_LLIST_HEAD(&sne->defrag.frag_list);
+	defrag_reset(sne);
 
 	llist_add(&sne->list, &gprs_sndcp_entities);
 
@@ -516,8 +499,8 @@ int sndcp_sm_deactivate_ind(struct gprs_llc_lle *lle, uint8_t nsapi)
 		return -ENOENT;
 	}
 	llist_del(&sne->list);
-	/* frag queue entries are hierarchically allocated, so no need to
-	 * free them explicitly here */
+	/* the reassembly buffer is hierarchically allocated, so no need to
+	 * free it explicitly here */
 	talloc_free(sne);
 
 	return 0;
@@ -808,37 +791,10 @@ int sndcp_llunitdata_ind(struct msgb *msg, struct gprs_llc_lle *lle,
 	DEBUGP(DSNDCP, ":::::::::::::::::::::::::::::::::::::::::::::::::::\n");
 	DEBUGP(DSNDCP, "===================================================\n");
 #endif
-	if (any_pcomp_or_dcomp_active(sgsn)) {
-
-		expnd = talloc_zero_size(msg, npdu_len * MAX_DATADECOMPR_FAC +
-					 MAX_HDRDECOMPR_INCR);
-		memcpy(expnd, npdu, npdu_len);
-
-		/* Apply data decompression */
-		rc = gprs_sndcp_dcomp_expand(expnd, npdu_len, sne->defrag.dcomp,
-					     sne->defrag.data);
-		if (rc < 0) {
-			LOGP(DSNDCP, LOGL_ERROR,
-			     "Data decompression failed!\n");
-			talloc_free(expnd);
-			return -EIO;
-		}
-
-		/* Apply header decompression */
-		rc = gprs_sndcp_pcomp_expand(expnd, rc, sne->defrag.pcomp,
-					     sne->defrag.proto);
-		if (rc < 0) {
-			LOGP(DSNDCP, LOGL_ERROR,
-			     "TCP/IP Header decompression failed!\n");
-			talloc_free(expnd);
-			return -EIO;
-		}
-
-		/* Modify npu length, expnd is handed directly handed
-		 * over to gsn_rx_sndcp_ud_ind(), see below */
-		npdu_len = rc;
-	} else
-		expnd = npdu;
+	rc = sndcp_expand(sne, npdu, npdu_len, &expnd);
+	if (rc < 0)
+		return -EIO;
+	npdu_len = rc;
 #if DEBUG_IP_PACKETS == 1
 	debug_ip_packet(expnd, npdu_len, 1, "sndcp_llunitdata_ind()");
 	DEBUGP(DSNDCP, "===================================================\n");
@@ -850,9 +806,6 @@ int sndcp_llunitdata_ind(struct msgb *msg, struct gprs_llc_lle *lle,
 	rc = sgsn_rx_sndcp_ud_ind(&sne->ra_id, lle->llme->tlli,
 				  sne->nsapi, msg, npdu_len, expnd);
 
-	if (any_pcomp_or_dcomp_active(sgsn))
-		talloc_free(expnd);
-
 	return rc;
 }
 
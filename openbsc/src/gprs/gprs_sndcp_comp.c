@@ -45,6 +45,13 @@ static struct gprs_sndcp_comp *gprs_sndcp_comp_create(const void *ctx,
 	struct gprs_sndcp_comp *comp_entity;
 	comp_entity = talloc_zero(ctx, struct gprs_sndcp_comp);
 
+	/* The algorithms work in this buffer, instead of allocating one for
+	 * every packet */
+	comp_entity->scratch = talloc_zero_size(comp_entity,
+						SNDCP_COMP_SCRATCH_LEN);
+	OSMO_ASSERT(comp_entity->scratch);
+	comp_entity->scratch_len = SNDCP_COMP_SCRATCH_LEN;
+
 	/* Copy relevant information from the SNDCP-XID field */
 	comp_entity->entity = comp_field->entity;
 	comp_entity->comp_len = comp_field->comp_len;
@@ -320,3 +327,46 @@ uint8_t gprs_sndcp_comp_get_comp(const struct gprs_sndcp_comp *comp_entity,
 	 * note in gprs_sndcp_comp_get_idx() */
 	return comp_entity->comp[comp_index - 1];
 }
+
+/* Expand a received N-PDU, first the data, then the header compression.
+ * The result is written to *buf, which is allocated from ctx the first
+ * time and then reused, so expanding does not allocate per N-PDU */
+int gprs_sndcp_comp_expand(const void *ctx, uint8_t **buf,
+			   const uint8_t *npdu, unsigned int len,
+			   uint8_t pcomp, uint8_t dcomp,
+			   const struct llist_head *proto_entities,
+			   const struct llist_head *data_entities)
+{
+	int rc;
+
+	/* The sender does not compress longer N-PDUs */
+	if (len > SNDCP_COMP_SCRATCH_LEN) {
+		LOGP(DSNDCP, LOGL_ERROR,
+		     "Compressed N-PDU too long (%u), dropping...\n", len);
+		return -EINVAL;
+	}
+
+	if (!*buf) {
+		*buf = talloc_size(ctx, SNDCP_EXPND_BUF_LEN);
+		if (!*buf)
+			return -ENOMEM;
+	}
+	memcpy(*buf, npdu, len);
+
+	/* Apply data decompression */
+	rc = gprs_sndcp_dcomp_expand(*buf, len, dcomp, data_entities);
+	if (rc < 0) {
+		LOGP(DSNDCP, LOGL_ERROR, "Data decompression failed!\n");
+		return -EIO;
+	}
+
+	/* Apply header decompression */
+	rc = gprs_sndcp_pcomp_expand(*buf, rc, pcomp, proto_entities);
+	if (rc < 0) {
+		LOGP(DSNDCP, LOGL_ERROR,
+		     "TCP/IP Header decompression failed!\n");
+		return -EIO;
+	}
+
+	return rc;
+}
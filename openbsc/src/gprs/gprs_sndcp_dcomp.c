@@ -47,28 +47,35 @@ struct v42bis_output_buffer {
 	uint8_t *buf;
 	uint8_t *buf_pointer;
 	int len;
+	int buf_len;		/* Capacity of buf */
+	bool overflow;		/* Output did not fit into buf */
 };
 
-/* Handler to capture the output data from the compressor */
-void tx_v42bis_frame_handler(void *user_data, const uint8_t *pkt, int len)
+static void v42bis_output_append(struct v42bis_output_buffer *output_buffer,
+				 const uint8_t *data, int len)
 {
-	struct v42bis_output_buffer *output_buffer =
-	    (struct v42bis_output_buffer *)user_data;
-	memcpy(output_buffer->buf_pointer, pkt, len);
+	if (output_buffer->overflow
+	    || len > output_buffer->buf_len - output_buffer->len) {
+		output_buffer->overflow = true;
+		return;
+	}
+	memcpy(output_buffer->buf_pointer, data, len);
 	output_buffer->buf_pointer += len;
 	output_buffer->len += len;
-	return;
+}
+
+/* Handler to capture the output data from the compressor */
+void tx_v42bis_frame_handler(void *user_data, const uint8_t *pkt, int len)
+{
+	v42bis_output_append((struct v42bis_output_buffer *)user_data, pkt,
+			     len);
 }
 
 /* Handler to capture the output data from the decompressor */
 void rx_v42bis_data_handler(void *user_data, const uint8_t *buf, int len)
 {
-	struct v42bis_output_buffer *output_buffer =
-	    (struct v42bis_output_buffer *)user_data;
-	memcpy(output_buffer->buf_pointer, buf, len);
-	output_buffer->buf_pointer += len;
-	output_buffer->len += len;
-	return;
+	v42bis_output_append((struct v42bis_output_buffer *)user_data, buf,
+			     len);
 }
 
 /* Initalize data compression */
@@ -152,12 +159,13 @@ static void v42bis_reset(v42bis_state_t *comp)
 
 /* Compress a packet using V.42bis data compression */
 static int v42bis_compress_unitdata(uint8_t *pcomp_index, uint8_t *data,
-				    unsigned int len, v42bis_state_t *comp)
+				    unsigned int len,
+				    struct gprs_sndcp_comp *comp_entity)
 {
 	/* Note: This implementation may only be used to compress SN_UNITDATA
 	 * packets, since it resets the compression state for each NPDU. */
 
-	uint8_t *data_o;
+	v42bis_state_t *comp = comp_entity->state;
 	int rc;
 	int skip = 0;
 	struct v42bis_output_buffer compressed_data;
@@ -166,6 +174,10 @@ static int v42bis_compress_unitdata(uint8_t *pcomp_index, uint8_t *data,
 	if (len < MIN_COMPR_PAYLOAD)
 		skip = 1;
 
+	/* Packets that exceed the working buffer are sent uncompressed */
+	if (len > comp_entity->scratch_len)
+		skip = 1;
+
 	/* Skip if compression is not enabled for TX direction */
 	if (!comp->compress.v42bis_parm_p0)
 		skip = 1;
@@ -179,11 +191,13 @@ static int v42bis_compress_unitdata(uint8_t *pcomp_index, uint8_t *data,
 	/* Reset V.42bis compression state */
 	v42bis_reset(comp);
 
-	/* Run compressor */
-	data_o = talloc_zero_size(comp, len * MAX_DATADECOMPR_FAC);
-	compressed_data.buf = data_o;
-	compressed_data.buf_pointer = data_o;
+	/* Run compressor, the output must not exceed the input length to be
+	 * of any use, so the working buffer is large enough */
+	compressed_data.buf = comp_entity->scratch;
+	compressed_data.buf_pointer = comp_entity->scratch;
 	compressed_data.len = 0;
+	compressed_data.buf_len = len;
+	compressed_data.overflow = false;
 	comp->compress.user_data = (&compressed_data);
 	rc = v42bis_compress(comp, data, len);
 	if (rc < 0) {
@@ -201,7 +215,7 @@ static int v42bis_compress_unitdata(uint8_t *pcomp_index, uint8_t *data,
 	/* The compressor might yield negative compression gain, in
 	 * this case, we just decide to send the packat as normal,
 	 * uncompressed payload => skip compresssion */
-	if (compressed_data.len >= len) {
+	if (compressed_data.overflow || compressed_data.len >= len) {
 		LOGP(DSNDCP, LOGL_ERROR,
 		     "Data compression ineffective, skipping...\n");
 		skip = 1;
@@ -210,50 +224,61 @@ static int v42bis_compress_unitdata(uint8_t *pcomp_index, uint8_t *data,
 	/* Skip compression */
 	if (skip) {
 		*pcomp_index = 0;
-		talloc_free(data_o);
 		return len;
 	}
 
 	*pcomp_index = 1;
-	memcpy(data, data_o, compressed_data.len);
-	talloc_free(data_o);
+	memcpy(data, comp_entity->scratch, compressed_data.len);
 
 	return compressed_data.len;
 }
 
 /* Expand a packet using V.42bis data compression */
 static int v42bis_expand_unitdata(uint8_t *data, unsigned int len,
-				  uint8_t pcomp_index, v42bis_state_t *comp)
+				  uint8_t pcomp_index,
+				  struct gprs_sndcp_comp *comp_entity)
 {
 	/* Note: This implementation may only be used to compress SN_UNITDATA
 	 * packets, since it resets the compression state for each NPDU. */
 
+	v42bis_state_t *comp = comp_entity->state;
 	int rc;
 	struct v42bis_output_buffer uncompressed_data;
-	uint8_t *data_i;
 
 	/* Skip when the packet is marked as uncompressed */
 	if (pcomp_index == 0) {
 		return len;
 	}
 
+	if (len > comp_entity->scratch_len) {
+		LOGP(DSNDCP, LOGL_ERROR,
+		     "Compressed packet too long (%u), dropping...\n", len);
+		return -EINVAL;
+	}
+
 	/* Reset V.42bis compression state */
 	v42bis_reset(comp);
 
-	/* Decompress packet */
-	data_i = talloc_zero_size(comp, len);
-	memcpy(data_i, data, len);
+	/* Decompress packet, the output replaces the input in data, so move
+	 * the input out of the way first. */
+	memcpy(comp_entity->scratch, data, len);
 	uncompressed_data.buf = data;
 	uncompressed_data.buf_pointer = data;
 	uncompressed_data.len = 0;
+	uncompressed_data.buf_len = len * MAX_DATADECOMPR_FAC;
+	uncompressed_data.overflow = false;
 	comp->decompress.user_data = (&uncompressed_data);
-	rc = v42bis_decompress(comp, data_i, len);
-	talloc_free(data_i);
+	rc = v42bis_decompress(comp, comp_entity->scratch, len);
 	if (rc < 0)
 		return -EINVAL;
 	rc = v42bis_decompress_flush(comp);
 	if (rc < 0)
 		return -EINVAL;
+	if (uncompressed_data.overflow) {
+		LOGP(DSNDCP, LOGL_ERROR,
+		     "Data decompression exceeds the buffer, dropping...\n");
+		return -EINVAL;
+	}
 
 	return uncompressed_data.len;
 }
@@ -299,7 +324,7 @@ int gprs_sndcp_dcomp_expand(uint8_t *data, unsigned int len, uint8_t pcomp,
 	pcomp_index = gprs_sndcp_comp_get_idx(comp_entity, pcomp);
 
 	/* Run decompression algo */
-	rc = v42bis_expand_unitdata(data, len, pcomp_index, comp_entity->state);
+	rc = v42bis_expand_unitdata(data, len, pcomp_index, comp_entity);
 
 	LOGP(DSNDCP, LOGL_DEBUG,
 	     "Data expansion done, old length=%d, new length=%d, entity=%p\n",
@@ -342,8 +367,7 @@ int gprs_sndcp_dcomp_compress(uint8_t *data, unsigned int len, uint8_t *pcomp,
 	OSMO_ASSERT(comp_entity->algo == V42BIS);
 
 	/* Run compression algo */
-	rc = v42bis_compress_unitdata(&pcomp_index, data, len,
-				      comp_entity->state);
+	rc = v42bis_compress_unitdata(&pcomp_index, data, len, comp_entity);
 
 	/* Find pcomp value */
 	*pcomp = gprs_sndcp_comp_get_comp(comp_entity, pcomp_index);
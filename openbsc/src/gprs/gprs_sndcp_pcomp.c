@@ -97,18 +97,27 @@ void gprs_sndcp_pcomp_term(struct gprs_sndcp_comp *comp_entity)
 
 /* Compress a packet using Van Jacobson RFC1144 header compression */
 static int rfc1144_compress(uint8_t *pcomp_index, uint8_t *data,
-			    unsigned int len, struct slcompress *comp)
+			    unsigned int len,
+			    struct gprs_sndcp_comp *comp_entity)
 {
-	uint8_t *comp_ptr;
+	uint8_t *comp_ptr = NULL;
+	uint8_t *data_o = comp_entity->scratch;
 	int compr_len;
-	uint8_t *data_o;
 
-	/* Create a working copy of the incoming data */
-	data_o = talloc_zero_size(comp, len);
-	memcpy(data_o, data, len);
+	/* Packets that exceed the working buffer are sent uncompressed */
+	if (len > comp_entity->scratch_len) {
+		*pcomp_index = 0;
+		return len;
+	}
 
-	/* Run compressor */
-	compr_len = slhc_compress(comp, data, len, data_o, &comp_ptr, 0);
+	/* Run compressor, which writes to the working buffer only if it
+	 * changes the packet, and points comp_ptr there in that case */
+	compr_len = slhc_compress(comp_entity->state, data, len, data_o,
+				  &comp_ptr, 0);
+	if (!comp_ptr) {
+		*pcomp_index = 0;
+		return compr_len;
+	}
 
 	/* Generate pcomp_index */
 	if (data_o[0] & SL_TYPE_COMPRESSED_TCP) {
@@ -123,7 +132,6 @@ static int rfc1144_compress(uint8_t *pcomp_index, uint8_t *data,
 	} else
 		*pcomp_index = 0;
 
-	talloc_free(data_o);
 	return compr_len;
 }
 
@@ -266,7 +274,7 @@ int gprs_sndcp_pcomp_compress(uint8_t *data, unsigned int len, uint8_t *pcomp,
 	OSMO_ASSERT(comp_entity->algo == RFC_1144);
 
 	/* Run compression algo */
-	rc = rfc1144_compress(&pcomp_index, data, len, comp_entity->state);
+	rc = rfc1144_compress(&pcomp_index, data, len, comp_entity);
 	slhc_i_status(comp_entity->state);
 	slhc_o_status(comp_entity->state);
 
@@ -56,6 +56,7 @@ static int gsup_read_cb(struct gsup_client *gsupc, struct msgb *msg);
 int gprs_subscr_init(struct sgsn_instance *sgi)
 {
 	const char *addr_str;
+	unsigned int i, j;
 
 	if (!sgi->cfg.gsup_server_addr.sin_addr.s_addr)
 		return 0;
@@ -70,6 +71,24 @@ int gprs_subscr_init(struct sgsn_instance *sgi)
 	if (!sgi->gsup_client)
 		return -1;
 
+	if (sgi->cfg.gsup_max_inflight)
+		sgi->gsup_client->max_inflight = sgi->cfg.gsup_max_inflight;
+	if (sgi->cfg.gsup_req_timeout)
+		sgi->gsup_client->req_timeout = sgi->cfg.gsup_req_timeout;
+
+	for (i = 1; i < sgi->cfg.gsup_connections; i++)
+		gsup_client_add_conn(sgi->gsup_client, addr_str,
+				     sgi->cfg.gsup_server_port);
+
+	for (i = 0; i < sgi->cfg.gsup_extra_servers.num; i++) {
+		struct sockaddr_in *sin = &sgi->cfg.gsup_extra_servers.addr[i];
+
+		addr_str = inet_ntoa(sin->sin_addr);
+		for (j = 0; j < sgi->cfg.gsup_connections; j++)
+			gsup_client_add_conn(sgi->gsup_client, addr_str,
+					     ntohs(sin->sin_port));
+	}
+
 	return 1;
 }
 
@@ -87,12 +106,23 @@ static int gsup_read_cb(struct gsup_client *gsupc, struct msgb *msg)
 
 int gprs_subscr_purge(struct gsm_subscriber *subscr);
 
-static struct sgsn_subscriber_data *sgsn_subscriber_data_alloc(void *ctx)
+static int sgsn_subscriber_data_free(struct sgsn_subscriber_data *sdata)
+{
+	sgsn_auth_prefetch_release(sdata);
+	return 0;
+}
+
+static struct sgsn_subscriber_data *sgsn_subscriber_data_alloc(
+	struct gsm_subscriber *subscr)
 {
 	struct sgsn_subscriber_data *sdata;
 	int idx;
 
-	sdata = talloc_zero(ctx, struct sgsn_subscriber_data);
+	sdata = talloc_zero(subscr, struct sgsn_subscriber_data);
+	sdata->subscr = subscr;
+	INIT_LLIST_HEAD(&sdata->prefetch_entry);
+	INIT_LLIST_HEAD(&sdata->spare_entry);
+	talloc_set_destructor(sdata, sgsn_subscriber_data_free);
 
 	sdata->error_cause = SGSN_ERROR_CAUSE_NONE;
 
@@ -203,6 +233,14 @@ static int gprs_subscr_handle_gsup_auth_res(struct gsm_subscriber *subscr,
 		"Got SendAuthenticationInfoResult, num_auth_vectors = %zu\n",
 		gsup_msg->num_auth_vectors);
 
+	/* An answer to a background refill, nobody is waiting for it */
+	if (sdata->prefetch_state == SGSN_AUTH_PREFETCH_PENDING &&
+	    !(subscr->flags & GPRS_SUBSCRIBER_UPDATE_AUTH_INFO_PENDING)) {
+		sgsn_auth_prefetch_done(subscr, gsup_msg->auth_vectors,
+					gsup_msg->num_auth_vectors);
+		return 0;
+	}
+
 	if (gsup_msg->num_auth_vectors > 0) {
 		memset(sdata->auth_triplets, 0, sizeof(sdata->auth_triplets));
 
@@ -400,6 +438,14 @@ static int gprs_subscr_handle_gsup_auth_err(struct gsm_subscriber *subscr,
 		"handled as: %s\n",
 		gsup_msg->cause, strerror(cause_err));
 
+	/* A failed background refill does not change the authorization,
+	 * the tuples will be requested again once they are needed */
+	if (sdata->prefetch_state == SGSN_AUTH_PREFETCH_PENDING &&
+	    !(subscr->flags & GPRS_SUBSCRIBER_UPDATE_AUTH_INFO_PENDING)) {
+		sgsn_auth_prefetch_done(subscr, NULL, 0);
+		return -gsup_msg->cause;
+	}
+
 	switch (cause_err) {
 	case EACCES:
 		LOGGSUBSCRP(LOGL_NOTICE, subscr,
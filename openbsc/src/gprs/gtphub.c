@@ -19,6 +19,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <inttypes.h>
@@ -618,6 +619,25 @@ void expiry_add(struct expiry *exq, struct expiring_item *item, time_t now)
 	llist_add_tail(&item->entry, &exq->items);
 }
 
+void expiry_add_at(struct expiry *exq, struct expiring_item *item,
+		   time_t expiry)
+{
+	struct llist_head *pos;
+
+	item->expiry = expiry;
+	llist_del(&item->entry);
+
+	/* Keep the queue sorted. Walk from the tail, where items with the
+	 * latest expiry are, so that adding in ascending order stays cheap. */
+	for (pos = exq->items.prev; pos != &exq->items; pos = pos->prev) {
+		struct expiring_item *i = llist_entry(pos, struct expiring_item,
+						      entry);
+		if (i->expiry <= expiry)
+			break;
+	}
+	llist_add(&item->entry, pos);
+}
+
 int expiry_tick(struct expiry *exq, time_t now)
 {
 	int expired = 0;
@@ -685,6 +705,37 @@ nr_t nr_pool_next(struct nr_pool *pool)
 	return pool->last_nr;
 }
 
+static unsigned int gtphub_hash_u32(uint32_t value, unsigned int bits)
+{
+	/* Fibonacci hashing, mixes low bits into the upper ones kept */
+	return (value * 2654435761U) >> (32 - bits);
+}
+
+static unsigned int nr_map_hash(const struct nr_map *map, void *origin,
+				nr_t nr)
+{
+	return gtphub_hash_u32((uint32_t)(uintptr_t)origin ^ (uint32_t)nr,
+			       map->hash_bits);
+}
+
+static struct llist_head *gtphub_hash_alloc(unsigned int bits)
+{
+	struct llist_head *heads;
+	unsigned int i;
+
+	heads = talloc_array(osmo_gtphub_ctx, struct llist_head, 1 << bits);
+	OSMO_ASSERT(heads);
+	for (i = 0; i < (1 << bits); i++)
+		INIT_LLIST_HEAD(&heads[i]);
+	return heads;
+}
+
+/* Whether a table of 2^bits chains should grow to hold count entries. */
+static int gtphub_hash_full(unsigned int count, unsigned int bits)
+{
+	return bits < NR_MAP_HASH_BITS_MAX && count > (1U << bits);
+}
+
 void nr_map_init(struct nr_map *map, struct nr_pool *pool,
 		 struct expiry *exq)
 {
@@ -698,17 +749,82 @@ void nr_mapping_init(struct nr_mapping *m)
 {
 	ZERO_STRUCT(m);
 	INIT_LLIST_HEAD(&m->entry);
+	INIT_LLIST_HEAD(&m->hash_entry);
+	INIT_LLIST_HEAD(&m->inv_hash_entry);
 	expiring_item_init(&m->expiry_entry);
 }
 
-void nr_map_add(struct nr_map *map, struct nr_mapping *mapping, time_t now)
+/* Remove the mapping from its map, without touching the expiry queue. */
+static void nr_mapping_unlink(struct nr_mapping *m)
 {
-	/* Generate a mapped number */
-	mapping->repl = nr_pool_next(map->pool);
+	struct nr_map *map = m->map;
 
+	llist_del(&m->entry);
+	INIT_LLIST_HEAD(&m->entry); /* mark unused */
+	llist_del(&m->hash_entry);
+	INIT_LLIST_HEAD(&m->hash_entry);
+	llist_del(&m->inv_hash_entry);
+	INIT_LLIST_HEAD(&m->inv_hash_entry);
+	m->map = NULL;
+
+	if (!map || --map->count)
+		return;
+
+	talloc_free(map->hash);
+	talloc_free(map->inv_hash);
+	map->hash = NULL;
+	map->inv_hash = NULL;
+	map->hash_bits = 0;
+}
+
+/* Move all mappings to new hash tables of 2^bits chains. The chronological
+ * list is walked, so each chain stays sorted by age. */
+static void nr_map_rehash(struct nr_map *map, unsigned int bits)
+{
+	struct nr_mapping *m;
+
+	talloc_free(map->hash);
+	talloc_free(map->inv_hash);
+	map->hash = gtphub_hash_alloc(bits);
+	map->inv_hash = gtphub_hash_alloc(bits);
+	map->hash_bits = bits;
+
+	llist_for_each_entry(m, &map->mappings, entry) {
+		llist_add_tail(&m->hash_entry,
+			       &map->hash[nr_map_hash(map, m->origin, m->orig)]);
+		llist_add_tail(&m->inv_hash_entry,
+			       &map->inv_hash[nr_map_hash(map, NULL, m->repl)]);
+	}
+}
+
+/* Add mapping to map's list and hash chains, mapping->repl must be set. */
+static void nr_map_insert(struct nr_map *map, struct nr_mapping *mapping)
+{
+	map->count ++;
+	if (!map->hash_bits)
+		nr_map_rehash(map, NR_MAP_HASH_BITS_MIN);
+	else if (gtphub_hash_full(map->count, map->hash_bits))
+		nr_map_rehash(map, map->hash_bits + 1);
+
+	mapping->map = map;
 	/* Add to the tail to always yield a list sorted by expiry, in
 	 * ascending order. */
 	llist_add_tail(&mapping->entry, &map->mappings);
+	/* Also add to the tail of the hash chains, so that the oldest of
+	 * several matching mappings is found first, as in the list. */
+	llist_add_tail(&mapping->hash_entry,
+		       &map->hash[nr_map_hash(map, mapping->origin,
+					      mapping->orig)]);
+	llist_add_tail(&mapping->inv_hash_entry,
+		       &map->inv_hash[nr_map_hash(map, NULL, mapping->repl)]);
+}
+
+void nr_map_add(struct nr_map *map, struct nr_mapping *mapping, time_t now)
+{
+	/* Generate a mapped number */
+	mapping->repl = nr_pool_next(map->pool);
+
+	nr_map_insert(map, mapping);
 	nr_map_refresh(map, mapping, now);
 }
 
@@ -739,7 +855,11 @@ struct nr_mapping *nr_map_get(const struct nr_map *map,
 			      void *origin, nr_t nr_orig)
 {
 	struct nr_mapping *mapping;
-	llist_for_each_entry(mapping, &map->mappings, entry) {
+	if (!map->hash)
+		return NULL;
+	llist_for_each_entry(mapping,
+			     &map->hash[nr_map_hash(map, origin, nr_orig)],
+			     hash_entry) {
 		if ((mapping->origin == origin)
 		    && (mapping->orig == nr_orig))
 			return mapping;
@@ -751,7 +871,11 @@ struct nr_mapping *nr_map_get(const struct nr_map *map,
 struct nr_mapping *nr_map_get_inv(const struct nr_map *map, nr_t nr_repl)
 {
 	struct nr_mapping *mapping;
-	llist_for_each_entry(mapping, &map->mappings, entry) {
+	if (!map->inv_hash)
+		return NULL;
+	llist_for_each_entry(mapping,
+			     &map->inv_hash[nr_map_hash(map, NULL, nr_repl)],
+			     inv_hash_entry) {
 		if (mapping->repl == nr_repl) {
 			return mapping;
 		}
@@ -763,8 +887,7 @@ struct nr_mapping *nr_map_get_inv(const struct nr_map *map, nr_t nr_repl)
 void nr_mapping_del(struct nr_mapping *mapping)
 {
 	OSMO_ASSERT(mapping);
-	llist_del(&mapping->entry);
-	INIT_LLIST_HEAD(&mapping->entry);
+	nr_mapping_unlink(mapping);
 	expiring_item_del(&mapping->expiry_entry);
 }
 
@@ -1078,6 +1201,129 @@ int gtphub_tunnel_complete(struct gtphub_tunnel *tun)
 	return 1;
 }
 
+static unsigned int gtphub_tei_hash(struct gtphub *hub, uint32_t tei)
+{
+	/* tei_repl is handed out sequentially, keep the low bits */
+	return tei & ((1 << hub->tunnels_hash_bits) - 1);
+}
+
+static unsigned int gtphub_tei_orig_hash(struct gtphub *hub, int side_idx,
+					 int plane_idx, uint32_t tei_orig)
+{
+	return gtphub_hash_u32(tei_orig ^ (side_idx << 1 | plane_idx),
+			       hub->tunnels_hash_bits);
+}
+
+/* Add the tunnel to the hub's hash tables. */
+static void gtphub_tunnel_hash(struct gtphub *hub, struct gtphub_tunnel *tun)
+{
+	int side_idx, plane_idx;
+
+	llist_add_tail(&tun->tei_entry,
+		       &hub->tunnels_by_tei[gtphub_tei_hash(hub, tun->tei_repl)]);
+
+	for_each_side_and_plane(side_idx, plane_idx) {
+		struct gtphub_tunnel_endpoint *te =
+			&tun->endpoint[side_idx][plane_idx];
+		if (!te->tei_orig) {
+			INIT_LLIST_HEAD(&te->tei_orig_entry);
+			continue;
+		}
+		llist_add_tail(&te->tei_orig_entry,
+			       &hub->tunnels_by_tei_orig[
+					gtphub_tei_orig_hash(hub, side_idx,
+							     plane_idx,
+							     te->tei_orig)]);
+	}
+}
+
+/* Move all tunnels to new hash tables of 2^bits chains. */
+static void gtphub_tunnels_rehash(struct gtphub *hub, unsigned int bits)
+{
+	struct gtphub_tunnel *tun;
+
+	talloc_free(hub->tunnels_by_tei);
+	talloc_free(hub->tunnels_by_tei_orig);
+	hub->tunnels_by_tei = gtphub_hash_alloc(bits);
+	hub->tunnels_by_tei_orig = gtphub_hash_alloc(bits);
+	hub->tunnels_hash_bits = bits;
+
+	llist_for_each_entry(tun, &hub->tunnels, entry) {
+		if (tun->hub)
+			gtphub_tunnel_hash(hub, tun);
+	}
+}
+
+static void gtphub_tunnel_unhash(struct gtphub_tunnel *tun)
+{
+	int side_idx, plane_idx;
+
+	llist_del(&tun->tei_entry);
+	INIT_LLIST_HEAD(&tun->tei_entry);
+	for_each_side_and_plane(side_idx, plane_idx) {
+		struct gtphub_tunnel_endpoint *te =
+			&tun->endpoint[side_idx][plane_idx];
+		llist_del(&te->tei_orig_entry);
+		INIT_LLIST_HEAD(&te->tei_orig_entry);
+	}
+}
+
+/* (Re-)Add the tunnel to the TEI indexes, after tun->tei_repl or one of the
+ * endpoints' tei_orig was set. */
+static void gtphub_tunnel_index(struct gtphub *hub,
+				struct gtphub_tunnel *tun)
+{
+	if (!tun->hub) {
+		tun->hub = hub;
+		hub->tunnels_count ++;
+		if (!hub->tunnels_hash_bits)
+			gtphub_tunnels_rehash(hub, NR_MAP_HASH_BITS_MIN);
+		else if (gtphub_hash_full(hub->tunnels_count,
+					  hub->tunnels_hash_bits))
+			gtphub_tunnels_rehash(hub, hub->tunnels_hash_bits + 1);
+	}
+
+	gtphub_tunnel_unhash(tun);
+	gtphub_tunnel_hash(hub, tun);
+}
+
+/* Remove the tunnel from the TEI indexes of its hub. */
+static void gtphub_tunnel_unindex(struct gtphub_tunnel *tun)
+{
+	struct gtphub *hub = tun->hub;
+
+	gtphub_tunnel_unhash(tun);
+	tun->hub = NULL;
+
+	if (!hub || --hub->tunnels_count)
+		return;
+
+	talloc_free(hub->tunnels_by_tei);
+	talloc_free(hub->tunnels_by_tei_orig);
+	hub->tunnels_by_tei = NULL;
+	hub->tunnels_by_tei_orig = NULL;
+	hub->tunnels_hash_bits = 0;
+}
+
+/* Return the tunnel other than except that uses tei_repl, if any. */
+static struct gtphub_tunnel *gtphub_tunnel_by_tei(struct gtphub *hub,
+						  uint32_t tei_repl,
+						  struct gtphub_tunnel *except)
+{
+	struct gtphub_tunnel *tun;
+
+	if (!hub->tunnels_by_tei)
+		return NULL;
+
+	llist_for_each_entry(tun,
+			     &hub->tunnels_by_tei[gtphub_tei_hash(hub, tei_repl)],
+			     tei_entry) {
+		if (tun != except && tun->tei_repl == tei_repl)
+			return tun;
+	}
+	return NULL;
+}
+
 static void gtphub_tunnel_del_cb(struct expiring_item *expi)
 {
 	struct gtphub_tunnel *tun = container_of(expi,
@@ -1087,6 +1333,7 @@ static void gtphub_tunnel_del_cb(struct expiring_item *expi)
 
 	llist_del(&tun->entry);
 	INIT_LLIST_HEAD(&tun->entry); /* mark unused */
+	gtphub_tunnel_unindex(tun);
 
 	expi->del_cb = 0; /* avoid recursion loops */
 	expiring_item_del(&tun->expiry_entry); /* usually already done, but make sure. */
@@ -1112,11 +1359,14 @@ static struct gtphub_tunnel *gtphub_tunnel_new()
 	OSMO_ASSERT(tun);
 
 	INIT_LLIST_HEAD(&tun->entry);
+	INIT_LLIST_HEAD(&tun->tei_entry);
 	expiring_item_init(&tun->expiry_entry);
 
 	int side_idx, plane_idx;
 	for_each_side_and_plane(side_idx, plane_idx) {
 		struct gtphub_tunnel_endpoint *te = &tun->endpoint[side_idx][plane_idx];
+		te->tun = tun;
+		INIT_LLIST_HEAD(&te->tei_orig_entry);
 		te->counters_io = rate_ctr_group_alloc(osmo_gtphub_ctx,
 						       &gtphub_ctrg_io_desc,
 						       0);
@@ -1177,8 +1427,7 @@ static void gtphub_mapping_del_cb(struct expiring_item *expi)
 	struct nr_mapping *nrm = container_of(expi,
 					      struct nr_mapping,
 					      expiry_entry);
-	llist_del(&nrm->entry);
-	INIT_LLIST_HEAD(&nrm->entry); /* mark unused */
+	nr_mapping_unlink(nrm);
 
 	/* Just for log */
 	struct gtphub_peer_port *from = nrm->origin;
@@ -1249,109 +1498,86 @@ static struct gtphub_peer_port *gtphub_unmap_seq(struct gtp_packet_desc *p,
 	return nrm->origin;
 }
 
-static int gtphub_check_mapped_tei(struct gtphub_tunnel *new_tun,
-				   struct gtphub_tunnel *iterated_tun,
-				   uint32_t *tei_min,
-				   uint32_t *tei_max)
+/* Return a tunnel other than new_tun whose endpoint on side_idx, plane_idx
+ * has the same peer address and TEI as new_tun's, if any. */
+static struct gtphub_tunnel *gtphub_tunnel_reusing_tei(
+	struct gtphub *hub, struct gtphub_tunnel *new_tun,
+	int side_idx, int plane_idx)
 {
-	if (!new_tun->tei_repl || !iterated_tun->tei_repl)
-		return 1;
-
-	*tei_min = (*tei_min < iterated_tun->tei_repl)? *tei_min : iterated_tun->tei_repl;
-	*tei_max = (*tei_max > iterated_tun->tei_repl)? *tei_max : iterated_tun->tei_repl;
-
-	if (new_tun->tei_repl != iterated_tun->tei_repl)
-		return 1;
+	struct gtphub_tunnel_endpoint *te;
+	struct gtphub_tunnel_endpoint *te2 =
+		&new_tun->endpoint[side_idx][plane_idx];
+	unsigned int h;
 
-	/* new_tun->tei_repl is already taken. Try to find one out of the known
-	 * range. */
-	LOG(LOGL_DEBUG, "TEI replacement %d already taken.\n", new_tun->tei_repl);
+	if (!te2->tei_orig || !te2->peer || !hub->tunnels_by_tei_orig)
+		return NULL;
 
-	if ((*tei_max) < 0xffffffff) {
-		(*tei_max)++;
-		new_tun->tei_repl = *tei_max;
-		LOG(LOGL_DEBUG, "Using TEI %d instead.\n", new_tun->tei_repl);
-		return 1;
-	} else if ((*tei_min) > 1) {
-		(*tei_min)--;
-		new_tun->tei_repl = *tei_min;
-		LOG(LOGL_DEBUG, "Using TEI %d instead.\n", new_tun->tei_repl);
-		return 1;
+	h = gtphub_tei_orig_hash(hub, side_idx, plane_idx, te2->tei_orig);
+	llist_for_each_entry(te, &hub->tunnels_by_tei_orig[h],
+			     tei_orig_entry) {
+		if (te->tun == new_tun
+		    || te != &te->tun->endpoint[side_idx][plane_idx]
+		    || te->tei_orig != te2->tei_orig
+		    || !te->peer
+		    || !gsn_addr_same(&te->peer->peer_addr->addr,
+				      &te2->peer->peer_addr->addr))
+			continue;
+		return te->tun;
 	}
-
-	/* None seems to be available. */
-	return 0;
+	return NULL;
 }
 
 static int gtphub_check_reused_teis(struct gtphub *hub,
 				    struct gtphub_tunnel *new_tun)
 {
-	uint32_t tei_min = 0xffffffff;
-	uint32_t tei_max = 0;
+	struct gtphub_tunnel *tun;
+	unsigned int tries;
 	int side_idx;
 	int plane_idx;
-	struct gtphub_tunnel_endpoint *te;
-	struct gtphub_tunnel_endpoint *te2;
-
-	struct gtphub_tunnel *tun, *ntun;
-
-	llist_for_each_entry_safe(tun, ntun, &hub->tunnels, entry) {
-		if (tun == new_tun)
-			continue;
 
+	for_each_side_and_plane(side_idx, plane_idx) {
 		/* Check whether the GSN sent a TEI that it is reusing from a
-		 * previous tunnel. */
-		int tun_continue = 0;
-		for_each_side(side_idx) {
-			for_each_plane(plane_idx) {
-				te = &tun->endpoint[side_idx][plane_idx];
-				te2 = &new_tun->endpoint[side_idx][plane_idx];
-				if ((te->tei_orig == 0)
-				    || (te->tei_orig != te2->tei_orig)
-				    || (!te->peer)
-				    || (!te2->peer)
-				    || !gsn_addr_same(&te->peer->peer_addr->addr,
-						      &te2->peer->peer_addr->addr))
-					continue;
-
-				/* The peer is reusing a TEI that I believe to
-				 * be part of another tunnel. The other tunnel
-				 * must be stale, then. */
-				LOG(LOGL_NOTICE,
-				    "Expiring tunnel due to reused TEI:"
-				    " %s peer %s sent %s TEI %x,"
-				    " previously used by tunnel %s...\n",
-				    gtphub_side_idx_names[side_idx],
-				    gtphub_port_str(te->peer),
-				    gtphub_plane_idx_names[plane_idx],
-				    te->tei_orig,
-				    gtphub_tunnel_str(tun));
-				LOG(LOGL_NOTICE, "...while establishing tunnel %s\n",
-				    gtphub_tunnel_str(new_tun));
-
-				expiring_item_del(&tun->expiry_entry);
-				/* continue to find more matches. There shouldn't be
-				 * any, but let's make sure. However, tun is deleted,
-				 * so we need to skip to the next tunnel. */
-				tun_continue = 1;
-				break;
-			}
-			if (tun_continue)
-				break;
+		 * previous tunnel. Expiring a tunnel unlinks its endpoints
+		 * from the chain, so look up again after each one. */
+		while ((tun = gtphub_tunnel_reusing_tei(hub, new_tun,
+							side_idx,
+							plane_idx))) {
+			struct gtphub_tunnel_endpoint *te =
+				&tun->endpoint[side_idx][plane_idx];
+
+			/* The peer is reusing a TEI that I believe to
+			 * be part of another tunnel. The other tunnel
+			 * must be stale, then. */
+			LOG(LOGL_NOTICE,
+			    "Expiring tunnel due to reused TEI:"
+			    " %s peer %s sent %s TEI %x,"
+			    " previously used by tunnel %s...\n",
+			    gtphub_side_idx_names[side_idx],
+			    gtphub_port_str(te->peer),
+			    gtphub_plane_idx_names[plane_idx],
+			    te->tei_orig,
+			    gtphub_tunnel_str(tun));
+			LOG(LOGL_NOTICE, "...while establishing tunnel %s\n",
+			    gtphub_tunnel_str(new_tun));
+
+			expiring_item_del(&tun->expiry_entry);
 		}
-		if (tun_continue)
-			continue;
+	}
 
-		/* Check whether the mapped TEI is already used by another
-		 * tunnel. */
-		if (!gtphub_check_mapped_tei(new_tun, tun, &tei_min, &tei_max)) {
+	/* Check whether the mapped TEI is already used by another tunnel.
+	 * The other tunnels hold less than tunnels_count numbers, so as many
+	 * numbers from the pool are enough to find an unused one. */
+	tries = hub->tunnels_count;
+	while (gtphub_tunnel_by_tei(hub, new_tun->tei_repl, new_tun)) {
+		LOG(LOGL_DEBUG, "TEI replacement %d already taken.\n",
+		    new_tun->tei_repl);
+		if (!tries--) {
 			LOG(LOGL_ERROR,
-			    "No mapped TEI is readily available."
-			    " Searching for holes between occupied"
-			    " TEIs not implemented.");
+			    "No mapped TEI is readily available.\n");
 			return 0;
 		}
-
+		new_tun->tei_repl = nr_pool_next(&hub->tei_pool);
+		LOG(LOGL_DEBUG, "Using TEI %d instead.\n", new_tun->tei_repl);
 	}
 
 	return 1;
@@ -1375,7 +1601,11 @@ static struct gtphub_tunnel_endpoint *gtphub_unmap_tei(struct gtphub *hub,
 	int other_side = other_side_idx(p->side_idx);
 
 	struct gtphub_tunnel *tun;
-	llist_for_each_entry(tun, &hub->tunnels, entry) {
+	if (!hub->tunnels_by_tei)
+		goto not_found;
+	llist_for_each_entry(tun,
+			     &hub->tunnels_by_tei[gtphub_tei_hash(hub, p->header_tei_rx)],
+			     tei_entry) {
 		struct gtphub_tunnel_endpoint *te_from =
 			&tun->endpoint[p->side_idx][p->plane_idx];
 		struct gtphub_tunnel_endpoint *te_to =
@@ -1391,6 +1621,7 @@ static struct gtphub_tunnel_endpoint *gtphub_unmap_tei(struct gtphub *hub,
 		}
 	}
 
+not_found:
 	if (unmapped_from_tun)
 		*unmapped_from_tun = NULL;
 	return NULL;
@@ -1490,6 +1721,7 @@ static int gtphub_handle_create_pdp_ctx(struct gtphub *hub,
 		tun->tei_repl = nr_pool_next(&hub->tei_pool);
 
 		llist_add(&tun->entry, &hub->tunnels);
+		gtphub_tunnel_index(hub, tun);
 		gtphub_tunnel_refresh(hub, tun, p->timestamp);
 		/* The endpoint peers on this side (SGSN) will be set from IEs
 		 * below. Also set the GGSN Ctrl endpoint, for logging. */
@@ -1590,20 +1822,21 @@ static int gtphub_handle_create_pdp_ctx(struct gtphub *hub,
 		}
 
 		if (tei_from_ie) {
-			/* Replace TEI in GTP packet IE */
 			tun->endpoint[side_idx][plane_idx].tei_orig = tei_from_ie;
-			p->ie[ie_idx]->tv4.v = hton32(tun->tei_repl);
 
 			if (!gtphub_check_reused_teis(hub, tun)) {
-				/* It's highly unlikely that all TEIs are
-				 * taken. But the code looking for an unused
-				 * TEI is, at the time of writing this comment,
-				 * not able to find gaps in the TEI space. To
+				/* Only happens when every TEI the pool hands
+				 * out is taken by another tunnel. To
 				 * explicitly alert the user of this problem,
 				 * rather abort than carry on. */
 				LOG(LOGL_FATAL, "TEI range exhausted. Cannot create TEI mapping, aborting.\n");
 				abort();
 			}
+			/* tei_repl may have been changed to avoid a clash */
+			gtphub_tunnel_index(hub, tun);
+
+			/* Replace TEI in GTP packet IE */
+			p->ie[ie_idx]->tv4.v = hton32(tun->tei_repl);
 		}
 
 		/* Replace the GSN address to reflect gtphub. */
@@ -2760,6 +2993,371 @@ struct gtphub_peer_port *gtphub_known_addr_have_port(const struct gtphub_bind *b
 }
 
 
+/* snapshot */
+
+/* The snapshot is a line based text file. Peer ports are numbered while
+ * writing, and seq mappings and tunnels refer to ports by that number.
+ * Expiry is stored as seconds remaining, since gtphub_now() is a monotonic
+ * clock that doesn't survive a restart. Resolved GGSN addresses and pending
+ * deletes are not stored; they are cheap to come by again. */
+
+#define GTPH_SNAPSHOT_VERSION 1
+
+static void snapshot_write_peers(FILE *f, struct gtphub *hub)
+{
+	struct gtphub_peer *peer;
+	struct gtphub_peer_addr *pa;
+	struct gtphub_peer_port *pp;
+	unsigned int peer_id = 0;
+	unsigned int port_id = 0;
+	int side_idx, plane_idx;
+
+	/* Lists are written back to front, so that reading them back with
+	 * llist_add() restores the same order. */
+	for_each_side_and_plane(side_idx, plane_idx) {
+		struct gtphub_bind *b = &hub->to_gsns[side_idx][plane_idx];
+		llist_for_each_entry_reverse(peer, &b->peers, entry) {
+			peer_id ++;
+			fprintf(f, "peer %u %d %d %u\n", peer_id, side_idx,
+				plane_idx, peer->seq_pool.last_nr);
+			llist_for_each_entry_reverse(pa, &peer->addresses, entry) {
+				llist_for_each_entry_reverse(pp, &pa->ports, entry) {
+					pp->snapshot_id = ++ port_id;
+					fprintf(f, "port %u %u %s %u %d\n",
+						port_id, peer_id,
+						gsn_addr_to_str(&pa->addr),
+						(unsigned int)pp->port,
+						pp->last_restart_count);
+				}
+			}
+		}
+	}
+
+	peer_id = 0;
+	for_each_side_and_plane(side_idx, plane_idx) {
+		struct gtphub_bind *b = &hub->to_gsns[side_idx][plane_idx];
+		llist_for_each_entry_reverse(peer, &b->peers, entry) {
+			struct nr_mapping *m;
+			peer_id ++;
+			llist_for_each_entry(m, &peer->seq_map.mappings, entry) {
+				struct gtphub_peer_port *from = m->origin;
+				fprintf(f, "seq %u %u %u %u %ld\n", peer_id,
+					from->snapshot_id, m->orig, m->repl,
+					(long)m->expiry_entry.expiry);
+			}
+		}
+	}
+}
+
+int gtphub_snapshot_save(struct gtphub *hub, const char *path, time_t now)
+{
+	char tmp_path[PATH_MAX];
+	struct gtphub_tunnel *tun;
+	FILE *f;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	f = fopen(tmp_path, "w");
+	if (!f) {
+		LOG(LOGL_ERROR, "Cannot write snapshot %s: %s\n", tmp_path,
+		    strerror(errno));
+		return -1;
+	}
+
+	fprintf(f, "gtphub-snapshot %d\n", GTPH_SNAPSHOT_VERSION);
+	fprintf(f, "now %ld\n", (long)now);
+	fprintf(f, "restart-counter %u\n", (unsigned int)hub->restart_counter);
+	fprintf(f, "tei-pool %u\n", hub->tei_pool.last_nr);
+
+	snapshot_write_peers(f, hub);
+
+	llist_for_each_entry_reverse(tun, &hub->tunnels, entry) {
+		int side_idx, plane_idx;
+		fprintf(f, "tunnel %u %ld", tun->tei_repl,
+			(long)tun->expiry_entry.expiry);
+		for_each_side_and_plane(side_idx, plane_idx) {
+			struct gtphub_tunnel_endpoint *te =
+				&tun->endpoint[side_idx][plane_idx];
+			fprintf(f, " %u %u",
+				te->peer ? te->peer->snapshot_id : 0,
+				te->tei_orig);
+		}
+		fprintf(f, "\n");
+	}
+
+	fprintf(f, "end\n");
+
+	if (fflush(f) || fsync(fileno(f))) {
+		LOG(LOGL_ERROR, "Cannot write snapshot %s: %s\n", tmp_path,
+		    strerror(errno));
+		fclose(f);
+		unlink(tmp_path);
+		return -1;
+	}
+	fclose(f);
+
+	if (rename(tmp_path, path)) {
+		LOG(LOGL_ERROR, "Cannot rename snapshot %s to %s: %s\n",
+		    tmp_path, path, strerror(errno));
+		unlink(tmp_path);
+		return -1;
+	}
+	return 0;
+}
+
+struct snapshot_peer {
+	struct gtphub_bind *bind;
+	struct gtphub_peer *peer;
+	nr_t seq_last_nr;
+};
+
+struct snapshot_state {
+	struct snapshot_peer *peers;
+	unsigned int peers_len;
+	struct gtphub_peer_port **ports;
+	unsigned int ports_len;
+	long saved_now;
+};
+
+static int snapshot_read_peer(struct gtphub *hub, struct snapshot_state *st,
+			      const char *line)
+{
+	unsigned int id, last_nr;
+	int side_idx, plane_idx;
+	struct snapshot_peer *sp;
+
+	if (sscanf(line, "peer %u %d %d %u", &id, &side_idx, &plane_idx,
+		   &last_nr) != 4)
+		return -1;
+	if (id != st->peers_len + 1
+	    || side_idx < 0 || side_idx >= GTPH_SIDE_N
+	    || plane_idx < 0 || plane_idx >= GTPH_PLANE_N)
+		return -1;
+
+	st->peers = talloc_realloc(osmo_gtphub_ctx, st->peers,
+				   struct snapshot_peer, id + 1);
+	OSMO_ASSERT(st->peers);
+	st->peers_len = id;
+
+	sp = &st->peers[id];
+	sp->bind = &hub->to_gsns[side_idx][plane_idx];
+	sp->peer = NULL;
+	sp->seq_last_nr = last_nr;
+	return 0;
+}
+
+static int snapshot_read_port(struct gtphub *hub, struct snapshot_state *st,
+			      const char *line)
+{
+	unsigned int id, peer_id, port;
+	int last_restart_count;
+	char addr_str[INET6_ADDRSTRLEN + 1];
+	struct gsn_addr gsna;
+	struct snapshot_peer *sp;
+	struct gtphub_peer_addr *pa;
+	struct gtphub_peer_port *pp;
+
+	if (sscanf(line, "port %u %u %46s %u %d", &id, &peer_id, addr_str,
+		   &port, &last_restart_count) != 5)
+		return -1;
+	if (id != st->ports_len + 1
+	    || peer_id < 1 || peer_id > st->peers_len
+	    || port > 0xffff
+	    || gsn_addr_from_str(&gsna, addr_str) != 0)
+		return -1;
+
+	sp = &st->peers[peer_id];
+	if (!sp->peer) {
+		/* The first address of a peer. This also finds peers that
+		 * already exist, like the configured proxies. */
+		pa = gtphub_addr_have(hub, sp->bind, &gsna);
+		sp->peer = pa->peer;
+		sp->peer->seq_pool.last_nr = sp->seq_last_nr;
+	} else {
+		pa = gtphub_peer_find_addr(sp->peer, &gsna);
+		if (!pa)
+			pa = gtphub_peer_add_addr(sp->peer, &gsna);
+	}
+
+	pp = gtphub_addr_find_port(pa, port);
+	if (!pp)
+		pp = gtphub_addr_add_port(pa, port);
+	if (!pp)
+		return -1;
+	pp->last_restart_count = last_restart_count;
+
+	st->ports = talloc_realloc(osmo_gtphub_ctx, st->ports,
+				   struct gtphub_peer_port *, id + 1);
+	OSMO_ASSERT(st->ports);
+	st->ports_len = id;
+	st->ports[id] = pp;
+	return 0;
+}
+
+static struct gtphub_peer_port *snapshot_port(struct snapshot_state *st,
+					      unsigned int id)
+{
+	if (id < 1 || id > st->ports_len)
+		return NULL;
+	return st->ports[id];
+}
+
+static int snapshot_read_seq(struct gtphub *hub, struct snapshot_state *st,
+			     const char *line, time_t now)
+{
+	unsigned int peer_id, port_id, orig, repl;
+	long expiry;
+	struct gtphub_peer *peer;
+	struct gtphub_peer_port *from;
+	struct nr_mapping *nrm;
+
+	if (sscanf(line, "seq %u %u %u %u %ld", &peer_id, &port_id, &orig,
+		   &repl, &expiry) != 5)
+		return -1;
+	if (peer_id < 1 || peer_id > st->peers_len)
+		return -1;
+	from = snapshot_port(st, port_id);
+	if (!from)
+		return -1;
+
+	peer = st->peers[peer_id].peer;
+	if (!peer) {
+		/* An addressless peer, we cannot reach it anyway. */
+		return 0;
+	}
+	if (nr_map_get(&peer->seq_map, from, orig))
+		return 0;
+
+	nrm = gtphub_mapping_new();
+	nrm->orig = orig;
+	nrm->origin = from;
+	nrm->repl = repl;
+	nr_map_insert(&peer->seq_map, nrm);
+	expiry_add_at(peer->seq_map.add_items_to_expiry, &nrm->expiry_entry,
+		      now + (expiry - st->saved_now));
+	gtphub_port_ref_count_inc(from);
+	return 0;
+}
+
+static int snapshot_read_tunnel(struct gtphub *hub, struct snapshot_state *st,
+				const char *line, time_t now)
+{
+	unsigned int tei_repl;
+	unsigned int port_id[GTPH_SIDE_N * GTPH_PLANE_N];
+	unsigned int tei[GTPH_SIDE_N * GTPH_PLANE_N];
+	long expiry;
+	struct gtphub_tunnel *tun;
+	int side_idx, plane_idx;
+	int i;
+
+	if (sscanf(line, "tunnel %u %ld %u %u %u %u %u %u %u %u",
+		   &tei_repl, &expiry,
+		   &port_id[0], &tei[0], &port_id[1], &tei[1],
+		   &port_id[2], &tei[2], &port_id[3], &tei[3]) != 10)
+		return -1;
+	if (!tei_repl)
+		return -1;
+	for (i = 0; i < ARRAY_SIZE(port_id); i++) {
+		if (port_id[i] && !snapshot_port(st, port_id[i]))
+			return -1;
+	}
+
+	tun = gtphub_tunnel_new();
+	tun->tei_repl = tei_repl;
+
+	i = 0;
+	for_each_side_and_plane(side_idx, plane_idx) {
+		struct gtphub_tunnel_endpoint *te =
+			&tun->endpoint[side_idx][plane_idx];
+		if (port_id[i])
+			gtphub_tunnel_endpoint_set_peer(te,
+				snapshot_port(st, port_id[i]));
+		te->tei_orig = tei[i];
+		i ++;
+	}
+
+	llist_add(&tun->entry, &hub->tunnels);
+	gtphub_tunnel_index(hub, tun);
+	expiry_add_at(&hub->expire_slowly, &tun->expiry_entry,
+		      now + (expiry - st->saved_now));
+	return 0;
+}
+
+int gtphub_snapshot_load(struct gtphub *hub, const char *path, time_t now)
+{
+	struct snapshot_state st = { 0 };
+	char line[256];
+	unsigned int restart_counter = hub->restart_counter;
+	nr_t tei_last_nr = hub->tei_pool.last_nr;
+	int version = 0;
+	int complete = 0;
+	int line_nr = 0;
+	int rc = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		LOG(LOGL_NOTICE, "No snapshot to restore from %s: %s\n", path,
+		    strerror(errno));
+		return -ENOENT;
+	}
+
+	while (!complete && fgets(line, sizeof(line), f)) {
+		line_nr ++;
+
+		if (line_nr == 1) {
+			if (sscanf(line, "gtphub-snapshot %d", &version) != 1
+			    || version != GTPH_SNAPSHOT_VERSION)
+				rc = -1;
+		} else if (!strncmp(line, "now ", 4))
+			rc = (sscanf(line, "now %ld", &st.saved_now) == 1)?
+				0 : -1;
+		else if (!strncmp(line, "restart-counter ", 16))
+			rc = (sscanf(line, "restart-counter %u",
+				     &restart_counter) == 1
+			      && restart_counter <= 255)? 0 : -1;
+		else if (!strncmp(line, "tei-pool ", 9))
+			rc = (sscanf(line, "tei-pool %u", &tei_last_nr) == 1)?
+				0 : -1;
+		else if (!strncmp(line, "peer ", 5))
+			rc = snapshot_read_peer(hub, &st, line);
+		else if (!strncmp(line, "port ", 5))
+			rc = snapshot_read_port(hub, &st, line);
+		else if (!strncmp(line, "seq ", 4))
+			rc = snapshot_read_seq(hub, &st, line, now);
+		else if (!strncmp(line, "tunnel ", 7))
+			rc = snapshot_read_tunnel(hub, &st, line, now);
+		else if (!strcmp(line, "end\n"))
+			complete = 1;
+		else
+			rc = -1;
+
+		if (rc)
+			break;
+	}
+	fclose(f);
+	talloc_free(st.peers);
+	talloc_free(st.ports);
+
+	if (rc || !complete) {
+		int side_idx, plane_idx;
+		LOG(LOGL_ERROR, "Invalid snapshot %s, line %d, not restoring"
+		    " any state\n", path, line_nr);
+		/* Drop whatever was restored so far. */
+		expiry_clear(&hub->expire_quickly);
+		expiry_clear(&hub->expire_slowly);
+		for_each_side_and_plane(side_idx, plane_idx)
+			gtphub_gc_bind(&hub->to_gsns[side_idx][plane_idx]);
+		return -EINVAL;
+	}
+
+	hub->restart_counter = restart_counter;
+	hub->tei_pool.last_nr = tei_last_nr;
+
+	LOG(LOGL_NOTICE, "Restored state from %s, restart counter %u\n",
+	    path, restart_counter);
+	return 0;
+}
+
 /* Return 0 if the message in p is not applicable for GGSN resolution, -1 if
  * resolution should be possible but failed, and 1 if resolution was
  * successful. *pp will be set to NULL if <1 is returned. */
@@ -37,9 +37,17 @@
 /* TODO split GRX ares from sgsn into a separate struct and allow use without
  * globals. */
 #include <openbsc/sgsn.h>
+#include <openbsc/sgsn_ares_cache.h>
 extern struct sgsn_instance *sgsn;
 
-struct sgsn_instance sgsn_inst = { 0 };
+struct sgsn_instance sgsn_inst = {
+	.cfg = {
+		.dns_cache = {
+			.max_ttl = SGSN_ARES_CACHE_MAX_TTL,
+			.neg_ttl = SGSN_ARES_CACHE_NEG_TTL,
+		},
+	},
+};
 struct sgsn_instance *sgsn = &sgsn_inst;
 
 extern void *osmo_gtphub_ctx;
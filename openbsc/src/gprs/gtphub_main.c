@@ -34,6 +34,7 @@
 #include <osmocom/core/logging.h>
 #include <osmocom/core/utils.h>
 #include <osmocom/core/rate_ctr.h>
+#include <osmocom/core/timer.h>
 
 #include <osmocom/vty/logging.h>
 #include <osmocom/vty/telnet_interface.h>
@@ -90,6 +91,35 @@ void log_cfg(struct gtphub_cfg *cfg)
 	}
 }
 
+struct cmdline_cfg {
+	const char *config_file;
+	const char *restart_counter_file;
+	const char *snapshot_file;
+	int snapshot_interval;
+	int daemonize;
+};
+
+static struct gtphub *snapshot_hub;
+static const char *snapshot_file;
+static struct osmo_timer_list snapshot_timer;
+
+static void snapshot_save(void)
+{
+	if (!snapshot_file)
+		return;
+	gtphub_snapshot_save(snapshot_hub, snapshot_file, gtphub_now());
+}
+
+static void snapshot_timer_cb(void *data)
+{
+	int interval = (int)(intptr_t)data;
+	snapshot_save();
+	osmo_timer_schedule(&snapshot_timer, interval, 0);
+}
+
+/* set from the signal handler, the main loop shuts down */
+static volatile sig_atomic_t term_requested;
+
 static void signal_handler(int signal)
 {
 	fprintf(stdout, "signal %d received\n", signal);
@@ -100,6 +130,11 @@ static void signal_handler(int signal)
 		sleep(1);
 		exit(0);
 		break;
+	case SIGTERM:
+		/* writing the snapshot allocates and does file I/O, leave it
+		 * to the main loop */
+		term_requested = 1;
+		break;
 	case SIGABRT:
 		/* in case of abort, we want to obtain a talloc report
 		 * and then return to the caller, who will abort the process */
@@ -121,11 +156,7 @@ static struct vty_app_info vty_info = {
 	.is_config_node	= bsc_vty_is_config_node,
 };
 
-struct cmdline_cfg {
-	const char *config_file;
-	const char *restart_counter_file;
-	int daemonize;
-};
+static int write_restart_count(const char *path, uint8_t counter);
 
 static uint8_t next_restart_count(const char *path)
 {
@@ -157,18 +188,11 @@ static uint8_t next_restart_count(const char *path)
 
 	counter ++;
 
-	f = fopen(path, "w");
-	if (!f)
-		goto failed_to_write;
-	if (fprintf(f, "%" PRIu8 "\n", counter) < 2)
-		goto failed_to_write;
-	if (fclose(f)) {
-		f = NULL;
-		goto failed_to_write;
-	}
-
 	umask(umask_was);
 
+	if (write_restart_count(path, counter))
+		exit(1);
+
 	LOGP(DGTPHUB, LOGL_NOTICE, "Restarted with counter %hhu\n", counter);
 	return counter;
 
@@ -178,6 +202,24 @@ failed_to_read:
 	LOGP(DGTPHUB, LOGL_FATAL, "Restart counter file cannot be parsed:"
 	     " %s\n", path);
 	exit(1);
+}
+
+static int write_restart_count(const char *path, uint8_t counter)
+{
+	int umask_was = umask(022);
+
+	FILE *f = fopen(path, "w");
+	if (!f)
+		goto failed_to_write;
+	if (fprintf(f, "%" PRIu8 "\n", counter) < 2)
+		goto failed_to_write;
+	if (fclose(f)) {
+		f = NULL;
+		goto failed_to_write;
+	}
+
+	umask(umask_was);
+	return 0;
 
 failed_to_write:
 	if (f)
@@ -185,7 +227,7 @@ failed_to_write:
 	umask(umask_was);
 	LOGP(DGTPHUB, LOGL_FATAL, "Restart counter file cannot be written:"
 	     " %s\n", path);
-	exit(1);
+	return -1;
 }
 
 static void print_help(struct cmdline_cfg *ccfg)
@@ -201,6 +243,10 @@ static void print_help(struct cmdline_cfg *ccfg)
 	printf("  -e,--log-level <nr>      Set a global log level.\n");
 	printf("  -r,--restart-file <path> File for counting restarts [%s].\n",
 	       ccfg->restart_counter_file);
+	printf("  -S,--snapshot-file <path> Save state to this file periodically\n");
+	printf("                       and on SIGTERM, restore it on startup.\n");
+	printf("  -i,--snapshot-interval <secs> Seconds between snapshots [%d].\n",
+	       ccfg->snapshot_interval);
 }
 
 static void list_categories(void)
@@ -228,10 +274,12 @@ static void handle_options(struct cmdline_cfg *ccfg, int argc, char **argv)
 			{"timestamp", 0, 0, 'T'},
 			{"log-level", 1, 0, 'e'},
 			{"restart-file", 1, 0, 'r'},
+			{"snapshot-file", 1, 0, 'S'},
+			{"snapshot-interval", 1, 0, 'i'},
 			{NULL, 0, 0, 0}
 		};
 
-		c = getopt_long(argc, argv, "hd:Dc:sTe:r:",
+		c = getopt_long(argc, argv, "hd:Dc:sTe:r:S:i:",
 				long_options, &option_index);
 		if (c == -1) {
 			if (optind < argc) {
@@ -273,6 +321,17 @@ static void handle_options(struct cmdline_cfg *ccfg, int argc, char **argv)
 		case 'r':
 			ccfg->restart_counter_file = optarg;
 			break;
+		case 'S':
+			ccfg->snapshot_file = optarg;
+			break;
+		case 'i':
+			ccfg->snapshot_interval = atoi(optarg);
+			if (ccfg->snapshot_interval < 1) {
+				LOGP(DGTPHUB, LOGL_FATAL,
+				     "Invalid snapshot interval: %s\n", optarg);
+				exit(2);
+			}
+			break;
 		default:
 			LOGP(DGTPHUB, LOGL_FATAL, "Invalid command line argument, abort.\n");
 			exit(1);
@@ -290,6 +349,7 @@ int main(int argc, char **argv)
 	memset(ccfg, '\0', sizeof(*ccfg));
 	ccfg->config_file = "./gtphub.conf";
 	ccfg->restart_counter_file = "./gtphub_restart_count";
+	ccfg->snapshot_interval = 60;
 
 	struct gtphub_cfg _cfg;
 	struct gtphub_cfg *cfg = &_cfg;
@@ -302,6 +362,7 @@ int main(int argc, char **argv)
 	msgb_talloc_ctx_init(osmo_gtphub_ctx, 0);
 
 	signal(SIGINT, &signal_handler);
+	signal(SIGTERM, &signal_handler);
 	signal(SIGABRT, &signal_handler);
 	signal(SIGUSR1, &signal_handler);
 	signal(SIGUSR2, &signal_handler);
@@ -336,6 +397,22 @@ int main(int argc, char **argv)
 	    != 0)
 		return -1;
 
+	if (ccfg->snapshot_file) {
+		/* A restored hub still has the peers' tunnels, so keep the
+		 * restart counter the peers know instead of counting up. */
+		if (gtphub_snapshot_load(hub, ccfg->snapshot_file,
+					 gtphub_now()) == 0)
+			write_restart_count(ccfg->restart_counter_file,
+					    hub->restart_counter);
+
+		snapshot_hub = hub;
+		snapshot_file = ccfg->snapshot_file;
+		snapshot_timer.cb = snapshot_timer_cb;
+		snapshot_timer.data = (void *)(intptr_t)ccfg->snapshot_interval;
+		osmo_timer_schedule(&snapshot_timer, ccfg->snapshot_interval,
+				    0);
+	}
+
 	log_cfg(cfg);
 
 	if (ccfg->daemonize) {
@@ -346,12 +423,13 @@ int main(int argc, char **argv)
 		}
 	}
 
-	while (1) {
+	while (!term_requested) {
 		rc = osmo_select_main(0);
 		if (rc < 0)
 			exit(3);
 	}
 
-	/* not reached */
+	/* Save the state for a warm restart */
+	snapshot_save();
 	exit(0);
 }
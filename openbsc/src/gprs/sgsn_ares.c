@@ -20,28 +20,75 @@
  */
 
 #include <openbsc/sgsn.h>
+#include <openbsc/sgsn_ares_cache.h>
 #include <openbsc/debug.h>
 
+#include <osmocom/core/utils.h>
+
 #include <netdb.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/nameser.h>
 
 struct cares_event_fd {
 	struct llist_head head;
 	struct osmo_fd fd;
 };
 
-struct cares_cb_data {
-	ares_host_callback cb;
-	void *data;
-};
-
 static void osmo_ares_reschedule(struct sgsn_instance *sgsn);
-static void ares_cb(void *_arg, int status, int timeouts, struct hostent *hostent)
+static void ares_cb(void *arg, int status, int timeouts,
+		   unsigned char *abuf, int alen)
 {
-	struct cares_cb_data *arg = _arg;
+	struct sgsn_ares_cache_entry *entry = arg;
+	struct ares_addrttl addrttls[SGSN_ARES_CACHE_MAX_ADDRS];
+	struct in_addr addrs[SGSN_ARES_CACHE_MAX_ADDRS];
+	int naddrttls = ARRAY_SIZE(addrttls);
+	unsigned int ttl = UINT_MAX;
+	int i;
+
+	if (status == ARES_SUCCESS)
+		status = ares_parse_a_reply(abuf, alen, NULL,
+					    addrttls, &naddrttls);
+	if (status != ARES_SUCCESS)
+		naddrttls = 0;
+
+	for (i = 0; i < naddrttls; i++) {
+		addrs[i] = addrttls[i].ipaddr;
+		if (addrttls[i].ttl >= 0)
+			ttl = OSMO_MIN(ttl, addrttls[i].ttl);
+	}
 
-	arg->cb(arg->data, status, timeouts, hostent);
+	sgsn_ares_cache_complete(entry, status, timeouts, addrs, naddrttls,
+				 naddrttls > 0 ? ttl : 0);
 	osmo_ares_reschedule(sgsn);
-	talloc_free(arg);
+}
+
+/* Resolver for the cache. ares_gethostbyname() does not tell the TTL of
+ * an answer, so the A records are queried directly. Names from the hosts
+ * file are still served first, they are kept for the maximum TTL. */
+static int ares_cache_resolve(struct sgsn_ares_cache *cache,
+			      struct sgsn_ares_cache_entry *entry)
+{
+	struct sgsn_instance *sgsn = cache->resolve_data;
+	struct in_addr addrs[SGSN_ARES_CACHE_MAX_ADDRS];
+	struct hostent *host;
+	unsigned int i;
+
+	if (ares_gethostbyname_file(sgsn->ares_channel, entry->name, AF_INET,
+				    &host) == ARES_SUCCESS) {
+		for (i = 0; i < ARRAY_SIZE(addrs) && host->h_addr_list[i]; i++)
+			memcpy(&addrs[i], host->h_addr_list[i], sizeof(addrs[i]));
+		ares_free_hostent(host);
+		sgsn_ares_cache_complete(entry, ARES_SUCCESS, 0, addrs, i,
+					 cache->max_ttl);
+		return 0;
+	}
+
+	ares_search(sgsn->ares_channel, entry->name, ns_c_in, ns_t_a,
+		    ares_cb, entry);
+	osmo_ares_reschedule(sgsn);
+	return 0;
 }
 
 static int ares_osmo_fd_cb(struct osmo_fd *fd, unsigned int what)
@@ -135,14 +182,7 @@ update_fd:
 int sgsn_ares_query(struct sgsn_instance *sgsn, const char *name,
 			ares_host_callback cb, void *data)
 {
-	struct cares_cb_data *cb_data;
-
-	cb_data = talloc_zero(tall_bsc_ctx, struct cares_cb_data);
-	cb_data->cb = cb;
-	cb_data->data = data;
-	ares_gethostbyname(sgsn->ares_channel, name, AF_INET, ares_cb, cb_data);
-	osmo_ares_reschedule(sgsn);
-	return 0;
+	return sgsn_ares_cache_query(sgsn->ares_cache, name, cb, data);
 }
 
 int sgsn_ares_init(struct sgsn_instance *sgsn)
@@ -166,6 +206,13 @@ int sgsn_ares_init(struct sgsn_instance *sgsn)
 	if (rc != ARES_SUCCESS)
 		return rc;
 
+	sgsn->ares_cache = sgsn_ares_cache_alloc(tall_bsc_ctx,
+						 ares_cache_resolve, sgsn);
+	if (!sgsn->ares_cache)
+		return -ENOMEM;
+	sgsn->ares_cache->max_ttl = sgsn->cfg.dns_cache.max_ttl;
+	sgsn->ares_cache->neg_ttl = sgsn->cfg.dns_cache.neg_ttl;
+
 	if (sgsn->ares_servers)
 		rc = ares_set_servers(sgsn->ares_channel, sgsn->ares_servers);
 
@@ -0,0 +1,312 @@
+/* Caching of GRX DNS answers in front of c-ares */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Every PDP context activation resolves the APN of the subscriber, and
+ * only a handful of distinct names are ever asked for. Answers are kept
+ * for their TTL (capped by max_ttl), names that do not exist for neg_ttl,
+ * and concurrent queries for a name that is being resolved wait for the
+ * same answer instead of sending another query.
+ */
+
+#include <openbsc/sgsn_ares_cache.h>
+#include <openbsc/debug.h>
+
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/core/rate_ctr.h>
+#include <osmocom/core/stats.h>
+
+#include <string.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+/* A caller waiting for an answer, with its own copy of the answer once
+ * it is known */
+struct ares_cache_waiter {
+	struct llist_head list;
+	ares_host_callback cb;
+	void *data;
+
+	int status;
+	int timeouts;
+	struct in_addr addrs[SGSN_ARES_CACHE_MAX_ADDRS];
+	unsigned int num_addrs;
+	char *name;
+};
+
+static const struct rate_ctr_desc ares_cache_ctr_description[] = {
+	[ARES_CACHE_CTR_HIT]		= { "hit",	"Answered from the cache     " },
+	[ARES_CACHE_CTR_NEG_HIT]	= { "neg_hit",	"Negative answers from cache " },
+	[ARES_CACHE_CTR_MISS]		= { "miss",	"Queries sent to the resolver" },
+	[ARES_CACHE_CTR_COALESCED]	= { "coalesced", "Joined an outstanding query " },
+	[ARES_CACHE_CTR_EXPIRED]	= { "expired",	"Entries expired by TTL      " },
+	[ARES_CACHE_CTR_EVICTED]	= { "evicted",	"Entries evicted when full   " },
+};
+
+static const struct rate_ctr_group_desc ares_cache_ctrg_desc = {
+	.group_name_prefix = "grx.dns_cache",
+	.group_description = "GRX DNS Answer Cache",
+	.num_ctr = ARRAY_SIZE(ares_cache_ctr_description),
+	.ctr_desc = ares_cache_ctr_description,
+	.class_id = OSMO_STATS_CLASS_GLOBAL,
+};
+
+static time_t monotonic_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static void deliver_cb(void *data)
+{
+	struct sgsn_ares_cache *cache = data;
+	struct ares_cache_waiter *w;
+
+	/* A callback may query again, e.g. with a different MNC, which
+	 * can append to the list while it is being worked off */
+	while (!llist_empty(&cache->deliver)) {
+		char *addr_list[SGSN_ARES_CACHE_MAX_ADDRS + 1];
+		char *no_aliases[1] = { NULL };
+		struct hostent hostent;
+		unsigned int i;
+
+		w = llist_entry(cache->deliver.next, struct ares_cache_waiter,
+				list);
+		llist_del(&w->list);
+
+		if (w->status != ARES_SUCCESS) {
+			w->cb(w->data, w->status, w->timeouts, NULL);
+			talloc_free(w);
+			continue;
+		}
+
+		for (i = 0; i < w->num_addrs; i++)
+			addr_list[i] = (char *) &w->addrs[i];
+		addr_list[i] = NULL;
+
+		memset(&hostent, 0, sizeof(hostent));
+		hostent.h_name = w->name;
+		hostent.h_aliases = no_aliases;
+		hostent.h_addrtype = AF_INET;
+		hostent.h_length = sizeof(struct in_addr);
+		hostent.h_addr_list = addr_list;
+
+		w->cb(w->data, w->status, w->timeouts, &hostent);
+		talloc_free(w);
+	}
+}
+
+static void waiter_answer(struct sgsn_ares_cache *cache,
+			  struct ares_cache_waiter *w,
+			  const struct sgsn_ares_cache_entry *entry,
+			  int timeouts)
+{
+	w->status = entry->status;
+	w->timeouts = timeouts;
+	w->num_addrs = entry->num_addrs;
+	memcpy(w->addrs, entry->addrs, sizeof(w->addrs));
+
+	llist_add_tail(&w->list, &cache->deliver);
+	if (!osmo_timer_pending(&cache->deliver_timer))
+		osmo_timer_schedule(&cache->deliver_timer, 0, 0);
+}
+
+static void entry_free(struct sgsn_ares_cache_entry *entry)
+{
+	llist_del(&entry->list);
+	entry->cache->num_entries -= 1;
+	talloc_free(entry);
+}
+
+/* Make room for one more entry. Entries with an outstanding query are
+ * never evicted, their answer is still awaited. */
+static void evict_one(struct sgsn_ares_cache *cache)
+{
+	struct sgsn_ares_cache_entry *entry;
+
+	llist_for_each_entry(entry, &cache->entries, list) {
+		if (entry->pending)
+			continue;
+		LOGP(DGPRS, LOGL_DEBUG, "DNS cache full, evicting %s\n",
+		     entry->name);
+		rate_ctr_inc(&cache->ctrg->ctr[ARES_CACHE_CTR_EVICTED]);
+		entry_free(entry);
+		return;
+	}
+}
+
+static struct sgsn_ares_cache_entry *
+entry_find(struct sgsn_ares_cache *cache, const char *name)
+{
+	struct sgsn_ares_cache_entry *entry;
+
+	llist_for_each_entry(entry, &cache->entries, list) {
+		if (!strcasecmp(entry->name, name))
+			return entry;
+	}
+	return NULL;
+}
+
+struct sgsn_ares_cache *sgsn_ares_cache_alloc(void *ctx,
+					      sgsn_ares_cache_resolve_t resolve,
+					      void *resolve_data)
+{
+	struct sgsn_ares_cache *cache;
+
+	cache = talloc_zero(ctx, struct sgsn_ares_cache);
+	if (!cache)
+		return NULL;
+
+	INIT_LLIST_HEAD(&cache->entries);
+	INIT_LLIST_HEAD(&cache->deliver);
+	cache->max_entries = SGSN_ARES_CACHE_MAX_ENTRIES;
+	cache->max_ttl = SGSN_ARES_CACHE_MAX_TTL;
+	cache->neg_ttl = SGSN_ARES_CACHE_NEG_TTL;
+	cache->resolve = resolve;
+	cache->resolve_data = resolve_data;
+	cache->now = monotonic_now;
+	cache->deliver_timer.cb = deliver_cb;
+	cache->deliver_timer.data = cache;
+	cache->ctrg = rate_ctr_group_alloc(cache, &ares_cache_ctrg_desc, 0);
+
+	return cache;
+}
+
+void sgsn_ares_cache_free(struct sgsn_ares_cache *cache)
+{
+	osmo_timer_del(&cache->deliver_timer);
+	rate_ctr_group_free(cache->ctrg);
+	talloc_free(cache);
+}
+
+int sgsn_ares_cache_query(struct sgsn_ares_cache *cache, const char *name,
+			  ares_host_callback cb, void *data)
+{
+	struct sgsn_ares_cache_entry *entry;
+	struct ares_cache_waiter *w;
+	int rc;
+
+	w = talloc_zero(cache, struct ares_cache_waiter);
+	if (!w)
+		return -ENOMEM;
+	w->cb = cb;
+	w->data = data;
+	w->name = talloc_strdup(w, name);
+
+	entry = entry_find(cache, name);
+	if (entry) {
+		/* most recently used go to the end */
+		llist_del(&entry->list);
+		llist_add_tail(&entry->list, &cache->entries);
+
+		if (entry->pending) {
+			rate_ctr_inc(&cache->ctrg->ctr[ARES_CACHE_CTR_COALESCED]);
+			llist_add_tail(&w->list, &entry->waiters);
+			return 0;
+		}
+
+		if (cache->now() < entry->expires) {
+			if (entry->status == ARES_SUCCESS)
+				rate_ctr_inc(&cache->ctrg->ctr[ARES_CACHE_CTR_HIT]);
+			else
+				rate_ctr_inc(&cache->ctrg->ctr[ARES_CACHE_CTR_NEG_HIT]);
+			waiter_answer(cache, w, entry, 0);
+			return 0;
+		}
+
+		LOGP(DGPRS, LOGL_DEBUG, "DNS cache entry for %s expired\n",
+		     name);
+		rate_ctr_inc(&cache->ctrg->ctr[ARES_CACHE_CTR_EXPIRED]);
+	} else {
+		if (cache->num_entries >= cache->max_entries)
+			evict_one(cache);
+
+		entry = talloc_zero(cache, struct sgsn_ares_cache_entry);
+		if (!entry) {
+			talloc_free(w);
+			return -ENOMEM;
+		}
+		entry->cache = cache;
+		entry->name = talloc_strdup(entry, name);
+		INIT_LLIST_HEAD(&entry->waiters);
+		llist_add_tail(&entry->list, &cache->entries);
+		cache->num_entries += 1;
+	}
+
+	rate_ctr_inc(&cache->ctrg->ctr[ARES_CACHE_CTR_MISS]);
+	entry->pending = 1;
+	llist_add_tail(&w->list, &entry->waiters);
+
+	/* the entry may be gone once this returns */
+	rc = cache->resolve(cache, entry);
+	if (rc != 0) {
+		LOGP(DGPRS, LOGL_ERROR, "Failed to resolve %s: %d\n", name, rc);
+		llist_del(&w->list);
+		talloc_free(w);
+		entry_free(entry);
+	}
+	return rc;
+}
+
+/* Called by the resolver with the answer for entry->name. ttl is the
+ * smallest TTL of the answer's records, it is ignored for failures. */
+void sgsn_ares_cache_complete(struct sgsn_ares_cache_entry *entry,
+			      int status, int timeouts,
+			      const struct in_addr *addrs, unsigned int num_addrs,
+			      unsigned int ttl)
+{
+	struct sgsn_ares_cache *cache = entry->cache;
+	struct ares_cache_waiter *w, *w2;
+
+	entry->pending = 0;
+	entry->status = status;
+	entry->num_addrs = OSMO_MIN(num_addrs, SGSN_ARES_CACHE_MAX_ADDRS);
+	memcpy(entry->addrs, addrs,
+	       entry->num_addrs * sizeof(entry->addrs[0]));
+
+	if (status == ARES_SUCCESS && entry->num_addrs == 0)
+		entry->status = ARES_ENODATA;
+
+	/* Only the authoritative "does not exist" answers are cached as
+	 * negative ones, a timeout or server failure is not. */
+	switch (entry->status) {
+	case ARES_SUCCESS:
+		ttl = OSMO_MIN(ttl, cache->max_ttl);
+		break;
+	case ARES_ENOTFOUND:
+	case ARES_ENODATA:
+		ttl = cache->neg_ttl;
+		break;
+	default:
+		ttl = 0;
+		break;
+	}
+	entry->expires = cache->now() + ttl;
+
+	llist_for_each_entry_safe(w, w2, &entry->waiters, list) {
+		llist_del(&w->list);
+		waiter_answer(cache, w, entry, timeouts);
+	}
+
+	if (ttl == 0)
+		entry_free(entry);
+}
@@ -20,6 +20,8 @@
  */
 
 #include <osmocom/gsm/protocol/gsm_04_08_gprs.h>
+#include <osmocom/core/rate_ctr.h>
+#include <osmocom/core/timer.h>
 #include <openbsc/sgsn.h>
 #include <openbsc/gprs_sgsn.h>
 #include <openbsc/gprs_gmm.h>
@@ -36,6 +38,193 @@ const struct value_string auth_state_names[] = {
 
 const struct value_string *sgsn_auth_state_names = auth_state_names;
 
+/*
+ * Background refill of authentication tuples
+ *
+ * Every tuple is used for a single authentication. Instead of asking the
+ * HLR once all of them are used up, which makes the MS wait for the round
+ * trip, a refill is requested in the background as soon as only low_water
+ * unused tuples are left. At most max_pending refills are outstanding at
+ * the HLR, the others wait in the queue, so that a mass re-attach does not
+ * flood it. Only max_subscribers keep unused tuples, the subscriber that
+ * has not been authenticated for the longest time loses them first.
+ * Refills are sent from the main loop, after the caller of
+ * sgsn_auth_get_tuple() has taken its tuple.
+ */
+static LLIST_HEAD(prefetch_queue);
+static LLIST_HEAD(spare_lru);
+static unsigned int prefetch_pending;
+static unsigned int spare_subscribers;
+static struct osmo_timer_list prefetch_timer;
+
+static unsigned int count_unused_tuples(struct sgsn_subscriber_data *sdata)
+{
+	unsigned int idx, count = 0;
+
+	for (idx = 0; idx < ARRAY_SIZE(sdata->auth_triplets); idx++) {
+		if (sdata->auth_triplets[idx].key_seq != GSM_KEY_SEQ_INVAL &&
+		    sdata->auth_triplets[idx].use_count == 0)
+			count += 1;
+	}
+	return count;
+}
+
+static void drop_unused_tuples(struct sgsn_subscriber_data *sdata)
+{
+	unsigned int idx;
+
+	for (idx = 0; idx < ARRAY_SIZE(sdata->auth_triplets); idx++) {
+		struct gsm_auth_tuple *at = &sdata->auth_triplets[idx];
+
+		if (at->key_seq == GSM_KEY_SEQ_INVAL || at->use_count != 0)
+			continue;
+		memset(at, 0, sizeof(*at));
+		at->key_seq = GSM_KEY_SEQ_INVAL;
+	}
+}
+
+/* Mark the subscriber as the most recently authenticated one */
+static void spare_touch(struct sgsn_subscriber_data *sdata)
+{
+	struct sgsn_subscriber_data *oldest;
+
+	if (llist_empty(&sdata->spare_entry))
+		spare_subscribers += 1;
+	else
+		llist_del(&sdata->spare_entry);
+	llist_add_tail(&sdata->spare_entry, &spare_lru);
+
+	while (spare_subscribers > sgsn->cfg.auth_prefetch.max_subscribers) {
+		oldest = llist_entry(spare_lru.next,
+				     struct sgsn_subscriber_data, spare_entry);
+		LOGGSUBSCRP(LOGL_INFO, oldest->subscr,
+			    "Dropping unused auth tuples\n");
+		drop_unused_tuples(oldest);
+		llist_del_init(&oldest->spare_entry);
+		spare_subscribers -= 1;
+		rate_ctr_inc(&sgsn->rate_ctrs->ctr[CTR_AUTH_PREFETCH_EVICTED]);
+	}
+}
+
+static void prefetch_kick(void *data)
+{
+	struct sgsn_subscriber_data *sdata;
+
+	while (prefetch_pending < sgsn->cfg.auth_prefetch.max_pending &&
+	       !llist_empty(&prefetch_queue)) {
+		sdata = llist_entry(prefetch_queue.next,
+				    struct sgsn_subscriber_data, prefetch_entry);
+		llist_del_init(&sdata->prefetch_entry);
+
+		LOGGSUBSCRP(LOGL_DEBUG, sdata->subscr,
+			    "Refilling auth tuples in the background\n");
+		if (gprs_subscr_query_auth_info(sdata->subscr) < 0) {
+			sdata->prefetch_state = SGSN_AUTH_PREFETCH_NONE;
+			continue;
+		}
+		sdata->prefetch_state = SGSN_AUTH_PREFETCH_PENDING;
+		prefetch_pending += 1;
+		rate_ctr_inc(&sgsn->rate_ctrs->ctr[CTR_AUTH_PREFETCH_REQUEST]);
+	}
+}
+
+static void schedule_kick(void)
+{
+	if (llist_empty(&prefetch_queue) || osmo_timer_pending(&prefetch_timer))
+		return;
+	prefetch_timer.cb = prefetch_kick;
+	osmo_timer_schedule(&prefetch_timer, 0, 0);
+}
+
+/* Queue a refill once the unused tuples run low, unless the tuples are
+ * being requested anyway */
+static void prefetch_check(struct gsm_subscriber *subscr)
+{
+	struct sgsn_subscriber_data *sdata = subscr->sgsn_data;
+
+	if (sdata->prefetch_state != SGSN_AUTH_PREFETCH_NONE)
+		return;
+	if (subscr->flags & GPRS_SUBSCRIBER_UPDATE_AUTH_INFO_PENDING)
+		return;
+	if (count_unused_tuples(sdata) > sgsn->cfg.auth_prefetch.low_water)
+		return;
+
+	sdata->prefetch_state = SGSN_AUTH_PREFETCH_QUEUED;
+	llist_add_tail(&sdata->prefetch_entry, &prefetch_queue);
+	schedule_kick();
+}
+
+/* Called with the answer to a background refill, num_vec is 0 if it
+ * failed. The new tuples take the place of used ones, except for the one
+ * the MS currently uses. Tuples that don't fit are discarded. */
+void sgsn_auth_prefetch_done(struct gsm_subscriber *subscr,
+			     const struct osmo_auth_vector *vec, size_t num_vec)
+{
+	struct sgsn_subscriber_data *sdata = subscr->sgsn_data;
+	int in_use = GSM_KEY_SEQ_INVAL;
+	unsigned int idx, stored = 0;
+	size_t i;
+
+	if (sdata->prefetch_state == SGSN_AUTH_PREFETCH_PENDING)
+		prefetch_pending -= 1;
+	sdata->prefetch_state = SGSN_AUTH_PREFETCH_NONE;
+
+	if (sdata->mm)
+		in_use = sdata->mm->auth_triplet.key_seq;
+
+	for (i = 0; i < num_vec; i++) {
+		struct gsm_auth_tuple *at = NULL;
+
+		for (idx = 0; idx < ARRAY_SIZE(sdata->auth_triplets); idx++) {
+			struct gsm_auth_tuple *cand = &sdata->auth_triplets[idx];
+
+			if (cand->key_seq == GSM_KEY_SEQ_INVAL) {
+				at = cand;
+				break;
+			}
+			if (!at && cand->use_count > 0 && idx != in_use)
+				at = cand;
+		}
+		if (!at)
+			break;
+
+		at->vec = vec[i];
+		at->key_seq = at - sdata->auth_triplets;
+		at->use_count = 0;
+		stored += 1;
+	}
+
+	LOGGSUBSCRP(LOGL_INFO, subscr,
+		    "Background refill stored %u of %zu auth tuples\n",
+		    stored, num_vec);
+	rate_ctr_add(&sgsn->rate_ctrs->ctr[CTR_AUTH_PREFETCH_TUPLES], stored);
+	if (stored > 0)
+		spare_touch(sdata);
+
+	schedule_kick();
+}
+
+/* The subscriber data is going away */
+void sgsn_auth_prefetch_release(struct sgsn_subscriber_data *sdata)
+{
+	if (sdata->prefetch_state == SGSN_AUTH_PREFETCH_PENDING)
+		prefetch_pending -= 1;
+	sdata->prefetch_state = SGSN_AUTH_PREFETCH_NONE;
+	llist_del_init(&sdata->prefetch_entry);
+
+	if (!llist_empty(&sdata->spare_entry)) {
+		llist_del_init(&sdata->spare_entry);
+		spare_subscribers -= 1;
+	}
+
+	schedule_kick();
+}
+
+unsigned int sgsn_auth_prefetch_pending(void)
+{
+	return prefetch_pending;
+}
+
 void sgsn_auth_init(void)
 {
 	INIT_LLIST_HEAD(&sgsn->cfg.imsi_acl);
@@ -178,6 +367,7 @@ int sgsn_auth_request(struct sgsn_mm_ctx *mmctx)
 
 		if (!at) {
 			/* No valid tuple found, request fresh ones */
+			rate_ctr_inc(&sgsn->rate_ctrs->ctr[CTR_AUTH_TUPLE_WAIT]);
 			mmctx->auth_triplet.key_seq = GSM_KEY_SEQ_INVAL;
 			LOGMMCTXP(LOGL_INFO, mmctx,
 				  "Requesting authentication tuples\n");
@@ -302,6 +492,10 @@ struct gsm_auth_tuple *sgsn_auth_get_tuple(struct sgsn_mm_ctx *mmctx,
 		if (sdata->auth_triplets[idx].use_count == 0) {
 			at = &sdata->auth_triplets[idx];
 			at->use_count = 1;
+			if (sgsn->cfg.auth_prefetch.low_water > 0) {
+				spare_touch(sdata);
+				prefetch_check(mmctx->subscr);
+			}
 			return at;
 		}
 	}
@@ -19,12 +19,15 @@
  */
 
 #include <openbsc/sgsn.h>
+#include <openbsc/sgsn_cdr.h>
 #include <openbsc/signal.h>
 #include <openbsc/gprs_utils.h>
 #include <openbsc/debug.h>
 
 #include <openbsc/vty.h>
 
+#include <osmocom/core/talloc.h>
+
 #include <gtp.h>
 #include <pdp.h>
 
@@ -33,6 +36,7 @@
 #include <time.h>
 
 #include <stdio.h>
+#include <errno.h>
 #include <inttypes.h>
 
 /* TODO...avoid going through a global */
@@ -59,47 +63,135 @@ extern struct sgsn_instance *sgsn;
  */
 
 
-static void maybe_print_header(FILE *cdr_file)
+/* The writer and the config it was last set up with */
+static struct sgsn_cdr_writer *cdr_writer;
+static struct sgsn_cdr cdr_writer_cfg;
+static uint64_t cdr_reported_drops;
+static uint64_t cdr_reported_errors;
+
+static void cdr_writer_release(void)
 {
-	if (ftell(cdr_file) != 0)
+	if (!cdr_writer)
 		return;
+	sgsn_cdr_writer_free(cdr_writer);
+	cdr_writer = NULL;
+	talloc_free(cdr_writer_cfg.filename);
+	cdr_writer_cfg.filename = NULL;
+}
 
-	fprintf(cdr_file, "timestamp,imsi,imei,msisdn,cell_id,lac,hlr,event,pdp_duration,ggsn_addr,sgsn_addr,apni,eua_addr,vol_in,vol_out,charging_id\n");
+static int cdr_cfg_changed(const struct sgsn_cdr *cfg)
+{
+	if (strcmp(cfg->filename, cdr_writer_cfg.filename) != 0)
+		return 1;
+	return cfg->format != cdr_writer_cfg.format
+		|| cfg->rotate_size != cdr_writer_cfg.rotate_size
+		|| cfg->rotate_interval != cdr_writer_cfg.rotate_interval;
 }
 
-static void cdr_log_mm(struct sgsn_instance *inst, const char *ev,
-			struct sgsn_mm_ctx *mmctx)
+/* Get the writer, set up or reconfigured after VTY changes. Returns NULL
+ * if CDRs are disabled. */
+static struct sgsn_cdr_writer *cdr_get_writer(struct sgsn_instance *inst)
+{
+	struct sgsn_cdr *cfg = &inst->cfg.cdr;
+	struct sgsn_cdr_writer_cfg wcfg;
+	struct sgsn_cdr_writer_stats stats;
+
+	if (!cfg->filename) {
+		cdr_writer_release();
+		return NULL;
+	}
+
+	/* the ring can't be resized while the thread is using it */
+	if (cdr_writer && cfg->buffer_size != cdr_writer_cfg.buffer_size)
+		cdr_writer_release();
+
+	if (!cdr_writer) {
+		cdr_writer = sgsn_cdr_writer_alloc(inst, cfg->buffer_size);
+		if (!cdr_writer)
+			return NULL;
+		cdr_writer_cfg.buffer_size = cfg->buffer_size;
+		cdr_reported_drops = cdr_reported_errors = 0;
+	} else if (!cdr_cfg_changed(cfg))
+		goto check_stats;
+
+	wcfg.filename = cfg->filename;
+	wcfg.format = cfg->format;
+	wcfg.rotate_size = cfg->rotate_size;
+	wcfg.rotate_interval = cfg->rotate_interval;
+	if (sgsn_cdr_writer_configure(cdr_writer, &wcfg) < 0) {
+		LOGP(DGPRS, LOGL_ERROR, "Failed to set up CDR writer for %s\n",
+			cfg->filename);
+		cdr_writer_release();
+		return NULL;
+	}
+
+	talloc_free(cdr_writer_cfg.filename);
+	cdr_writer_cfg.filename = talloc_strdup(inst, cfg->filename);
+	cdr_writer_cfg.format = cfg->format;
+	cdr_writer_cfg.rotate_size = cfg->rotate_size;
+	cdr_writer_cfg.rotate_interval = cfg->rotate_interval;
+
+check_stats:
+	/* the writer thread can't log, report its troubles here */
+	sgsn_cdr_writer_stats(cdr_writer, &stats);
+	if (stats.write_errors != cdr_reported_errors) {
+		LOGP(DGPRS, LOGL_ERROR, "Failed to write CDRs to %s\n",
+			cfg->filename);
+		cdr_reported_errors = stats.write_errors;
+	}
+	if (stats.dropped != cdr_reported_drops) {
+		LOGP(DGPRS, LOGL_ERROR, "CDR buffer full, dropped %" PRIu64
+			" CDRs\n", stats.dropped - cdr_reported_drops);
+		cdr_reported_drops = stats.dropped;
+	}
+
+	return cdr_writer;
+}
+
+static void cdr_set_timestamp(struct sgsn_cdr_rec *rec)
 {
-	FILE *cdr_file;
-	struct tm tm;
 	struct timeval tv;
 
-	if (!inst->cfg.cdr.filename)
-		return;
+	gettimeofday(&tv, NULL);
+	rec->timestamp_ms = (uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
 
-	cdr_file = fopen(inst->cfg.cdr.filename, "a");
-	if (!cdr_file) {
-		LOGP(DGPRS, LOGL_ERROR, "Failed to open %s\n",
-			inst->cfg.cdr.filename);
+static void cdr_set_mm(struct sgsn_cdr_rec *rec, struct sgsn_mm_ctx *mmctx)
+{
+	if (!mmctx) {
+		strcpy(rec->imsi, "N/A");
+		strcpy(rec->imei, "N/A");
+		strcpy(rec->msisdn, "N/A");
+		strcpy(rec->hlr, "N/A");
+		rec->cell_id = -1;
+		rec->lac = -1;
 		return;
 	}
 
-	maybe_print_header(cdr_file);
-	gettimeofday(&tv, NULL);
-	gmtime_r(&tv.tv_sec, &tm);
-	fprintf(cdr_file, "%04d%02d%02d%02d%02d%02d%03d,%s,%s,%s,%d,%d,%s,%s\n",
-		tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
-		tm.tm_hour, tm.tm_min, tm.tm_sec,
-		(int)(tv.tv_usec / 1000),
-		mmctx->imsi,
-		mmctx->imei,
-		mmctx->msisdn,
-		mmctx->gb.cell_id,
-		mmctx->ra.lac,
-		mmctx->hlr,
-		ev);
-
-	fclose(cdr_file);
+	strncpy(rec->imsi, mmctx->imsi, sizeof(rec->imsi) - 1);
+	strncpy(rec->imei, mmctx->imei, sizeof(rec->imei) - 1);
+	strncpy(rec->msisdn, mmctx->msisdn, sizeof(rec->msisdn) - 1);
+	strncpy(rec->hlr, mmctx->hlr, sizeof(rec->hlr) - 1);
+	rec->cell_id = mmctx->gb.cell_id;
+	rec->lac = mmctx->ra.lac;
+}
+
+static void cdr_log_mm(struct sgsn_instance *inst, enum sgsn_cdr_event ev,
+			struct sgsn_mm_ctx *mmctx)
+{
+	struct sgsn_cdr_writer *writer;
+	struct sgsn_cdr_rec rec;
+
+	writer = cdr_get_writer(inst);
+	if (!writer)
+		return;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.ev = ev;
+	cdr_set_timestamp(&rec);
+	cdr_set_mm(&rec, mmctx);
+
+	sgsn_cdr_writer_add(writer, &rec);
 }
 
 static void extract_eua(struct ul66_t *eua, char *eua_addr)
@@ -123,81 +215,51 @@ static void extract_eua(struct ul66_t *eua, char *eua_addr)
 	}
 }
 
-static void cdr_log_pdp(struct sgsn_instance *inst, const char *ev,
+static void cdr_log_pdp(struct sgsn_instance *inst, enum sgsn_cdr_event ev,
 			struct sgsn_pdp_ctx *pdp)
 {
-	FILE *cdr_file;
-	char apni[(pdp->lib ? pdp->lib->apn_use.l : 0) + 1];
-	char ggsn_addr[INET_ADDRSTRLEN + 1];
-	char sgsn_addr[INET_ADDRSTRLEN + 1];
-	char eua_addr[INET6_ADDRSTRLEN + 1];
-	struct tm tm;
-	struct timeval tv;
-	time_t duration;
+	struct sgsn_cdr_writer *writer;
+	struct sgsn_cdr_rec rec;
 	struct timespec tp;
 
-	if (!inst->cfg.cdr.filename)
+	writer = cdr_get_writer(inst);
+	if (!writer)
 		return;
 
-	memset(apni, 0, sizeof(apni));
-	memset(ggsn_addr, 0, sizeof(ggsn_addr));
-	memset(eua_addr, 0, sizeof(eua_addr));
-
+	memset(&rec, 0, sizeof(rec));
+	rec.is_pdp = 1;
+	rec.ev = ev;
+	cdr_set_timestamp(&rec);
+	cdr_set_mm(&rec, pdp->mm);
 
 	if (pdp->lib) {
-		gprs_apn_to_str(apni, pdp->lib->apn_use.v, pdp->lib->apn_use.l);
-		inet_ntop(AF_INET, &pdp->lib->hisaddr0.s_addr, ggsn_addr, sizeof(ggsn_addr));
-		extract_eua(&pdp->lib->eua, eua_addr);
+		if (pdp->lib->apn_use.l < sizeof(rec.apni))
+			gprs_apn_to_str(rec.apni, pdp->lib->apn_use.v,
+					pdp->lib->apn_use.l);
+		inet_ntop(AF_INET, &pdp->lib->hisaddr0.s_addr, rec.ggsn_addr,
+			  sizeof(rec.ggsn_addr));
+		extract_eua(&pdp->lib->eua, rec.eua_addr);
 	}
 
 	if (pdp->ggsn)
-		inet_ntop(AF_INET, &pdp->ggsn->gsn->gsnc.s_addr, sgsn_addr, sizeof(sgsn_addr));
-
-	cdr_file = fopen(inst->cfg.cdr.filename, "a");
-	if (!cdr_file) {
-		LOGP(DGPRS, LOGL_ERROR, "Failed to open %s\n",
-			inst->cfg.cdr.filename);
-		return;
-	}
-
-	maybe_print_header(cdr_file);
+		inet_ntop(AF_INET, &pdp->ggsn->gsn->gsnc.s_addr, rec.sgsn_addr,
+			  sizeof(rec.sgsn_addr));
 
+	/* Check the duration of the PDP context */
 	clock_gettime(CLOCK_MONOTONIC, &tp);
-	gettimeofday(&tv, NULL);
+	rec.duration = tp.tv_sec - pdp->cdr_start.tv_sec;
 
-	/* convert the timestamp to UTC */
-	gmtime_r(&tv.tv_sec, &tm);
+	rec.vol_in = pdp->cdr_bytes_in;
+	rec.vol_out = pdp->cdr_bytes_out;
+	rec.charging_id = pdp->cdr_charging_id;
 
-	/* Check the duration of the PDP context */
-	duration = tp.tv_sec - pdp->cdr_start.tv_sec;
-
-	fprintf(cdr_file,
-		"%04d%02d%02d%02d%02d%02d%03d,%s,%s,%s,%d,%d,%s,%s,%ld,%s,%s,%s,%s,%" PRIu64 ",%" PRIu64 ",%u\n",
-		tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
-		tm.tm_hour, tm.tm_min, tm.tm_sec,
-		(int)(tv.tv_usec / 1000),
-		pdp->mm ? pdp->mm->imsi : "N/A",
-		pdp->mm ? pdp->mm->imei : "N/A",
-		pdp->mm ? pdp->mm->msisdn : "N/A",
-		pdp->mm ? pdp->mm->gb.cell_id : -1,
-		pdp->mm ? pdp->mm->ra.lac : -1,
-		pdp->mm ? pdp->mm->hlr : "N/A",
-		ev,
-		(unsigned long ) duration,
-		ggsn_addr,
-		sgsn_addr,
-		apni,
-		eua_addr,
-		pdp->cdr_bytes_in,
-		pdp->cdr_bytes_out,
-		pdp->cdr_charging_id);
-	fclose(cdr_file);
+	sgsn_cdr_writer_add(writer, &rec);
 }
 
 static void cdr_pdp_timeout(void *_data)
 {
 	struct sgsn_pdp_ctx *pdp = _data;
-	cdr_log_pdp(sgsn, "pdp-periodic", pdp);
+	cdr_log_pdp(sgsn, SGSN_CDR_EV_PDP_PERIODIC, pdp);
 	osmo_timer_schedule(&pdp->cdr_timer, sgsn->cfg.cdr.interval, 0);
 }
 
@@ -212,35 +274,35 @@ static int handle_sgsn_sig(unsigned int subsys, unsigned int signal,
 
 	switch (signal) {
 	case S_SGSN_ATTACH:
-		cdr_log_mm(inst, "attach", signal_data->mm);
+		cdr_log_mm(inst, SGSN_CDR_EV_ATTACH, signal_data->mm);
 		break;
 	case S_SGSN_UPDATE:
-		cdr_log_mm(inst, "update", signal_data->mm);
+		cdr_log_mm(inst, SGSN_CDR_EV_UPDATE, signal_data->mm);
 		break;
 	case S_SGSN_DETACH:
-		cdr_log_mm(inst, "detach", signal_data->mm);
+		cdr_log_mm(inst, SGSN_CDR_EV_DETACH, signal_data->mm);
 		break;
 	case S_SGSN_MM_FREE:
-		cdr_log_mm(inst, "free", signal_data->mm);
+		cdr_log_mm(inst, SGSN_CDR_EV_FREE, signal_data->mm);
 		break;
 	case S_SGSN_PDP_ACT:
 		clock_gettime(CLOCK_MONOTONIC, &signal_data->pdp->cdr_start);
 		signal_data->pdp->cdr_charging_id = signal_data->pdp->lib->cid;
-		cdr_log_pdp(inst, "pdp-act", signal_data->pdp);
+		cdr_log_pdp(inst, SGSN_CDR_EV_PDP_ACT, signal_data->pdp);
 		signal_data->pdp->cdr_timer.cb = cdr_pdp_timeout;
 		signal_data->pdp->cdr_timer.data = signal_data->pdp;
 		osmo_timer_schedule(&signal_data->pdp->cdr_timer, inst->cfg.cdr.interval, 0);
 		break;
 	case S_SGSN_PDP_DEACT:
-		cdr_log_pdp(inst, "pdp-deact", signal_data->pdp);
+		cdr_log_pdp(inst, SGSN_CDR_EV_PDP_DEACT, signal_data->pdp);
 		osmo_timer_del(&signal_data->pdp->cdr_timer);
 		break;
 	case S_SGSN_PDP_TERMINATE:
-		cdr_log_pdp(inst, "pdp-terminate", signal_data->pdp);
+		cdr_log_pdp(inst, SGSN_CDR_EV_PDP_TERMINATE, signal_data->pdp);
 		osmo_timer_del(&signal_data->pdp->cdr_timer);
 		break;
 	case S_SGSN_PDP_FREE:
-		cdr_log_pdp(inst, "pdp-free", signal_data->pdp);
+		cdr_log_pdp(inst, SGSN_CDR_EV_PDP_FREE, signal_data->pdp);
 		osmo_timer_del(&signal_data->pdp->cdr_timer);
 		break;
 	}
@@ -252,7 +314,24 @@ int sgsn_cdr_init(struct sgsn_instance *sgsn)
 {
 	/* register for CDR related events */
 	sgsn->cfg.cdr.interval = 10 * 60;
+	sgsn->cfg.cdr.buffer_size = SGSN_CDR_BUFFER_DEFAULT;
 	osmo_signal_register_handler(SS_SGSN, handle_sgsn_sig, sgsn);
 
 	return 0;
 }
+
+/*! \brief Write out all pending CDRs, e.g. before shutting down */
+void sgsn_cdr_flush(void)
+{
+	if (cdr_writer)
+		sgsn_cdr_writer_flush(cdr_writer);
+}
+
+/*! \brief Get the writer statistics, returns -ENOENT if CDRs are off */
+int sgsn_cdr_stats(struct sgsn_cdr_writer_stats *stats)
+{
+	if (!cdr_writer)
+		return -ENOENT;
+	sgsn_cdr_writer_stats(cdr_writer, stats);
+	return 0;
+}
@@ -0,0 +1,113 @@
+/* Convert binary SGSN CDR files to the CSV format */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <openbsc/sgsn_cdr.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+static int decode_file(const char *path, FILE *in)
+{
+	uint8_t buf[64 * 1024];
+	char line[SGSN_CDR_BIN_MAX_LEN];
+	size_t have = 0;
+	size_t got;
+	unsigned long nr = 0;
+
+	got = fread(buf, 1, SGSN_CDR_BIN_MAGIC_LEN, in);
+	if (got != SGSN_CDR_BIN_MAGIC_LEN
+	    || memcmp(buf, SGSN_CDR_BIN_MAGIC, SGSN_CDR_BIN_MAGIC_LEN) != 0) {
+		fprintf(stderr, "%s: not a binary CDR file\n", path);
+		return -EINVAL;
+	}
+
+	while ((got = fread(buf + have, 1, sizeof(buf) - have, in)) > 0
+	       || have > 0) {
+		size_t off = 0;
+
+		have += got;
+		while (off < have) {
+			struct sgsn_cdr_rec rec;
+			int rc;
+
+			rc = sgsn_cdr_rec_decode(&rec, buf + off, have - off);
+			if (rc == 0)
+				break;
+			if (rc < 0) {
+				fprintf(stderr, "%s: malformed record %lu\n",
+					path, nr);
+				return rc;
+			}
+			off += rc;
+			nr += 1;
+
+			if (sgsn_cdr_rec_to_csv(&rec, line, sizeof(line)) > 0)
+				fputs(line, stdout);
+		}
+
+		if (got == 0 && off < have) {
+			fprintf(stderr, "%s: truncated record %lu\n", path, nr);
+			return -EINVAL;
+		}
+		memmove(buf, buf + off, have - off);
+		have -= off;
+		if (got == 0)
+			break;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+	int failed = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s FILE...\n"
+			"Print binary SGSN CDR files as CSV, use - for stdin\n",
+			argv[0]);
+		return 1;
+	}
+
+	fputs(sgsn_cdr_csv_header, stdout);
+
+	for (i = 1; i < argc; i++) {
+		FILE *in;
+
+		if (!strcmp(argv[i], "-"))
+			in = stdin;
+		else
+			in = fopen(argv[i], "rb");
+		if (!in) {
+			fprintf(stderr, "%s: %s\n", argv[i], strerror(errno));
+			failed = 1;
+			continue;
+		}
+
+		if (decode_file(argv[i], in) < 0)
+			failed = 1;
+
+		if (in != stdin)
+			fclose(in);
+	}
+
+	return failed;
+}
@@ -0,0 +1,655 @@
+/* GPRS SGSN CDR record formats and the CDR file writer */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <openbsc/sgsn_cdr.h>
+
+#include <osmocom/core/bits.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * Record formats
+ */
+
+static const char *sgsn_cdr_event_names[_NUM_SGSN_CDR_EV] = {
+	[SGSN_CDR_EV_ATTACH]		= "attach",
+	[SGSN_CDR_EV_UPDATE]		= "update",
+	[SGSN_CDR_EV_DETACH]		= "detach",
+	[SGSN_CDR_EV_FREE]		= "free",
+	[SGSN_CDR_EV_PDP_ACT]		= "pdp-act",
+	[SGSN_CDR_EV_PDP_DEACT]		= "pdp-deact",
+	[SGSN_CDR_EV_PDP_TERMINATE]	= "pdp-terminate",
+	[SGSN_CDR_EV_PDP_FREE]		= "pdp-free",
+	[SGSN_CDR_EV_PDP_PERIODIC]	= "pdp-periodic",
+};
+
+const char *sgsn_cdr_event_name(enum sgsn_cdr_event ev)
+{
+	if (ev >= _NUM_SGSN_CDR_EV)
+		return "unknown";
+	return sgsn_cdr_event_names[ev];
+}
+
+const char sgsn_cdr_csv_header[] = "timestamp,imsi,imei,msisdn,cell_id,lac,hlr,event,pdp_duration,ggsn_addr,sgsn_addr,apni,eua_addr,vol_in,vol_out,charging_id\n";
+
+int sgsn_cdr_rec_to_csv(const struct sgsn_cdr_rec *rec, char *buf, size_t len)
+{
+	struct tm tm;
+	time_t secs = rec->timestamp_ms / 1000;
+	int rc;
+
+	gmtime_r(&secs, &tm);
+	rc = snprintf(buf, len, "%04d%02d%02d%02d%02d%02d%03d,%s,%s,%s,%d,%d,%s,%s",
+		tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+		tm.tm_hour, tm.tm_min, tm.tm_sec,
+		(int)(rec->timestamp_ms % 1000),
+		rec->imsi,
+		rec->imei,
+		rec->msisdn,
+		rec->cell_id,
+		rec->lac,
+		rec->hlr,
+		sgsn_cdr_event_name(rec->ev));
+	if (rc < 0 || rc >= len)
+		return -ENOSPC;
+
+	if (rec->is_pdp) {
+		int rc2 = snprintf(buf + rc, len - rc,
+			",%lu,%s,%s,%s,%s,%" PRIu64 ",%" PRIu64 ",%u",
+			(unsigned long) rec->duration,
+			rec->ggsn_addr,
+			rec->sgsn_addr,
+			rec->apni,
+			rec->eua_addr,
+			rec->vol_in,
+			rec->vol_out,
+			rec->charging_id);
+		if (rc2 < 0 || rc + rc2 >= len)
+			return -ENOSPC;
+		rc += rc2;
+	}
+
+	if (rc + 1 >= len)
+		return -ENOSPC;
+	buf[rc++] = '\n';
+	buf[rc] = '\0';
+	return rc;
+}
+
+static uint8_t *put_str(uint8_t *p, const char *str, size_t size)
+{
+	size_t len = strnlen(str, OSMO_MIN(size, UINT8_MAX));
+
+	*p++ = len;
+	memcpy(p, str, len);
+	return p + len;
+}
+
+static const uint8_t *get_str(const uint8_t *p, const uint8_t *end,
+			      char *str, size_t size)
+{
+	size_t len;
+
+	if (p >= end)
+		return NULL;
+	len = *p++;
+	if (len >= size || p + len > end)
+		return NULL;
+	memcpy(str, p, len);
+	str[len] = '\0';
+	return p + len;
+}
+
+/*! \brief Encode a CDR in the binary format
+ *  \returns the length of the record or a negative error */
+int sgsn_cdr_rec_encode(const struct sgsn_cdr_rec *rec, uint8_t *buf, size_t len)
+{
+	uint8_t *p = buf;
+
+	/* every string is at most SGSN_CDR_STR_LEN * 2 */
+	if (len < SGSN_CDR_BIN_MAX_LEN)
+		return -ENOSPC;
+
+	p += 2;
+	*p++ = rec->is_pdp ? 1 : 0;
+	*p++ = rec->ev;
+	osmo_store64be(rec->timestamp_ms, p);
+	p += 8;
+	p = put_str(p, rec->imsi, sizeof(rec->imsi));
+	p = put_str(p, rec->imei, sizeof(rec->imei));
+	p = put_str(p, rec->msisdn, sizeof(rec->msisdn));
+	p = put_str(p, rec->hlr, sizeof(rec->hlr));
+	osmo_store32be(rec->cell_id, p);
+	p += 4;
+	osmo_store32be(rec->lac, p);
+	p += 4;
+
+	if (rec->is_pdp) {
+		osmo_store32be(rec->duration, p);
+		p += 4;
+		p = put_str(p, rec->ggsn_addr, sizeof(rec->ggsn_addr));
+		p = put_str(p, rec->sgsn_addr, sizeof(rec->sgsn_addr));
+		p = put_str(p, rec->apni, sizeof(rec->apni));
+		p = put_str(p, rec->eua_addr, sizeof(rec->eua_addr));
+		osmo_store64be(rec->vol_in, p);
+		p += 8;
+		osmo_store64be(rec->vol_out, p);
+		p += 8;
+		osmo_store32be(rec->charging_id, p);
+		p += 4;
+	}
+
+	osmo_store16be(p - buf, buf);
+	return p - buf;
+}
+
+/*! \brief Decode one CDR in the binary format
+ *  \returns the length of the record, 0 if buf holds no complete record,
+ *  or -EINVAL for a malformed record */
+int sgsn_cdr_rec_decode(struct sgsn_cdr_rec *rec, const uint8_t *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	const uint8_t *end;
+	uint16_t rec_len;
+
+	if (len < 2)
+		return 0;
+	rec_len = osmo_load16be(buf);
+	if (rec_len > len)
+		return 0;
+	if (rec_len < 12 + 4 + 8)
+		return -EINVAL;
+	end = buf + rec_len;
+	p += 2;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->is_pdp = *p++;
+	rec->ev = *p++;
+	rec->timestamp_ms = osmo_load64be(p);
+	p += 8;
+	p = get_str(p, end, rec->imsi, sizeof(rec->imsi));
+	if (p)
+		p = get_str(p, end, rec->imei, sizeof(rec->imei));
+	if (p)
+		p = get_str(p, end, rec->msisdn, sizeof(rec->msisdn));
+	if (p)
+		p = get_str(p, end, rec->hlr, sizeof(rec->hlr));
+	if (!p || p + 8 > end)
+		return -EINVAL;
+	rec->cell_id = (int32_t) osmo_load32be(p);
+	p += 4;
+	rec->lac = (int32_t) osmo_load32be(p);
+	p += 4;
+
+	if (!rec->is_pdp)
+		return p == end ? rec_len : -EINVAL;
+
+	if (p + 4 > end)
+		return -EINVAL;
+	rec->duration = osmo_load32be(p);
+	p += 4;
+	p = get_str(p, end, rec->ggsn_addr, sizeof(rec->ggsn_addr));
+	if (p)
+		p = get_str(p, end, rec->sgsn_addr, sizeof(rec->sgsn_addr));
+	if (p)
+		p = get_str(p, end, rec->apni, sizeof(rec->apni));
+	if (p)
+		p = get_str(p, end, rec->eua_addr, sizeof(rec->eua_addr));
+	if (!p || p + 20 != end)
+		return -EINVAL;
+	rec->vol_in = osmo_load64be(p);
+	p += 8;
+	rec->vol_out = osmo_load64be(p);
+	p += 8;
+	rec->charging_id = osmo_load32be(p);
+
+	return rec_len;
+}
+
+/*
+ * The writer
+ *
+ * The main loop formats each CDR into a ring of bytes and returns right
+ * away. A thread of its own writes the ring to the file, so that neither
+ * opening, writing nor rotating the file blocks the SGSN. The ring only
+ * ever contains complete records, so rotation happens on record
+ * boundaries. The thread must not log or use talloc, neither of which is
+ * thread safe; errors are counted and reported by the main loop.
+ */
+
+struct writer_cfg {
+	char filename[PATH_MAX];
+	enum sgsn_cdr_format format;
+	unsigned int rotate_size;
+	unsigned int rotate_interval;
+};
+
+struct sgsn_cdr_writer {
+	pthread_t thread;
+	int running;
+
+	pthread_mutex_t lock;
+	/* signalled when records were added or the config changed */
+	pthread_cond_t wake;
+	/* signalled when the thread has written everything */
+	pthread_cond_t drained;
+
+	uint8_t *ring;
+	size_t ring_size;
+	/* byte positions, they only ever grow. Records are added at head
+	 * by the main loop and written from tail by the thread. */
+	uint64_t head;
+	uint64_t tail;
+
+	/* the format records are added in, only used by the main loop */
+	enum sgsn_cdr_format format;
+
+	/* the config to apply once the thread reaches new_cfg_pos */
+	struct writer_cfg new_cfg;
+	uint64_t new_cfg_pos;
+	int new_cfg_pending;
+
+	int stop;
+	struct sgsn_cdr_writer_stats stats;
+
+	/* only used by the thread */
+	struct writer_cfg cfg;
+	int fd;
+	off_t file_size;
+	time_t file_opened;
+};
+
+static void writer_close(struct sgsn_cdr_writer *w)
+{
+	if (w->fd < 0)
+		return;
+	fsync(w->fd);
+	close(w->fd);
+	w->fd = -1;
+}
+
+static int write_all(int fd, const uint8_t *data, size_t len)
+{
+	while (len > 0) {
+		ssize_t rc = write(fd, data, len);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		data += rc;
+		len -= rc;
+	}
+	return 0;
+}
+
+static void writer_rotate(struct sgsn_cdr_writer *w);
+
+static const char *writer_header(const struct writer_cfg *cfg, size_t *len)
+{
+	if (cfg->format == SGSN_CDR_FMT_BINARY) {
+		*len = SGSN_CDR_BIN_MAGIC_LEN;
+		return SGSN_CDR_BIN_MAGIC;
+	}
+	*len = strlen(sgsn_cdr_csv_header);
+	return sgsn_cdr_csv_header;
+}
+
+/* Check that an existing file starts with the header of the format */
+static int writer_header_ok(struct sgsn_cdr_writer *w)
+{
+	char buf[256];
+	const char *hdr;
+	size_t len;
+
+	hdr = writer_header(&w->cfg, &len);
+	if (len > sizeof(buf) || pread(w->fd, buf, len, 0) != (ssize_t) len)
+		return 0;
+	return memcmp(buf, hdr, len) == 0;
+}
+
+static int writer_open(struct sgsn_cdr_writer *w)
+{
+	struct stat st;
+	const char *hdr;
+	size_t len;
+
+	w->fd = open(w->cfg.filename, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (w->fd < 0)
+		return -errno;
+	if (fstat(w->fd, &st) < 0)
+		st.st_size = 0;
+	w->file_size = st.st_size;
+	w->file_opened = time(NULL);
+
+	if (w->file_size != 0) {
+		if (writer_header_ok(w))
+			return 0;
+
+		/* written in another format, never mix two in one file */
+		writer_rotate(w);
+		w->fd = open(w->cfg.filename, O_RDWR | O_CREAT | O_APPEND, 0644);
+		if (w->fd < 0)
+			return -errno;
+		if (fstat(w->fd, &st) < 0 || st.st_size != 0)
+			return -EIO;
+	}
+
+	/* a new file, start it with the header of the format */
+	hdr = writer_header(&w->cfg, &len);
+	if (write_all(w->fd, (const uint8_t *) hdr, len) < 0)
+		return -EIO;
+	w->file_size = len;
+	return 0;
+}
+
+/* Move the current file aside as <filename>.<UTC time>, called without the
+ * lock held */
+static void writer_rotate(struct sgsn_cdr_writer *w)
+{
+	char path[PATH_MAX + 32];
+	struct tm tm;
+	time_t now = time(NULL);
+	int rc;
+	int i;
+
+	writer_close(w);
+
+	gmtime_r(&now, &tm);
+	for (i = 0; i < 100; i++) {
+		int len = snprintf(path, sizeof(path), "%s.%04d%02d%02d%02d%02d%02d",
+				   w->cfg.filename,
+				   tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+				   tm.tm_hour, tm.tm_min, tm.tm_sec);
+		if (i > 0)
+			snprintf(path + len, sizeof(path) - len, "-%d", i);
+		if (access(path, F_OK) != 0)
+			break;
+	}
+
+	rc = rename(w->cfg.filename, path);
+
+	pthread_mutex_lock(&w->lock);
+	if (rc == 0)
+		w->stats.rotations += 1;
+	else
+		w->stats.write_errors += 1;
+	pthread_mutex_unlock(&w->lock);
+}
+
+static int writer_need_rotate(struct sgsn_cdr_writer *w, time_t now)
+{
+	size_t hdr_len;
+
+	writer_header(&w->cfg, &hdr_len);
+	if (w->fd < 0 || w->file_size <= hdr_len)
+		return 0;
+	if (w->cfg.rotate_size && w->file_size >= w->cfg.rotate_size)
+		return 1;
+	if (w->cfg.rotate_interval
+	    && now - w->file_opened >= w->cfg.rotate_interval)
+		return 1;
+	return 0;
+}
+
+/* Write the ring from tail up to end, called without the lock held */
+static int writer_write(struct sgsn_cdr_writer *w, uint64_t end)
+{
+	uint64_t pos = w->tail;
+	int rc;
+
+	if (!w->cfg.filename[0])
+		return 0;
+
+	if (writer_need_rotate(w, time(NULL)))
+		writer_rotate(w);
+
+	if (w->fd < 0) {
+		rc = writer_open(w);
+		if (rc < 0) {
+			writer_close(w);
+			return rc;
+		}
+	}
+
+	while (pos < end) {
+		size_t off = pos % w->ring_size;
+		size_t len = OSMO_MIN(end - pos, w->ring_size - off);
+
+		rc = write_all(w->fd, w->ring + off, len);
+		if (rc < 0) {
+			writer_close(w);
+			return rc;
+		}
+		pos += len;
+		w->file_size += len;
+	}
+	return 0;
+}
+
+static void *writer_thread(void *data)
+{
+	struct sgsn_cdr_writer *w = data;
+
+	pthread_mutex_lock(&w->lock);
+	while (1) {
+		uint64_t end;
+		int rc;
+
+		if (w->new_cfg_pending && w->tail == w->new_cfg_pos) {
+			writer_close(w);
+			w->cfg = w->new_cfg;
+			w->new_cfg_pending = 0;
+			/* a second configure call may be waiting for this */
+			pthread_cond_broadcast(&w->drained);
+		}
+
+		if (w->tail == w->head) {
+			struct timespec ts;
+
+			pthread_cond_broadcast(&w->drained);
+			if (w->stop)
+				break;
+
+			/* wake up once a second for time based rotation */
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += 1;
+			pthread_cond_timedwait(&w->wake, &w->lock, &ts);
+
+			if (w->tail == w->head && !w->new_cfg_pending
+			    && writer_need_rotate(w, time(NULL))) {
+				pthread_mutex_unlock(&w->lock);
+				writer_rotate(w);
+				pthread_mutex_lock(&w->lock);
+			}
+			continue;
+		}
+
+		/* do not write past a pending config change */
+		end = w->head;
+		if (w->new_cfg_pending)
+			end = w->new_cfg_pos;
+		pthread_mutex_unlock(&w->lock);
+
+		rc = writer_write(w, end);
+
+		pthread_mutex_lock(&w->lock);
+		if (rc < 0)
+			w->stats.write_errors += 1;
+		else
+			w->stats.bytes_written += end - w->tail;
+		/* on errors the records are lost, the ring has to move on */
+		w->tail = end;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	writer_close(w);
+	return NULL;
+}
+
+struct sgsn_cdr_writer *sgsn_cdr_writer_alloc(void *ctx, size_t ring_size)
+{
+	struct sgsn_cdr_writer *w;
+
+	w = talloc_zero(ctx, struct sgsn_cdr_writer);
+	if (!w)
+		return NULL;
+	w->ring = talloc_size(w, ring_size);
+	if (!w->ring) {
+		talloc_free(w);
+		return NULL;
+	}
+	w->ring_size = ring_size;
+	w->fd = -1;
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->wake, NULL);
+	pthread_cond_init(&w->drained, NULL);
+	return w;
+}
+
+/*! \brief Write out all queued records, stop the thread and free w */
+void sgsn_cdr_writer_free(struct sgsn_cdr_writer *w)
+{
+	if (w->running) {
+		pthread_mutex_lock(&w->lock);
+		w->stop = 1;
+		pthread_cond_signal(&w->wake);
+		pthread_mutex_unlock(&w->lock);
+		pthread_join(w->thread, NULL);
+	}
+	pthread_cond_destroy(&w->drained);
+	pthread_cond_destroy(&w->wake);
+	pthread_mutex_destroy(&w->lock);
+	talloc_free(w);
+}
+
+/*! \brief Change file name, format or rotation
+ *
+ * Records added before the call are still written with the previous
+ * config, the thread is started on the first call. Until then, records
+ * are queued in the CSV format. A file that holds records of another
+ * format is rotated away before the first record is written to it.
+ * Only one change is pending at a time, a second call waits until the
+ * thread has written everything queued in the old config. */
+int sgsn_cdr_writer_configure(struct sgsn_cdr_writer *w,
+			      const struct sgsn_cdr_writer_cfg *cfg)
+{
+	struct writer_cfg new_cfg;
+	int rc = 0;
+
+	memset(&new_cfg, 0, sizeof(new_cfg));
+	if (cfg->filename) {
+		if (strlen(cfg->filename) >= sizeof(new_cfg.filename))
+			return -ENAMETOOLONG;
+		strcpy(new_cfg.filename, cfg->filename);
+	}
+	new_cfg.format = cfg->format;
+	new_cfg.rotate_size = cfg->rotate_size;
+	new_cfg.rotate_interval = cfg->rotate_interval;
+
+	pthread_mutex_lock(&w->lock);
+	while (w->new_cfg_pending) {
+		pthread_cond_signal(&w->wake);
+		pthread_cond_wait(&w->drained, &w->lock);
+	}
+	w->new_cfg = new_cfg;
+	/* the first config also applies to what was queued before */
+	w->new_cfg_pos = w->running ? w->head : w->tail;
+	w->new_cfg_pending = 1;
+	w->format = cfg->format;
+	pthread_cond_signal(&w->wake);
+	pthread_mutex_unlock(&w->lock);
+
+	if (!w->running) {
+		rc = -pthread_create(&w->thread, NULL, writer_thread, w);
+		if (rc == 0)
+			w->running = 1;
+	}
+	return rc;
+}
+
+/*! \brief Queue one record for writing
+ *  \returns 0 or -ENOSPC if the ring is full and the record was dropped */
+int sgsn_cdr_writer_add(struct sgsn_cdr_writer *w,
+			const struct sgsn_cdr_rec *rec)
+{
+	uint8_t buf[SGSN_CDR_BIN_MAX_LEN];
+	size_t off;
+	int len;
+
+	if (w->format == SGSN_CDR_FMT_BINARY)
+		len = sgsn_cdr_rec_encode(rec, buf, sizeof(buf));
+	else
+		len = sgsn_cdr_rec_to_csv(rec, (char *) buf, sizeof(buf));
+	if (len < 0)
+		return len;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->ring_size - (w->head - w->tail) < len) {
+		w->stats.dropped += 1;
+		pthread_mutex_unlock(&w->lock);
+		return -ENOSPC;
+	}
+
+	off = w->head % w->ring_size;
+	if (off + len <= w->ring_size)
+		memcpy(w->ring + off, buf, len);
+	else {
+		size_t first = w->ring_size - off;
+		memcpy(w->ring + off, buf, first);
+		memcpy(w->ring, buf + first, len - first);
+	}
+	w->head += len;
+	w->stats.records += 1;
+	pthread_cond_signal(&w->wake);
+	pthread_mutex_unlock(&w->lock);
+
+	return 0;
+}
+
+/*! \brief Wait until all queued records have been written */
+void sgsn_cdr_writer_flush(struct sgsn_cdr_writer *w)
+{
+	if (!w->running)
+		return;
+
+	pthread_mutex_lock(&w->lock);
+	while (w->tail != w->head || w->new_cfg_pending) {
+		pthread_cond_signal(&w->wake);
+		pthread_cond_wait(&w->drained, &w->lock);
+	}
+	pthread_mutex_unlock(&w->lock);
+}
+
+void sgsn_cdr_writer_stats(struct sgsn_cdr_writer *w,
+			   struct sgsn_cdr_writer_stats *stats)
+{
+	pthread_mutex_lock(&w->lock);
+	*stats = w->stats;
+	pthread_mutex_unlock(&w->lock);
+}
@@ -39,6 +39,7 @@
 #include <osmocom/core/talloc.h>
 #include <osmocom/core/select.h>
 #include <osmocom/core/rate_ctr.h>
+#include <osmocom/core/bits.h>
 #include <osmocom/gprs/gprs_bssgp.h>
 #include <osmocom/gsm/protocol/gsm_04_08_gprs.h>
 
@@ -493,6 +494,9 @@ int sgsn_ranap_rab_ass_resp(struct sgsn_mm_ctx *ctx, RANAP_RAB_SetupOrModifiedIt
 	if (require_pdp_update)
 		gtp_update_context(pdp->ggsn->gsn, pdp->lib, pdp, &pdp->lib->hisaddr0);
 
+	/* Hand over what arrived while the UE was paged */
+	sgsn_mm_ctx_dl_flush(ctx, pdp->nsapi);
+
 	if (pdp->state != PDP_STATE_CR_CONF) {
 		send_act_pdp_cont_acc(pdp);
 		pdp->state = PDP_STATE_CR_CONF;
@@ -633,13 +637,107 @@ static int cb_extheader_ind(struct sockaddr_in *peer)
 }
 
 /* Called whenever we recive a DATA packet */
+static void count_dl(struct sgsn_pdp_ctx *pdp, unsigned int len)
+{
+	struct sgsn_mm_ctx *mm = pdp->mm;
+
+	rate_ctr_inc(&pdp->ctrg->ctr[PDP_CTR_PKTS_UDATA_OUT]);
+	rate_ctr_add(&pdp->ctrg->ctr[PDP_CTR_BYTES_UDATA_OUT], len);
+	rate_ctr_inc(&mm->ctrg->ctr[GMM_CTR_PKTS_UDATA_OUT]);
+	rate_ctr_add(&mm->ctrg->ctr[GMM_CTR_BYTES_UDATA_OUT], len);
+
+	/* It is easier to have a global count */
+	pdp->cdr_bytes_out += len;
+}
+
+static int tx_dl_gb(struct sgsn_pdp_ctx *pdp, const uint8_t *data,
+		    unsigned int len)
+{
+	struct sgsn_mm_ctx *mm = pdp->mm;
+	struct msgb *msg;
+	uint8_t *ud;
+
+	msg = msgb_alloc_headroom(len+256, 128, "GTP->SNDCP");
+	ud = msgb_put(msg, len);
+	memcpy(ud, data, len);
+
+	msgb_tlli(msg) = mm->gb.tlli;
+	msgb_bvci(msg) = mm->gb.bvci;
+	msgb_nsei(msg) = mm->gb.nsei;
+
+	count_dl(pdp, len);
+
+	return sndcp_unitdata_req(msg, &mm->gb.llme->lle[pdp->sapi],
+				  pdp->nsapi, mm);
+}
+
+#ifdef BUILD_IU
+/* Send an N-PDU straight to the RNC, as the GGSN would once the RAB is
+ * up again: the RNC's user plane address and TEI are in gsnlu and
+ * teid_own, see sgsn_ranap_rab_ass_resp() */
+static int tx_dl_iu(struct sgsn_pdp_ctx *pdp, const uint8_t *data,
+		    unsigned int len)
+{
+	struct sockaddr_in addr;
+	struct iovec iov[2];
+	struct msghdr mh;
+	uint8_t hdr[8];
+
+	if (pdp->lib->gsnlu.l != 4)
+		return -ENOTSUP;
+
+	/* GTPv1-U header without optional fields, G-PDU */
+	hdr[0] = 0x30;
+	hdr[1] = 0xff;
+	osmo_store16be(len, &hdr[2]);
+	osmo_store32be(pdp->lib->teid_own, &hdr[4]);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(GTP1U_PORT);
+	memcpy(&addr.sin_addr, pdp->lib->gsnlu.v, 4);
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void *) data;
+	iov[1].iov_len = len;
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_name = &addr;
+	mh.msg_namelen = sizeof(addr);
+	mh.msg_iov = iov;
+	mh.msg_iovlen = 2;
+
+	if (sendmsg(pdp->ggsn->gsn->fd1u, &mh, 0) < 0) {
+		LOGPDPCTXP(LOGL_ERROR, pdp, "Failed to send buffered N-PDU "
+			   "to the RNC: %s\n", strerror(errno));
+		return -errno;
+	}
+
+	count_dl(pdp, len);
+	return 0;
+}
+#endif
+
+/* Send a downlink N-PDU that was kept while the MS was paged */
+int sgsn_pdp_tx_dl(struct sgsn_pdp_ctx *pdp, const uint8_t *data,
+		   unsigned int len)
+{
+	if (pdp->mm->ran_type == MM_CTX_T_UTRAN_Iu) {
+#ifdef BUILD_IU
+		return tx_dl_iu(pdp, data, len);
+#else
+		return -ENOTSUP;
+#endif
+	}
+
+	return tx_dl_gb(pdp, data, len);
+}
+
 static int cb_data_ind(struct pdp_t *lib, void *packet, unsigned int len)
 {
 	struct bssgp_paging_info pinfo;
 	struct sgsn_pdp_ctx *pdp;
 	struct sgsn_mm_ctx *mm;
-	struct msgb *msg;
-	uint8_t *ud;
 
 	DEBUGP(DGPRS, "GTP DATA IND from GGSN, length=%u\n", len);
 
@@ -658,9 +756,10 @@ static int cb_data_ind(struct pdp_t *lib, void *packet, unsigned int len)
 
 	if (mm->ran_type == MM_CTX_T_UTRAN_Iu) {
 #ifdef BUILD_IU
-		/* Ignore the packet for now and page the UE to get the RAB
-		 * reestablished */
-		iu_page_ps(mm->imsi, &mm->p_tmsi, mm->ra.lac, mm->ra.rac);
+		/* Keep the packet until the RAB is reestablished, page the
+		 * UE only for the first one */
+		if (sgsn_mm_ctx_dl_enqueue(mm, pdp->nsapi, packet, len))
+			iu_page_ps(mm->imsi, &mm->p_tmsi, mm->ra.lac, mm->ra.rac);
 
 		return 0;
 #else
@@ -668,17 +767,12 @@ static int cb_data_ind(struct pdp_t *lib, void *packet, unsigned int len)
 #endif
 	}
 
-	msg = msgb_alloc_headroom(len+256, 128, "GTP->SNDCP");
-	ud = msgb_put(msg, len);
-	memcpy(ud, packet, len);
-
-	msgb_tlli(msg) = mm->gb.tlli;
-	msgb_bvci(msg) = mm->gb.bvci;
-	msgb_nsei(msg) = mm->gb.nsei;
-
 	switch (mm->mm_state) {
 	case GMM_REGISTERED_SUSPENDED:
-		/* initiate PS PAGING procedure */
+		/* Keep the packet until the MS resumes, only the first one
+		 * initiates the PS PAGING procedure */
+		if (!sgsn_mm_ctx_dl_enqueue(mm, pdp->nsapi, packet, len))
+			return 0;
 		memset(&pinfo, 0, sizeof(pinfo));
 		pinfo.mode = BSSGP_PAGING_PS;
 		pinfo.scope = BSSGP_PAGING_BVCI;
@@ -689,27 +783,16 @@ static int cb_data_ind(struct pdp_t *lib, void *packet, unsigned int len)
 		pinfo.qos[0] = 0; // FIXME
 		bssgp_tx_paging(mm->gb.nsei, 0, &pinfo);
 		rate_ctr_inc(&mm->ctrg->ctr[GMM_CTR_PAGING_PS]);
-		/* FIXME: queue the packet we received from GTP */
-		break;
+		return 0;
 	case GMM_REGISTERED_NORMAL:
 		break;
 	default:
 		LOGP(DGPRS, LOGL_ERROR, "GTP DATA IND for TLLI %08X in state "
 			"%u\n", mm->gb.tlli, mm->mm_state);
-		msgb_free(msg);
 		return -1;
 	}
 
-	rate_ctr_inc(&pdp->ctrg->ctr[PDP_CTR_PKTS_UDATA_OUT]);
-	rate_ctr_add(&pdp->ctrg->ctr[PDP_CTR_BYTES_UDATA_OUT], len);
-	rate_ctr_inc(&mm->ctrg->ctr[GMM_CTR_PKTS_UDATA_OUT]);
-	rate_ctr_add(&mm->ctrg->ctr[GMM_CTR_BYTES_UDATA_OUT], len);
-
-	/* It is easier to have a global count */
-	pdp->cdr_bytes_out += len;
-
-	return sndcp_unitdata_req(msg, &mm->gb.llme->lle[pdp->sapi],
-				  pdp->nsapi, mm);
+	return tx_dl_gb(pdp, packet, len);
 }
 
 /* Called by SNDCP when it has received/re-assembled a N-PDU */
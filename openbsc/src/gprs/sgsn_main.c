@@ -136,15 +136,17 @@ int bssgp_prim_cb(struct osmo_prim_hdr *oph, void *ctx)
 	return 0;
 }
 
+/* set from the signal handler, the main loop shuts down */
+static volatile sig_atomic_t quit_requested;
+
 static void signal_handler(int signal)
 {
 	fprintf(stdout, "signal %u received\n", signal);
 
 	switch (signal) {
 	case SIGINT:
-		osmo_signal_dispatch(SS_L_GLOBAL, S_L_GLOBAL_SHUTDOWN, NULL);
-		sleep(1);
-		exit(0);
+		/* the CDR writer takes locks, leave it to the main loop */
+		quit_requested = 1;
 		break;
 	case SIGABRT:
 		/* in case of abort, we want to obtain a talloc report
@@ -446,12 +448,14 @@ int main(int argc, char **argv)
 		}
 	}
 
-	while (1) {
+	while (!quit_requested) {
 		rc = osmo_select_main(0);
 		if (rc < 0)
 			exit(3);
 	}
 
-	/* not reached */
+	osmo_signal_dispatch(SS_L_GLOBAL, S_L_GLOBAL_SHUTDOWN, NULL);
+	sgsn_cdr_flush();
+	sleep(1);
 	exit(0);
 }
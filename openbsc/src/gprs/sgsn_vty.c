@@ -23,6 +23,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <time.h>
+#include <inttypes.h>
 
 #include <osmocom/core/talloc.h>
 #include <osmocom/core/utils.h>
@@ -31,6 +32,8 @@
 
 #include <openbsc/debug.h>
 #include <openbsc/sgsn.h>
+#include <openbsc/sgsn_cdr.h>
+#include <openbsc/sgsn_ares_cache.h>
 #include <osmocom/gprs/gprs_ns.h>
 #include <openbsc/gprs_sgsn.h>
 #include <openbsc/vty.h>
@@ -188,6 +191,7 @@ static int config_write_sgsn(struct vty *vty)
 	struct imsi_acl_entry *acl;
 	struct apn_ctx *actx;
 	struct ares_addr_node *server;
+	unsigned int i;
 
 	vty_out(vty, "sgsn%s", VTY_NEWLINE);
 
@@ -209,6 +213,10 @@ static int config_write_sgsn(struct vty *vty)
 
 	for (server = sgsn->ares_servers; server; server = server->next)
 		vty_out(vty, " grx-dns-add %s%s", inet_ntoa(server->addr.addr4), VTY_NEWLINE);
+	vty_out(vty, " grx-dns-cache max-ttl %u%s",
+		g_cfg->dns_cache.max_ttl, VTY_NEWLINE);
+	vty_out(vty, " grx-dns-cache negative-ttl %u%s",
+		g_cfg->dns_cache.neg_ttl, VTY_NEWLINE);
 
 	if (g_cfg->cipher != GPRS_ALGO_GEA0)
 		vty_out(vty, " encryption %s%s",
@@ -220,9 +228,27 @@ static int config_write_sgsn(struct vty *vty)
 	if (g_cfg->gsup_server_port)
 		vty_out(vty, " gsup remote-port %d%s",
 			g_cfg->gsup_server_port, VTY_NEWLINE);
+	for (i = 0; i < g_cfg->gsup_extra_servers.num; i++) {
+		struct sockaddr_in *sin = &g_cfg->gsup_extra_servers.addr[i];
+		vty_out(vty, " gsup remote-add %s %u%s",
+			inet_ntoa(sin->sin_addr), ntohs(sin->sin_port),
+			VTY_NEWLINE);
+	}
+	vty_out(vty, " gsup connections %u%s",
+		g_cfg->gsup_connections, VTY_NEWLINE);
+	vty_out(vty, " gsup max-inflight %u%s",
+		g_cfg->gsup_max_inflight, VTY_NEWLINE);
+	vty_out(vty, " gsup request-timeout %u%s",
+		g_cfg->gsup_req_timeout, VTY_NEWLINE);
 	vty_out(vty, " auth-policy %s%s",
 		get_value_string(sgsn_auth_pol_strs, g_cfg->auth_policy),
 		VTY_NEWLINE);
+	vty_out(vty, " auth-prefetch low-water %u%s",
+		g_cfg->auth_prefetch.low_water, VTY_NEWLINE);
+	vty_out(vty, " auth-prefetch max-pending %u%s",
+		g_cfg->auth_prefetch.max_pending, VTY_NEWLINE);
+	vty_out(vty, " auth-prefetch max-subscribers %u%s",
+		g_cfg->auth_prefetch.max_subscribers, VTY_NEWLINE);
 
 	vty_out(vty, " gsup oap-id %d%s",
 		(int)g_cfg->oap.client_id, VTY_NEWLINE);
@@ -255,6 +281,20 @@ static int config_write_sgsn(struct vty *vty)
 	else
 		vty_out(vty, " no cdr filename%s", VTY_NEWLINE);
 	vty_out(vty, " cdr interval %d%s", g_cfg->cdr.interval, VTY_NEWLINE);
+	vty_out(vty, " cdr format %s%s",
+		g_cfg->cdr.format == SGSN_CDR_FMT_BINARY ? "binary" : "csv",
+		VTY_NEWLINE);
+	vty_out(vty, " cdr rotate size %u%s", g_cfg->cdr.rotate_size,
+		VTY_NEWLINE);
+	vty_out(vty, " cdr rotate interval %u%s", g_cfg->cdr.rotate_interval,
+		VTY_NEWLINE);
+	vty_out(vty, " cdr buffer-size %u%s", g_cfg->cdr.buffer_size,
+		VTY_NEWLINE);
+
+	vty_out(vty, " paging-buffer max-bytes %u%s",
+		g_cfg->paging_buffer.max_bytes, VTY_NEWLINE);
+	vty_out(vty, " paging-buffer max-age %u%s",
+		g_cfg->paging_buffer.max_age, VTY_NEWLINE);
 
 	vty_out(vty, " timer t3312 %d%s", g_cfg->timers.T3312, VTY_NEWLINE);
 	vty_out(vty, " timer t3322 %d%s", g_cfg->timers.T3322, VTY_NEWLINE);
@@ -383,6 +423,30 @@ DEFUN(cfg_grx_ggsn, cfg_grx_ggsn_cmd,
 	return CMD_SUCCESS;
 }
 
+#define DNS_CACHE_STR "Cache DNS answers for the GGSN lookup\n"
+
+DEFUN(cfg_grx_dns_cache_max_ttl, cfg_grx_dns_cache_max_ttl_cmd,
+	"grx-dns-cache max-ttl <0-86400>",
+	DNS_CACHE_STR "Limit how long an answer is kept\n"
+	"Seconds, 0 to disable the cache\n")
+{
+	g_cfg->dns_cache.max_ttl = atoi(argv[0]);
+	if (sgsn->ares_cache)
+		sgsn->ares_cache->max_ttl = g_cfg->dns_cache.max_ttl;
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_grx_dns_cache_neg_ttl, cfg_grx_dns_cache_neg_ttl_cmd,
+	"grx-dns-cache negative-ttl <0-3600>",
+	DNS_CACHE_STR "How long a name that does not exist is remembered\n"
+	"Seconds, 0 to not cache such answers\n")
+{
+	g_cfg->dns_cache.neg_ttl = atoi(argv[0]);
+	if (sgsn->ares_cache)
+		sgsn->ares_cache->neg_ttl = g_cfg->dns_cache.neg_ttl;
+	return CMD_SUCCESS;
+}
+
 #define APN_STR	"Configure the information per APN\n"
 #define APN_GW_STR "The APN gateway name optionally prefixed by '*' (wildcard)\n"
 
@@ -469,6 +533,9 @@ static void vty_dump_mmctx(struct vty *vty, const char *pfx,
 		get_value_string(gprs_mm_st_strs, mm->mm_state),
 		mm->ra.mcc, mm->ra.mnc, mm->ra.lac, mm->ra.rac,
 		mm->gb.cell_id, VTY_NEWLINE);
+	if (!llist_empty(&mm->dl_buf))
+		vty_out(vty, "%s  Downlink kept for paging: %u bytes%s",
+			pfx, mm->dl_buf_bytes, VTY_NEWLINE);
 
 	vty_out_rate_ctr_group(vty, " ", mm->ctrg);
 
@@ -483,13 +550,48 @@ static void vty_dump_mmctx(struct vty *vty, const char *pfx,
 DEFUN(show_sgsn, show_sgsn_cmd, "show sgsn",
       SHOW_STR "Display information about the SGSN")
 {
+	struct sgsn_cdr_writer_stats cdr_stats;
+
 	if (sgsn->gsup_client) {
-		struct ipa_client_conn *link = sgsn->gsup_client->link;
-		vty_out(vty,
-			"  Remote authorization: %sconnected to %s:%d via GSUP%s",
-			sgsn->gsup_client->is_connected ? "" : "not ",
-			link->addr, link->port,
-			VTY_NEWLINE);
+		struct gsup_client *gsupc = sgsn->gsup_client;
+		struct gsup_client_conn *conn;
+
+		llist_for_each_entry(conn, &gsupc->conns, list)
+			vty_out(vty,
+				"  Remote authorization: %sconnected to %s:%d via GSUP, "
+				"%u requests outstanding%s",
+				conn->is_connected ? "" : "not ",
+				conn->link->addr, conn->link->port,
+				conn->num_inflight, VTY_NEWLINE);
+		vty_out(vty, "  GSUP requests: %u outstanding, %u queued, "
+			"%" PRIu64 " sent, %" PRIu64 " answered, "
+			"%" PRIu64 " timed out, %" PRIu64 " dropped, "
+			"%" PRIu64 " unmatched answers%s",
+			gsupc->num_inflight, gsupc->num_queued,
+			gsupc->stats.sent, gsupc->stats.answered,
+			gsupc->stats.timeouts, gsupc->stats.dropped,
+			gsupc->stats.unmatched, VTY_NEWLINE);
+	}
+	if (sgsn_cdr_stats(&cdr_stats) == 0)
+		vty_out(vty, "  CDRs: %" PRIu64 " queued, %" PRIu64 " dropped, "
+			"%" PRIu64 " bytes written, %" PRIu64 " rotations, "
+			"%" PRIu64 " write errors%s",
+			cdr_stats.records, cdr_stats.dropped,
+			cdr_stats.bytes_written, cdr_stats.rotations,
+			cdr_stats.write_errors, VTY_NEWLINE);
+	if (g_cfg->auth_prefetch.low_water > 0)
+		vty_out(vty, "  Auth tuple refills outstanding: %u%s",
+			sgsn_auth_prefetch_pending(), VTY_NEWLINE);
+	if (sgsn->ares_cache) {
+		struct rate_ctr *ctr = sgsn->ares_cache->ctrg->ctr;
+		vty_out(vty, "  GRX DNS cache: %u entries, %" PRIu64 " hits, "
+			"%" PRIu64 " negative hits, %" PRIu64 " misses, "
+			"%" PRIu64 " coalesced%s",
+			sgsn->ares_cache->num_entries,
+			ctr[ARES_CACHE_CTR_HIT].current,
+			ctr[ARES_CACHE_CTR_NEG_HIT].current,
+			ctr[ARES_CACHE_CTR_MISS].current,
+			ctr[ARES_CACHE_CTR_COALESCED].current, VTY_NEWLINE);
 	}
 	/* FIXME: statistics */
 	return CMD_SUCCESS;
@@ -637,6 +739,36 @@ DEFUN(cfg_auth_policy, cfg_auth_policy_cmd,
 	return CMD_SUCCESS;
 }
 
+#define AUTH_PREFETCH_STR "Refill authentication tuples in the background\n"
+
+DEFUN(cfg_auth_prefetch_low_water, cfg_auth_prefetch_low_water_cmd,
+	"auth-prefetch low-water <0-4>",
+	AUTH_PREFETCH_STR "Refill once this many unused tuples are left\n"
+	"Number of tuples, 0 to only request tuples when they are needed\n")
+{
+	g_cfg->auth_prefetch.low_water = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_auth_prefetch_max_pending, cfg_auth_prefetch_max_pending_cmd,
+	"auth-prefetch max-pending <1-10000>",
+	AUTH_PREFETCH_STR "Limit the refills outstanding at the HLR\n"
+	"Number of requests\n")
+{
+	g_cfg->auth_prefetch.max_pending = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_auth_prefetch_max_subscr, cfg_auth_prefetch_max_subscr_cmd,
+	"auth-prefetch max-subscribers <1-1000000>",
+	AUTH_PREFETCH_STR "Limit the subscribers keeping unused tuples, "
+	"the least recently authenticated lose theirs first\n"
+	"Number of subscribers\n")
+{
+	g_cfg->auth_prefetch.max_subscribers = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
 /* Subscriber */
 #include <openbsc/gsm_subscriber.h>
 
@@ -979,6 +1111,114 @@ DEFUN(cfg_gsup_remote_port, cfg_gsup_remote_port_cmd,
 	return CMD_SUCCESS;
 }
 
+static int gsup_server_find(const struct in_addr *addr, uint16_t port)
+{
+	unsigned int i;
+
+	for (i = 0; i < g_cfg->gsup_extra_servers.num; i++) {
+		struct sockaddr_in *sin = &g_cfg->gsup_extra_servers.addr[i];
+		if (sin->sin_addr.s_addr == addr->s_addr &&
+		    sin->sin_port == htons(port))
+			return i;
+	}
+	return -1;
+}
+
+DEFUN(cfg_gsup_remote_add, cfg_gsup_remote_add_cmd,
+	"gsup remote-add A.B.C.D <1-65535>",
+	"GSUP Parameters\n"
+	"Add another GSUP server, requests are spread across all of them\n"
+	"IPv4 Address\n" "Remote TCP port\n")
+{
+	struct sockaddr_in *sin;
+	struct in_addr addr;
+	uint16_t port = atoi(argv[1]);
+
+	if (!inet_aton(argv[0], &addr)) {
+		vty_out(vty, "%% Invalid address %s%s", argv[0], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	if (gsup_server_find(&addr, port) >= 0)
+		return CMD_SUCCESS;
+	if (g_cfg->gsup_extra_servers.num >= SGSN_GSUP_MAX_SERVERS) {
+		vty_out(vty, "%% Only %d additional GSUP servers are supported%s",
+			SGSN_GSUP_MAX_SERVERS, VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	sin = &g_cfg->gsup_extra_servers.addr[g_cfg->gsup_extra_servers.num++];
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_addr = addr;
+	sin->sin_port = htons(port);
+
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_gsup_remote_add, cfg_no_gsup_remote_add_cmd,
+	"no gsup remote-add A.B.C.D <1-65535>",
+	NO_STR "GSUP Parameters\n"
+	"Remove an additional GSUP server\n"
+	"IPv4 Address\n" "Remote TCP port\n")
+{
+	struct in_addr addr;
+	int idx;
+
+	if (!inet_aton(argv[0], &addr)) {
+		vty_out(vty, "%% Invalid address %s%s", argv[0], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	idx = gsup_server_find(&addr, atoi(argv[1]));
+	if (idx < 0)
+		return CMD_SUCCESS;
+
+	g_cfg->gsup_extra_servers.num -= 1;
+	memmove(&g_cfg->gsup_extra_servers.addr[idx],
+		&g_cfg->gsup_extra_servers.addr[idx + 1],
+		(g_cfg->gsup_extra_servers.num - idx) *
+		sizeof(g_cfg->gsup_extra_servers.addr[0]));
+
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_gsup_connections, cfg_gsup_connections_cmd,
+	"gsup connections <1-16>",
+	"GSUP Parameters\n"
+	"Set the number of IPA connections to each GSUP server\n"
+	"Number of connections\n")
+{
+	g_cfg->gsup_connections = atoi(argv[0]);
+
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_gsup_max_inflight, cfg_gsup_max_inflight_cmd,
+	"gsup max-inflight <1-10000>",
+	"GSUP Parameters\n"
+	"Limit the requests outstanding on one connection, further ones "
+	"are queued\n"
+	"Number of requests\n")
+{
+	g_cfg->gsup_max_inflight = atoi(argv[0]);
+	if (sgsn->gsup_client)
+		sgsn->gsup_client->max_inflight = g_cfg->gsup_max_inflight;
+
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_gsup_req_timeout, cfg_gsup_req_timeout_cmd,
+	"gsup request-timeout <1-300>",
+	"GSUP Parameters\n"
+	"Fail requests the GSUP server has not answered in time\n"
+	"Seconds\n")
+{
+	g_cfg->gsup_req_timeout = atoi(argv[0]);
+	if (sgsn->gsup_client)
+		sgsn->gsup_client->req_timeout = g_cfg->gsup_req_timeout;
+
+	return CMD_SUCCESS;
+}
+
 DEFUN(cfg_gsup_oap_id, cfg_gsup_oap_id_cmd,
 	"gsup oap-id <0-65535>",
 	"GSUP Parameters\n"
@@ -1102,6 +1342,68 @@ DEFUN(cfg_cdr_interval, cfg_cdr_interval_cmd,
 	return CMD_SUCCESS;
 }
 
+DEFUN(cfg_cdr_format, cfg_cdr_format_cmd,
+	"cdr format (csv|binary)",
+	"CDR\nSet the format of the CDR file\n"
+	"One line of comma separated values per CDR\n"
+	"Compact binary records, see osmo-sgsn-cdr-decode\n")
+{
+	if (!strcmp(argv[0], "binary"))
+		g_cfg->cdr.format = SGSN_CDR_FMT_BINARY;
+	else
+		g_cfg->cdr.format = SGSN_CDR_FMT_CSV;
+	return CMD_SUCCESS;
+}
+
+#define CDR_ROTATE_STR "CDR\nRotate the CDR file\n"
+
+DEFUN(cfg_cdr_rotate_size, cfg_cdr_rotate_size_cmd,
+	"cdr rotate size <0-2147483647>",
+	CDR_ROTATE_STR "Rotate once the file reaches a size\n"
+	"Size in bytes, 0 to disable\n")
+{
+	g_cfg->cdr.rotate_size = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_cdr_rotate_interval, cfg_cdr_rotate_interval_cmd,
+	"cdr rotate interval <0-2147483647>",
+	CDR_ROTATE_STR "Rotate once the file reaches an age\n"
+	"Seconds, 0 to disable\n")
+{
+	g_cfg->cdr.rotate_interval = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_cdr_buffer_size, cfg_cdr_buffer_size_cmd,
+	"cdr buffer-size <4096-67108864>",
+	"CDR\nSize of the buffer for CDRs not yet written to the file\n"
+	"Size in bytes\n")
+{
+	g_cfg->cdr.buffer_size = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+#define PAGING_BUFFER_STR "Keep downlink N-PDUs while the MS is paged\n"
+
+DEFUN(cfg_paging_buffer_bytes, cfg_paging_buffer_bytes_cmd,
+	"paging-buffer max-bytes <0-1048576>",
+	PAGING_BUFFER_STR "Limit the N-PDUs kept per MS\n"
+	"Bytes, 0 to drop N-PDUs during paging\n")
+{
+	g_cfg->paging_buffer.max_bytes = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_paging_buffer_age, cfg_paging_buffer_age_cmd,
+	"paging-buffer max-age <1-300>",
+	PAGING_BUFFER_STR "Drop N-PDUs not delivered in time\n"
+	"Seconds\n")
+{
+	g_cfg->paging_buffer.max_age = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
 #define COMPRESSION_STR "Configure compression\n"
 DEFUN(cfg_no_comp_rfc1144, cfg_no_comp_rfc1144_cmd,
       "no compression rfc1144",
@@ -1215,9 +1517,17 @@ int sgsn_vty_init(void)
 	install_element(SGSN_NODE, &cfg_ggsn_gtp_version_cmd);
 	install_element(SGSN_NODE, &cfg_imsi_acl_cmd);
 	install_element(SGSN_NODE, &cfg_auth_policy_cmd);
+	install_element(SGSN_NODE, &cfg_auth_prefetch_low_water_cmd);
+	install_element(SGSN_NODE, &cfg_auth_prefetch_max_pending_cmd);
+	install_element(SGSN_NODE, &cfg_auth_prefetch_max_subscr_cmd);
 	install_element(SGSN_NODE, &cfg_encrypt_cmd);
 	install_element(SGSN_NODE, &cfg_gsup_remote_ip_cmd);
 	install_element(SGSN_NODE, &cfg_gsup_remote_port_cmd);
+	install_element(SGSN_NODE, &cfg_gsup_remote_add_cmd);
+	install_element(SGSN_NODE, &cfg_no_gsup_remote_add_cmd);
+	install_element(SGSN_NODE, &cfg_gsup_connections_cmd);
+	install_element(SGSN_NODE, &cfg_gsup_max_inflight_cmd);
+	install_element(SGSN_NODE, &cfg_gsup_req_timeout_cmd);
 	install_element(SGSN_NODE, &cfg_gsup_oap_id_cmd);
 	install_element(SGSN_NODE, &cfg_gsup_oap_k_cmd);
 	install_element(SGSN_NODE, &cfg_gsup_oap_opc_cmd);
@@ -1228,8 +1538,16 @@ int sgsn_vty_init(void)
 	install_element(SGSN_NODE, &cfg_cdr_filename_cmd);
 	install_element(SGSN_NODE, &cfg_no_cdr_filename_cmd);
 	install_element(SGSN_NODE, &cfg_cdr_interval_cmd);
+	install_element(SGSN_NODE, &cfg_cdr_format_cmd);
+	install_element(SGSN_NODE, &cfg_cdr_rotate_size_cmd);
+	install_element(SGSN_NODE, &cfg_cdr_rotate_interval_cmd);
+	install_element(SGSN_NODE, &cfg_cdr_buffer_size_cmd);
+	install_element(SGSN_NODE, &cfg_paging_buffer_bytes_cmd);
+	install_element(SGSN_NODE, &cfg_paging_buffer_age_cmd);
 	install_element(SGSN_NODE, &cfg_ggsn_dynamic_lookup_cmd);
 	install_element(SGSN_NODE, &cfg_grx_ggsn_cmd);
+	install_element(SGSN_NODE, &cfg_grx_dns_cache_max_ttl_cmd);
+	install_element(SGSN_NODE, &cfg_grx_dns_cache_neg_ttl_cmd);
 
 	install_element(SGSN_NODE, &cfg_sgsn_T3312_cmd);
 	install_element(SGSN_NODE, &cfg_sgsn_T3322_cmd);
@@ -1272,6 +1590,20 @@ int sgsn_parse_config(const char *config_file, struct sgsn_config *cfg)
 	g_cfg->timers.T3395 = GSM0408_T3395_SECS;
 	g_cfg->timers.T3397 = GSM0408_T3397_SECS;
 
+	g_cfg->paging_buffer.max_bytes = SGSN_PAGING_BUFFER_BYTES;
+	g_cfg->paging_buffer.max_age = SGSN_PAGING_BUFFER_AGE;
+
+	g_cfg->auth_prefetch.low_water = SGSN_AUTH_PREFETCH_LOW_WATER;
+	g_cfg->auth_prefetch.max_pending = SGSN_AUTH_PREFETCH_PENDING;
+	g_cfg->auth_prefetch.max_subscribers = SGSN_AUTH_PREFETCH_SUBSCRIBERS;
+
+	g_cfg->dns_cache.max_ttl = SGSN_ARES_CACHE_MAX_TTL;
+	g_cfg->dns_cache.neg_ttl = SGSN_ARES_CACHE_NEG_TTL;
+
+	g_cfg->gsup_connections = 1;
+	g_cfg->gsup_max_inflight = GSUP_CLIENT_MAX_INFLIGHT;
+	g_cfg->gsup_req_timeout = GSUP_CLIENT_REQ_TIMEOUT;
+
 	rc = vty_read_config_file(config_file, NULL);
 	if (rc < 0) {
 		fprintf(stderr, "Failed to parse the config file: '%s'\n", config_file);
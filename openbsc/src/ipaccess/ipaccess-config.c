@@ -63,6 +63,7 @@ static char *unit_id;
 static uint16_t nv_flags;
 static uint16_t nv_mask;
 static char *software = NULL;
+static uint8_t sw_window_size = 19;
 static int sw_load_state = 0;
 static int oml_state = 0;
 static int dump_files = 0;
@@ -608,7 +609,8 @@ static int nm_state_event(int evt, uint8_t obj_class, void *obj,
 		else if (software) {
 			int rc;
 			printf("Attempting software upload with '%s'\n", software);
-			rc = abis_nm_software_load(trx->bts, trx->nr, software, 19, 0, swload_cbfn, trx);
+			rc = abis_nm_software_load(trx->bts, trx->nr, software,
+						   sw_window_size, 0, swload_cbfn, trx);
 			if (rc < 0) {
 				fprintf(stderr, "Failed to start software load\n");
 				exit(-3);
@@ -819,6 +821,7 @@ static void print_help(void)
 	printf("  -L --Listen TEST_NAME\t\tPerform specified test\n");
 	printf("  -s --stream-id ID\t\tSet the IPA Stream Identifier for OML\n");
 	printf("  -d --software FIRMWARE\tDownload firmware into BTS\n");
+	printf("  -W --window-size N\t\tSegments per window of the download (1-255)\n");
 	printf("\n");
 	printf("Miscellaneous commands:\n");
 	printf("  -h --help\t\t\tthis text\n");
@@ -886,6 +889,7 @@ int main(int argc, char **argv)
 			{ "Listen", 1, 0, 'L' },
 			{ "stream-id", 1, 0, 's' },
 			{ "software", 1, 0, 'd' },
+			{ "window-size", 1, 0, 'W' },
 			{ "firmware", 1, 0, 'f' },
 			{ "write-firmware", 0, 0, 'w' },
 			{ "disable-color", 0, 0, 'c'},
@@ -893,7 +897,7 @@ int main(int argc, char **argv)
 			{ 0, 0, 0, 0 },
 		};
 
-		c = getopt_long(argc, argv, "u:o:i:g:rn:S:U:l:L:hs:d:f:wcpH", long_options,
+		c = getopt_long(argc, argv, "u:o:i:g:rn:S:U:l:L:hs:d:W:f:wcpH", long_options,
 				&option_index);
 
 		if (c == -1)
@@ -958,6 +962,14 @@ int main(int argc, char **argv)
 			if (find_sw_load_params(optarg) != 0)
 				exit(0);
 			break;
+		case 'W':
+			ul = strtoul(optarg, NULL, 10);
+			if (ul < 1 || ul > 255) {
+				fprintf(stderr, "The window size is 1 to 255\n");
+				exit(2);
+			}
+			sw_window_size = ul;
+			break;
 		case 'f':
 			firmware_analysis = optarg;
 			break;
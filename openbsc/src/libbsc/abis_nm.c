@@ -763,6 +763,32 @@ enum sw_state {
 	SW_STATE_ERROR,
 };
 
+/* A software image, read and split into segments once and shared by all
+ * downloads of the same file to BTS of the same type */
+struct abis_nm_sw_image {
+	struct llist_head list;
+	int refcount;
+
+	char *fname;
+	enum gsm_bts_type bts_type;
+	/* to notice that the file has been replaced */
+	time_t mtime;
+	off_t size;
+
+	uint8_t *data;
+	/* segment n are the bytes from seg_off[n] up to seg_off[n + 1] */
+	size_t *seg_off;
+	unsigned int num_segs;
+
+	uint8_t file_id[255];
+	uint8_t file_id_len;
+
+	uint8_t file_version[255];
+	uint8_t file_version_len;
+};
+
+static LLIST_HEAD(sw_images);
+
 struct abis_nm_sw {
 	struct gsm_bts *bts;
 	int trx_nr;
@@ -774,34 +800,43 @@ struct abis_nm_sw {
 	uint8_t obj_class;
 	uint8_t obj_instance[3];
 
-	uint8_t file_id[255];
-	uint8_t file_id_len;
-
-	uint8_t file_version[255];
-	uint8_t file_version_len;
+	struct abis_nm_sw_image *img;
+	unsigned int next_seg;
 
 	uint8_t window_size;
 	uint8_t seg_in_window;
 
-	int fd;
-	FILE *stream;
 	enum sw_state state;
 	int last_seg;
+
+	struct abis_nm_sw_progress progress;
 };
 
-static struct abis_nm_sw g_sw;
+/* every BTS has its own software load, allocated on first use */
+static struct abis_nm_sw *sw_get(struct gsm_bts *bts)
+{
+	if (!bts->sw_load) {
+		bts->sw_load = talloc_zero(bts, struct abis_nm_sw);
+		if (!bts->sw_load)
+			return NULL;
+		bts->sw_load->bts = bts;
+	}
+	return bts->sw_load;
+}
 
 static void sw_add_file_id_and_ver(struct abis_nm_sw *sw, struct msgb *msg)
 {
+	struct abis_nm_sw_image *img = sw->img;
+
 	if (sw->bts->type == GSM_BTS_TYPE_NANOBTS) {
 		msgb_v_put(msg, NM_ATT_SW_DESCR);
-		msgb_tl16v_put(msg, NM_ATT_FILE_ID, sw->file_id_len, sw->file_id);
-		msgb_tl16v_put(msg, NM_ATT_FILE_VERSION, sw->file_version_len,
-			       sw->file_version);
+		msgb_tl16v_put(msg, NM_ATT_FILE_ID, img->file_id_len, img->file_id);
+		msgb_tl16v_put(msg, NM_ATT_FILE_VERSION, img->file_version_len,
+			       img->file_version);
 	} else if (sw->bts->type == GSM_BTS_TYPE_BS11) {
-		msgb_tlv_put(msg, NM_ATT_FILE_ID, sw->file_id_len, sw->file_id);
-		msgb_tlv_put(msg, NM_ATT_FILE_VERSION, sw->file_version_len,
-			     sw->file_version);
+		msgb_tlv_put(msg, NM_ATT_FILE_ID, img->file_id_len, img->file_id);
+		msgb_tlv_put(msg, NM_ATT_FILE_VERSION, img->file_version_len,
+			     img->file_version);
 	} else {
 		LOGP(DNM, LOGL_ERROR, "Please implement this for the BTS.\n");
 	}
@@ -812,7 +847,7 @@ static int sw_load_init(struct abis_nm_sw *sw)
 {
 	struct abis_om_hdr *oh;
 	struct msgb *msg = nm_msgb_alloc();
-	uint8_t len = 3*2 + sw->file_id_len + sw->file_version_len;
+	uint8_t len = 3*2 + sw->img->file_id_len + sw->img->file_version_len;
 
 	oh = (struct abis_om_hdr *) msgb_put(msg, ABIS_OM_FOM_HDR_SIZE);
 	fill_om_fom_hdr(oh, len, NM_MT_LOAD_INIT, sw->obj_class,
@@ -825,84 +860,50 @@ static int sw_load_init(struct abis_nm_sw *sw)
 	return abis_nm_sendmsg(sw->bts, msg);
 }
 
-static int is_last_line(FILE *stream)
-{
-	char next_seg_buf[256];
-	long pos;
-
-	/* check if we're sending the last line */
-	pos = ftell(stream);
-
-	/* Did ftell fail? Then we are at the end for sure */
-	if (pos < 0)
-		return 1;
-
-	if (!fgets(next_seg_buf, sizeof(next_seg_buf)-2, stream)) {
-		int rc = fseek(stream, pos, SEEK_SET);
-		if (rc < 0)
-			return rc;
-		return 1;
-	}
-
-	fseek(stream, pos, SEEK_SET);
-	return 0;
-}
-
 /* 6.2.2 / 8.3.2 Load Data Segment */
 static int sw_load_segment(struct abis_nm_sw *sw)
 {
+	struct abis_nm_sw_image *img = sw->img;
 	struct abis_om_hdr *oh;
-	struct msgb *msg = nm_msgb_alloc();
-	char seg_buf[256];
-	char *line_buf = seg_buf+2;
+	struct msgb *msg;
+	const uint8_t *seg;
 	unsigned char *tlv;
-	int len;
+	int len, seg_len;
 
+	if (sw->next_seg >= img->num_segs) {
+		LOGP(DNM, LOGL_ERROR, "No segment left to send.\n");
+		return -EINVAL;
+	}
+	seg = img->data + img->seg_off[sw->next_seg];
+	seg_len = img->seg_off[sw->next_seg + 1] - img->seg_off[sw->next_seg];
+	sw->last_seg = sw->next_seg + 1 == img->num_segs;
+
+	msg = nm_msgb_alloc();
 	oh = (struct abis_om_hdr *) msgb_put(msg, ABIS_OM_FOM_HDR_SIZE);
 
 	switch (sw->bts->type) {
 	case GSM_BTS_TYPE_BS11:
-		if (fgets(line_buf, sizeof(seg_buf)-2, sw->stream) == NULL) {
-			perror("fgets reading segment");
-			return -EINVAL;
-		}
-		seg_buf[0] = 0x00;
-
-		/* check if we're sending the last line */
-		sw->last_seg = is_last_line(sw->stream);
-		if (sw->last_seg)
-			seg_buf[1] = 0;
-		else
-			seg_buf[1] = 1 + sw->seg_in_window++;
-
-		len = strlen(line_buf) + 2;
+		len = seg_len + 2;
 		tlv = msgb_put(msg, TLV_GROSS_LEN(len));
-		tlv_put(tlv, NM_ATT_BS11_FILE_DATA, len, (uint8_t *)seg_buf);
+		tlv[0] = NM_ATT_BS11_FILE_DATA;
 		/* BS11 wants CR + LF in excess of the TLV length !?! */
-		tlv[1] -= 2;
-
-		/* we only now know the exact length for the OM hdr */
-		len = strlen(line_buf)+2;
+		tlv[1] = len - 2;
+		tlv[2] = 0x00;
+		if (sw->last_seg)
+			tlv[3] = 0;
+		else
+			tlv[3] = 1 + sw->seg_in_window++;
+		memcpy(tlv + 4, seg, seg_len);
 		break;
-	case GSM_BTS_TYPE_NANOBTS: {
-		osmo_static_assert(sizeof(seg_buf) >= IPACC_SEGMENT_SIZE, buffer_big_enough);
-		len = read(sw->fd, &seg_buf, IPACC_SEGMENT_SIZE);
-		if (len < 0) {
-			perror("read failed");
-			return -EINVAL;
-		}
-
-		if (len != IPACC_SEGMENT_SIZE)
-			sw->last_seg = 1;
-
+	case GSM_BTS_TYPE_NANOBTS:
 		++sw->seg_in_window;
-		msgb_tl16v_put(msg, NM_ATT_IPACC_FILE_DATA, len, (const uint8_t *) seg_buf);
-		len += 3;
+		msgb_tl16v_put(msg, NM_ATT_IPACC_FILE_DATA, seg_len, seg);
+		len = seg_len + 3;
 		break;
-	}
 	default:
 		LOGP(DNM, LOGL_ERROR, "sw_load_segment needs implementation for the BTS.\n");
 		/* FIXME: Other BTS types */
+		msgb_free(msg);
 		return -1;
 	}
 
@@ -910,6 +911,8 @@ static int sw_load_segment(struct abis_nm_sw *sw)
 			sw->obj_instance[0], sw->obj_instance[1],
 			sw->obj_instance[2]);
 
+	sw->next_seg++;
+	sw->progress.segs_sent++;
 	return abis_nm_sendmsg_direct(sw->bts, msg);
 }
 
@@ -918,7 +921,7 @@ static int sw_load_end(struct abis_nm_sw *sw)
 {
 	struct abis_om_hdr *oh;
 	struct msgb *msg = nm_msgb_alloc();
-	uint8_t len = 2*2 + sw->file_id_len + sw->file_version_len;
+	uint8_t len = 2*2 + sw->img->file_id_len + sw->img->file_version_len;
 
 	oh = (struct abis_om_hdr *) msgb_put(msg, ABIS_OM_FOM_HDR_SIZE);
 	fill_om_fom_hdr(oh, len, NM_MT_LOAD_END, sw->obj_class,
@@ -934,7 +937,7 @@ static int sw_activate(struct abis_nm_sw *sw)
 {
 	struct abis_om_hdr *oh;
 	struct msgb *msg = nm_msgb_alloc();
-	uint8_t len = 2*2 + sw->file_id_len + sw->file_version_len;
+	uint8_t len = 2*2 + sw->img->file_id_len + sw->img->file_version_len;
 
 	oh = (struct abis_om_hdr *) msgb_put(msg, ABIS_OM_FOM_HDR_SIZE);
 	fill_om_fom_hdr(oh, len, NM_MT_ACTIVATE_SW, sw->obj_class,
@@ -942,9 +945,10 @@ static int sw_activate(struct abis_nm_sw *sw)
 			sw->obj_instance[2]);
 
 	/* FIXME: this is BS11 specific format */
-	msgb_tlv_put(msg, NM_ATT_FILE_ID, sw->file_id_len, sw->file_id);
-	msgb_tlv_put(msg, NM_ATT_FILE_VERSION, sw->file_version_len,
-		     sw->file_version);
+	msgb_tlv_put(msg, NM_ATT_FILE_ID, sw->img->file_id_len,
+		     sw->img->file_id);
+	msgb_tlv_put(msg, NM_ATT_FILE_VERSION, sw->img->file_version_len,
+		     sw->img->file_version);
 
 	return abis_nm_sendmsg(sw->bts, msg);
 }
@@ -956,17 +960,15 @@ struct sdp_firmware {
 	unsigned int file_length;
 } __attribute__ ((packed));
 
-static int parse_sdp_header(struct abis_nm_sw *sw)
+static int parse_sdp_header(struct abis_nm_sw_image *img)
 {
 	struct sdp_firmware firmware_header;
-	int rc;
-	struct stat stat;
 
-	rc = read(sw->fd, &firmware_header, sizeof(firmware_header));
-	if (rc != sizeof(firmware_header)) {
+	if (img->size < sizeof(firmware_header)) {
 		LOGP(DNM, LOGL_ERROR, "Could not read SDP file header.\n");
 		return -1;
 	}
+	memcpy(&firmware_header, img->data, sizeof(firmware_header));
 
 	if (strncmp(firmware_header.magic, " SDP", 4) != 0) {
 		LOGP(DNM, LOGL_ERROR, "The magic number1 is wrong.\n");
@@ -981,19 +983,11 @@ static int parse_sdp_header(struct abis_nm_sw *sw)
 		return -1;
 	}
 
-
-	if (fstat(sw->fd, &stat) == -1) {
-		LOGP(DNM, LOGL_ERROR, "Could not stat the file.\n");
-		return -1;
-	}
-
-	if (ntohl(firmware_header.file_length) != stat.st_size) {
+	if (ntohl(firmware_header.file_length) != img->size) {
 		LOGP(DNM, LOGL_ERROR, "The filesizes do not match.\n");
 		return -1;
 	}
 
-	/* go back to the start as we checked the whole filesize.. */
-	lseek(sw->fd, 0l, SEEK_SET);
 	LOGP(DNM, LOGL_NOTICE, "The ipaccess SDP header is not fully understood.\n"
 			       "There might be checksums in the file that are not\n"
 			       "verified and incomplete firmware might be flashed.\n"
@@ -1002,69 +996,213 @@ static int parse_sdp_header(struct abis_nm_sw *sw)
 	return 0;
 }
 
-static int sw_open_file(struct abis_nm_sw *sw, const char *fname)
+/* The BS11 gets the file line by line, lines longer than 253 bytes are
+ * split. The first line carries the file ID and version. */
+static int sw_image_split_bs11(struct abis_nm_sw_image *img)
 {
 	char file_id[12+1];
 	char file_version[80+1];
+	size_t pos, end;
+	unsigned int n = 0;
 	int rc;
 
-	sw->fd = open(fname, O_RDONLY);
-	if (sw->fd < 0)
-		return sw->fd;
+	rc = sscanf((char *) img->data, "@(#)%12s:%80s\r\n",
+		    file_id, file_version);
+	if (rc != 2) {
+		LOGP(DNM, LOGL_ERROR, "Could not parse the header line of "
+		     "%s\n", img->fname);
+		return -1;
+	}
+	strcpy((char *)img->file_id, file_id);
+	img->file_id_len = strlen(file_id);
+	strcpy((char *)img->file_version, file_version);
+	img->file_version_len = strlen(file_version);
+
+	/* count the segments first, then note where they start */
+	for (pos = 0; pos < img->size; pos = end) {
+		for (end = pos; end < img->size && end - pos < 253; )
+			if (img->data[end++] == '\n')
+				break;
+		n++;
+	}
 
-	switch (sw->bts->type) {
-	case GSM_BTS_TYPE_BS11:
-		sw->stream = fdopen(sw->fd, "r");
-		if (!sw->stream) {
-			perror("fdopen");
-			return -1;
-		}
-		/* read first line and parse file ID and VERSION */
-		rc = fscanf(sw->stream, "@(#)%12s:%80s\r\n",
-			    file_id, file_version);
-		if (rc != 2) {
-			perror("parsing header line of software file");
-			return -1;
-		}
-		strcpy((char *)sw->file_id, file_id);
-		sw->file_id_len = strlen(file_id);
-		strcpy((char *)sw->file_version, file_version);
-		sw->file_version_len = strlen(file_version);
-		/* rewind to start of file */
-		rewind(sw->stream);
-		break;	
-	case GSM_BTS_TYPE_NANOBTS:
-		/* TODO: extract that from the filename or content */
-		rc = parse_sdp_header(sw);
-		if (rc < 0) {
-			fprintf(stderr, "Could not parse the ipaccess SDP header\n");
-			return -1;
+	img->seg_off = talloc_array(img, size_t, n + 1);
+	if (!img->seg_off)
+		return -ENOMEM;
+	img->num_segs = 0;
+	for (pos = 0; pos < img->size; pos = end) {
+		for (end = pos; end < img->size && end - pos < 253; )
+			if (img->data[end++] == '\n')
+				break;
+		img->seg_off[img->num_segs++] = pos;
+	}
+	img->seg_off[img->num_segs] = img->size;
+	return 0;
+}
+
+/* The nanoBTS gets segments of IPACC_SEGMENT_SIZE, the last one is
+ * shorter, or even empty. */
+static int sw_image_split_ipacc(struct abis_nm_sw_image *img)
+{
+	unsigned int i;
+
+	if (parse_sdp_header(img) < 0) {
+		LOGP(DNM, LOGL_ERROR, "Could not parse the ipaccess SDP "
+		     "header\n");
+		return -1;
+	}
+
+	/* TODO: extract that from the filename or content */
+	strcpy((char *)img->file_id, "id");
+	img->file_id_len = 3;
+	strcpy((char *)img->file_version, "version");
+	img->file_version_len = 8;
+
+	img->num_segs = img->size / IPACC_SEGMENT_SIZE + 1;
+	img->seg_off = talloc_array(img, size_t, img->num_segs + 1);
+	if (!img->seg_off)
+		return -ENOMEM;
+	for (i = 0; i < img->num_segs; i++)
+		img->seg_off[i] = i * IPACC_SEGMENT_SIZE;
+	img->seg_off[i] = img->size;
+	return 0;
+}
+
+static struct abis_nm_sw_image *sw_image_load(const char *fname,
+					      enum gsm_bts_type bts_type)
+{
+	struct abis_nm_sw_image *img;
+	struct stat st;
+	ssize_t len;
+	off_t pos;
+	int fd, rc;
+
+	fd = open(fname, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	img = talloc_zero(tall_bsc_ctx, struct abis_nm_sw_image);
+	if (!img) {
+		close(fd);
+		return NULL;
+	}
+	img->fname = talloc_strdup(img, fname);
+	img->bts_type = bts_type;
+	img->mtime = st.st_mtime;
+	img->size = st.st_size;
+
+	/* one more for the NUL that ends the header line parsing */
+	img->data = talloc_size(img, img->size + 1);
+	if (!img->data)
+		goto err;
+	for (pos = 0; pos < img->size; pos += len) {
+		len = read(fd, img->data + pos, img->size - pos);
+		if (len <= 0) {
+			LOGP(DNM, LOGL_ERROR, "Could not read %s: %s\n",
+			     fname, len < 0 ? strerror(errno) : "short file");
+			goto err;
 		}
+	}
+	img->data[img->size] = '\0';
+	close(fd);
+	fd = -1;
 
-		strcpy((char *)sw->file_id, "id");
-		sw->file_id_len = 3;
-		strcpy((char *)sw->file_version, "version");
-		sw->file_version_len = 8;
+	switch (bts_type) {
+	case GSM_BTS_TYPE_BS11:
+		rc = sw_image_split_bs11(img);
+		break;
+	case GSM_BTS_TYPE_NANOBTS:
+		rc = sw_image_split_ipacc(img);
 		break;
 	default:
 		/* We don't know how to treat them yet */
-		close(sw->fd);
-		return -EINVAL;
+		rc = -EINVAL;
+		break;
 	}
+	if (rc < 0 || img->num_segs == 0)
+		goto err;
 
-	return 0;
+	LOGP(DNM, LOGL_INFO, "Loaded %s, %u segments\n", fname,
+	     img->num_segs);
+	llist_add_tail(&img->list, &sw_images);
+	return img;
+
+err:
+	if (fd >= 0)
+		close(fd);
+	talloc_free(img);
+	return NULL;
 }
-	
+
+/* Find the image of the file, or read it if nobody is using it yet */
+static struct abis_nm_sw_image *sw_image_get(const char *fname,
+					     enum gsm_bts_type bts_type)
+{
+	struct abis_nm_sw_image *img;
+	struct stat st;
+
+	if (stat(fname, &st) < 0)
+		return NULL;
+
+	llist_for_each_entry(img, &sw_images, list) {
+		if (img->bts_type != bts_type || strcmp(img->fname, fname))
+			continue;
+		if (img->mtime != st.st_mtime || img->size != st.st_size)
+			continue;
+		img->refcount++;
+		return img;
+	}
+
+	img = sw_image_load(fname, bts_type);
+	if (img)
+		img->refcount = 1;
+	return img;
+}
+
+static void sw_image_put(struct abis_nm_sw_image *img)
+{
+	if (--img->refcount > 0)
+		return;
+	llist_del(&img->list);
+	talloc_free(img);
+}
+
 static void sw_close_file(struct abis_nm_sw *sw)
 {
+	if (!sw->img)
+		return;
+	sw_image_put(sw->img);
+	sw->img = NULL;
+}
+
+static int sw_open_file(struct abis_nm_sw *sw, const char *fname)
+{
+	sw_close_file(sw);
+
 	switch (sw->bts->type) {
 	case GSM_BTS_TYPE_BS11:
-		fclose(sw->stream);
+	case GSM_BTS_TYPE_NANOBTS:
 		break;
 	default:
-		close(sw->fd);
-		break;
+		/* We don't know how to treat them yet */
+		return -EINVAL;
 	}
+
+	sw->img = sw_image_get(fname, sw->bts->type);
+	if (!sw->img)
+		return -EINVAL;
+
+	sw->next_seg = 0;
+	sw->seg_in_window = 0;
+	sw->last_seg = 0;
+	memset(&sw->progress, 0, sizeof(sw->progress));
+	sw->progress.segs_total = sw->img->num_segs;
+	sw->progress.bytes_total = sw->img->size;
+	return 0;
 }
 
 /* Fill the window */
@@ -1088,8 +1226,17 @@ static int abis_nm_rcvmsg_sw(struct msgb *mb)
 	struct abis_om_fom_hdr *foh = msgb_l3(mb);
 	struct e1inp_sign_link *sign_link = mb->dst;
 	int rc = -1;
-	struct abis_nm_sw *sw = &g_sw;
-	enum sw_state old_state = sw->state;
+	struct abis_nm_sw *sw = sign_link->trx->bts->sw_load;
+	enum sw_state old_state;
+
+	if (!sw) {
+		if (foh->msg_type == NM_MT_ACTIVATE_SW_ACK)
+			return 0;
+		DEBUGP(DNM, "unexpected NM MT 0x%02x without software load\n",
+			foh->msg_type);
+		return rc;
+	}
+	old_state = sw->state;
 	
 	//DEBUGP(DNM, "state %u, NM MT 0x%02x\n", sw->state, foh->msg_type);
 
@@ -1132,6 +1279,9 @@ static int abis_nm_rcvmsg_sw(struct msgb *mb)
 	case SW_STATE_WAIT_SEGACK:
 		switch (foh->msg_type) {
 		case NM_MT_LOAD_SEG_ACK:
+			sw->progress.segs_acked = sw->progress.segs_sent;
+			sw->progress.bytes_acked = sw->img->seg_off[sw->next_seg];
+			sw->progress.windows++;
 			if (sw->cbfn)
 				sw->cbfn(GSM_HOOK_NM_SWLOAD,
 					 NM_MT_LOAD_SEG_ACK, mb,
@@ -1238,16 +1388,17 @@ int abis_nm_software_load(struct gsm_bts *bts, int trx_nr, const char *fname,
 			  uint8_t win_size, int forced,
 			  gsm_cbfn *cbfn, void *cb_data)
 {
-	struct abis_nm_sw *sw = &g_sw;
+	struct abis_nm_sw *sw = sw_get(bts);
 	int rc;
 
 	DEBUGP(DNM, "Software Load (BTS %u, File \"%s\")\n",
 		bts->nr, fname);
 
+	if (!sw)
+		return -ENOMEM;
 	if (sw->state != SW_STATE_NONE)
 		return -EBUSY;
 
-	sw->bts = bts;
 	sw->trx_nr = trx_nr;
 
 	switch (bts->type) {
@@ -1286,37 +1437,43 @@ int abis_nm_software_load(struct gsm_bts *bts, int trx_nr, const char *fname,
 
 int abis_nm_software_load_status(struct gsm_bts *bts)
 {
-	struct abis_nm_sw *sw = &g_sw;
-	struct stat st;
-	int rc, percent;
+	struct abis_nm_sw *sw = bts->sw_load;
 
-	rc = fstat(sw->fd, &st);
-	if (rc < 0) {
-		perror("ERROR during stat");
-		return rc;
-	}
+	if (!sw || !sw->img)
+		return -EINVAL;
+	if (sw->progress.bytes_total == 0)
+		return 100;
 
-	if (sw->stream)
-		percent = (ftell(sw->stream) * 100) / st.st_size;
-	else
-		percent = (lseek(sw->fd, 0, SEEK_CUR) * 100) / st.st_size;
-	return percent;
+	return (sw->progress.bytes_acked * 100) / sw->progress.bytes_total;
+}
+
+int abis_nm_software_load_progress(struct gsm_bts *bts,
+				   struct abis_nm_sw_progress *progress)
+{
+	struct abis_nm_sw *sw = bts->sw_load;
+
+	if (!sw || !sw->img)
+		return -EINVAL;
+
+	*progress = sw->progress;
+	return 0;
 }
 
 /* Activate the specified software into the BTS */
 int abis_nm_software_activate(struct gsm_bts *bts, const char *fname,
 			      gsm_cbfn *cbfn, void *cb_data)
 {
-	struct abis_nm_sw *sw = &g_sw;
+	struct abis_nm_sw *sw = sw_get(bts);
 	int rc;
 
 	DEBUGP(DNM, "Activating Software (BTS %u, File \"%s\")\n",
 		bts->nr, fname);
 
+	if (!sw)
+		return -ENOMEM;
 	if (sw->state != SW_STATE_NONE)
 		return -EBUSY;
 
-	sw->bts = bts;
 	sw->obj_class = NM_OC_SITE_MANAGER;
 	sw->obj_instance[0] = 0xff;
 	sw->obj_instance[1] = 0xff;
@@ -1331,9 +1488,10 @@ int abis_nm_software_activate(struct gsm_bts *bts, const char *fname,
 		sw->state = SW_STATE_NONE;
 		return rc;
 	}
-	sw_close_file(sw);
 
-	return sw_activate(sw);
+	rc = sw_activate(sw);
+	sw_close_file(sw);
+	return rc;
 }
 
 static void fill_nm_channel(struct abis_nm_channel *ch, uint8_t bts_port,
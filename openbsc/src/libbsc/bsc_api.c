@@ -249,6 +249,7 @@ struct gsm_subscriber_connection *bsc_subscr_con_allocate(struct gsm_lchan *lcha
 		return NULL;
 
 	conn->network = net;
+	INIT_LLIST_HEAD(&conn->trans_list);
 	conn->lchan = lchan;
 	conn->bts = lchan->ts->trx->bts;
 	lchan->conn = conn;
@@ -407,8 +407,7 @@ void lchan_free(struct gsm_lchan *lchan)
 		lchan->meas_rep[i].flags = 0;
 		lchan->meas_rep[i].nr = 0;
 	}
-	for (i = 0; i < ARRAY_SIZE(lchan->neigh_meas); i++)
-		lchan->neigh_meas[i].arfcn = 0;
+	memset(lchan->neigh_meas, 0, sizeof(lchan->neigh_meas));
 
 	if (lchan->rqd_ref) {
 		talloc_free(lchan->rqd_ref);
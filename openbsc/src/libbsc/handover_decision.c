@@ -22,7 +22,9 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #include <osmocom/core/msgb.h>
 #include <openbsc/debug.h>
@@ -31,7 +33,9 @@
 #include <openbsc/signal.h>
 #include <osmocom/core/talloc.h>
 #include <openbsc/handover.h>
+#include <openbsc/handover_decision.h>
 #include <osmocom/gsm/gsm_utils.h>
+#include <osmocom/core/utils.h>
 
 /* issue handover to a cell identified by ARFCN and BSIC */
 static int handover_to_arfcn_bsic(struct gsm_lchan *lchan,
@@ -70,60 +74,94 @@ static int rxlev_for_cell_in_rep(struct gsm_meas_rep *mr,
 	return -ENODEV;
 }
 
-/* obtain averaged rxlev for given neighbor */
-static int neigh_meas_avg(struct neigh_meas_proc *nmp, int window)
+/* monotonic seconds for the penalty of a cell */
+static time_t ho_dec_now(void)
 {
-	unsigned int i, idx;
-	int avg = 0;
+	struct timespec ts;
 
-	idx = calc_initial_idx(ARRAY_SIZE(nmp->rxlev),
-				nmp->rxlev_cnt % ARRAY_SIZE(nmp->rxlev),
-				window);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
 
-	for (i = 0; i < window; i++) {
-		int j = (idx+i) % ARRAY_SIZE(nmp->rxlev);
+/* recalculate the sum of the last 'window' rxlev values of a neighbor */
+static void neigh_meas_resum(struct neigh_meas_proc *nmp, unsigned int window)
+{
+	unsigned int i, num = OSMO_MIN(nmp->rxlev_cnt, window);
 
-		avg += nmp->rxlev[j];
-	}
+	nmp->rxlev_sum = 0;
+	for (i = 1; i <= num; i++)
+		nmp->rxlev_sum +=
+			nmp->rxlev[(nmp->rxlev_cnt - i) % ARRAY_SIZE(nmp->rxlev)];
+	nmp->rxlev_win = window;
+}
+
+/* add a rxlev value to the window of a neighbor, keeping the sum of the
+ * window up to date instead of adding it up for every report */
+static void neigh_meas_add(struct neigh_meas_proc *nmp, uint8_t rxlev,
+			   unsigned int window)
+{
+	if (nmp->rxlev_win != window)
+		neigh_meas_resum(nmp, window);
+
+	/* the value that falls out of the window */
+	if (nmp->rxlev_cnt >= window)
+		nmp->rxlev_sum -= nmp->rxlev[(nmp->rxlev_cnt - window) %
+					     ARRAY_SIZE(nmp->rxlev)];
+
+	nmp->rxlev[nmp->rxlev_cnt % ARRAY_SIZE(nmp->rxlev)] = rxlev;
+	nmp->rxlev_sum += rxlev;
+	nmp->rxlev_cnt++;
+}
 
-	return avg / window;
+/* obtain averaged rxlev for given neighbor, values not yet reported
+ * count as zero */
+static int neigh_meas_avg(struct neigh_meas_proc *nmp, unsigned int window)
+{
+	if (nmp->rxlev_win != window)
+		neigh_meas_resum(nmp, window);
+
+	return nmp->rxlev_sum / window;
 }
 
 /* find empty or evict bad neighbor */
-static struct neigh_meas_proc *find_evict_neigh(struct gsm_lchan *lchan)
+static struct neigh_meas_proc *find_evict_neigh(struct gsm_lchan *lchan,
+						unsigned int window)
 {
 	int j, worst = 999999;
 	struct neigh_meas_proc *nmp_worst = NULL;
 
-	/* first try to find an empty/unused slot */
 	for (j = 0; j < ARRAY_SIZE(lchan->neigh_meas); j++) {
 		struct neigh_meas_proc *nmp = &lchan->neigh_meas[j];
-		if (!nmp->arfcn)
-			return nmp;
-	}
+		int avg;
 
-	/* no empty slot found. evict worst neighbor from list */
-	for (j = 0; j < ARRAY_SIZE(lchan->neigh_meas); j++) {
-		struct neigh_meas_proc *nmp = &lchan->neigh_meas[j];
-		int avg = neigh_meas_avg(nmp, MAX_WIN_NEIGH_AVG);
+		/* an empty/unused slot */
+		if (!nmp->arfcn) {
+			nmp_worst = nmp;
+			break;
+		}
+
+		avg = neigh_meas_avg(nmp, window);
 		if (!nmp_worst || avg < worst) {
 			worst = avg;
 			nmp_worst = nmp;
 		}
 	}
 
+	/* nothing of the evicted neighbor carries over */
+	memset(nmp_worst, 0, sizeof(*nmp_worst));
 	return nmp_worst;
 }
 
 /* process neighbor cell measurement reports */
 static void process_meas_neigh(struct gsm_meas_rep *mr)
 {
-	int i, j, idx;
+	struct gsm_network *net = mr->lchan->ts->trx->bts->network;
+	unsigned int window = net->handover.win_rxlev_avg_neigh;
+	int i, j;
 
 	/* for each reported cell, try to update global state */
 	for (j = 0; j < ARRAY_SIZE(mr->lchan->neigh_meas); j++) {
 		struct neigh_meas_proc *nmp = &mr->lchan->neigh_meas[j];
-		unsigned int idx;
 		int rxlev;
 
 		/* skip unused entries */
@@ -131,13 +169,11 @@ static void process_meas_neigh(struct gsm_meas_rep *mr)
 			continue;
 
 		rxlev = rxlev_for_cell_in_rep(mr, nmp->arfcn, nmp->bsic);
-		idx = nmp->rxlev_cnt % ARRAY_SIZE(nmp->rxlev);
 		if (rxlev >= 0) {
-			nmp->rxlev[idx] = rxlev;
+			neigh_meas_add(nmp, rxlev, window);
 			nmp->last_seen_nr = mr->nr;
 		} else
-			nmp->rxlev[idx] = 0;
-		nmp->rxlev_cnt++;
+			neigh_meas_add(nmp, 0, window);
 	}
 
 	/* iterate over list of reported cells, check if we did not
@@ -149,88 +185,100 @@ static void process_meas_neigh(struct gsm_meas_rep *mr)
 		if (mrc->flags & MRC_F_PROCESSED)
 			continue;
 
-		nmp = find_evict_neigh(mr->lchan);
+		nmp = find_evict_neigh(mr->lchan, window);
 
 		nmp->arfcn = mrc->arfcn;
 		nmp->bsic = mrc->bsic;
-
-		idx = nmp->rxlev_cnt % ARRAY_SIZE(nmp->rxlev);
-		nmp->rxlev[idx] = mrc->rxlev;
-		nmp->rxlev_cnt++;
+		neigh_meas_add(nmp, mrc->rxlev, window);
 		nmp->last_seen_nr = mr->nr;
 
 		mrc->flags |= MRC_F_PROCESSED;
 	}
 }
 
+/* do not consider this cell for a while */
+static void penalize_neigh(struct gsm_network *net, struct neigh_meas_proc *nmp)
+{
+	LOGP(DHO, LOGL_INFO, "Cell on ARFCN %u BSIC %u is not a handover "
+	     "candidate for %us\n", nmp->arfcn, nmp->bsic,
+	     net->handover.penalty_time);
+	nmp->penalty_until = ho_dec_now() + net->handover.penalty_time;
+	nmp->ho_started = 0;
+}
+
 /* attempt to do a handover */
-static int attempt_handover(struct gsm_meas_rep *mr)
+static int attempt_handover(struct gsm_meas_rep *mr, int av_rxlev)
 {
 	struct gsm_network *net = mr->lchan->ts->trx->bts->network;
-	struct neigh_meas_proc *best_cell = NULL;
-	unsigned int best_better_db = 0;
-	int i, rc;
-
-	/* find the best cell in this report that is at least RXLEV_HYST
-	 * better than the current serving cell */
-
+	struct neigh_meas_proc *cand[MAX_NEIGH_MEAS];
+	int better[MAX_NEIGH_MEAS];
+	unsigned int num_cand = 0;
+	time_t now = ho_dec_now();
+	int i, j, rc = 0;
+
+	/* rank the cells that are at least pwr_hysteresis better than the
+	 * serving cell, the best first */
 	for (i = 0; i < ARRAY_SIZE(mr->lchan->neigh_meas); i++) {
 		struct neigh_meas_proc *nmp = &mr->lchan->neigh_meas[i];
-		int avg, better;
+		int avg, b;
 
-		/* skip empty slots */
-		if (nmp->arfcn == 0)
+		/* skip empty slots and penalized cells */
+		if (nmp->arfcn == 0 || nmp->penalty_until > now)
 			continue;
 
 		/* caculate average rxlev for this cell over the window */
 		avg = neigh_meas_avg(nmp, net->handover.win_rxlev_avg_neigh);
 
 		/* check if hysteresis is fulfilled */
-		if (avg < mr->dl.full.rx_lev + net->handover.pwr_hysteresis)
+		if (avg < av_rxlev + (int) net->handover.pwr_hysteresis)
 			continue;
 
-		better = avg - mr->dl.full.rx_lev;
-		if (better > best_better_db) {
-			best_cell = nmp;
-			best_better_db = better;
+		b = avg - av_rxlev;
+		for (j = num_cand; j > 0 && better[j - 1] < b; j--) {
+			cand[j] = cand[j - 1];
+			better[j] = better[j - 1];
 		}
+		cand[j] = nmp;
+		better[j] = b;
+		num_cand++;
 	}
 
-	if (!best_cell)
-		return 0;
-
-	LOGP(DHO, LOGL_INFO, "%s: Cell on ARFCN %u is better: ",
-		gsm_ts_name(mr->lchan->ts), best_cell->arfcn);
-	if (!net->handover.active) {
-		LOGPC(DHO, LOGL_INFO, "Skipping, Handover disabled\n");
-		return 0;
-	}
+	/* the next candidate is tried if the better one cannot take the
+	 * call right now */
+	for (i = 0; i < num_cand; i++) {
+		LOGP(DHO, LOGL_INFO, "%s: Cell on ARFCN %u is %d better: ",
+			gsm_ts_name(mr->lchan->ts), cand[i]->arfcn, better[i]);
+		if (!net->handover.active) {
+			LOGPC(DHO, LOGL_INFO, "Skipping, Handover disabled\n");
+			return 0;
+		}
 
-	rc = handover_to_arfcn_bsic(mr->lchan, best_cell->arfcn, best_cell->bsic);
-	switch (rc) {
-	case 0:
-		LOGPC(DHO, LOGL_INFO, "Starting handover\n");
-		break;
-	case -ENOSPC:
-		LOGPC(DHO, LOGL_INFO, "No channel available\n");
-		break;
-	case -EBUSY:
-		LOGPC(DHO, LOGL_INFO, "Handover already active\n");
-		break;
-	default:
-		LOGPC(DHO, LOGL_ERROR, "Unknown error\n");
+		rc = handover_to_arfcn_bsic(mr->lchan, cand[i]->arfcn,
+					    cand[i]->bsic);
+		switch (rc) {
+		case 0:
+			LOGPC(DHO, LOGL_INFO, "Starting handover\n");
+			cand[i]->ho_started = 1;
+			return 0;
+		case -ENOSPC:
+			LOGPC(DHO, LOGL_INFO, "No channel available\n");
+			break;
+		case -EBUSY:
+			LOGPC(DHO, LOGL_INFO, "Handover already active\n");
+			return rc;
+		default:
+			LOGPC(DHO, LOGL_ERROR, "Unknown error\n");
+			break;
+		}
+		penalize_neigh(net, cand[i]);
 	}
 	return rc;
 }
 
-/* process an already parsed measurement report and decide if we want to
- * attempt a handover */
-static int process_meas_rep(struct gsm_meas_rep *mr)
+/* take the neighbor cells of an already parsed measurement report into
+ * account, returns 0 if the lchan is not subject to handover */
+static int update_meas_rep(struct gsm_meas_rep *mr)
 {
-	struct gsm_network *net = mr->lchan->ts->trx->bts->network;
-	enum meas_rep_field dlev, dqual;
-	int av_rxlev;
-
 	/* we currently only do handover for TCH channels */
 	switch (mr->lchan->type) {
 	case GSM_LCHAN_TCH_F:
@@ -240,6 +288,21 @@ static int process_meas_rep(struct gsm_meas_rep *mr)
 		return 0;
 	}
 
+	/* parse actual neighbor cell info */
+	if (mr->num_cell > 0 && mr->num_cell < 7)
+		process_meas_neigh(mr);
+
+	return 1;
+}
+
+/* decide if we want to attempt a handover, based on the latest report
+ * of an lchan */
+static int decide_meas_rep(struct gsm_meas_rep *mr)
+{
+	struct gsm_network *net = mr->lchan->ts->trx->bts->network;
+	enum meas_rep_field dlev, dqual;
+	int av_rxlev;
+
 	if (mr->flags & MEAS_REP_F_DL_DTX) {
 		dlev = MEAS_REP_DL_RXLEV_SUB;
 		dqual = MEAS_REP_DL_RXQUAL_SUB;
@@ -248,38 +311,71 @@ static int process_meas_rep(struct gsm_meas_rep *mr)
 		dqual = MEAS_REP_DL_RXQUAL_FULL;
 	}
 
-	/* parse actual neighbor cell info */
-	if (mr->num_cell > 0 && mr->num_cell < 7)
-		process_meas_neigh(mr);
-
 	av_rxlev = get_meas_rep_avg(mr->lchan, dlev,
 				    net->handover.win_rxlev_avg);
 
 	/* Interference HO */
 	if (rxlev2dbm(av_rxlev) > -85 &&
 	    meas_rep_n_out_of_m_be(mr->lchan, dqual, 3, 4, 5))
-		return attempt_handover(mr);
+		return attempt_handover(mr, av_rxlev);
 
 	/* Bad Quality */
 	if (meas_rep_n_out_of_m_be(mr->lchan, dqual, 3, 4, 5))
-		return attempt_handover(mr);
+		return attempt_handover(mr, av_rxlev);
 
 	/* Low Level */
 	if (rxlev2dbm(av_rxlev) <= -110)
-		return attempt_handover(mr);
+		return attempt_handover(mr, av_rxlev);
 
 	/* Distance */
 	if (mr->ms_l1.ta > net->handover.max_distance)
-		return attempt_handover(mr);
+		return attempt_handover(mr, av_rxlev);
 
 	/* Power Budget AKA Better Cell */
 	if ((mr->nr % net->handover.pwr_interval) == 0)
-		return attempt_handover(mr);
+		return attempt_handover(mr, av_rxlev);
 
 	return 0;
 
 }
 
+/* Process a batch of already parsed measurement reports in one pass.
+ * The neighbor statistics take every report into account, but each
+ * lchan is decided on only once, with its latest report of the batch. */
+void ho_dec_meas_reps(struct gsm_meas_rep **mrs, unsigned int num)
+{
+	unsigned int i;
+
+	for (i = 0; i < num; i++) {
+		if (update_meas_rep(mrs[i]))
+			mrs[i]->lchan->ho_dec_mr = mrs[i];
+	}
+
+	for (i = 0; i < num; i++) {
+		struct gsm_lchan *lchan = mrs[i]->lchan;
+
+		if (lchan->ho_dec_mr != mrs[i])
+			continue;
+		lchan->ho_dec_mr = NULL;
+		decide_meas_rep(mrs[i]);
+	}
+}
+
+/* the handover to a cell has failed or timed out, pass it over for a
+ * while */
+static void handover_failed(struct gsm_lchan *lchan)
+{
+	struct gsm_network *net = lchan->ts->trx->bts->network;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(lchan->neigh_meas); i++) {
+		struct neigh_meas_proc *nmp = &lchan->neigh_meas[i];
+
+		if (nmp->arfcn && nmp->ho_started)
+			penalize_neigh(net, nmp);
+	}
+}
+
 static int ho_dec_sig_cb(unsigned int subsys, unsigned int signal,
 			   void *handler_data, void *signal_data)
 {
@@ -291,7 +387,11 @@ static int ho_dec_sig_cb(unsigned int subsys, unsigned int signal,
 	lchan_data = signal_data;
 	switch (signal) {
 	case S_LCHAN_MEAS_REP:
-		process_meas_rep(lchan_data->mr);
+		ho_dec_meas_reps(&lchan_data->mr, 1);
+		break;
+	case S_LCHAN_HANDOVER_FAIL:
+	case S_LCHAN_HANDOVER_TIMEOUT:
+		handover_failed(lchan_data->lchan);
 		break;
 	}
 
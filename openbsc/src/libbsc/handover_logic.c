@@ -41,9 +41,11 @@
 #include <openbsc/transaction.h>
 #include <openbsc/trau_mux.h>
 
+/* An ongoing handover is reachable from both its lchans through
+ * lchan->ho. An lchan is only ever part of one handover: the new lchan is
+ * a free one, and it only becomes the old lchan of another handover after
+ * this one is complete. */
 struct bsc_handover {
-	struct llist_head list;
-
 	struct gsm_lchan *old_lchan;
 	struct gsm_lchan *new_lchan;
 
@@ -52,37 +54,30 @@ struct bsc_handover {
 	uint8_t ho_ref;
 };
 
-static LLIST_HEAD(bsc_handovers);
-
 static void handover_free(struct bsc_handover *ho)
 {
 	osmo_timer_del(&ho->T3103);
-	llist_del(&ho->list);
+	if (ho->old_lchan->ho == ho)
+		ho->old_lchan->ho = NULL;
+	if (ho->new_lchan->ho == ho)
+		ho->new_lchan->ho = NULL;
 	talloc_free(ho);
 }
 
 static struct bsc_handover *bsc_ho_by_new_lchan(struct gsm_lchan *new_lchan)
 {
-	struct bsc_handover *ho;
-
-	llist_for_each_entry(ho, &bsc_handovers, list) {
-		if (ho->new_lchan == new_lchan)
-			return ho;
-	}
-
-	return NULL;
+	if (!new_lchan || !new_lchan->ho)
+		return NULL;
+	if (new_lchan->ho->new_lchan != new_lchan)
+		return NULL;
+	return new_lchan->ho;
 }
 
 static struct bsc_handover *bsc_ho_by_old_lchan(struct gsm_lchan *old_lchan)
 {
-	struct bsc_handover *ho;
-
-	llist_for_each_entry(ho, &bsc_handovers, list) {
-		if (ho->old_lchan == old_lchan)
-			return ho;
-	}
-
-	return NULL;
+	if (!old_lchan->ho || old_lchan->ho->old_lchan != old_lchan)
+		return NULL;
+	return old_lchan->ho;
 }
 
 /*! \brief Hand over the specified logical channel to the specified new BTS.
@@ -151,7 +146,8 @@ int bsc_handover_start(struct gsm_lchan *old_lchan, struct gsm_bts *bts)
 	}
 
 	rsl_lchan_set_state(new_lchan, LCHAN_S_ACT_REQ);
-	llist_add(&ho->list, &bsc_handovers);
+	old_lchan->ho = ho;
+	new_lchan->ho = ho;
 	/* we continue in the SS_LCHAN handler / ho_chan_activ_ack */
 
 	return 0;
@@ -186,9 +182,11 @@ static void ho_T3103_cb(void *_ho)
 {
 	struct bsc_handover *ho = _ho;
 	struct gsm_network *net = ho->new_lchan->ts->trx->bts->network;
+	struct lchan_signal_data sig = { .lchan = ho->old_lchan };
 
 	DEBUGP(DHO, "HO T3103 expired\n");
 	rate_ctr_inc(&net->bsc_ctrs->ctr[BSC_CTR_HANDOVER_TIMEOUT]);
+	osmo_signal_dispatch(SS_LCHAN, S_LCHAN_HANDOVER_TIMEOUT, &sig);
 
 	ho->new_lchan->conn->ho_lchan = NULL;
 	ho->new_lchan->conn = NULL;
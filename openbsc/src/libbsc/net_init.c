@@ -56,6 +56,7 @@ struct gsm_network *bsc_network_init(void *ctx,
 	net->handover.pwr_interval = 6;
 	net->handover.pwr_hysteresis = 3;
 	net->handover.max_distance = 9999;
+	net->handover.penalty_time = 10;
 
 	INIT_LLIST_HEAD(&net->bts_list);
 
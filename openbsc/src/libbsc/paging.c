@@ -62,6 +62,7 @@ static void paging_remove_request(struct gsm_bts_paging_state *paging_bts,
 {
 	osmo_timer_del(&to_be_deleted->T3113);
 	llist_del(&to_be_deleted->entry);
+	llist_del(&to_be_deleted->subscr_entry);
 	subscr_put(to_be_deleted->subscr);
 	talloc_free(to_be_deleted);
 }
@@ -235,16 +236,22 @@ static void paging_init_if_needed(struct gsm_bts *bts)
 	bts->paging.available_slots = 20;
 }
 
-static int paging_pending_request(struct gsm_bts_paging_state *bts,
-				struct gsm_subscriber *subscr) {
+/*
+ * Find the request for the subscriber at the given BTS. A subscriber is
+ * only paged on the few BTS of its location area, so this is cheaper
+ * than walking the pending requests of the BTS.
+ */
+static struct gsm_paging_request *paging_find(struct gsm_bts *bts,
+					      struct gsm_subscriber *subscr)
+{
 	struct gsm_paging_request *req;
 
-	llist_for_each_entry(req, &bts->pending_requests, entry) {
-		if (subscr == req->subscr)
-			return 1;
+	llist_for_each_entry(req, &subscr->paging_requests, subscr_entry) {
+		if (req->bts == bts)
+			return req;
 	}
 
-	return 0;	
+	return NULL;
 }
 
 static void paging_T3113_expired(void *data)
@@ -282,7 +289,7 @@ static int _paging_request(struct gsm_bts *bts, struct gsm_subscriber *subscr,
 	struct gsm_bts_paging_state *bts_entry = &bts->paging;
 	struct gsm_paging_request *req;
 
-	if (paging_pending_request(bts_entry, subscr)) {
+	if (paging_find(bts, subscr)) {
 		LOGP(DPAG, LOGL_INFO, "Paging request already pending for %s\n", subscr->imsi);
 		return -EEXIST;
 	}
@@ -299,6 +306,7 @@ static int _paging_request(struct gsm_bts *bts, struct gsm_subscriber *subscr,
 	req->T3113.data = req;
 	osmo_timer_schedule(&req->T3113, bts->network->T3113, 0);
 	llist_add_tail(&req->entry, &bts_entry->pending_requests);
+	llist_add_tail(&req->subscr_entry, &subscr->paging_requests);
 	paging_schedule_if_needed(bts_entry);
 
 	return 0;
@@ -360,30 +368,27 @@ static void _paging_request_stop(struct gsm_bts *bts, struct gsm_subscriber *sub
 				 struct gsm_subscriber_connection *conn,
 				 struct msgb *msg)
 {
-	struct gsm_bts_paging_state *bts_entry = &bts->paging;
-	struct gsm_paging_request *req, *req2;
+	struct gsm_paging_request *req;
+	gsm_cbfn *cbfn;
+	void *param;
 
-	paging_init_if_needed(bts);
+	req = paging_find(bts, subscr);
+	if (!req)
+		return;
 
-	llist_for_each_entry_safe(req, req2, &bts_entry->pending_requests,
-				 entry) {
-		if (req->subscr == subscr) {
-			gsm_cbfn *cbfn = req->cbfn;
-			void *param = req->cbfn_param;
-
-			/* now give up the data structure */
-			paging_remove_request(&bts->paging, req);
-			req = NULL;
-
-			if (conn && cbfn) {
-				LOGP(DPAG, LOGL_DEBUG, "Stop paging on bts %d, calling cbfn.\n", bts->nr);
-				cbfn(GSM_HOOK_RR_PAGING, GSM_PAGING_SUCCEEDED,
-					  msg, conn, param);
-			} else
-				LOGP(DPAG, LOGL_DEBUG, "Stop paging on bts %d silently.\n", bts->nr);
-			break;
-		}
-	}
+	cbfn = req->cbfn;
+	param = req->cbfn_param;
+
+	/* now give up the data structure */
+	paging_remove_request(&bts->paging, req);
+	req = NULL;
+
+	if (conn && cbfn) {
+		LOGP(DPAG, LOGL_DEBUG, "Stop paging on bts %d, calling cbfn.\n", bts->nr);
+		cbfn(GSM_HOOK_RR_PAGING, GSM_PAGING_SUCCEEDED,
+			  msg, conn, param);
+	} else
+		LOGP(DPAG, LOGL_DEBUG, "Stop paging on bts %d silently.\n", bts->nr);
 }
 
 /* Stop paging on all other bts' */
@@ -391,21 +396,26 @@ void paging_request_stop(struct gsm_bts *_bts, struct gsm_subscriber *subscr,
 			 struct gsm_subscriber_connection *conn,
 			 struct msgb *msg)
 {
-	struct gsm_bts *bts;
+	struct gsm_paging_request *req;
 
 	log_set_context(BSC_CTX_SUBSCR, subscr);
 
+	/* the requests hold the references, keep subscr around until
+	 * the last one is gone */
+	subscr_get(subscr);
+
 	/* Stop this first and dispatch the request */
 	if (_bts)
 		_paging_request_stop(_bts, subscr, conn, msg);
 
 	/* Make sure to cancel this everywhere else */
-	llist_for_each_entry(bts, &subscr->group->net->bts_list, list) {
-		/* Sort of an optimization. */
-		if (bts == _bts)
-			continue;
-		_paging_request_stop(bts, subscr, NULL, NULL);
+	while (!llist_empty(&subscr->paging_requests)) {
+		req = llist_entry(subscr->paging_requests.next,
+				  struct gsm_paging_request, subscr_entry);
+		_paging_request_stop(req->bts, subscr, NULL, NULL);
 	}
+
+	subscr_put(subscr);
 }
 
 void paging_update_buffer_space(struct gsm_bts *bts, uint16_t free_slots)
@@ -437,9 +447,6 @@ void *paging_get_data(struct gsm_bts *bts, struct gsm_subscriber *subscr)
 {
 	struct gsm_paging_request *req;
 
-	llist_for_each_entry(req, &bts->paging.pending_requests, entry)
-		if (req->subscr == subscr)
-			return req->cbfn_param;
-
-	return NULL;
+	req = paging_find(bts, subscr);
+	return req ? req->cbfn_param : NULL;
 }
@@ -42,6 +42,7 @@ struct gsm_network *gsm_network_init(void *ctx,
 				     mncc_recv_cb_t mncc_recv)
 {
 	struct gsm_network *net;
+	int i;
 
 	const char *default_regexp = ".*";
 
@@ -67,7 +68,12 @@ struct gsm_network *gsm_network_init(void *ctx,
 	net->network_code = network_code;
 
 	INIT_LLIST_HEAD(&net->trans_list);
+	for (i = 0; i < GSM_TRANS_HASH_SIZE; i++) {
+		INIT_LLIST_HEAD(&net->trans_callref_hash[i]);
+		INIT_LLIST_HEAD(&net->trans_id_hash[i]);
+	}
 	INIT_LLIST_HEAD(&net->upqueue);
+	net->mncc_sock_queue_max = MNCC_SOCK_QUEUE_DEFAULT;
 	INIT_LLIST_HEAD(&net->subscr_conns);
 
 	/* init statistics */
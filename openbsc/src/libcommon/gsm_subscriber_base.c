@@ -65,6 +65,7 @@ struct gsm_subscriber *subscr_alloc(void)
 	s->tmsi = GSM_RESERVED_TMSI;
 
 	INIT_LLIST_HEAD(&s->requests);
+	INIT_LLIST_HEAD(&s->paging_requests);
 
 	return s;
 }
@@ -25,8 +25,11 @@
 
 #include <osmocom/abis/ipa.h>
 #include <osmocom/gsm/protocol/ipaccess.h>
+#include <osmocom/gsm/protocol/gsm_04_08_gprs.h>
+#include <osmocom/gsm/gsup.h>
 #include <osmocom/core/msgb.h>
 #include <osmocom/core/logging.h>
+#include <osmocom/core/talloc.h>
 
 #include <openbsc/debug.h>
 
@@ -35,143 +38,340 @@
 
 extern void *tall_bsc_ctx;
 
-static void start_test_procedure(struct gsup_client *gsupc);
+/* A request to the HLR, either awaiting its answer on conn or waiting in
+ * the queue for a connection with room */
+struct gsup_client_req {
+	struct llist_head list;
+	struct gsup_client *gsupc;
+	struct gsup_client_conn *conn;
+	uint32_t id;
+
+	/* what the answer is matched against */
+	uint8_t msg_type;
+	char imsi[GSM23003_IMSI_MAX_DIGITS+1];
+
+	/* only set while queued */
+	struct msgb *msg;
+	struct osmo_timer_list timer;
+};
+
+static void start_test_procedure(struct gsup_client_conn *conn);
+static void req_kick(struct gsup_client *gsupc);
 
-static void gsup_client_send_ping(struct gsup_client *gsupc)
+static void gsup_client_send_ping(struct gsup_client_conn *conn)
 {
 	struct msgb *msg = gsup_client_msgb_alloc();
 
 	msg->l2h = msgb_put(msg, 1);
 	msg->l2h[0] = IPAC_MSGT_PING;
 	ipa_msg_push_header(msg, IPAC_PROTO_IPACCESS);
-	ipa_client_conn_send(gsupc->link, msg);
+	ipa_client_conn_send(conn->link, msg);
 }
 
-static int gsup_client_connect(struct gsup_client *gsupc)
+static int gsup_client_connect(struct gsup_client_conn *conn)
 {
 	int rc;
 
-	if (gsupc->is_connected)
+	if (conn->is_connected)
 		return 0;
 
-	if (osmo_timer_pending(&gsupc->connect_timer)) {
+	if (osmo_timer_pending(&conn->connect_timer)) {
 		LOGP(DLGSUP, LOGL_DEBUG,
 		     "GSUP connect: connect timer already running\n");
-		osmo_timer_del(&gsupc->connect_timer);
+		osmo_timer_del(&conn->connect_timer);
 	}
 
-	if (osmo_timer_pending(&gsupc->ping_timer)) {
+	if (osmo_timer_pending(&conn->ping_timer)) {
 		LOGP(DLGSUP, LOGL_DEBUG,
 		     "GSUP connect: ping timer already running\n");
-		osmo_timer_del(&gsupc->ping_timer);
+		osmo_timer_del(&conn->ping_timer);
 	}
 
-	if (ipa_client_conn_clear_queue(gsupc->link) > 0)
+	if (ipa_client_conn_clear_queue(conn->link) > 0)
 		LOGP(DLGSUP, LOGL_DEBUG, "GSUP connect: discarded stored messages\n");
 
-	rc = ipa_client_conn_open(gsupc->link);
+	rc = ipa_client_conn_open(conn->link);
 
 	if (rc >= 0) {
 		LOGP(DLGSUP, LOGL_INFO, "GSUP connecting to %s:%d\n",
-		     gsupc->link->addr, gsupc->link->port);
+		     conn->link->addr, conn->link->port);
 		return 0;
 	}
 
 	LOGP(DLGSUP, LOGL_INFO, "GSUP failed to connect to %s:%d: %s\n",
-	     gsupc->link->addr, gsupc->link->port, strerror(-rc));
+	     conn->link->addr, conn->link->port, strerror(-rc));
 
 	if (rc == -EBADF || rc == -ENOTSOCK || rc == -EAFNOSUPPORT ||
 	    rc == -EINVAL)
 		return rc;
 
-	osmo_timer_schedule(&gsupc->connect_timer,
+	osmo_timer_schedule(&conn->connect_timer,
 			    GSUP_CLIENT_RECONNECT_INTERVAL, 0);
 
 	LOGP(DLGSUP, LOGL_INFO, "Scheduled timer to retry GSUP connect to %s:%d\n",
-	     gsupc->link->addr, gsupc->link->port);
+	     conn->link->addr, conn->link->port);
 
 	return 0;
 }
 
-static void connect_timer_cb(void *gsupc_)
+static void connect_timer_cb(void *conn_)
 {
-	struct gsup_client *gsupc = gsupc_;
+	struct gsup_client_conn *conn = conn_;
 
-	if (gsupc->is_connected)
+	if (conn->is_connected)
 		return;
 
-	gsup_client_connect(gsupc);
+	gsup_client_connect(conn);
 }
 
-static void client_send(struct gsup_client *gsupc, int proto_ext,
+static void client_send(struct gsup_client_conn *conn, int proto_ext,
 			struct msgb *msg_tx)
 {
 	ipa_prepend_header_ext(msg_tx, proto_ext);
 	ipa_msg_push_header(msg_tx, IPAC_PROTO_OSMO);
-	ipa_client_conn_send(gsupc->link, msg_tx);
+	ipa_client_conn_send(conn->link, msg_tx);
 	/* msg_tx is now queued and will be freed. */
 }
 
-static void gsup_client_oap_register(struct gsup_client *gsupc)
+static void gsup_client_oap_register(struct gsup_client_conn *conn)
 {
 	struct msgb *msg_tx;
 	int rc;
-	rc = oap_client_register(&gsupc->oap_state, &msg_tx);
+	rc = oap_client_register(&conn->oap_state, &msg_tx);
 
 	if ((rc < 0) || (!msg_tx)) {
 		LOGP(DLGSUP, LOGL_ERROR, "GSUP OAP set up, but cannot register.\n");
 		return;
 	}
 
-	client_send(gsupc, IPAC_PROTO_EXT_OAP, msg_tx);
+	client_send(conn, IPAC_PROTO_EXT_OAP, msg_tx);
+}
+
+static void req_free(struct gsup_client_req *req)
+{
+	struct gsup_client *gsupc = req->gsupc;
+
+	osmo_timer_del(&req->timer);
+	llist_del(&req->list);
+	if (req->conn) {
+		req->conn->num_inflight -= 1;
+		gsupc->num_inflight -= 1;
+	} else {
+		gsupc->num_queued -= 1;
+	}
+	if (req->msg)
+		msgb_free(req->msg);
+	talloc_free(req);
+}
+
+/* Fail a request towards its originator the way the HLR would have,
+ * so that it cleans up its own state */
+static void req_fail(struct gsup_client_req *req)
+{
+	struct gsup_client *gsupc = req->gsupc;
+	struct osmo_gsup_message gsup_msg = {0};
+	struct msgb *msg;
+
+	strncpy(gsup_msg.imsi, req->imsi, sizeof(gsup_msg.imsi) - 1);
+	gsup_msg.message_type = OSMO_GSUP_TO_MSGT_ERROR(req->msg_type);
+	gsup_msg.cause = GMM_CAUSE_NET_FAIL;
+	req_free(req);
+
+	msg = gsup_client_msgb_alloc();
+	osmo_gsup_encode(msg, &gsup_msg);
+	msg->l2h = msg->data;
+
+	gsupc->rx_conn = NULL;
+	gsupc->read_cb(gsupc, msg);
+	/* expecting read_cb() to free msg */
+}
+
+static void req_timer_cb(void *req_)
+{
+	struct gsup_client_req *req = req_;
+	struct gsup_client *gsupc = req->gsupc;
+
+	LOGP(DLGSUP, LOGL_NOTICE,
+	     "GSUP request %u (type 0x%02x) for IMSI %s timed out%s\n",
+	     req->id, req->msg_type, req->imsi,
+	     req->conn ? "" : " while queued");
+	gsupc->stats.timeouts += 1;
+
+	req_fail(req);
+	req_kick(gsupc);
+}
+
+/* Connected connection with the fewest outstanding requests. With
+ * need_room, only one that may take another request. */
+static struct gsup_client_conn *conn_pick(struct gsup_client *gsupc,
+					  int need_room)
+{
+	struct gsup_client_conn *conn, *best = NULL;
+
+	llist_for_each_entry(conn, &gsupc->conns, list) {
+		if (!conn->is_connected)
+			continue;
+		if (need_room && conn->num_inflight >= gsupc->max_inflight)
+			continue;
+		if (!best || conn->num_inflight < best->num_inflight)
+			best = conn;
+	}
+	return best;
+}
+
+static void req_start(struct gsup_client_req *req,
+		      struct gsup_client_conn *conn, struct msgb *msg)
+{
+	struct gsup_client *gsupc = req->gsupc;
+
+	req->conn = conn;
+	req->msg = NULL;
+	conn->num_inflight += 1;
+	gsupc->num_inflight += 1;
+	llist_add_tail(&req->list, &gsupc->inflight);
+	gsupc->stats.sent += 1;
+
+	LOGP(DLGSUP, LOGL_DEBUG,
+	     "GSUP request %u (type 0x%02x) for IMSI %s to %s:%d\n",
+	     req->id, req->msg_type, req->imsi,
+	     conn->link->addr, conn->link->port);
+
+	client_send(conn, IPAC_PROTO_EXT_GSUP, msg);
+}
+
+/* Send queued requests while there is room */
+static void req_kick(struct gsup_client *gsupc)
+{
+	struct gsup_client_conn *conn;
+	struct gsup_client_req *req;
+
+	while (!llist_empty(&gsupc->queue)) {
+		conn = conn_pick(gsupc, 1);
+		if (!conn)
+			return;
+
+		req = llist_entry(gsupc->queue.next, struct gsup_client_req,
+				  list);
+		llist_del(&req->list);
+		gsupc->num_queued -= 1;
+		req_start(req, conn, req->msg);
+	}
+}
+
+/* Fail everything sent on a connection that went away, the answers will
+ * not come */
+static void conn_fail_inflight(struct gsup_client_conn *conn)
+{
+	struct gsup_client *gsupc = conn->gsupc;
+	struct gsup_client_req *req, *req2;
+
+	/* read_cb may send new requests, which are appended */
+	llist_for_each_entry_safe(req, req2, &gsupc->inflight, list) {
+		if (req->conn != conn)
+			continue;
+		LOGP(DLGSUP, LOGL_NOTICE,
+		     "GSUP request %u for IMSI %s lost with the link to %s:%d\n",
+		     req->id, req->imsi, conn->link->addr, conn->link->port);
+		req_fail(req);
+		if (conn->num_inflight == 0)
+			break;
+	}
 }
 
 static void gsup_client_updown_cb(struct ipa_client_conn *link, int up)
 {
-	struct gsup_client *gsupc = link->data;
+	struct gsup_client_conn *conn = link->data;
+	struct gsup_client *gsupc = conn->gsupc;
 
 	LOGP(DLGSUP, LOGL_INFO, "GSUP link to %s:%d %s\n",
 		     link->addr, link->port, up ? "UP" : "DOWN");
 
-	gsupc->is_connected = up;
+	conn->is_connected = up;
 
 	if (up) {
-		start_test_procedure(gsupc);
+		start_test_procedure(conn);
 
-		if (gsupc->oap_state.state == OAP_INITIALIZED)
-			gsup_client_oap_register(gsupc);
+		if (conn->oap_state.state == OAP_INITIALIZED)
+			gsup_client_oap_register(conn);
 
-		osmo_timer_del(&gsupc->connect_timer);
+		osmo_timer_del(&conn->connect_timer);
+		req_kick(gsupc);
 	} else {
-		osmo_timer_del(&gsupc->ping_timer);
+		osmo_timer_del(&conn->ping_timer);
 
-		osmo_timer_schedule(&gsupc->connect_timer,
+		osmo_timer_schedule(&conn->connect_timer,
 				    GSUP_CLIENT_RECONNECT_INTERVAL, 0);
+		conn_fail_inflight(conn);
+		req_kick(gsupc);
 	}
 }
 
-static int gsup_client_oap_handle(struct gsup_client *gsupc, struct msgb *msg_rx)
+static int gsup_client_oap_handle(struct gsup_client_conn *conn,
+				  struct msgb *msg_rx)
 {
 	int rc;
 	struct msgb *msg_tx;
 
 	/* If the oap_state is disabled, this will reject the messages. */
-	rc = oap_client_handle(&gsupc->oap_state, msg_rx, &msg_tx);
+	rc = oap_client_handle(&conn->oap_state, msg_rx, &msg_tx);
 	msgb_free(msg_rx);
 	if (rc < 0)
 		return rc;
 
 	if (msg_tx)
-		client_send(gsupc, IPAC_PROTO_EXT_OAP, msg_tx);
+		client_send(conn, IPAC_PROTO_EXT_OAP, msg_tx);
 
 	return 0;
 }
 
+/* Retire the request a result or error belongs to */
+static void gsup_client_match(struct gsup_client_conn *conn,
+			      const struct osmo_gsup_message *gsup_msg)
+{
+	struct gsup_client *gsupc = conn->gsupc;
+	struct gsup_client_req *req;
+	uint8_t req_type = gsup_msg->message_type & ~0x03;
+
+	llist_for_each_entry(req, &gsupc->inflight, list) {
+		if (req->msg_type != req_type || req->conn != conn ||
+		    strcmp(req->imsi, gsup_msg->imsi))
+			continue;
+
+		gsupc->stats.answered += 1;
+		req_free(req);
+		return;
+	}
+
+	LOGP(DLGSUP, LOGL_INFO,
+	     "GSUP answer (type 0x%02x) for IMSI %s matches no request\n",
+	     gsup_msg->message_type, gsup_msg->imsi);
+	gsupc->stats.unmatched += 1;
+}
+
+static void gsup_client_rx_gsup(struct gsup_client_conn *conn,
+				struct msgb *msg)
+{
+	struct gsup_client *gsupc = conn->gsupc;
+	struct osmo_gsup_message gsup_msg;
+
+	if (osmo_gsup_decode(msgb_l2(msg), msgb_l2len(msg), &gsup_msg) >= 0 &&
+	    !OSMO_GSUP_IS_MSGT_REQUEST(gsup_msg.message_type))
+		gsup_client_match(conn, &gsup_msg);
+
+	OSMO_ASSERT(gsupc->read_cb != NULL);
+	gsupc->rx_conn = conn;
+	gsupc->read_cb(gsupc, msg);
+	/* expecting read_cb() to free msg */
+	gsupc->rx_conn = NULL;
+
+	req_kick(gsupc);
+}
+
 static int gsup_client_read_cb(struct ipa_client_conn *link, struct msgb *msg)
 {
 	struct ipaccess_head *hh = (struct ipaccess_head *) msg->data;
 	struct ipaccess_head_ext *he = (struct ipaccess_head_ext *) msgb_l2(msg);
-	struct gsup_client *gsupc = (struct gsup_client *)link->data;
+	struct gsup_client_conn *conn = (struct gsup_client_conn *)link->data;
 	int rc;
 	static struct ipaccess_unit ipa_dev = {
 		.unit_name = "SGSN"
@@ -186,8 +386,9 @@ static int gsup_client_read_cb(struct ipa_client_conn *link, struct msgb *msg)
 		     "GSUP received an invalid IPA/CCM message from %s:%d\n",
 		     link->addr, link->port);
 		/* Link has been closed */
-		gsupc->is_connected = 0;
+		conn->is_connected = 0;
 		msgb_free(msg);
+		conn_fail_inflight(conn);
 		return -1;
 	}
 
@@ -196,7 +397,7 @@ static int gsup_client_read_cb(struct ipa_client_conn *link, struct msgb *msg)
 		/* CCM message */
 		if (msg_type == IPAC_MSGT_PONG) {
 			LOGP(DLGSUP, LOGL_DEBUG, "GSUP receiving PONG\n");
-			gsupc->got_ipa_pong = 1;
+			conn->got_ipa_pong = 1;
 		}
 
 		msgb_free(msg);
@@ -212,11 +413,9 @@ static int gsup_client_read_cb(struct ipa_client_conn *link, struct msgb *msg)
 	msg->l2h = &he->data[0];
 
 	if (he->proto == IPAC_PROTO_EXT_GSUP) {
-		OSMO_ASSERT(gsupc->read_cb != NULL);
-		gsupc->read_cb(gsupc, msg);
-		/* expecting read_cb() to free msg */
+		gsup_client_rx_gsup(conn, msg);
 	} else if (he->proto == IPAC_PROTO_EXT_OAP) {
-		return gsup_client_oap_handle(gsupc, msg);
+		return gsup_client_oap_handle(conn, msg);
 		/* gsup_client_oap_handle frees msg */
 	} else
 		goto invalid;
@@ -232,74 +431,123 @@ invalid:
 	return -1;
 }
 
-static void ping_timer_cb(void *gsupc_)
+static void ping_timer_cb(void *conn_)
 {
-	struct gsup_client *gsupc = gsupc_;
+	struct gsup_client_conn *conn = conn_;
 
 	LOGP(DLGSUP, LOGL_INFO, "GSUP ping callback (%s, %s PONG)\n",
-	     gsupc->is_connected ? "connected" : "not connected",
-	     gsupc->got_ipa_pong ? "got" : "didn't get");
+	     conn->is_connected ? "connected" : "not connected",
+	     conn->got_ipa_pong ? "got" : "didn't get");
 
-	if (gsupc->got_ipa_pong) {
-		start_test_procedure(gsupc);
+	if (conn->got_ipa_pong) {
+		start_test_procedure(conn);
 		return;
 	}
 
 	LOGP(DLGSUP, LOGL_NOTICE, "GSUP ping timed out, reconnecting\n");
-	ipa_client_conn_close(gsupc->link);
-	gsupc->is_connected = 0;
+	ipa_client_conn_close(conn->link);
+	conn->is_connected = 0;
+	conn_fail_inflight(conn);
 
-	gsup_client_connect(gsupc);
+	gsup_client_connect(conn);
 }
 
-static void start_test_procedure(struct gsup_client *gsupc)
+static void start_test_procedure(struct gsup_client_conn *conn)
 {
-	gsupc->ping_timer.data = gsupc;
-	gsupc->ping_timer.cb = &ping_timer_cb;
+	conn->ping_timer.data = conn;
+	conn->ping_timer.cb = &ping_timer_cb;
 
-	gsupc->got_ipa_pong = 0;
-	osmo_timer_schedule(&gsupc->ping_timer, GSUP_CLIENT_PING_INTERVAL, 0);
+	conn->got_ipa_pong = 0;
+	osmo_timer_schedule(&conn->ping_timer, GSUP_CLIENT_PING_INTERVAL, 0);
 	LOGP(DLGSUP, LOGL_DEBUG, "GSUP sending PING\n");
-	gsup_client_send_ping(gsupc);
+	gsup_client_send_ping(conn);
 }
 
-struct gsup_client *gsup_client_create(const char *ip_addr,
-				       unsigned int tcp_port,
-				       gsup_client_read_cb_t read_cb,
-				       struct oap_client_config *oapc_config)
+static void conn_destroy(struct gsup_client_conn *conn)
 {
-	struct gsup_client *gsupc;
+	osmo_timer_del(&conn->connect_timer);
+	osmo_timer_del(&conn->ping_timer);
+
+	if (conn->link) {
+		ipa_client_conn_close(conn->link);
+		ipa_client_conn_destroy(conn->link);
+		conn->link = NULL;
+	}
+	llist_del(&conn->list);
+	conn->gsupc->num_conns -= 1;
+	talloc_free(conn);
+}
+
+/* Add another connection, to the same or a different HLR */
+int gsup_client_add_conn(struct gsup_client *gsupc, const char *ip_addr,
+			 unsigned int tcp_port)
+{
+	struct gsup_client_conn *conn;
 	int rc;
 
-	gsupc = talloc_zero(tall_bsc_ctx, struct gsup_client);
-	OSMO_ASSERT(gsupc);
+	conn = talloc_zero(gsupc, struct gsup_client_conn);
+	OSMO_ASSERT(conn);
+	conn->gsupc = gsupc;
+	llist_add_tail(&conn->list, &gsupc->conns);
+	gsupc->num_conns += 1;
 
 	/* a NULL oapc_config will mark oap_state disabled. */
-	rc = oap_client_init(oapc_config, &gsupc->oap_state);
+	rc = oap_client_init(gsupc->oap_config, &conn->oap_state);
 	if (rc != 0)
 		goto failed;
 
-	gsupc->link = ipa_client_conn_create(gsupc,
-					     /* no e1inp */ NULL,
-					     0,
-					     ip_addr, tcp_port,
-					     gsup_client_updown_cb,
-					     gsup_client_read_cb,
-					     /* default write_cb */ NULL,
-					     gsupc);
-	if (!gsupc->link)
+	conn->link = ipa_client_conn_create(conn,
+					    /* no e1inp */ NULL,
+					    0,
+					    ip_addr, tcp_port,
+					    gsup_client_updown_cb,
+					    gsup_client_read_cb,
+					    /* default write_cb */ NULL,
+					    conn);
+	if (!conn->link) {
+		rc = -ENOMEM;
 		goto failed;
+	}
 
-	gsupc->connect_timer.data = gsupc;
-	gsupc->connect_timer.cb = &connect_timer_cb;
+	conn->connect_timer.data = conn;
+	conn->connect_timer.cb = &connect_timer_cb;
 
-	rc = gsup_client_connect(gsupc);
+	rc = gsup_client_connect(conn);
 
 	if (rc < 0)
 		goto failed;
 
+	return 0;
+
+failed:
+	conn_destroy(conn);
+	return rc;
+}
+
+struct gsup_client *gsup_client_create(const char *ip_addr,
+				       unsigned int tcp_port,
+				       gsup_client_read_cb_t read_cb,
+				       struct oap_client_config *oapc_config)
+{
+	struct gsup_client *gsupc;
+	int rc;
+
+	gsupc = talloc_zero(tall_bsc_ctx, struct gsup_client);
+	OSMO_ASSERT(gsupc);
+
+	INIT_LLIST_HEAD(&gsupc->conns);
+	INIT_LLIST_HEAD(&gsupc->inflight);
+	INIT_LLIST_HEAD(&gsupc->queue);
+	gsupc->max_inflight = GSUP_CLIENT_MAX_INFLIGHT;
+	gsupc->max_queued = GSUP_CLIENT_MAX_QUEUED;
+	gsupc->req_timeout = GSUP_CLIENT_REQ_TIMEOUT;
+	gsupc->oap_config = oapc_config;
 	gsupc->read_cb = read_cb;
 
+	rc = gsup_client_add_conn(gsupc, ip_addr, tcp_port);
+	if (rc < 0)
+		goto failed;
+
 	return gsupc;
 
 failed:
@@ -309,31 +557,92 @@ failed:
 
 void gsup_client_destroy(struct gsup_client *gsupc)
 {
-	osmo_timer_del(&gsupc->connect_timer);
-	osmo_timer_del(&gsupc->ping_timer);
+	struct gsup_client_conn *conn, *conn2;
+	struct gsup_client_req *req, *req2;
+
+	llist_for_each_entry_safe(req, req2, &gsupc->inflight, list)
+		req_free(req);
+	llist_for_each_entry_safe(req, req2, &gsupc->queue, list)
+		req_free(req);
+	llist_for_each_entry_safe(conn, conn2, &gsupc->conns, list)
+		conn_destroy(conn);
 
-	if (gsupc->link) {
-		ipa_client_conn_close(gsupc->link);
-		ipa_client_conn_destroy(gsupc->link);
-		gsupc->link = NULL;
-	}
 	talloc_free(gsupc);
 }
 
+int gsup_client_is_connected(struct gsup_client *gsupc)
+{
+	return gsupc && conn_pick(gsupc, 0) != NULL;
+}
+
+/* Send a GSUP message in msg. Requests are tracked until their answer
+ * arrives or req_timeout expires, and wait in a queue while every
+ * connection has max_inflight requests outstanding. Results and errors
+ * go back on the connection the HLR's request came in on. */
 int gsup_client_send(struct gsup_client *gsupc, struct msgb *msg)
 {
+	struct osmo_gsup_message gsup_msg;
+	struct gsup_client_conn *conn;
+	struct gsup_client_req *req;
+	int rc;
+
 	if (!gsupc) {
 		msgb_free(msg);
 		return -ENOTCONN;
 	}
 
-	if (!gsupc->is_connected) {
+	conn = conn_pick(gsupc, 0);
+	if (!conn) {
 		msgb_free(msg);
 		return -EAGAIN;
 	}
 
-	client_send(gsupc, IPAC_PROTO_EXT_GSUP, msg);
+	rc = osmo_gsup_decode(msgb_data(msg), msgb_length(msg), &gsup_msg);
+	if (rc < 0) {
+		LOGP(DLGSUP, LOGL_ERROR,
+		     "GSUP refusing to send an undecodable message: %d\n", rc);
+		msgb_free(msg);
+		return rc;
+	}
+
+	if (!OSMO_GSUP_IS_MSGT_REQUEST(gsup_msg.message_type)) {
+		if (gsupc->rx_conn && gsupc->rx_conn->is_connected)
+			conn = gsupc->rx_conn;
+		client_send(conn, IPAC_PROTO_EXT_GSUP, msg);
+		return 0;
+	}
+
+	req = talloc_zero(gsupc, struct gsup_client_req);
+	OSMO_ASSERT(req);
+	req->gsupc = gsupc;
+	req->id = gsupc->next_req_id++;
+	req->msg_type = gsup_msg.message_type;
+	strncpy(req->imsi, gsup_msg.imsi, sizeof(req->imsi) - 1);
+	req->timer.cb = req_timer_cb;
+	req->timer.data = req;
+	osmo_timer_schedule(&req->timer, gsupc->req_timeout, 0);
+
+	conn = conn_pick(gsupc, 1);
+	if (conn) {
+		req_start(req, conn, msg);
+		return 0;
+	}
+
+	if (gsupc->num_queued >= gsupc->max_queued) {
+		LOGP(DLGSUP, LOGL_ERROR,
+		     "GSUP queue full, dropping request for IMSI %s\n",
+		     req->imsi);
+		gsupc->stats.dropped += 1;
+		osmo_timer_del(&req->timer);
+		talloc_free(req);
+		msgb_free(msg);
+		return -ENOSPC;
+	}
 
+	req->msg = msg;
+	llist_add_tail(&req->list, &gsupc->queue);
+	gsupc->num_queued += 1;
+	gsupc->stats.queued += 1;
 	return 0;
 }
 
@@ -26,6 +26,7 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 #include <dbi/dbi.h>
 
@@ -49,7 +50,7 @@ static char *db_basename = NULL;
 static char *db_dirname = NULL;
 static dbi_conn conn;
 
-#define SCHEMA_REVISION "4"
+#define SCHEMA_REVISION "5"
 
 enum {
 	SCHEMA_META,
@@ -180,6 +181,27 @@ static const char *create_stmts[] = {
 		")",
 };
 
+/* created after the schema migration, the rev 3 update re-creates SMS */
+static const char *create_index_stmts[] = {
+	/* unsent SMS by receiver, see db_sms_get_unsent_by_subscr() */
+	"CREATE INDEX IF NOT EXISTS SMS_unsent_idx "
+		"ON SMS (dest_addr, id) "
+		"WHERE sent IS NULL",
+	"CREATE INDEX IF NOT EXISTS Subscriber_attached_idx "
+		"ON Subscriber (id) WHERE lac > 0",
+	"CREATE INDEX IF NOT EXISTS Subscriber_expire_idx "
+		"ON Subscriber (expire_lu) WHERE expire_lu IS NOT NULL",
+	"CREATE INDEX IF NOT EXISTS EquipmentWatch_equipment_idx "
+		"ON EquipmentWatch (equipment_id)",
+	"CREATE INDEX IF NOT EXISTS Counters_name_idx "
+		"ON Counters (name, timestamp)",
+	"CREATE INDEX IF NOT EXISTS RateCounters_name_idx "
+		"ON RateCounters (name, idx, timestamp)",
+};
+
+static const char *db_journal_mode = NULL;
+static const char *db_synchronous = "FULL";
+
 void db_error_func(dbi_conn conn, void *data)
 {
 	const char *msg;
@@ -371,6 +393,27 @@ rollback:
 	return -EINVAL;
 }
 
+static int update_db_revision_4(void)
+{
+	dbi_result result;
+
+	LOGP(DDB, LOGL_NOTICE, "Going to migrate from revision 4\n");
+
+	/* the indexes themselves are created by db_prepare() */
+	result = dbi_conn_query(conn,
+				"UPDATE Meta "
+				"SET value = '5' "
+				"WHERE key = 'revision'");
+	if (!result) {
+		LOGP(DDB, LOGL_ERROR,
+		     "Failed to update DB schema revision (upgrade from rev 4).\n");
+		return -EINVAL;
+	}
+	dbi_result_free(result);
+
+	return 0;
+}
+
 static int check_db_revision(void)
 {
 	dbi_result result;
@@ -414,6 +457,9 @@ static int check_db_revision(void)
 	case 3:
 		if (update_db_revision_3())
 			goto error;
+	case 4:
+		if (update_db_revision_4())
+			goto error;
 
 	/* The end of waterfall */
 	break;
@@ -435,8 +481,16 @@ static int db_configure(void)
 {
 	dbi_result result;
 
-	result = dbi_conn_query(conn,
-				"PRAGMA synchronous = FULL");
+	if (db_journal_mode) {
+		result = dbi_conn_queryf(conn, "PRAGMA journal_mode = %s",
+					 db_journal_mode);
+		if (!result)
+			return -EINVAL;
+		dbi_result_free(result);
+	}
+
+	result = dbi_conn_queryf(conn, "PRAGMA synchronous = %s",
+				 db_synchronous);
 	if (!result)
 		return -EINVAL;
 
@@ -444,6 +498,82 @@ static int db_configure(void)
 	return 0;
 }
 
+static const char *db_journal_modes[] = {
+	"DELETE", "TRUNCATE", "PERSIST", "MEMORY", "WAL", "OFF", NULL
+};
+
+static const char *db_synchronous_modes[] = {
+	"OFF", "NORMAL", "FULL", NULL
+};
+
+static const char *db_find_mode(const char **modes, const char *mode)
+{
+	int i;
+
+	for (i = 0; modes[i]; i++)
+		if (!strcasecmp(modes[i], mode))
+			return modes[i];
+	return NULL;
+}
+
+/* select the SQLite journal mode, to be called before db_prepare() */
+int db_set_journal_mode(const char *mode)
+{
+	const char *m = db_find_mode(db_journal_modes, mode);
+
+	if (!m)
+		return -EINVAL;
+	db_journal_mode = m;
+	return 0;
+}
+
+/* select the SQLite synchronous mode, to be called before db_prepare() */
+int db_set_synchronous(const char *mode)
+{
+	const char *m = db_find_mode(db_synchronous_modes, mode);
+
+	if (!m)
+		return -EINVAL;
+	db_synchronous = m;
+	return 0;
+}
+
+int db_begin_transaction(void)
+{
+	dbi_result result;
+
+	result = dbi_conn_query(conn, "BEGIN TRANSACTION");
+	if (!result)
+		return -EIO;
+
+	dbi_result_free(result);
+	return 0;
+}
+
+int db_commit_transaction(void)
+{
+	dbi_result result;
+
+	result = dbi_conn_query(conn, "COMMIT TRANSACTION");
+	if (!result)
+		return -EIO;
+
+	dbi_result_free(result);
+	return 0;
+}
+
+int db_rollback_transaction(void)
+{
+	dbi_result result;
+
+	result = dbi_conn_query(conn, "ROLLBACK TRANSACTION");
+	if (!result)
+		return -EIO;
+
+	dbi_result_free(result);
+	return 0;
+}
+
 int db_init(const char *name)
 {
 	dbi_initialize(NULL);
@@ -504,6 +634,16 @@ int db_prepare(void)
                 return -1;
 	}
 
+	for (i = 0; i < ARRAY_SIZE(create_index_stmts); i++) {
+		result = dbi_conn_query(conn, create_index_stmts[i]);
+		if (!result) {
+			LOGP(DDB, LOGL_ERROR,
+			     "Failed to create some index.\n");
+			return 1;
+		}
+		dbi_result_free(result);
+	}
+
 	db_configure();
 
 	return 0;
@@ -1611,6 +1751,45 @@ struct gsm_sms *db_sms_get_unsent_by_subscr(struct gsm_network *net,
 	return sms;
 }
 
+/* retrieve up to max unsent SMS for subscribers with ID >= min_subscr_id,
+ * ordered by subscriber and SMS id. The callback takes ownership of each
+ * SMS. Returns the number of SMS handed to the callback. */
+int db_sms_get_unsent_by_subscr_batch(struct gsm_network *net,
+			unsigned long long min_subscr_id, unsigned int failed,
+			unsigned int max, void *priv,
+			void (*callback)(void *priv, struct gsm_sms *sms,
+					 unsigned long long subscr_id))
+{
+	dbi_result result;
+	struct gsm_sms *sms;
+	int count = 0;
+
+	result = dbi_conn_queryf(conn,
+		"SELECT SMS.*, Subscriber.id AS receiver_id "
+			"FROM SMS JOIN Subscriber ON "
+				"SMS.dest_addr = Subscriber.extension "
+			"WHERE Subscriber.id >= %llu AND SMS.sent IS NULL "
+				"AND Subscriber.lac > 0 AND SMS.deliver_attempts < %u "
+			"ORDER BY Subscriber.id, SMS.id LIMIT %u",
+		min_subscr_id, failed, max);
+	if (!result) {
+		LOGP(DDB, LOGL_ERROR, "Failed to get unsent SMS batch\n");
+		return -EIO;
+	}
+
+	while (dbi_result_next_row(result)) {
+		sms = sms_from_result(net, result);
+		if (!sms)
+			continue;
+		callback(priv, sms,
+			 dbi_result_get_ulonglong(result, "receiver_id"));
+		count += 1;
+	}
+
+	dbi_result_free(result);
+	return count;
+}
+
 /* retrieve the next unsent SMS for a given subscriber */
 struct gsm_sms *db_sms_get_unsent_for_subscr(struct gsm_subscriber *subscr)
 {
@@ -1746,6 +1925,9 @@ static int db_store_rate_ctr(struct rate_ctr_group *ctrg, unsigned int num,
 	return 0;
 }
 
+/* Like db_store_counter(), this opens no transaction of its own. Wrap
+ * it in db_begin_transaction()/db_commit_transaction() to store the
+ * group with one commit. */
 int db_store_rate_ctr_group(struct rate_ctr_group *ctrg)
 {
 	unsigned int i;
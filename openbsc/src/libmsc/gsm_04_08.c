@@ -396,7 +396,7 @@ static int gsm0408_authorize(struct gsm_subscriber_connection *conn, struct msgb
 
 void gsm0408_clear_request(struct gsm_subscriber_connection *conn, uint32_t cause)
 {
-	struct gsm_trans *trans, *temp;
+	struct gsm_trans *trans;
 
 	/* avoid someone issuing a clear */
 	conn->in_release = 1;
@@ -422,18 +422,15 @@ void gsm0408_clear_request(struct gsm_subscriber_connection *conn, uint32_t caus
 	 * facilities that will send the release indications. As part of
 	 * the CC REL_IND the remote leg might be released and this will
 	 * trigger the call to trans_free. This is something the llist
-	 * macro can not handle and we will need to re-iterate the list.
+	 * macro can not handle, so always pick the head of the list.
 	 *
-	 * TODO: Move the trans_list into the subscriber connection and
-	 * create a pending list for MT transactions. These exist before
-	 * we have a subscriber connection.
+	 * TODO: create a pending list for MT transactions. These exist
+	 * before we have a subscriber connection.
 	 */
-restart:
-	llist_for_each_entry_safe(trans, temp, &conn->network->trans_list, entry) {
-		if (trans->conn == conn) {
-			trans_free(trans);
-			goto restart;
-		}
+	while (!llist_empty(&conn->trans_list)) {
+		trans = llist_entry(conn->trans_list.next, struct gsm_trans,
+				    conn_entry);
+		trans_free(trans);
 	}
 }
 
@@ -445,7 +442,7 @@ void gsm0408_clear_all_trans(struct gsm_network *net, int protocol)
 
 	llist_for_each_entry_safe(trans, temp, &net->trans_list, entry) {
 		if (trans->protocol == protocol) {
-			trans->callref = 0;
+			trans_set_callref(trans, 0);
 			trans_free(trans);
 		}
 	}
@@ -1419,6 +1416,10 @@ static int mncc_recvmsg(struct gsm_network *net, struct gsm_trans *trans,
 
 	mncc->msg_type = msg_type;
 
+	/* the MNCC app does not know the callref of a refused call */
+	if (trans && trans->cc.mncc_refused)
+		return 0;
+
 	msg = msgb_alloc(sizeof(struct gsm_mncc), "MNCC");
 	if (!msg)
 		return -ENOMEM;
@@ -1480,7 +1481,7 @@ static int setup_trig_pag_evt(unsigned int hooknum, unsigned int event,
 		DEBUGP(DCC, "Paging subscr %s succeeded!\n", transt->subscr->extension);
 		OSMO_ASSERT(conn);
 		/* Assign lchan */
-		transt->conn = conn;
+		trans_set_conn(transt, conn);
 		/* send SETUP request to called party */
 		gsm48_cc_tx_setup(transt, &transt->cc.msg);
 		break;
@@ -1493,7 +1494,7 @@ static int setup_trig_pag_evt(unsigned int hooknum, unsigned int event,
 				 transt->callref,
 				 GSM48_CAUSE_LOC_PRN_S_LU,
 				 GSM48_CC_CAUSE_DEST_OOO);
-		transt->callref = 0;
+		trans_set_callref(transt, 0);
 		transt->paging_request = NULL;
 		trans_free(transt);
 		break;
@@ -1896,7 +1897,7 @@ static void gsm48_cc_timeout(void *arg)
 		/* process release towards layer 4 */
 		mncc_release_ind(trans->net, trans, trans->callref,
 				 l4_location, l4_cause);
-		trans->callref = 0;
+		trans_set_callref(trans, 0);
 	}
 
 	if (disconnect && trans->callref) {
@@ -2056,7 +2057,7 @@ static int gsm48_cc_tx_setup(struct gsm_trans *trans, void *arg)
 		rc = mncc_release_ind(trans->net, trans, trans->callref,
 				      GSM48_CAUSE_LOC_PRN_S_LU,
 				      GSM48_CC_CAUSE_RESOURCE_UNAVAIL);
-		trans->callref = 0;
+		trans_set_callref(trans, 0);
 		trans_free(trans);
 		return rc;
 	}
@@ -2069,11 +2070,11 @@ static int gsm48_cc_tx_setup(struct gsm_trans *trans, void *arg)
 		rc = mncc_release_ind(trans->net, trans, trans->callref,
 				      GSM48_CAUSE_LOC_PRN_S_LU,
 				      GSM48_CC_CAUSE_RESOURCE_UNAVAIL);
-		trans->callref = 0;
+		trans_set_callref(trans, 0);
 		trans_free(trans);
 		return rc;
 	}
-	trans->transaction_id = trans_id;
+	trans_set_trans_id(trans, trans_id);
 
 	gh->msg_type = GSM48_MT_CC_SETUP;
 
@@ -2504,7 +2505,7 @@ static int gsm48_cc_rx_release(struct gsm_trans *trans, struct msgb *msg)
 
 	new_cc_state(trans, GSM_CSTATE_NULL);
 
-	trans->callref = 0;
+	trans_set_callref(trans, 0);
 	trans_free(trans);
 
 	return rc;
@@ -2594,7 +2595,7 @@ static int gsm48_cc_rx_release_compl(struct gsm_trans *trans, struct msgb *msg)
 		}
 	}
 
-	trans->callref = 0;
+	trans_set_callref(trans, 0);
 	trans_free(trans);
 
 	return rc;
@@ -2609,7 +2610,7 @@ static int gsm48_cc_tx_release_compl(struct gsm_trans *trans, void *arg)
 
 	gh->msg_type = GSM48_MT_CC_RELEASE_COMPL;
 
-	trans->callref = 0;
+	trans_set_callref(trans, 0);
 
 	gsm48_stop_cc_timer(trans);
 
@@ -3488,7 +3489,7 @@ int mncc_tx_to_cc(struct gsm_network *net, int msg_type, void *arg)
 			return 0;
 		}
 		/* Assign lchan */
-		trans->conn = conn;
+		trans_set_conn(trans, conn);
 		subscr_put(subscr);
 	} else {
 		/* update the subscriber we deal with */
@@ -3510,7 +3511,7 @@ int mncc_tx_to_cc(struct gsm_network *net, int msg_type, void *arg)
 			rc = mncc_recvmsg(net, trans, MNCC_REL_CNF, &rel);
 		else
 			rc = mncc_recvmsg(net, trans, MNCC_REL_IND, &rel);
-		trans->callref = 0;
+		trans_set_callref(trans, 0);
 		trans_free(trans);
 		return rc;
 	}
@@ -3632,7 +3633,7 @@ static int gsm0408_rcv_cc(struct gsm_subscriber_connection *conn, struct msgb *m
 			return -ENOMEM;
 		}
 		/* Assign transaction */
-		trans->conn = conn;
+		trans_set_conn(trans, conn);
 	}
 
 	/* find function for current state and message */
@@ -3692,6 +3693,7 @@ struct gsm_subscriber_connection *msc_subscr_con_allocate(struct gsm_network *ne
 		return NULL;
 
 	conn->network = network;
+	INIT_LLIST_HEAD(&conn->trans_list);
 	llist_add_tail(&conn->entry, &network->subscr_conns);
 	return conn;
 }
@@ -1,13 +1,17 @@
 /* UDP-Feed of measurement reports */
 
 #include <unistd.h>
+#include <fcntl.h>
 
 #include <sys/socket.h>
+#include <sys/mman.h>
 
 #include <osmocom/core/msgb.h>
 #include <osmocom/core/socket.h>
 #include <osmocom/core/write_queue.h>
 #include <osmocom/core/talloc.h>
+#include <osmocom/core/timer.h>
+#include <osmocom/core/utils.h>
 
 #include <osmocom/vty/command.h>
 #include <osmocom/vty/vty.h>
@@ -20,35 +24,37 @@
 
 #include "meas_feed.h"
 
+/* a batch that is not full goes out after this time */
+#define MEAS_FEED_FLUSH_MS	500
+
 struct meas_feed_state {
 	struct osmo_wqueue wqueue;
 	char scenario[31+1];
 	char *dst_host;
 	uint16_t dst_port;
-};
-
 
-static struct meas_feed_state g_mfs;
-
-static int process_meas_rep(struct gsm_meas_rep *mr)
-{
-	struct msgb *msg;
-	struct meas_feed_meas *mfm;
-	struct gsm_subscriber *subscr;
+	/* records per datagram and the datagram being filled */
+	unsigned int batch;
+	struct msgb *pending;
+	struct osmo_timer_list flush_timer;
 
-	/* ignore measurements as long as we don't know who it is */
-	if (!mr->lchan || !mr->lchan->conn || !mr->lchan->conn->subscr)
-		return 0;
+	/* the shared memory ring for local readers */
+	char *shm_name;
+	struct meas_feed_ring *ring;
+	size_t ring_size;
+};
 
-	subscr = mr->lchan->conn->subscr;
 
-	msg = msgb_alloc(sizeof(struct meas_feed_meas), "Meas. Feed");
-	if (!msg)
-		return 0;
+static struct meas_feed_state g_mfs = {
+	.batch = 1,
+};
 
+static void fill_meas(struct meas_feed_meas *mfm, struct gsm_meas_rep *mr,
+		      struct gsm_subscriber *subscr)
+{
 	/* fill in the header */
-	mfm = (struct meas_feed_meas *) msgb_put(msg, sizeof(*mfm));
 	mfm->hdr.msg_type = MEAS_FEED_MEAS;
+	mfm->hdr.reserved = 0;
 	mfm->hdr.version = MEAS_FEED_VERSION;
 
 	/* fill in MEAS_FEED_MEAS specific header */
@@ -70,10 +76,79 @@ static int process_meas_rep(struct gsm_meas_rep *mr)
 	mfm->trx_nr = mr->lchan->ts->trx->nr;
 	mfm->ts_nr = mr->lchan->ts->nr;
 	mfm->ss_nr = mr->lchan->nr;
+}
+
+static void flush_pending(void)
+{
+	struct msgb *msg = g_mfs.pending;
+
+	osmo_timer_del(&g_mfs.flush_timer);
+	if (!msg)
+		return;
 
-	/* and send it to the socket */
+	g_mfs.pending = NULL;
 	if (osmo_wqueue_enqueue(&g_mfs.wqueue, msg) != 0)
 		msgb_free(msg);
+}
+
+static void flush_timer_cb(void *data)
+{
+	flush_pending();
+}
+
+static void send_meas(struct gsm_meas_rep *mr, struct gsm_subscriber *subscr)
+{
+	struct msgb *msg = g_mfs.pending;
+
+	if (!msg) {
+		msg = msgb_alloc(g_mfs.batch * sizeof(struct meas_feed_meas),
+				 "Meas. Feed");
+		if (!msg)
+			return;
+		g_mfs.pending = msg;
+		if (g_mfs.batch > 1)
+			osmo_timer_schedule(&g_mfs.flush_timer, 0,
+					    MEAS_FEED_FLUSH_MS * 1000);
+	}
+
+	fill_meas((struct meas_feed_meas *) msgb_put(msg, sizeof(struct meas_feed_meas)),
+		  mr, subscr);
+
+	/* and send it to the socket once the datagram is full */
+	if (msgb_tailroom(msg) < sizeof(struct meas_feed_meas))
+		flush_pending();
+}
+
+static void ring_meas(struct gsm_meas_rep *mr, struct gsm_subscriber *subscr)
+{
+	struct meas_feed_ring *ring = g_mfs.ring;
+	struct meas_feed_ring_slot *slot;
+	uint64_t n = ring->head;
+
+	slot = &ring->slots[n & (ring->num_slots - 1)];
+
+	/* readers must see the slot as busy before it changes */
+	__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	fill_meas(&slot->mfm, mr, subscr);
+	__atomic_store_n(&slot->seq, n + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->head, n + 1, __ATOMIC_RELEASE);
+}
+
+static int process_meas_rep(struct gsm_meas_rep *mr)
+{
+	struct gsm_subscriber *subscr;
+
+	/* ignore measurements as long as we don't know who it is */
+	if (!mr->lchan || !mr->lchan->conn || !mr->lchan->conn->subscr)
+		return 0;
+
+	subscr = mr->lchan->conn->subscr;
+
+	if (g_mfs.ring)
+		ring_meas(mr, subscr);
+	if (g_mfs.dst_port)
+		send_meas(mr, subscr);
 
 	return 0;
 }
@@ -108,6 +183,18 @@ static int feed_read_cb(struct osmo_fd *ofd)
 	return rc;
 }
 
+static void meas_feed_init(void)
+{
+	static int initialized = 0;
+
+	if (initialized)
+		return;
+
+	g_mfs.flush_timer.cb = flush_timer_cb;
+	osmo_signal_register_handler(SS_LCHAN, meas_feed_sig_cb, NULL);
+	initialized = 1;
+}
+
 int meas_feed_cfg_set(const char *dst_host, uint16_t dst_port)
 {
 	int rc;
@@ -126,10 +213,13 @@ int meas_feed_cfg_set(const char *dst_host, uint16_t dst_port)
 		osmo_wqueue_init(&g_mfs.wqueue, 10);
 		g_mfs.wqueue.write_cb = feed_write_cb;
 		g_mfs.wqueue.read_cb = feed_read_cb;
-		osmo_signal_register_handler(SS_LCHAN, meas_feed_sig_cb, NULL);
+		meas_feed_init();
 	}
 
 	if (already_initialized) {
+		msgb_free(g_mfs.pending);
+		g_mfs.pending = NULL;
+		osmo_timer_del(&g_mfs.flush_timer);
 		osmo_wqueue_clear(&g_mfs.wqueue);
 		osmo_fd_unregister(&g_mfs.wqueue.bfd);
 		close(g_mfs.wqueue.bfd.fd);
@@ -168,3 +258,89 @@ const char *meas_feed_scenario_get(void)
 {
 	return g_mfs.scenario;
 }
+
+void meas_feed_batch_set(unsigned int batch)
+{
+	if (batch < 1)
+		batch = 1;
+	if (batch > MEAS_FEED_MAX_BATCH)
+		batch = MEAS_FEED_MAX_BATCH;
+
+	/* the pending datagram was sized for the old batch */
+	if (batch != g_mfs.batch && g_mfs.pending)
+		flush_pending();
+	g_mfs.batch = batch;
+}
+
+unsigned int meas_feed_batch_get(void)
+{
+	return g_mfs.batch;
+}
+
+static void shm_unmap(void)
+{
+	if (!g_mfs.ring)
+		return;
+
+	munmap(g_mfs.ring, g_mfs.ring_size);
+	shm_unlink(g_mfs.shm_name);
+	talloc_free(g_mfs.shm_name);
+	g_mfs.ring = NULL;
+	g_mfs.shm_name = NULL;
+}
+
+int meas_feed_shm_set(const char *name, unsigned int num_slots)
+{
+	struct meas_feed_ring *ring;
+	size_t size;
+	int fd;
+
+	/* keep the index a mask */
+	num_slots = 1 << (32 - __builtin_clz(num_slots - 1));
+
+	if (g_mfs.ring && !strcmp(name, g_mfs.shm_name) &&
+	    g_mfs.ring->num_slots == num_slots)
+		return 0;
+
+	shm_unmap();
+
+	size = meas_feed_ring_size(num_slots);
+	fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -errno;
+	if (ftruncate(fd, size) != 0) {
+		close(fd);
+		shm_unlink(name);
+		return -errno;
+	}
+
+	ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ring == MAP_FAILED) {
+		shm_unlink(name);
+		return -ENOMEM;
+	}
+
+	/* the file is fresh, all slots and the head are zero */
+	ring->version = MEAS_FEED_VERSION;
+	ring->rec_size = sizeof(struct meas_feed_meas);
+	ring->num_slots = num_slots;
+	__atomic_store_n(&ring->magic, MEAS_FEED_RING_MAGIC, __ATOMIC_RELEASE);
+
+	g_mfs.ring = ring;
+	g_mfs.ring_size = size;
+	g_mfs.shm_name = talloc_strdup(NULL, name);
+	meas_feed_init();
+	return 0;
+}
+
+void meas_feed_shm_del(void)
+{
+	shm_unmap();
+}
+
+const char *meas_feed_shm_get(unsigned int *num_slots)
+{
+	*num_slots = g_mfs.ring ? g_mfs.ring->num_slots : 0;
+	return g_mfs.shm_name;
+}
@@ -9,4 +9,11 @@ void meas_feed_cfg_get(char **host, uint16_t *port);
 void meas_feed_scenario_set(const char *name);
 const char *meas_feed_scenario_get(void);
 
+void meas_feed_batch_set(unsigned int batch);
+unsigned int meas_feed_batch_get(void);
+
+int meas_feed_shm_set(const char *name, unsigned int num_slots);
+void meas_feed_shm_del(void);
+const char *meas_feed_shm_get(unsigned int *num_slots);
+
 #endif  /* _INT_MEAS_FEED_H */
@@ -40,14 +40,38 @@ void *tall_call_ctx;
 
 static LLIST_HEAD(call_list);
 
+#define CALL_HASH_SIZE	1024
+static struct llist_head call_hash[CALL_HASH_SIZE];
+
 static uint32_t new_callref = 0x00000001;
 
 struct mncc_int mncc_int = {
 	.def_codec = { GSM48_CMODE_SPEECH_V1, GSM48_CMODE_SPEECH_V1 },
 };
 
+static struct llist_head *call_hash_bucket(uint32_t callref)
+{
+	static int initialized = 0;
+	int i;
+
+	if (!initialized) {
+		for (i = 0; i < CALL_HASH_SIZE; i++)
+			INIT_LLIST_HEAD(&call_hash[i]);
+		initialized = 1;
+	}
+
+	return &call_hash[(callref ^ (callref >> 16)) & (CALL_HASH_SIZE - 1)];
+}
+
+static void add_call(struct gsm_call *call)
+{
+	llist_add_tail(&call->entry, &call_list);
+	llist_add_tail(&call->hash_entry, call_hash_bucket(call->callref));
+}
+
 static void free_call(struct gsm_call *call)
 {
+	llist_del(&call->hash_entry);
 	llist_del(&call->entry);
 	DEBUGP(DMNCC, "(call %x) Call removed.\n", call->callref);
 	talloc_free(call);
@@ -58,7 +82,7 @@ static struct gsm_call *get_call_ref(uint32_t callref)
 {
 	struct gsm_call *callt;
 
-	llist_for_each_entry(callt, &call_list, entry) {
+	llist_for_each_entry(callt, call_hash_bucket(callref), hash_entry) {
 		if (callt->callref == callref)
 			return callt;
 	}
@@ -118,9 +142,9 @@ static int mncc_setup_ind(struct gsm_call *call, int msg_type,
 				GSM48_CC_CAUSE_RESOURCE_UNAVAIL);
 		goto out_reject;
 	}
-	llist_add_tail(&remote->entry, &call_list);
 	remote->net = call->net;
 	remote->callref = new_callref++;
+	add_call(remote);
 	DEBUGP(DMNCC, "(call %x) Creating new remote instance %x.\n",
 		call->callref, remote->callref);
 
@@ -308,7 +332,7 @@ int int_mncc_recv(struct gsm_network *net, struct msgb *msg)
 	struct gsm_mncc *data = arg;
 	int msg_type = data->msg_type;
 	int callref;
-	struct gsm_call *call = NULL, *callt;
+	struct gsm_call *call;
 	int rc = 0;
 
 	/* Special messages */
@@ -317,12 +341,7 @@ int int_mncc_recv(struct gsm_network *net, struct msgb *msg)
 	
 	/* find callref */
 	callref = data->callref;
-	llist_for_each_entry(callt, &call_list, entry) {
-		if (callt->callref == callref) {
-			call = callt;
-			break;
-		}
-	}
+	call = get_call_ref(callref);
 
 	/* create callref, if setup is received */
 	if (!call) {
@@ -339,9 +358,9 @@ int int_mncc_recv(struct gsm_network *net, struct msgb *msg)
 			mncc_tx_to_cc(net, MNCC_REL_REQ, &rel);
 			goto out_free;
 		}
-		llist_add_tail(&call->entry, &call_list);
 		call->net = net;
 		call->callref = callref;
+		add_call(call);
 		DEBUGP(DMNCC, "(call %x) Call created.\n", call->callref);
 	}
 
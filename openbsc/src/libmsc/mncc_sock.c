@@ -21,6 +21,7 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -29,6 +30,7 @@
 #include <assert.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 
 #include <osmocom/core/talloc.h>
 #include <osmocom/core/select.h>
@@ -38,42 +40,124 @@
 #include <openbsc/debug.h>
 #include <openbsc/mncc.h>
 #include <openbsc/gsm_data.h>
+#include <openbsc/transaction.h>
+
+#include "bscconfig.h"
+
+/* primitives read or written per socket callback */
+#define MNCC_SOCK_BATCH		32
 
 struct mncc_sock_state {
 	struct gsm_network *net;
 	struct osmo_fd listen_bfd;	/* fd for listen socket */
 	struct osmo_fd conn_bfd;		/* fd for connection to lcr */
+	unsigned int queue_len;		/* messages in net->upqueue */
+	struct msgb *rx_msg;		/* re-used for every recv() */
 };
 
+static void upqueue_add(struct mncc_sock_state *state, struct msgb *msg)
+{
+	msgb_enqueue(&state->net->upqueue, msg);
+	state->queue_len += 1;
+	state->conn_bfd.when |= BSC_FD_WRITE;
+}
+
+static struct msgb *upqueue_dequeue(struct mncc_sock_state *state)
+{
+	struct msgb *msg = msgb_dequeue(&state->net->upqueue);
+
+	if (msg)
+		state->queue_len -= 1;
+	return msg;
+}
+
+/* make room by dropping the oldest queued voice frame */
+static int upqueue_drop_frame(struct mncc_sock_state *state)
+{
+	struct msgb *msg;
+
+	llist_for_each_entry(msg, &state->net->upqueue, list) {
+		struct gsm_mncc *mncc_prim = (struct gsm_mncc *) msg->data;
+
+		if (!mncc_is_data_frame(mncc_prim->msg_type))
+			continue;
+		llist_del(&msg->list);
+		state->queue_len -= 1;
+		msgb_free(msg);
+		return 0;
+	}
+
+	return -1;
+}
+
+/* release the call a primitive belongs to, data frames are just dropped */
+static void mncc_sock_reject(struct gsm_network *net,
+			     struct gsm_mncc *mncc_in)
+{
+	struct gsm_mncc mncc_out;
+
+	if (mncc_is_data_frame(mncc_in->msg_type))
+		return;
+
+	memset(&mncc_out, 0, sizeof(mncc_out));
+	mncc_out.callref = mncc_in->callref;
+	mncc_set_cause(&mncc_out, GSM48_CAUSE_LOC_PRN_S_LU,
+			GSM48_CC_CAUSE_TEMP_FAILURE);
+	mncc_tx_to_cc(net, MNCC_REL_REQ, &mncc_out);
+}
+
 /* input from CC code into mncc_sock */
 int mncc_sock_from_cc(struct gsm_network *net, struct msgb *msg)
 {
+	struct mncc_sock_state *state = net->mncc_state;
 	struct gsm_mncc *mncc_in = (struct gsm_mncc *) msgb_data(msg);
 	int msg_type = mncc_in->msg_type;
 
 	/* Check if we currently have a MNCC handler connected */
-	if (net->mncc_state->conn_bfd.fd < 0) {
+	if (state->conn_bfd.fd < 0) {
 		LOGP(DMNCC, LOGL_ERROR, "mncc_sock receives %s for external CC app "
 			"but socket is gone\n", get_mncc_name(msg_type));
-		if (!mncc_is_data_frame(msg_type)) {
-			/* release the request */
-			struct gsm_mncc mncc_out;
-			memset(&mncc_out, 0, sizeof(mncc_out));
-			mncc_out.callref = mncc_in->callref;
-			mncc_set_cause(&mncc_out, GSM48_CAUSE_LOC_PRN_S_LU,
-					GSM48_CC_CAUSE_TEMP_FAILURE);
-			mncc_tx_to_cc(net, MNCC_REL_REQ, &mncc_out);
-		}
+		/* release the request */
+		mncc_sock_reject(net, mncc_in);
 		/* free the original message */
 		msgb_free(msg);
 		return -1;
 	}
 
-	/* FIXME: check for some maximum queue depth? */
+	/*
+	 * The CC app does not keep up. Voice frames are dropped first,
+	 * new calls are refused and the signalling of existing calls is
+	 * always queued, a release for it would only cause more of it.
+	 */
+	if (net->mncc_sock_queue_max
+	    && state->queue_len >= net->mncc_sock_queue_max) {
+		if (mncc_is_data_frame(msg_type)) {
+			rate_ctr_inc(&net->msc_ctrs->ctr[MSC_CTR_MNCC_QUEUE_DROP]);
+			msgb_free(msg);
+			return -1;
+		}
+		if (msg_type == MNCC_SETUP_IND) {
+			struct gsm_trans *trans;
+
+			LOGP(DMNCC, LOGL_ERROR, "mncc_sock queue is full (%u), "
+			     "rejecting new call %x\n", state->queue_len,
+			     mncc_in->callref);
+			rate_ctr_inc(&net->msc_ctrs->ctr[MSC_CTR_MNCC_QUEUE_REJECT]);
+			/* the app never sees this callref, so it must not see
+			 * the release that follows either */
+			trans = trans_find_by_callref(net, mncc_in->callref);
+			if (trans)
+				trans->cc.mncc_refused = 1;
+			mncc_sock_reject(net, mncc_in);
+			msgb_free(msg);
+			return -1;
+		}
+		if (upqueue_drop_frame(state) == 0)
+			rate_ctr_inc(&net->msc_ctrs->ctr[MSC_CTR_MNCC_QUEUE_DROP]);
+	}
 
 	/* Actually enqueue the message and mark socket write need */
-	msgb_enqueue(&net->upqueue, msg);
-	net->mncc_state->conn_bfd.when |= BSC_FD_WRITE;
+	upqueue_add(state, msg);
 	return 0;
 }
 
@@ -95,7 +179,7 @@ static void mncc_sock_close(struct mncc_sock_state *state)
 
 	/* flush the queue */
 	while (!llist_empty(&state->net->upqueue)) {
-		struct msgb *msg = msgb_dequeue(&state->net->upqueue);
+		struct msgb *msg = upqueue_dequeue(state);
 		msgb_free(msg);
 	}
 }
@@ -103,39 +187,107 @@ static void mncc_sock_close(struct mncc_sock_state *state)
 static int mncc_sock_read(struct osmo_fd *bfd)
 {
 	struct mncc_sock_state *state = (struct mncc_sock_state *)bfd->data;
+	struct msgb *msg = state->rx_msg;
 	struct gsm_mncc *mncc_prim;
-	struct msgb *msg;
-	int rc;
+	int i, rc;
 
-	msg = msgb_alloc(sizeof(*mncc_prim)+256, "mncc_sock_rx");
-	if (!msg)
-		return -ENOMEM;
+	/* drain a few packets per select() round */
+	for (i = 0; i < MNCC_SOCK_BATCH; i++) {
+		msgb_reset(msg);
+		mncc_prim = (struct gsm_mncc *) msg->tail;
 
-	mncc_prim = (struct gsm_mncc *) msg->tail;
+		rc = recv(bfd->fd, msg->tail, msgb_tailroom(msg), MSG_DONTWAIT);
+		if (rc == 0)
+			goto close;
 
-	rc = recv(bfd->fd, msg->tail, msgb_tailroom(msg), 0);
-	if (rc == 0)
-		goto close;
+		if (rc < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			goto close;
+		}
 
-	if (rc < 0) {
-		if (errno == EAGAIN)
-			return 0;
-		goto close;
+		/* the buffer is re-used, don't let a short primitive see
+		 * the tail of the previous one */
+		if (rc < sizeof(*mncc_prim))
+			memset(msg->tail + rc, 0, sizeof(*mncc_prim) - rc);
+
+		/* as we always synchronously process the message in
+		 * mncc_send() and its callbacks, the buffer is free again
+		 * once this returns. */
+		mncc_tx_to_cc(state->net, mncc_prim->msg_type, mncc_prim);
 	}
 
-	rc = mncc_tx_to_cc(state->net, mncc_prim->msg_type, mncc_prim);
+	return 0;
 
-	/* as we always synchronously process the message in mncc_send() and
-	 * its callbacks, we can free the message here. */
-	msgb_free(msg);
+close:
+	mncc_sock_close(state);
+	return -1;
+}
 
-	return rc;
+#ifdef HAVE_SENDMMSG
+/* hand up to MNCC_SOCK_BATCH queued primitives to the kernel in one call,
+ * each one is still its own SEQPACKET record */
+static int mncc_sock_write_batch(struct osmo_fd *bfd)
+{
+	struct mncc_sock_state *state = bfd->data;
+	struct gsm_network *net = state->net;
+	struct mmsghdr mmsg[MNCC_SOCK_BATCH];
+	struct iovec iov[MNCC_SOCK_BATCH];
+	struct msgb *msg, *msg2;
+	int i, n, rc;
+
+	bfd->when &= ~BSC_FD_WRITE;
+
+	while (!llist_empty(&net->upqueue)) {
+		n = 0;
+		llist_for_each_entry_safe(msg, msg2, &net->upqueue, list) {
+			if (!msgb_length(msg)) {
+				LOGP(DMNCC, LOGL_ERROR, "message type (%d) with "
+				     "ZERO bytes!\n",
+				     ((struct gsm_mncc *) msg->data)->msg_type);
+				llist_del(&msg->list);
+				state->queue_len -= 1;
+				msgb_free(msg);
+				continue;
+			}
+
+			iov[n].iov_base = msgb_data(msg);
+			iov[n].iov_len = msgb_length(msg);
+			memset(&mmsg[n], 0, sizeof(mmsg[n]));
+			mmsg[n].msg_hdr.msg_iov = &iov[n];
+			mmsg[n].msg_hdr.msg_iovlen = 1;
+			if (++n == MNCC_SOCK_BATCH)
+				break;
+		}
+		if (n == 0)
+			break;
+
+		rc = sendmmsg(bfd->fd, mmsg, n, 0);
+		if (rc < 0) {
+			if (errno == EAGAIN) {
+				bfd->when |= BSC_FD_WRITE;
+				break;
+			}
+			goto close;
+		}
+
+		/* the first rc messages went out */
+		for (i = 0; i < rc; i++)
+			msgb_free(upqueue_dequeue(state));
+
+		if (rc < n) {
+			bfd->when |= BSC_FD_WRITE;
+			break;
+		}
+	}
+	return 0;
 
 close:
-	msgb_free(msg);
 	mncc_sock_close(state);
+
 	return -1;
 }
+#endif
 
 static int mncc_sock_write(struct osmo_fd *bfd)
 {
@@ -143,6 +295,11 @@ static int mncc_sock_write(struct osmo_fd *bfd)
 	struct gsm_network *net = state->net;
 	int rc;
 
+#ifdef HAVE_SENDMMSG
+	if (net->mncc_sock_batch)
+		return mncc_sock_write_batch(bfd);
+#endif
+
 	while (!llist_empty(&net->upqueue)) {
 		struct msgb *msg, *msg2;
 		struct gsm_mncc *mncc_prim;
@@ -174,7 +331,7 @@ static int mncc_sock_write(struct osmo_fd *bfd)
 
 dontsend:
 		/* _after_ we send it, we can deueue */
-		msg2 = msgb_dequeue(&net->upqueue);
+		msg2 = upqueue_dequeue(state);
 		assert(msg == msg2);
 		msgb_free(msg);
 	}
@@ -226,8 +383,7 @@ static void queue_hello(struct mncc_sock_state *mncc)
 	hello->emergency_offset = offsetof(struct gsm_mncc, emergency);
 	hello->lchan_type_offset = offsetof(struct gsm_mncc, lchan_type);
 
-	msgb_enqueue(&mncc->net->upqueue, msg);
-	mncc->conn_bfd.when |= BSC_FD_WRITE;
+	upqueue_add(mncc, msg);
 }
 
 /* accept a new connection */
@@ -288,6 +444,12 @@ int mncc_sock_init(struct gsm_network *net, const char *sock_path)
 	state->net = net;
 	state->conn_bfd.fd = -1;
 
+	state->rx_msg = msgb_alloc(sizeof(struct gsm_mncc)+256, "mncc_sock_rx");
+	if (!state->rx_msg) {
+		talloc_free(state);
+		return -ENOMEM;
+	}
+
 	bfd = &state->listen_bfd;
 
 	bfd->fd = osmo_sock_unix_init(SOCK_SEQPACKET, 0, sock_path,
@@ -295,6 +457,7 @@ int mncc_sock_init(struct gsm_network *net, const char *sock_path)
 	if (bfd->fd < 0) {
 		LOGP(DMNCC, LOGL_ERROR, "Could not create unix socket: %s: %s\n",
 		     sock_path, strerror(errno));
+		msgb_free(state->rx_msg);
 		talloc_free(state);
 		return -1;
 	}
@@ -307,6 +470,7 @@ int mncc_sock_init(struct gsm_network *net, const char *sock_path)
 	if (rc < 0) {
 		LOGP(DMNCC, LOGL_ERROR, "Could not register listen fd: %d\n", rc);
 		close(bfd->fd);
+		msgb_free(state->rx_msg);
 		talloc_free(state);
 		return rc;
 	}
@@ -25,7 +25,10 @@
 #include <errno.h>
 #include <limits.h>
 
+#include <time.h>
+
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 
 #include <smpp34.h>
@@ -54,6 +57,16 @@ enum emse_bind {
 	ESME_BIND_TX = 0x02,
 };
 
+/* number of queued PDUs handed to one writev() */
+#define SMPP_WRITE_IOV		32
+
+/*! \brief a DELIVER-SM that has not been answered yet */
+struct smpp_deliver_pending {
+	struct llist_head list;	/*!< in esme.deliver_pending */
+	uint32_t sequence_nr;
+	time_t sent;
+};
+
 const struct value_string smpp_status_strs[] = {
 	{ ESME_ROK,		"No Error" },
 	{ ESME_RINVMSGLEN,	"Message Length is invalid" },
@@ -242,6 +255,7 @@ void smpp_esme_get(struct osmo_esme *esme)
 
 static void esme_destroy(struct osmo_esme *esme)
 {
+	osmo_timer_del(&esme->deliver_timer);
 	osmo_wqueue_clear(&esme->wqueue);
 	if (esme->wqueue.bfd.fd >= 0) {
 		osmo_fd_unregister(&esme->wqueue.bfd);
@@ -648,18 +662,65 @@ int smpp_tx_alert(struct osmo_esme *esme, uint8_t ton, uint8_t npi,
 	return PACK_AND_SEND(esme, &alert);
 }
 
+/*! \brief give up on DELIVER-SM the ESME never answered */
+static void deliver_timer_cb(void *data)
+{
+	struct osmo_esme *esme = data;
+	struct smpp_deliver_pending *pend, *pend2;
+	time_t now = time(NULL);
+
+	llist_for_each_entry_safe(pend, pend2, &esme->deliver_pending, list) {
+		if (pend->sent + SMPP_DELIVER_TIMEOUT > now) {
+			osmo_timer_schedule(&esme->deliver_timer,
+					    pend->sent + SMPP_DELIVER_TIMEOUT - now, 0);
+			break;
+		}
+		LOGP(DSMPP, LOGL_NOTICE, "[%s] No DELIVER-SM RESP for "
+		     "sequence %u\n", esme->system_id, pend->sequence_nr);
+		llist_del(&pend->list);
+		esme->deliver_inflight -= 1;
+		talloc_free(pend);
+	}
+}
+
 /* \brief send a DELIVER-SM message to given ESME */
 int smpp_tx_deliver(struct osmo_esme *esme, struct deliver_sm_t *deliver)
 {
+	struct smpp_deliver_pending *pend;
+	unsigned int window = esme->acl ? esme->acl->deliver_window : 0;
+	int rc;
+
+	if (window && esme->deliver_inflight >= window) {
+		LOGP(DSMPP, LOGL_NOTICE, "[%s] %u DELIVER-SM in flight, "
+		     "window is full\n", esme->system_id, esme->deliver_inflight);
+		return -EBUSY;
+	}
+
 	deliver->sequence_number = esme_inc_seq_nr(esme);
 
-	return PACK_AND_SEND(esme, deliver);
+	rc = PACK_AND_SEND(esme, deliver);
+	if (rc < 0)
+		return rc;
+
+	pend = talloc_zero(esme, struct smpp_deliver_pending);
+	if (!pend)
+		return 0;
+	pend->sequence_nr = deliver->sequence_number;
+	pend->sent = time(NULL);
+	llist_add_tail(&pend->list, &esme->deliver_pending);
+	esme->deliver_inflight += 1;
+
+	if (!osmo_timer_pending(&esme->deliver_timer))
+		osmo_timer_schedule(&esme->deliver_timer, SMPP_DELIVER_TIMEOUT, 0);
+
+	return 0;
 }
 
 /*! \brief handle an incoming SMPP DELIVER-SM RESPONSE */
 static int smpp_handle_deliver_resp(struct osmo_esme *esme, struct msgb *msg)
 {
 	struct deliver_sm_resp_t deliver_r;
+	struct smpp_deliver_pending *pend;
 	int rc;
 
 	memset(&deliver_r, 0, sizeof(deliver_r));
@@ -675,6 +736,20 @@ static int smpp_handle_deliver_resp(struct osmo_esme *esme, struct msgb *msg)
 		esme->system_id, get_value_string(smpp_status_strs,
 						  deliver_r.command_status));
 
+	/* responses come mostly in order, the match is usually the first */
+	llist_for_each_entry(pend, &esme->deliver_pending, list) {
+		if (pend->sequence_nr != deliver_r.sequence_number)
+			continue;
+		llist_del(&pend->list);
+		esme->deliver_inflight -= 1;
+		talloc_free(pend);
+		if (llist_empty(&esme->deliver_pending))
+			osmo_timer_del(&esme->deliver_timer);
+		return 0;
+	}
+
+	LOGP(DSMPP, LOGL_NOTICE, "[%s] DELIVER-SM RESP for unknown "
+	     "sequence %u\n", esme->system_id, deliver_r.sequence_number);
 	return 0;
 }
 
@@ -786,99 +861,139 @@ static int smpp_pdu_rx(struct osmo_esme *esme, struct msgb *msg __uses)
 		goto err_label; \
 	}
 
+static void esme_link_close(struct osmo_esme *esme)
+{
+	osmo_fd_unregister(&esme->wqueue.bfd);
+	close(esme->wqueue.bfd.fd);
+	esme->wqueue.bfd.fd = -1;
+	smpp_esme_put(esme);
+}
+
+/*! \brief let a msgb point to a PDU inside the receive buffer */
+static void pdu_msgb_init(struct msgb *msg, uint8_t *data, uint32_t len)
+{
+	memset(msg, 0, sizeof(*msg));
+	msg->head = msg->data = data;
+	msg->tail = data + len;
+	msg->data_len = msg->len = len;
+}
+
 /* !\brief call-back when per-ESME TCP socket has some data to be read */
 static int esme_link_read_cb(struct osmo_fd *ofd)
 {
 	struct osmo_esme *esme = ofd->data;
-	uint32_t len;
-	uint8_t *lenptr = (uint8_t *) &len;
-	uint8_t *cur;
-	struct msgb *msg;
-	ssize_t rdlen, rc;
-
-	switch (esme->read_state) {
-	case READ_ST_IN_LEN:
-		rdlen = sizeof(uint32_t) - esme->read_idx;
-		rc = read(ofd->fd, lenptr + esme->read_idx, rdlen);
-		if (rc < 0)
-			LOGP(DSMPP, LOGL_ERROR, "[%s] read returned %zd (%s)\n",
-					esme->system_id, rc, strerror(errno));
-		OSMO_FD_CHECK_READ(rc, dead_socket);
-
-		esme->read_idx += rc;
-
-		if (esme->read_idx >= sizeof(uint32_t)) {
-			esme->read_len = ntohl(len);
-			if (esme->read_len < 8 || esme->read_len > UINT16_MAX) {
-				LOGP(DSMPP, LOGL_ERROR, "[%s] length invalid %u\n",
-						esme->system_id, esme->read_len);
-				goto dead_socket;
-			}
+	uint32_t offset = 0, len;
+	struct msgb msg;
+	ssize_t rc;
 
-			msg = msgb_alloc(esme->read_len, "SMPP Rx");
-			if (!msg)
-				return -ENOMEM;
-			esme->read_msg = msg;
-			cur = msgb_put(msg, sizeof(uint32_t));
-			memcpy(cur, lenptr, sizeof(uint32_t));
-			esme->read_state = READ_ST_IN_MSG;
-			esme->read_idx = sizeof(uint32_t);
-		}
-		break;
-	case READ_ST_IN_MSG:
-		msg = esme->read_msg;
-		rdlen = esme->read_len - esme->read_idx;
-		rc = read(ofd->fd, msg->tail, OSMO_MIN(rdlen, msgb_tailroom(msg)));
-		if (rc < 0)
-			LOGP(DSMPP, LOGL_ERROR, "[%s] read returned %zd (%s)\n",
-					esme->system_id, rc, strerror(errno));
-		OSMO_FD_CHECK_READ(rc, dead_socket);
-
-		esme->read_idx += rc;
-		msgb_put(msg, rc);
-
-		if (esme->read_idx >= esme->read_len) {
-			rc = smpp_pdu_rx(esme, esme->read_msg);
-			msgb_free(esme->read_msg);
-			esme->read_msg = NULL;
-			esme->read_idx = 0;
-			esme->read_len = 0;
-			esme->read_state = READ_ST_IN_LEN;
+	rc = read(ofd->fd, esme->read_buf + esme->read_len,
+		  SMPP_READ_BUF_LEN - esme->read_len);
+	if (rc < 0)
+		LOGP(DSMPP, LOGL_ERROR, "[%s] read returned %zd (%s)\n",
+				esme->system_id, rc, strerror(errno));
+	OSMO_FD_CHECK_READ(rc, dead_socket);
+
+	esme->read_len += rc;
+
+	/* handle every complete PDU we have */
+	while (esme->read_len - offset >= sizeof(uint32_t)) {
+		memcpy(&len, esme->read_buf + offset, sizeof(len));
+		len = ntohl(len);
+		if (len < 8 || len > UINT16_MAX) {
+			LOGP(DSMPP, LOGL_ERROR, "[%s] length invalid %u\n",
+					esme->system_id, len);
+			goto dead_socket;
 		}
-		break;
+		if (esme->read_len - offset < len)
+			break;
+
+		pdu_msgb_init(&msg, esme->read_buf + offset, len);
+		smpp_pdu_rx(esme, &msg);
+		offset += len;
+	}
+
+	/* move the start of the next PDU to the front */
+	if (offset) {
+		memmove(esme->read_buf, esme->read_buf + offset,
+			esme->read_len - offset);
+		esme->read_len -= offset;
 	}
 
 	return 0;
 dead_socket:
-	msgb_free(esme->read_msg);
-	osmo_fd_unregister(&esme->wqueue.bfd);
-	close(esme->wqueue.bfd.fd);
-	esme->wqueue.bfd.fd = -1;
-	smpp_esme_put(esme);
+	esme_link_close(esme);
 
-	return 0;
+	return -1;
 }
 
-/* call-back of write queue once it wishes to write a message to the socket */
-static int esme_link_write_cb(struct osmo_fd *ofd, struct msgb *msg)
+/* write as much of the queue as the socket takes */
+static int esme_link_write_cb(struct osmo_fd *ofd)
 {
 	struct osmo_esme *esme = ofd->data;
-	int rc;
+	struct osmo_wqueue *wq = &esme->wqueue;
+	struct iovec iov[SMPP_WRITE_IOV];
+	struct msgb *msg, *msg2;
+	ssize_t rc;
+	int n = 0;
+
+	llist_for_each_entry(msg, &wq->msg_queue, list) {
+		uint32_t offset = n ? 0 : esme->write_offset;
+
+		iov[n].iov_base = msgb_data(msg) + offset;
+		iov[n].iov_len = msgb_length(msg) - offset;
+		if (++n == SMPP_WRITE_IOV)
+			break;
+	}
 
-	rc = write(ofd->fd, msgb_data(msg), msgb_length(msg));
-	if (rc == 0) {
-		osmo_fd_unregister(&esme->wqueue.bfd);
-		close(esme->wqueue.bfd.fd);
-		esme->wqueue.bfd.fd = -1;
-		smpp_esme_put(esme);
-	} else if (rc < msgb_length(msg)) {
-		LOGP(DSMPP, LOGL_ERROR, "[%s] Short write\n", esme->system_id);
+	if (n == 0) {
+		ofd->when &= ~BSC_FD_WRITE;
+		return 0;
+	}
+
+	rc = writev(ofd->fd, iov, n);
+	if (rc < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	if (rc <= 0) {
+		LOGP(DSMPP, LOGL_ERROR, "[%s] write returned %zd (%s)\n",
+		     esme->system_id, rc, strerror(errno));
+		esme_link_close(esme);
 		return -1;
 	}
 
+	/* free what is out, a short write leaves an offset into the next */
+	rc += esme->write_offset;
+	llist_for_each_entry_safe(msg, msg2, &wq->msg_queue, list) {
+		if (rc < msgb_length(msg))
+			break;
+		rc -= msgb_length(msg);
+		llist_del(&msg->list);
+		wq->current_length -= 1;
+		msgb_free(msg);
+	}
+	esme->write_offset = rc;
+
+	if (llist_empty(&wq->msg_queue))
+		ofd->when &= ~BSC_FD_WRITE;
+
 	return 0;
 }
 
+static int esme_link_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	int rc = 0;
+
+	if (what & BSC_FD_READ)
+		rc = esme_link_read_cb(ofd);
+	/* the ESME may be gone */
+	if (rc < 0)
+		return rc;
+
+	if (what & BSC_FD_WRITE)
+		rc = esme_link_write_cb(ofd);
+
+	return rc;
+}
+
 /* callback for already-accepted new TCP socket */
 static int link_accept_cb(struct smsc *smsc, int fd,
 			  struct sockaddr_storage *s, socklen_t s_len)
@@ -889,14 +1004,26 @@ static int link_accept_cb(struct smsc *smsc, int fd,
 		return -ENOMEM;
 	}
 
+	esme->read_buf = talloc_size(esme, SMPP_READ_BUF_LEN);
+	if (!esme->read_buf) {
+		close(fd);
+		talloc_free(esme);
+		return -ENOMEM;
+	}
+
 	smpp_esme_get(esme);
 	esme->own_seq_nr = rand();
 	esme_inc_seq_nr(esme);
 	esme->smsc = smsc;
-	osmo_wqueue_init(&esme->wqueue, 10);
+	INIT_LLIST_HEAD(&esme->deliver_pending);
+	esme->deliver_timer.cb = deliver_timer_cb;
+	esme->deliver_timer.data = esme;
+	osmo_wqueue_init(&esme->wqueue, SMPP_WRITE_QUEUE_LEN);
 	esme->wqueue.bfd.fd = fd;
 	esme->wqueue.bfd.data = esme;
 	esme->wqueue.bfd.when = BSC_FD_READ;
+	/* reads and writes are batched, bypass the per-msgb callbacks */
+	esme->wqueue.bfd.cb = esme_link_cb;
 
 	if (osmo_fd_register(&esme->wqueue.bfd) != 0) {
 		close(fd);
@@ -904,9 +1031,6 @@ static int link_accept_cb(struct smsc *smsc, int fd,
 		return -EIO;
 	}
 
-	esme->wqueue.read_cb = esme_link_read_cb;
-	esme->wqueue.write_cb = esme_link_write_cb;
-
 	esme->sa_len = OSMO_MIN(sizeof(esme->sa), s_len);
 	memcpy(&esme->sa, s, esme->sa_len);
 
@@ -7,6 +7,7 @@
 #include <osmocom/core/utils.h>
 #include <osmocom/core/msgb.h>
 #include <osmocom/core/write_queue.h>
+#include <osmocom/core/timer.h>
 
 #include <smpp34.h>
 #include <smpp34_structs.h>
@@ -18,10 +19,11 @@
 #define MODE_7BIT	7
 #define MODE_8BIT	8
 
-enum esme_read_state {
-	READ_ST_IN_LEN = 0,
-	READ_ST_IN_MSG = 1,
-};
+/* large enough for one maximum size PDU plus the start of the next */
+#define SMPP_READ_BUF_LEN	(128 * 1024)
+#define SMPP_WRITE_QUEUE_LEN	1024
+/* seconds to wait for a DELIVER-SM RESP */
+#define SMPP_DELIVER_TIMEOUT	60
 
 struct osmo_smpp_acl;
 
@@ -43,10 +45,16 @@ struct osmo_esme {
 	struct sockaddr_storage sa;
 	socklen_t sa_len;
 
-	enum esme_read_state read_state;
+	/* complete PDUs are handled in place, a partial one is kept */
+	uint8_t *read_buf;
 	uint32_t read_len;
-	uint32_t read_idx;
-	struct msgb *read_msg;
+	/* bytes of the first queued msgb that are already written */
+	uint32_t write_offset;
+
+	/* DELIVER-SM waiting for their response */
+	struct llist_head deliver_pending;
+	unsigned int deliver_inflight;
+	struct osmo_timer_list deliver_timer;
 
 	uint8_t smpp_version;
 	char system_id[SMPP_SYS_ID_LEN+1];
@@ -65,6 +73,8 @@ struct osmo_smpp_acl {
 	int deliver_src_imsi;
 	int osmocom_ext;
 	int dcs_transparent;
+	/* max. DELIVER-SM without response, 0 for no limit */
+	unsigned int deliver_window;
 	struct llist_head route_list;
 };
 
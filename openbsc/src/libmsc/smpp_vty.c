@@ -499,6 +499,17 @@ DEFUN(cfg_esme_no_dcs_transp, cfg_esme_no_dcs_transp_cmd,
 	return CMD_SUCCESS;
 }
 
+DEFUN(cfg_esme_deliver_window, cfg_esme_deliver_window_cmd,
+	"deliver-window <0-65535>",
+	"Limit the DELIVER-SM waiting for a response from this ESME\n"
+	"Number of DELIVER-SM, 0 for no limit\n")
+{
+	struct osmo_smpp_acl *acl = vty->index;
+
+	acl->deliver_window = atoi(argv[0]);
+
+	return CMD_SUCCESS;
+}
 
 static void dump_one_esme(struct vty *vty, struct osmo_esme *esme)
 {
@@ -515,6 +526,9 @@ static void dump_one_esme(struct vty *vty, struct osmo_esme *esme)
 	vty_out(vty, "  Connected from: %s:%s%s", host, serv, VTY_NEWLINE);
 	if (esme->smsc->def_route == esme->acl)
 		vty_out(vty, "  Is current default route%s", VTY_NEWLINE);
+	vty_out(vty, "  DELIVER-SM in flight: %u, queued for Tx: %u%s",
+		esme->deliver_inflight, esme->wqueue.current_length,
+		VTY_NEWLINE);
 }
 
 DEFUN(show_esme, show_esme_cmd,
@@ -560,6 +574,9 @@ static void config_write_esme_single(struct vty *vty, struct osmo_smpp_acl *acl)
 		vty_out(vty, "  osmocom-extensions%s", VTY_NEWLINE);
 	if (acl->dcs_transparent)
 		vty_out(vty, "  dcs-transparent%s", VTY_NEWLINE);
+	if (acl->deliver_window)
+		vty_out(vty, "  deliver-window %u%s", acl->deliver_window,
+			VTY_NEWLINE);
 
 	llist_for_each_entry(r, &acl->route_list, list)
 		write_esme_route_single(vty, r);
@@ -605,6 +622,7 @@ int smpp_vty_init(void)
 	install_element(SMPP_ESME_NODE, &cfg_esme_no_osmo_ext_cmd);
 	install_element(SMPP_ESME_NODE, &cfg_esme_dcs_transp_cmd);
 	install_element(SMPP_ESME_NODE, &cfg_esme_no_dcs_transp_cmd);
+	install_element(SMPP_ESME_NODE, &cfg_esme_deliver_window_cmd);
 
 	install_element_ve(&show_esme_cmd);
 
@@ -41,11 +41,24 @@
 
 #include <osmocom/vty/vty.h>
 
+#include <time.h>
+
+/* number of buckets of the pending and prefetch indexes, power of two */
+#define SMSQ_HASH_SIZE		256
+/* SMS prefetched per database query by default */
+#define SMSQ_PREFETCH_DEFAULT	200
+/* prefetched SMS older than this are dropped and fetched again */
+#define SMSQ_READY_MAX_AGE	30
+/* SMS with this many delivery attempts are not fetched anymore */
+#define SMSQ_MAX_DELIVER_ATTEMPTS	10
+
 /*
  * One pending SMS that we wait for.
  */
 struct gsm_sms_pending {
 	struct llist_head entry;
+	struct llist_head id_entry;
+	struct llist_head subscr_entry;
 
 	struct gsm_subscriber *subscr;
 	unsigned long long sms_id;
@@ -53,27 +66,66 @@ struct gsm_sms_pending {
 	int resend;
 };
 
+/*
+ * Unsent SMS prefetched from the database for one receiver. The
+ * receivers are served round-robin, their SMS in order of the id.
+ */
+struct gsm_sms_receiver {
+	struct llist_head entry;
+	struct llist_head hash_entry;
+
+	unsigned long long subscr_id;
+	time_t fetched;
+	struct llist_head ready;
+};
+
+struct gsm_sms_ready {
+	struct llist_head entry;
+	struct llist_head id_entry;
+
+	struct gsm_sms_receiver *receiver;
+	struct gsm_sms *sms;
+};
+
 struct gsm_sms_queue {
 	struct osmo_timer_list resend_pending;
 	struct osmo_timer_list push_queue;
+	struct osmo_timer_list refill;
 	struct gsm_network *network;
 	int max_fail;
 	int max_pending;
 	int pending;
 
 	struct llist_head pending_sms;
+	struct llist_head pending_by_id[SMSQ_HASH_SIZE];
+	struct llist_head pending_by_subscr[SMSQ_HASH_SIZE];
 	unsigned long long last_subscr_id;
+
+	/* prefetched SMS, see sms_queue_refill() */
+	int prefetch;
+	int ready;
+	int nr_receivers;
+	int exhausted;
+	struct llist_head receivers;
+	struct llist_head receiver_hash[SMSQ_HASH_SIZE];
+	struct llist_head ready_by_id[SMSQ_HASH_SIZE];
 };
 
 static int sms_subscr_cb(unsigned int, unsigned int, void *, void *);
 static int sms_sms_cb(unsigned int, unsigned int, void *, void *);
 
+static inline unsigned int smsq_hash(unsigned long long id)
+{
+	return id & (SMSQ_HASH_SIZE - 1);
+}
+
 static struct gsm_sms_pending *sms_find_pending(struct gsm_sms_queue *smsq,
 						struct gsm_sms *sms)
 {
 	struct gsm_sms_pending *pending;
 
-	llist_for_each_entry(pending, &smsq->pending_sms, entry) {
+	llist_for_each_entry(pending, &smsq->pending_by_id[smsq_hash(sms->id)],
+			     id_entry) {
 		if (pending->sms_id == sms->id)
 			return pending;
 	}
@@ -92,7 +144,9 @@ static struct gsm_sms_pending *sms_subscriber_find_pending(
 {
 	struct gsm_sms_pending *pending;
 
-	llist_for_each_entry(pending, &smsq->pending_sms, entry) {
+	llist_for_each_entry(pending,
+			     &smsq->pending_by_subscr[smsq_hash(subscr->id)],
+			     subscr_entry) {
 		if (pending->subscr == subscr)
 			return pending;
 	}
@@ -117,16 +171,200 @@ static struct gsm_sms_pending *sms_pending_from(struct gsm_sms_queue *smsq,
 
 	pending->subscr = subscr_get(sms->receiver);
 	pending->sms_id = sms->id;
+
+	smsq->pending += 1;
+	llist_add_tail(&pending->entry, &smsq->pending_sms);
+	llist_add_tail(&pending->id_entry,
+		       &smsq->pending_by_id[smsq_hash(pending->sms_id)]);
+	llist_add_tail(&pending->subscr_entry,
+		       &smsq->pending_by_subscr[smsq_hash(pending->subscr->id)]);
 	return pending;
 }
 
 static void sms_pending_free(struct gsm_sms_pending *pending)
 {
 	subscr_put(pending->subscr);
+	llist_del(&pending->subscr_entry);
+	llist_del(&pending->id_entry);
 	llist_del(&pending->entry);
 	talloc_free(pending);
 }
 
+static struct gsm_sms_receiver *sms_find_receiver(struct gsm_sms_queue *smsq,
+						  unsigned long long subscr_id)
+{
+	struct gsm_sms_receiver *rcv;
+
+	llist_for_each_entry(rcv, &smsq->receiver_hash[smsq_hash(subscr_id)],
+			     hash_entry) {
+		if (rcv->subscr_id == subscr_id)
+			return rcv;
+	}
+
+	return NULL;
+}
+
+static struct gsm_sms_ready *sms_find_ready(struct gsm_sms_queue *smsq,
+					    unsigned long long sms_id)
+{
+	struct gsm_sms_ready *ready;
+
+	llist_for_each_entry(ready, &smsq->ready_by_id[smsq_hash(sms_id)],
+			     id_entry) {
+		if (ready->sms->id == sms_id)
+			return ready;
+	}
+
+	return NULL;
+}
+
+static void sms_receiver_free(struct gsm_sms_queue *smsq,
+			      struct gsm_sms_receiver *rcv)
+{
+	struct gsm_sms_ready *ready, *tmp;
+
+	llist_for_each_entry_safe(ready, tmp, &rcv->ready, entry) {
+		llist_del(&ready->id_entry);
+		sms_free(ready->sms);
+		smsq->ready -= 1;
+	}
+
+	llist_del(&rcv->hash_entry);
+	llist_del(&rcv->entry);
+	smsq->nr_receivers -= 1;
+	talloc_free(rcv);
+}
+
+static void sms_ready_flush(struct gsm_sms_queue *smsq)
+{
+	struct gsm_sms_receiver *rcv, *tmp;
+
+	llist_for_each_entry_safe(rcv, tmp, &smsq->receivers, entry)
+		sms_receiver_free(smsq, rcv);
+}
+
+/* detach a prefetched SMS from the queue and return it to the caller */
+static struct gsm_sms *sms_ready_unlink(struct gsm_sms_queue *smsq,
+					struct gsm_sms_ready *ready)
+{
+	struct gsm_sms_receiver *rcv = ready->receiver;
+	struct gsm_sms *sms = ready->sms;
+
+	llist_del(&ready->id_entry);
+	llist_del(&ready->entry);
+	talloc_free(ready);
+	smsq->ready -= 1;
+
+	if (llist_empty(&rcv->ready))
+		sms_receiver_free(smsq, rcv);
+	return sms;
+}
+
+/*
+ * Take the oldest prefetched SMS of a receiver. The prefetched data is
+ * dropped when it got too old or the receiver detached in between.
+ */
+static struct gsm_sms *sms_ready_take(struct gsm_sms_queue *smsq,
+				      struct gsm_sms_receiver *rcv)
+{
+	struct gsm_sms_ready *ready;
+
+	ready = llist_entry(rcv->ready.next, struct gsm_sms_ready, entry);
+	if (time(NULL) - rcv->fetched > SMSQ_READY_MAX_AGE ||
+	    !ready->sms->receiver->lac) {
+		LOGP(DLSMS, LOGL_DEBUG,
+		     "Dropping prefetched SMS for sub %llu.\n", rcv->subscr_id);
+		sms_receiver_free(smsq, rcv);
+		return NULL;
+	}
+
+	return sms_ready_unlink(smsq, ready);
+}
+
+/* database callback, remember one unsent SMS */
+static void sms_ready_add(void *priv, struct gsm_sms *sms,
+			  unsigned long long subscr_id)
+{
+	struct gsm_sms_queue *smsq = priv;
+	struct gsm_sms_receiver *rcv;
+	struct gsm_sms_ready *ready;
+
+	smsq->last_subscr_id = subscr_id + 1;
+
+	if (!sms->receiver || sms_is_in_pending(smsq, sms) ||
+	    sms_find_ready(smsq, sms->id)) {
+		sms_free(sms);
+		return;
+	}
+
+	rcv = sms_find_receiver(smsq, subscr_id);
+	if (!rcv) {
+		rcv = talloc_zero(smsq, struct gsm_sms_receiver);
+		if (!rcv) {
+			sms_free(sms);
+			return;
+		}
+		rcv->subscr_id = subscr_id;
+		rcv->fetched = time(NULL);
+		INIT_LLIST_HEAD(&rcv->ready);
+		llist_add_tail(&rcv->entry, &smsq->receivers);
+		llist_add_tail(&rcv->hash_entry,
+			       &smsq->receiver_hash[smsq_hash(subscr_id)]);
+		smsq->nr_receivers += 1;
+	}
+
+	ready = talloc_zero(smsq, struct gsm_sms_ready);
+	if (!ready) {
+		sms_free(sms);
+		if (llist_empty(&rcv->ready))
+			sms_receiver_free(smsq, rcv);
+		return;
+	}
+	ready->receiver = rcv;
+	ready->sms = sms;
+	llist_add_tail(&ready->entry, &rcv->ready);
+	llist_add_tail(&ready->id_entry, &smsq->ready_by_id[smsq_hash(sms->id)]);
+	smsq->ready += 1;
+}
+
+/*
+ * Fetch a batch of unsent SMS, continuing with the subscriber after
+ * the last one we have seen and wrapping around at the end.
+ */
+static int sms_queue_refill(struct gsm_sms_queue *smsq)
+{
+	unsigned long long start = smsq->last_subscr_id;
+	int want = smsq->prefetch - smsq->ready;
+	int before = smsq->ready;
+	int rc;
+
+	if (want <= 0)
+		return 0;
+
+	rc = db_sms_get_unsent_by_subscr_batch(smsq->network, start,
+					       SMSQ_MAX_DELIVER_ATTEMPTS, want,
+					       smsq, sms_ready_add);
+	if (rc < 0)
+		return rc;
+
+	/* need to wrap around */
+	if (rc < want)
+		smsq->last_subscr_id = 0;
+	if (rc == 0 && start != 0)
+		rc = db_sms_get_unsent_by_subscr_batch(smsq->network, 0,
+						SMSQ_MAX_DELIVER_ATTEMPTS, want,
+						smsq, sms_ready_add);
+	if (rc < 0)
+		return rc;
+
+	/* nothing left, wait for sms_queue_trigger() */
+	smsq->exhausted = (rc == 0);
+
+	LOGP(DLSMS, LOGL_DEBUG, "SMSqueue prefetched %d SMS for %d subscribers\n",
+	     smsq->ready - before, smsq->nr_receivers);
+	return smsq->ready - before;
+}
+
 static void sms_pending_resend(struct gsm_sms_pending *pending)
 {
 	struct gsm_sms_queue *smsq;
@@ -186,72 +424,52 @@ static void sms_resend_pending(void *_data)
 	}
 }
 
-static struct gsm_sms *take_next_sms(struct gsm_sms_queue *smsq)
+/* remember that we deliver this SMS and send it */
+static int sms_send_pending(struct gsm_sms_queue *smsq, struct gsm_sms *sms)
 {
-	struct gsm_sms *sms;
-
-	sms = db_sms_get_unsent_by_subscr(smsq->network, smsq->last_subscr_id, 10);
-	if (sms) {
-		smsq->last_subscr_id = sms->receiver->id + 1;
-		return sms;
+	if (!sms_pending_from(smsq, sms)) {
+		LOGP(DLSMS, LOGL_ERROR,
+		     "Failed to create pending SMS entry.\n");
+		sms_free(sms);
+		return -1;
 	}
 
-	/* need to wrap around */
-	smsq->last_subscr_id = 0;
-	sms = db_sms_get_unsent_by_subscr(smsq->network,
-					  smsq->last_subscr_id, 10);
-	if (sms)
-		smsq->last_subscr_id = sms->receiver->id + 1;
-	return sms;
+	gsm411_send_sms_subscr(sms->receiver, sms);
+	return 0;
 }
 
 /**
- * I will submit up to max_pending - pending SMS to the
- * subsystem.
+ * I will submit up to max_pending - pending prefetched SMS to the
+ * subsystem, visiting every receiver at most once.
+ *
+ * Sending can call back into the queue, so the receiver at the head
+ * is rotated to the tail before it is used and no list pointer is
+ * kept across gsm411_send_sms_subscr().
  */
-static void sms_submit_pending(void *_data)
+static int sms_submit_ready(struct gsm_sms_queue *smsq)
 {
-	struct gsm_sms_queue *smsq = _data;
 	int attempts = smsq->max_pending - smsq->pending;
-	int initialized = 0;
-	unsigned long long first_sub = 0;
-	int attempted = 0, rounds = 0;
-
-	LOGP(DLSMS, LOGL_DEBUG, "Attempting to send %d SMS\n", attempts);
+	int receivers = smsq->nr_receivers;
+	int attempted = 0;
 
-	do {
-		struct gsm_sms_pending *pending;
+	while (attempted < attempts && receivers-- > 0 &&
+	       !llist_empty(&smsq->receivers)) {
+		struct gsm_sms_receiver *rcv;
+		struct gsm_sms_ready *ready;
 		struct gsm_sms *sms;
 
+		rcv = llist_entry(smsq->receivers.next,
+				  struct gsm_sms_receiver, entry);
+		llist_move_tail(&rcv->entry, &smsq->receivers);
 
-		sms = take_next_sms(smsq);
-		if (!sms) {
-			LOGP(DLSMS, LOGL_DEBUG, "Sending SMS done (%d attempted)\n",
-			     attempted);
-			break;
-		}
-
-		rounds += 1;
-		LOGP(DLSMS, LOGL_DEBUG, "Sending SMS round %d\n", rounds);
+		/* no need to send a SMS with the same receiver */
+		ready = llist_entry(rcv->ready.next, struct gsm_sms_ready, entry);
+		if (sms_subscriber_is_pending(smsq, ready->sms->receiver))
+			continue;
 
-		/*
-		 * This code needs to detect a loop. It assumes that no SMS
-		 * will vanish during the time this is executed. We will remember
-		 * the id of the first GSM subscriber we see and then will
-		 * compare this. The Database code should make sure that we will
-		 * see all other subscribers first before seeing this one again.
-		 *
-		 * It is always scary to have an infinite loop like this.
-		 */
-		if (!initialized) {
-			first_sub = sms->receiver->id;
-			initialized = 1;
-		} else if (first_sub == sms->receiver->id) {
-			LOGP(DLSMS, LOGL_DEBUG, "Sending SMS done (loop) (%d attempted)\n",
-			     attempted);
-			sms_free(sms);
-			break;
-		}
+		sms = sms_ready_take(smsq, rcv);
+		if (!sms)
+			continue;
 
 		/* no need to send a pending sms */
 		if (sms_is_in_pending(smsq, sms)) {
@@ -261,29 +479,54 @@ static void sms_submit_pending(void *_data)
 			continue;
 		}
 
-		/* no need to send a SMS with the same receiver */
-		if (sms_subscriber_is_pending(smsq, sms->receiver)) {
-			LOGP(DLSMS, LOGL_DEBUG,
-			     "SMSqueue with pending sub: %llu. Skipping\n", sms->receiver->id);
-			sms_free(sms);
-			continue;
-		}
+		if (sms_send_pending(smsq, sms) == 0)
+			attempted += 1;
+	}
 
-		pending = sms_pending_from(smsq, sms);
-		if (!pending) {
-			LOGP(DLSMS, LOGL_ERROR,
-			     "Failed to create pending SMS entry.\n");
-			sms_free(sms);
-			continue;
-		}
+	return attempted;
+}
 
-		attempted += 1;
-		smsq->pending += 1;
-		llist_add_tail(&pending->entry, &smsq->pending_sms);
-		gsm411_send_sms_subscr(sms->receiver, sms);
-	} while (attempted < attempts && rounds < 1000);
+static void sms_refill_ready(void *_data)
+{
+	struct gsm_sms_queue *smsq = _data;
+
+	if (sms_queue_refill(smsq) > 0)
+		sms_submit_ready(smsq);
+}
+
+static void sms_submit_pending(void *_data)
+{
+	struct gsm_sms_queue *smsq = _data;
+	int attempted;
+
+	LOGP(DLSMS, LOGL_DEBUG, "Attempting to send %d SMS\n",
+	     smsq->max_pending - smsq->pending);
+
+	attempted = sms_submit_ready(smsq);
 
-	LOGP(DLSMS, LOGL_DEBUG, "SMSqueue added %d messages in %d rounds\n", attempted, rounds);
+	LOGP(DLSMS, LOGL_DEBUG, "SMSqueue added %d messages, %d prefetched\n",
+	     attempted, smsq->ready);
+
+	/* fetch more from the database from the main loop */
+	if (smsq->exhausted || smsq->ready > smsq->prefetch / 2)
+		return;
+	if (!osmo_timer_pending(&smsq->refill))
+		osmo_timer_schedule(&smsq->refill, 0, 0);
+}
+
+/* Get the next SMS for a subscriber, from the prefetched ones if possible */
+static struct gsm_sms *sms_take_for_subscr(struct gsm_sms_queue *smsq,
+					   struct gsm_subscriber *subscr)
+{
+	struct gsm_sms_receiver *rcv;
+	struct gsm_sms *sms = NULL;
+
+	rcv = sms_find_receiver(smsq, subscr->id);
+	if (rcv)
+		sms = sms_ready_take(smsq, rcv);
+	if (!sms)
+		sms = db_sms_get_unsent_for_subscr(subscr);
+	return sms;
 }
 
 /**
@@ -292,33 +535,21 @@ static void sms_submit_pending(void *_data)
 static void sms_send_next(struct gsm_subscriber *subscr)
 {
 	struct gsm_sms_queue *smsq = subscr->group->net->sms_queue;
-	struct gsm_sms_pending *pending;
 	struct gsm_sms *sms;
 
 	/* the subscriber should not be in the queue */
 	OSMO_ASSERT(!sms_subscriber_is_pending(smsq, subscr));
 
 	/* check for more messages for this subscriber */
-	sms = db_sms_get_unsent_for_subscr(subscr);
+	sms = sms_take_for_subscr(smsq, subscr);
 	if (!sms)
 		goto no_pending_sms;
 
 	/* No sms should be scheduled right now */
 	OSMO_ASSERT(!sms_is_in_pending(smsq, sms));
 
-	/* Remember that we deliver this SMS and send it */
-	pending = sms_pending_from(smsq, sms);
-	if (!pending) {
-		LOGP(DLSMS, LOGL_ERROR,
-			"Failed to create pending SMS entry.\n");
-		sms_free(sms);
-		goto no_pending_sms;
-	}
-
-	smsq->pending += 1;
-	llist_add_tail(&pending->entry, &smsq->pending_sms);
-	gsm411_send_sms_subscr(sms->receiver, sms);
-	return;
+	if (sms_send_pending(smsq, sms) == 0)
+		return;
 
 no_pending_sms:
 	/* Try to send the SMS to avoid the queue being stuck */
@@ -331,6 +562,7 @@ no_pending_sms:
 int sms_queue_trigger(struct gsm_sms_queue *smsq)
 {
 	LOGP(DLSMS, LOGL_DEBUG, "Triggering SMS queue\n");
+	smsq->exhausted = 0;
 	if (osmo_timer_pending(&smsq->push_queue))
 		return 0;
 
@@ -341,6 +573,8 @@ int sms_queue_trigger(struct gsm_sms_queue *smsq)
 int sms_queue_start(struct gsm_network *network, int max_pending)
 {
 	struct gsm_sms_queue *sms = talloc_zero(network, struct gsm_sms_queue);
+	int i;
+
 	if (!sms) {
 		LOGP(DMSC, LOGL_ERROR, "Failed to create the SMS queue.\n");
 		return -1;
@@ -351,13 +585,23 @@ int sms_queue_start(struct gsm_network *network, int max_pending)
 
 	network->sms_queue = sms;
 	INIT_LLIST_HEAD(&sms->pending_sms);
+	INIT_LLIST_HEAD(&sms->receivers);
+	for (i = 0; i < SMSQ_HASH_SIZE; i++) {
+		INIT_LLIST_HEAD(&sms->pending_by_id[i]);
+		INIT_LLIST_HEAD(&sms->pending_by_subscr[i]);
+		INIT_LLIST_HEAD(&sms->receiver_hash[i]);
+		INIT_LLIST_HEAD(&sms->ready_by_id[i]);
+	}
 	sms->max_fail = 1;
+	sms->prefetch = SMSQ_PREFETCH_DEFAULT;
 	sms->network = network;
 	sms->max_pending = max_pending;
 	sms->push_queue.data = sms;
 	sms->push_queue.cb = sms_submit_pending;
 	sms->resend_pending.data = sms;
 	sms->resend_pending.cb = sms_resend_pending;
+	sms->refill.data = sms;
+	sms->refill.cb = sms_refill_ready;
 
 	sms_submit_pending(sms);
 
@@ -398,7 +642,8 @@ static int sub_ready_for_sm(struct gsm_network *net, struct gsm_subscriber *subs
 		return -1;
 
 	/* Now try to deliver any pending SMS to this sub */
-	sms = db_sms_get_unsent_for_subscr(subscr);
+	net->sms_queue->exhausted = 0;
+	sms = sms_take_for_subscr(net->sms_queue, subscr);
 	if (!sms)
 		return -1;
 	gsm411_send_sms(conn, sms);
@@ -442,8 +687,15 @@ static int sms_sms_cb(unsigned int subsys, unsigned int signal,
 	 * open anyway.
 	 */
 	pending = sms_find_pending(network->sms_queue, sig_sms->sms);
-	if (!pending)
+	if (!pending) {
+		struct gsm_sms_ready *ready;
+
+		/* do not send it again from the prefetched SMS */
+		ready = sms_find_ready(network->sms_queue, sig_sms->sms->id);
+		if (ready && signal == S_SMS_DELIVERED)
+			sms_free(sms_ready_unlink(network->sms_queue, ready));
 		return 0;
+	}
 
 	switch (signal) {
 	case S_SMS_DELIVERED:
@@ -507,6 +759,8 @@ int sms_queue_stats(struct gsm_sms_queue *smsq, struct vty *vty)
 
 	vty_out(vty, "SMSqueue with max_pending: %d pending: %d%s",
 		smsq->max_pending, smsq->pending, VTY_NEWLINE);
+	vty_out(vty, " Prefetched SMS: %d of %d for %d subscribers%s",
+		smsq->ready, smsq->prefetch, smsq->nr_receivers, VTY_NEWLINE);
 
 	llist_for_each_entry(pending, &smsq->pending_sms, entry)
 		vty_out(vty, " SMS Pending for Subscriber: %llu SMS: %llu Failed: %d.%s",
@@ -531,6 +785,14 @@ int sms_queue_set_max_failure(struct gsm_sms_queue *smsq, int max_fail)
 	return 0;
 }
 
+int sms_queue_set_prefetch(struct gsm_sms_queue *smsq, int prefetch)
+{
+	LOGP(DLSMS, LOGL_NOTICE, "SMSqueue prefetch old: %d new: %d\n",
+	     smsq->prefetch, prefetch);
+	smsq->prefetch = prefetch;
+	return 0;
+}
+
 int sms_queue_clear(struct gsm_sms_queue *smsq)
 {
 	struct gsm_sms_pending *pending, *tmp;
@@ -542,5 +804,6 @@ int sms_queue_clear(struct gsm_sms_queue *smsq)
 	}
 
 	smsq->pending = 0;
+	sms_ready_flush(smsq);
 	return 0;
 }
@@ -33,14 +33,54 @@ void *tall_trans_ctx;
 
 void _gsm48_cc_trans_free(struct gsm_trans *trans);
 
-struct gsm_trans *trans_find_by_id(struct gsm_subscriber_connection *conn,
-				   uint8_t proto, uint8_t trans_id)
+static inline unsigned int callref_hash(uint32_t callref)
+{
+	return (callref ^ (callref >> 16)) & (GSM_TRANS_HASH_SIZE - 1);
+}
+
+static inline unsigned int trans_id_hash(const struct gsm_subscriber *subscr,
+					 uint8_t proto, uint8_t trans_id)
+{
+	unsigned long h = (unsigned long) subscr >> 4;
+
+	h ^= h >> 11;
+	h = h * 31 + proto;
+	h = h * 31 + trans_id;
+
+	return h & (GSM_TRANS_HASH_SIZE - 1);
+}
+
+static void trans_hash_id(struct gsm_trans *trans)
+{
+	struct llist_head *bucket;
+
+	bucket = &trans->net->trans_id_hash[trans_id_hash(trans->subscr,
+				trans->protocol, trans->transaction_id)];
+	llist_add_tail(&trans->id_entry, bucket);
+}
+
+static void trans_hash_callref(struct gsm_trans *trans)
+{
+	/* many released or SMS transactions share callref 0, keep them
+	 * out of the hash and let trans_find_by_callref() scan for them */
+	if (!trans->callref) {
+		INIT_LLIST_HEAD(&trans->callref_entry);
+		return;
+	}
+
+	llist_add_tail(&trans->callref_entry,
+		       &trans->net->trans_callref_hash[callref_hash(trans->callref)]);
+}
+
+static struct gsm_trans *trans_lookup_id(struct gsm_network *net,
+					 struct gsm_subscriber *subscr,
+					 uint8_t proto, uint8_t trans_id)
 {
 	struct gsm_trans *trans;
-	struct gsm_network *net = conn->network;
-	struct gsm_subscriber *subscr = conn->subscr;
+	struct llist_head *bucket;
 
-	llist_for_each_entry(trans, &net->trans_list, entry) {
+	bucket = &net->trans_id_hash[trans_id_hash(subscr, proto, trans_id)];
+	llist_for_each_entry(trans, bucket, id_entry) {
 		if (trans->subscr == subscr &&
 		    trans->protocol == proto &&
 		    trans->transaction_id == trans_id)
@@ -49,12 +89,28 @@ struct gsm_trans *trans_find_by_id(struct gsm_subscriber_connection *conn,
 	return NULL;
 }
 
+struct gsm_trans *trans_find_by_id(struct gsm_subscriber_connection *conn,
+				   uint8_t proto, uint8_t trans_id)
+{
+	return trans_lookup_id(conn->network, conn->subscr, proto, trans_id);
+}
+
 struct gsm_trans *trans_find_by_callref(struct gsm_network *net,
 					uint32_t callref)
 {
 	struct gsm_trans *trans;
+	struct llist_head *bucket;
 
-	llist_for_each_entry(trans, &net->trans_list, entry) {
+	if (!callref) {
+		llist_for_each_entry(trans, &net->trans_list, entry) {
+			if (trans->callref == callref)
+				return trans;
+		}
+		return NULL;
+	}
+
+	bucket = &net->trans_callref_hash[callref_hash(callref)];
+	llist_for_each_entry(trans, bucket, callref_entry) {
 		if (trans->callref == callref)
 			return trans;
 	}
@@ -83,10 +139,41 @@ struct gsm_trans *trans_alloc(struct gsm_network *net,
 
 	trans->net = net;
 	llist_add_tail(&trans->entry, &net->trans_list);
+	trans_hash_callref(trans);
+	trans_hash_id(trans);
+	INIT_LLIST_HEAD(&trans->conn_entry);
 
 	return trans;
 }
 
+/* change the callref and move the transaction in the callref index */
+void trans_set_callref(struct gsm_trans *trans, uint32_t callref)
+{
+	llist_del(&trans->callref_entry);
+	trans->callref = callref;
+	trans_hash_callref(trans);
+}
+
+/* change the transaction id and move the transaction in the id index */
+void trans_set_trans_id(struct gsm_trans *trans, uint8_t trans_id)
+{
+	llist_del(&trans->id_entry);
+	trans->transaction_id = trans_id;
+	trans_hash_id(trans);
+}
+
+/* bind the transaction to a connection, it is released together with it */
+void trans_set_conn(struct gsm_trans *trans,
+		    struct gsm_subscriber_connection *conn)
+{
+	llist_del(&trans->conn_entry);
+	INIT_LLIST_HEAD(&trans->conn_entry);
+
+	trans->conn = conn;
+	if (conn)
+		llist_add_tail(&trans->conn_entry, &conn->trans_list);
+}
+
 void trans_free(struct gsm_trans *trans)
 {
 	switch (trans->protocol) {
@@ -103,13 +190,16 @@ void trans_free(struct gsm_trans *trans)
 		trans->paging_request = NULL;
 	}
 
+	llist_del(&trans->id_entry);
+	llist_del(&trans->callref_entry);
+	llist_del(&trans->conn_entry);
+	llist_del(&trans->entry);
+
 	if (trans->subscr) {
 		subscr_put(trans->subscr);
 		trans->subscr = NULL;
 	}
 
-	llist_del(&trans->entry);
-
 	if (trans->conn)
 		msc_release_connection(trans->conn);
 
@@ -122,7 +212,6 @@ void trans_free(struct gsm_trans *trans)
 int trans_assign_trans_id(struct gsm_network *net, struct gsm_subscriber *subscr,
 			  uint8_t protocol, uint8_t ti_flag)
 {
-	struct gsm_trans *trans;
 	unsigned int used_tid_bitmask = 0;
 	int i, j, h;
 
@@ -130,12 +219,9 @@ int trans_assign_trans_id(struct gsm_network *net, struct gsm_subscriber *subscr
 		ti_flag = 0x8;
 
 	/* generate bitmask of already-used TIDs for this (subscr,proto) */
-	llist_for_each_entry(trans, &net->trans_list, entry) {
-		if (trans->subscr != subscr ||
-		    trans->protocol != protocol ||
-		    trans->transaction_id == 0xff)
-			continue;
-		used_tid_bitmask |= (1 << trans->transaction_id);
+	for (i = 0; i < 16; i++) {
+		if (trans_lookup_id(net, subscr, protocol, i))
+			used_tid_bitmask |= (1 << i);
 	}
 
 	/* find a new one, trying to go in a 'circular' pattern */
@@ -153,11 +239,5 @@ int trans_assign_trans_id(struct gsm_network *net, struct gsm_subscriber *subscr
 
 int trans_has_conn(const struct gsm_subscriber_connection *conn)
 {
-	struct gsm_trans *trans;
-
-	llist_for_each_entry(trans, &conn->network->trans_list, entry)
-		if (trans->conn == conn)
-			return 1;
-
-	return 0;
+	return !llist_empty(&conn->trans_list);
 }
@@ -19,6 +19,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <limits.h>
 #include <unistd.h>
 #include <stdbool.h>
@@ -869,6 +870,17 @@ DEFUN(smsqueue_max,
 	return CMD_SUCCESS;
 }
 
+DEFUN(smsqueue_prefetch,
+      smsqueue_prefetch_cmd,
+      "sms-queue prefetch <1-10000>",
+      "SMS Queue\n" "SMS to fetch from the database at once\n" "Amount\n")
+{
+	struct gsm_network *net = gsmnet_from_vty(vty);
+
+	sms_queue_set_prefetch(net->sms_queue, atoi(argv[0]));
+	return CMD_SUCCESS;
+}
+
 DEFUN(smsqueue_clear,
       smsqueue_clear_cmd,
       "sms-queue clear",
@@ -924,6 +936,8 @@ static int config_write_mncc_int(struct vty *vty)
 	uint16_t meas_port;
 	char *meas_host;
 	const char *meas_scenario;
+	const char *meas_shm;
+	unsigned int meas_slots;
 
 	meas_feed_cfg_get(&meas_host, &meas_port);
 	meas_scenario = meas_feed_scenario_get();
@@ -941,6 +955,13 @@ static int config_write_mncc_int(struct vty *vty)
 	if (strlen(meas_scenario) > 0)
 		vty_out(vty, " meas-feed scenario %s%s",
 			meas_scenario, VTY_NEWLINE);
+	if (meas_feed_batch_get() > 1)
+		vty_out(vty, " meas-feed batch %u%s",
+			meas_feed_batch_get(), VTY_NEWLINE);
+	meas_shm = meas_feed_shm_get(&meas_slots);
+	if (meas_shm)
+		vty_out(vty, " meas-feed shared-memory %s %u%s",
+			meas_shm, meas_slots, VTY_NEWLINE);
 
 
 	return CMD_SUCCESS;
@@ -1005,6 +1026,43 @@ DEFUN(meas_feed_scenario, meas_feed_scenario_cmd,
 	return CMD_SUCCESS;
 }
 
+DEFUN(mnccint_meas_feed_batch, mnccint_meas_feed_batch_cmd,
+	"meas-feed batch <1-32>",
+	MEAS_STR "Put several reports into one datagram\n"
+	"Number of reports per datagram\n")
+{
+	meas_feed_batch_set(atoi(argv[0]));
+
+	return CMD_SUCCESS;
+}
+
+DEFUN(mnccint_meas_feed_shm, mnccint_meas_feed_shm_cmd,
+	"meas-feed shared-memory NAME <16-65536>",
+	MEAS_STR "Keep the latest reports in a shared memory ring\n"
+	"POSIX shared memory name, e.g. /osmo-meas\n"
+	"Number of reports, rounded up to a power of two\n")
+{
+	int rc;
+
+	rc = meas_feed_shm_set(argv[0], atoi(argv[1]));
+	if (rc < 0) {
+		vty_out(vty, "%% Unable to map %s: %s%s",
+			argv[0], strerror(-rc), VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	return CMD_SUCCESS;
+}
+
+DEFUN(mnccint_no_meas_feed_shm, mnccint_no_meas_feed_shm_cmd,
+	"no meas-feed shared-memory",
+	NO_STR MEAS_STR "Keep the latest reports in a shared memory ring\n")
+{
+	meas_feed_shm_del();
+
+	return CMD_SUCCESS;
+}
+
 
 DEFUN(logging_fltr_imsi,
       logging_fltr_imsi_cmd,
@@ -1102,6 +1160,41 @@ DEFUN(cfg_nitb_no_assign_tmsi, cfg_nitb_no_assign_tmsi_cmd,
 	return CMD_SUCCESS;
 }
 
+#define MNCC_SOCK_STR "MNCC socket to an external call control\n"
+
+DEFUN(cfg_nitb_mncc_queue, cfg_nitb_mncc_queue_cmd,
+      "mncc-socket queue-limit <0-65535>",
+      MNCC_SOCK_STR
+      "Limit the primitives queued towards the call control. Voice frames"
+      " are dropped and new calls refused beyond it, the signalling of"
+      " existing calls is always queued and may exceed it\n"
+      "Number of primitives, 0 for no limit\n")
+{
+	struct gsm_network *gsmnet = gsmnet_from_vty(vty);
+	gsmnet->mncc_sock_queue_max = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_nitb_mncc_batch, cfg_nitb_mncc_batch_cmd,
+      "mncc-socket batch-write",
+      MNCC_SOCK_STR
+      "Write several queued primitives with one system call\n")
+{
+	struct gsm_network *gsmnet = gsmnet_from_vty(vty);
+	gsmnet->mncc_sock_batch = true;
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_nitb_no_mncc_batch, cfg_nitb_no_mncc_batch_cmd,
+      "no mncc-socket batch-write",
+      NO_STR MNCC_SOCK_STR
+      "Write several queued primitives with one system call\n")
+{
+	struct gsm_network *gsmnet = gsmnet_from_vty(vty);
+	gsmnet->mncc_sock_batch = false;
+	return CMD_SUCCESS;
+}
+
 static int config_write_nitb(struct vty *vty)
 {
 	struct gsm_network *gsmnet = gsmnet_from_vty(vty);
@@ -1120,6 +1213,11 @@ static int config_write_nitb(struct vty *vty)
 			VTY_NEWLINE);
 	vty_out(vty, " %sassign-tmsi%s",
 		gsmnet->avoid_tmsi ? "no " : "", VTY_NEWLINE);
+	if (gsmnet->mncc_sock_queue_max != MNCC_SOCK_QUEUE_DEFAULT)
+		vty_out(vty, " mncc-socket queue-limit %u%s",
+			gsmnet->mncc_sock_queue_max, VTY_NEWLINE);
+	if (gsmnet->mncc_sock_batch)
+		vty_out(vty, " mncc-socket batch-write%s", VTY_NEWLINE);
 	return CMD_SUCCESS;
 }
 
@@ -1154,6 +1252,7 @@ int bsc_vty_init_extra(void)
 	install_element(ENABLE_NODE, &smsqueue_max_cmd);
 	install_element(ENABLE_NODE, &smsqueue_clear_cmd);
 	install_element(ENABLE_NODE, &smsqueue_fail_cmd);
+	install_element(ENABLE_NODE, &smsqueue_prefetch_cmd);
 	install_element(ENABLE_NODE, &subscriber_send_pending_sms_cmd);
 	install_element(ENABLE_NODE, &meas_feed_scenario_cmd);
 
@@ -1164,6 +1263,9 @@ int bsc_vty_init_extra(void)
 	install_element(MNCC_INT_NODE, &mnccint_def_codec_h_cmd);
 	install_element(MNCC_INT_NODE, &mnccint_meas_feed_cmd);
 	install_element(MNCC_INT_NODE, &meas_feed_scenario_cmd);
+	install_element(MNCC_INT_NODE, &mnccint_meas_feed_batch_cmd);
+	install_element(MNCC_INT_NODE, &mnccint_meas_feed_shm_cmd);
+	install_element(MNCC_INT_NODE, &mnccint_no_meas_feed_shm_cmd);
 
 	install_element(CFG_LOG_NODE, &log_level_sms_cmd);
 	install_element(CFG_LOG_NODE, &logging_fltr_imsi_cmd);
@@ -1176,6 +1278,9 @@ int bsc_vty_init_extra(void)
 	install_element(NITB_NODE, &cfg_nitb_no_subscr_create_cmd);
 	install_element(NITB_NODE, &cfg_nitb_assign_tmsi_cmd);
 	install_element(NITB_NODE, &cfg_nitb_no_assign_tmsi_cmd);
+	install_element(NITB_NODE, &cfg_nitb_mncc_queue_cmd);
+	install_element(NITB_NODE, &cfg_nitb_mncc_batch_cmd);
+	install_element(NITB_NODE, &cfg_nitb_no_mncc_batch_cmd);
 
 	return 0;
 }
@@ -24,6 +24,8 @@
 #include <openbsc/debug.h>
 #include <openbsc/paging.h>
 
+#include <osmocom/core/rate_ctr.h>
+
 #include <stdlib.h>
 
 static void handle_lu_request(struct gsm_subscriber_connection *conn,
@@ -152,27 +154,14 @@ struct osmo_msc_data *bsc_find_msc(struct gsm_subscriber_connection *conn,
 	 */
 	if (pdisc == GSM48_PDISC_RR && mtype == GSM48_MT_RR_PAG_RESP)
 		goto paging;
-	else if (pdisc == GSM48_PDISC_MM && mtype == GSM48_MT_MM_CM_SERV_REQ) {
+	else if (pdisc == GSM48_PDISC_MM && mtype == GSM48_MT_MM_CM_SERV_REQ)
 		is_emerg = is_cm_service_for_emerg(msg);
-		goto round_robin;
-	} else
-		goto round_robin;
 
-round_robin:
-	llist_for_each_entry(msc, &bsc->mscs, entry) {
-		if (!msc->msc_con->is_authenticated)
-			continue;
-		if (!is_emerg && msc->type != MSC_CON_TYPE_NORMAL)
-			continue;
-		if (is_emerg && !msc->allow_emerg)
-			continue;
-
-		/* force round robin by moving it to the end */
-		llist_move_tail(&msc->entry, &bsc->mscs);
-		return msc;
-	}
-
-	return NULL;
+	msc = osmo_bsc_route_msc(bsc, msg, is_emerg);
+	if (!msc)
+		LOGP(DMSC, LOGL_ERROR, "No MSC is available%s.\n",
+		     is_emerg ? " for the emergency call" : "");
+	return msc;
 
 paging:
 	subscr = extract_sub(conn, msg);
@@ -194,8 +183,8 @@ paging:
 		 * is not the connection will be dropped.
 		 */
 
-		/* force round robin by moving it to the end */
-		llist_move_tail(&msc->entry, &bsc->mscs);
+		if (msc->route.ctrg)
+			rate_ctr_inc(&msc->route.ctrg->ctr[MSC_ROUTE_CTR_PAGING]);
 		return msc;
 	}
 
@@ -580,6 +580,7 @@ struct osmo_msc_data *osmo_msc_data_alloc(struct gsm_network *net, int nr)
 
 	msc_data->nr = nr;
 	msc_data->allow_emerg = 1;
+	osmo_bsc_route_msc_init(msc_data);
 
 	/* Defaults for the audio setup */
 	msc_data->amr_conf.m5_90 = 1;
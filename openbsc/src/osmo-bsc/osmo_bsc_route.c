@@ -0,0 +1,281 @@
+/* Selection of the MSC for a new connection */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * A subscriber stays with the MSC that knows it: a TMSI carries the NRI
+ * of the MSC that allocated it, and an IMSI is hashed onto the available
+ * MSCs. Everything else, and subscribers whose MSC is gone or full, go
+ * to the MSC with the least outstanding work, weighed by how quickly it
+ * has been confirming new connections.
+ */
+
+#include <openbsc/osmo_bsc.h>
+#include <openbsc/osmo_msc_data.h>
+#include <openbsc/bsc_msc.h>
+#include <openbsc/debug.h>
+
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/rate_ctr.h>
+#include <osmocom/core/stats.h>
+#include <osmocom/gsm/gsm48.h>
+#include <osmocom/gsm/protocol/gsm_04_08.h>
+
+/* added to the delay, so that the number of connections still counts
+ * before any delay has been measured */
+#define ROUTE_DELAY_BASE_MS	10
+/* what a connection that was never confirmed counts as */
+#define ROUTE_CC_TIMEOUT_MS	10000
+
+static const struct rate_ctr_desc msc_route_ctr_description[] = {
+	[MSC_ROUTE_CTR_NRI]	   = { "route.nri",	   "Routed by the NRI of the TMSI " },
+	[MSC_ROUTE_CTR_IMSI]	   = { "route.imsi",	   "Routed by the IMSI hash       " },
+	[MSC_ROUTE_CTR_LOAD]	   = { "route.load",	   "Routed as the least loaded MSC" },
+	[MSC_ROUTE_CTR_PAGING]	   = { "route.paging",	   "Paging responses routed       " },
+	[MSC_ROUTE_CTR_FULL]	   = { "route.full",	   "Passed over at max-connections" },
+	[MSC_ROUTE_CTR_CC_TIMEOUT] = { "route.cc_timeout", "Connections never confirmed   " },
+};
+
+static const struct rate_ctr_group_desc msc_route_ctrg_desc = {
+	.group_name_prefix = "msc.route",
+	.group_description = "MSC Routing Statistics",
+	.num_ctr = ARRAY_SIZE(msc_route_ctr_description),
+	.ctr_desc = msc_route_ctr_description,
+	.class_id = OSMO_STATS_CLASS_PEER,
+};
+
+void osmo_bsc_route_msc_init(struct osmo_msc_data *msc)
+{
+	msc->route.ctrg = rate_ctr_group_alloc(msc, &msc_route_ctrg_desc,
+					       msc->nr);
+}
+
+static void route_ctr_inc(struct osmo_msc_data *msc, int ctr)
+{
+	if (msc->route.ctrg)
+		rate_ctr_inc(&msc->route.ctrg->ctr[ctr]);
+}
+
+static int msc_usable(struct osmo_msc_data *msc, int is_emerg)
+{
+	if (!msc->msc_con || !msc->msc_con->is_authenticated)
+		return 0;
+	if (!is_emerg && msc->type != MSC_CON_TYPE_NORMAL)
+		return 0;
+	if (is_emerg && !msc->allow_emerg)
+		return 0;
+	return 1;
+}
+
+static int msc_full(struct osmo_msc_data *msc)
+{
+	return msc->route.max_conns &&
+		msc->route.num_conns >= msc->route.max_conns;
+}
+
+/* Find the mobile identity of an initial MM message, NULL if there is
+ * none */
+static const uint8_t *route_get_mi(struct msgb *msg, uint8_t *mi_len)
+{
+	struct gsm48_hdr *gh = msgb_l3(msg);
+	unsigned int len = msgb_l3len(msg) - sizeof(*gh);
+	const uint8_t *lv;
+
+	if (gsm48_hdr_pdisc(gh) != GSM48_PDISC_MM)
+		return NULL;
+
+	switch (gsm48_hdr_msg_type(gh)) {
+	case GSM48_MT_MM_LOC_UPD_REQUEST:
+		if (len < sizeof(struct gsm48_loc_upd_req))
+			return NULL;
+		lv = &((struct gsm48_loc_upd_req *) gh->data)->mi_len;
+		break;
+	case GSM48_MT_MM_CM_SERV_REQ:
+	case GSM48_MT_MM_CM_REEST_REQ:
+		/* service type and key sequence, then classmark 2 as LV */
+		if (len < 2 || len < 2 + gh->data[1] + 1)
+			return NULL;
+		lv = &gh->data[2 + gh->data[1]];
+		break;
+	case GSM48_MT_MM_IMSI_DETACH_IND:
+		/* classmark 1, then the LV */
+		if (len < 2)
+			return NULL;
+		lv = &gh->data[1];
+		break;
+	default:
+		return NULL;
+	}
+
+	if (lv[0] == 0 || lv + 1 + lv[0] > gh->data + len)
+		return NULL;
+
+	*mi_len = lv[0];
+	return lv + 1;
+}
+
+static struct osmo_msc_data *route_by_nri(struct osmo_bsc_data *bsc,
+					  uint32_t tmsi, int is_emerg)
+{
+	struct osmo_msc_data *msc;
+	unsigned int nri;
+
+	/* the NRI are the bits 23 and down of the TMSI */
+	nri = (tmsi >> (24 - bsc->nri_bitlen)) & ((1 << bsc->nri_bitlen) - 1);
+
+	llist_for_each_entry(msc, &bsc->mscs, entry) {
+		if (!(msc->route.nri[nri / 8] & (1 << (nri % 8))))
+			continue;
+		if (!msc_usable(msc, is_emerg))
+			continue;
+		if (msc_full(msc)) {
+			route_ctr_inc(msc, MSC_ROUTE_CTR_FULL);
+			continue;
+		}
+		LOGP(DMSC, LOGL_DEBUG, "TMSI 0x%08x has NRI %u of MSC %d\n",
+		     tmsi, nri, msc->nr);
+		route_ctr_inc(msc, MSC_ROUTE_CTR_NRI);
+		return msc;
+	}
+
+	return NULL;
+}
+
+static uint32_t route_hash(const char *imsi, int nr)
+{
+	/* FNV-1a */
+	uint32_t hash = 2166136261u;
+
+	for (; *imsi; imsi++)
+		hash = (hash ^ (uint8_t) *imsi) * 16777619u;
+	hash = (hash ^ (uint8_t) nr) * 16777619u;
+	hash = (hash ^ (uint8_t) (nr >> 8)) * 16777619u;
+	return hash;
+}
+
+/*
+ * Rendezvous hashing: every IMSI ranks the MSCs in its own order and
+ * takes the first available one, so a subscriber only moves when its
+ * MSC goes away.
+ */
+static struct osmo_msc_data *route_by_imsi(struct osmo_bsc_data *bsc,
+					   const char *imsi, int is_emerg)
+{
+	struct osmo_msc_data *msc, *best = NULL;
+	uint32_t hash, best_hash = 0;
+
+	llist_for_each_entry(msc, &bsc->mscs, entry) {
+		if (!msc_usable(msc, is_emerg))
+			continue;
+		hash = route_hash(imsi, msc->nr);
+		if (best && hash <= best_hash)
+			continue;
+		best = msc;
+		best_hash = hash;
+	}
+
+	if (!best)
+		return NULL;
+	if (msc_full(best)) {
+		route_ctr_inc(best, MSC_ROUTE_CTR_FULL);
+		return NULL;
+	}
+
+	route_ctr_inc(best, MSC_ROUTE_CTR_IMSI);
+	return best;
+}
+
+static struct osmo_msc_data *route_by_load(struct osmo_bsc_data *bsc,
+					   int is_emerg)
+{
+	struct osmo_msc_data *msc, *best = NULL;
+	uint64_t load, best_load = 0;
+
+	llist_for_each_entry(msc, &bsc->mscs, entry) {
+		if (!msc_usable(msc, is_emerg) || msc_full(msc))
+			continue;
+
+		load = (uint64_t) (msc->route.num_conns + 1) *
+			(msc->route.cc_delay_ms + ROUTE_DELAY_BASE_MS);
+		if (best && load >= best_load)
+			continue;
+		best = msc;
+		best_load = load;
+	}
+
+	if (!best)
+		return NULL;
+
+	/* equally loaded MSCs take turns */
+	llist_move_tail(&best->entry, &bsc->mscs);
+	route_ctr_inc(best, MSC_ROUTE_CTR_LOAD);
+	return best;
+}
+
+struct osmo_msc_data *osmo_bsc_route_msc(struct osmo_bsc_data *bsc,
+					 struct msgb *msg, int is_emerg)
+{
+	struct osmo_msc_data *msc = NULL;
+	char imsi[GSM48_MI_SIZE];
+	const uint8_t *mi;
+	uint8_t mi_len;
+
+	mi = route_get_mi(msg, &mi_len);
+	if (!mi)
+		return route_by_load(bsc, is_emerg);
+
+	switch (mi[0] & GSM_MI_TYPE_MASK) {
+	case GSM_MI_TYPE_TMSI:
+		if (bsc->nri_bitlen <= 0 || mi_len != 5)
+			break;
+		msc = route_by_nri(bsc, (mi[1] << 24) | (mi[2] << 16) |
+					(mi[3] << 8) | mi[4], is_emerg);
+		break;
+	case GSM_MI_TYPE_IMSI:
+		gsm48_mi_to_string(imsi, sizeof(imsi), mi, mi_len);
+		msc = route_by_imsi(bsc, imsi, is_emerg);
+		break;
+	}
+
+	return msc ? msc : route_by_load(bsc, is_emerg);
+}
+
+/* The MSC confirmed a connection requested at cr_time */
+void osmo_bsc_route_cc_delay(struct osmo_msc_data *msc,
+			     const struct timeval *cr_time)
+{
+	struct timeval now, delta;
+	unsigned int delay_ms;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, cr_time, &delta);
+	delay_ms = delta.tv_sec * 1000 + delta.tv_usec / 1000;
+
+	/* a moving average over roughly the last eight connections */
+	if (msc->route.cc_delay_ms == 0)
+		msc->route.cc_delay_ms = delay_ms;
+	else
+		msc->route.cc_delay_ms =
+			(msc->route.cc_delay_ms * 7 + delay_ms) / 8;
+}
+
+void osmo_bsc_route_cc_timeout(struct osmo_msc_data *msc)
+{
+	route_ctr_inc(msc, MSC_ROUTE_CTR_CC_TIMEOUT);
+	msc->route.cc_delay_ms =
+		(msc->route.cc_delay_ms * 7 + ROUTE_CC_TIMEOUT_MS) / 8;
+}
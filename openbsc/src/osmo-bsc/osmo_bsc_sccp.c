@@ -98,6 +98,7 @@ static void msc_outgoing_sccp_state(struct sccp_connection *conn, int old_state)
 
 		osmo_timer_del(&con_data->sccp_cc_timeout);
 		osmo_timer_schedule(&con_data->sccp_it_timeout, SCCP_IT_TIMER, 0);
+		osmo_bsc_route_cc_delay(con_data->msc, &con_data->cr_time);
 
 		send_queued(con_data);
 	}
@@ -135,6 +136,7 @@ static void sccp_cc_timeout(void *_data)
 		return;
 
 	LOGP(DMSC, LOGL_ERROR, "The connection was never established.\n");
+	osmo_bsc_route_cc_timeout(data->msc);
 	bsc_sccp_force_free(data);
 }
 
@@ -243,6 +245,7 @@ enum bsc_con bsc_create_new_connection(struct gsm_subscriber_connection *conn,
 	bsc_con->msc = msc;
 	bsc_con->conn = conn;
 	llist_add_tail(&bsc_con->entry, &active_connections);
+	msc->route.num_conns += 1;
 	conn->sccp_con = bsc_con;
 	return BSC_CON_SUCCESS;
 }
@@ -250,6 +253,7 @@ enum bsc_con bsc_create_new_connection(struct gsm_subscriber_connection *conn,
 int bsc_open_connection(struct osmo_bsc_sccp_con *conn, struct msgb *msg)
 {
 	osmo_timer_schedule(&conn->sccp_cc_timeout, 10, 0);
+	gettimeofday(&conn->cr_time, NULL);
 	sccp_connection_connect(conn->sccp, &sccp_ssn_bssap, msg);
 	msgb_free(msg);
 	return 0;
@@ -264,6 +268,7 @@ int bsc_delete_connection(struct osmo_bsc_sccp_con *sccp)
 		LOGP(DMSC, LOGL_ERROR, "Should have been cleared.\n");
 
 	llist_del(&sccp->entry);
+	sccp->msc->route.num_conns -= 1;
 	osmo_timer_del(&sccp->sccp_it_timeout);
 	osmo_timer_del(&sccp->sccp_cc_timeout);
 	talloc_free(sccp);
@@ -103,6 +103,7 @@ static void write_msc_amr_options(struct vty *vty, struct osmo_msc_data *msc)
 static void write_msc(struct vty *vty, struct osmo_msc_data *msc)
 {
 	struct bsc_msc_dest *dest;
+	int i;
 
 	vty_out(vty, "msc %d%s", msc->nr, VTY_NEWLINE);
 	if (msc->bsc_token)
@@ -182,6 +183,11 @@ static void write_msc(struct vty *vty, struct osmo_msc_data *msc)
 	if (msc->acc_lst_name)
 		vty_out(vty, " access-list-name %s%s", msc->acc_lst_name, VTY_NEWLINE);
 
+	vty_out(vty, " max-connections %u%s", msc->route.max_conns, VTY_NEWLINE);
+	for (i = 0; i < MSC_ROUTE_NRI_MAX; i++)
+		if (msc->route.nri[i / 8] & (1 << (i % 8)))
+			vty_out(vty, " nri add %d%s", i, VTY_NEWLINE);
+
 	/* write amr options */
 	write_msc_amr_options(vty, msc);
 }
@@ -219,6 +225,7 @@ static int config_write_bsc(struct vty *vty)
 		vty_out(vty, " no missing-msc-text%s", VTY_NEWLINE);
 	if (bsc->acc_lst_name)
 		vty_out(vty, " access-list-name %s%s", bsc->acc_lst_name, VTY_NEWLINE);
+	vty_out(vty, " nri bitlen %d%s", bsc->nri_bitlen, VTY_NEWLINE);
 
 	return CMD_SUCCESS;
 }
@@ -685,6 +692,57 @@ DEFUN(cfg_msc_no_acc_lst_name,
 	return CMD_SUCCESS;
 }
 
+DEFUN(cfg_net_msc_max_conns,
+      cfg_net_msc_max_conns_cmd,
+      "max-connections <0-65535>",
+      "Limit the SCCP connections to this MSC, new subscribers go elsewhere\n"
+      "Number of connections, 0 for no limit\n")
+{
+	struct osmo_msc_data *msc = osmo_msc_data(vty);
+
+	msc->route.max_conns = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+#define NRI_STR "Network Resource Indicators of this MSC's TMSIs\n"
+
+DEFUN(cfg_net_msc_nri_add,
+      cfg_net_msc_nri_add_cmd,
+      "nri add <0-1023>",
+      NRI_STR "Route TMSIs with this NRI to this MSC\n" "NRI value\n")
+{
+	struct osmo_msc_data *msc = osmo_msc_data(vty);
+	int nri = atoi(argv[0]);
+
+	msc->route.nri[nri / 8] |= 1 << (nri % 8);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_net_msc_nri_del,
+      cfg_net_msc_nri_del_cmd,
+      "nri del <0-1023>",
+      NRI_STR "Do not route TMSIs with this NRI to this MSC\n" "NRI value\n")
+{
+	struct osmo_msc_data *msc = osmo_msc_data(vty);
+	int nri = atoi(argv[0]);
+
+	msc->route.nri[nri / 8] &= ~(1 << (nri % 8));
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_net_bsc_nri_bitlen,
+      cfg_net_bsc_nri_bitlen_cmd,
+      "nri bitlen <0-10>",
+      "Network Resource Indicator\n"
+      "Set the length of the NRI in the TMSI\n"
+      "Number of bits, 0 to not route by NRI\n")
+{
+	struct osmo_bsc_data *bsc = osmo_bsc_data(vty);
+
+	bsc->nri_bitlen = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
 DEFUN(cfg_net_bsc_mid_call_text,
       cfg_net_bsc_mid_call_text_cmd,
       "mid-call-text .TEXT",
@@ -789,6 +847,9 @@ DEFUN(show_mscs,
 			msc->msc_con ? msc->msc_con->is_connected : -1,
 			msc->msc_con ? msc->msc_con->is_authenticated : -1,
 			VTY_NEWLINE);
+		vty_out(vty, " Connections: %u open, max-connections %u, confirmed in %u ms.%s",
+			msc->route.num_conns, msc->route.max_conns,
+			msc->route.cc_delay_ms, VTY_NEWLINE);
 	}
 
 	return CMD_SUCCESS;
@@ -894,6 +955,7 @@ int bsc_vty_init_extra(void)
 	install_element(BSC_NODE, &cfg_net_bsc_no_missing_msc_text_cmd);
 	install_element(BSC_NODE, &cfg_bsc_acc_lst_name_cmd);
 	install_element(BSC_NODE, &cfg_bsc_no_acc_lst_name_cmd);
+	install_element(BSC_NODE, &cfg_net_bsc_nri_bitlen_cmd);
 
 	install_node(&msc_node, config_write_msc);
 	vty_install_default(MSC_NODE);
@@ -932,6 +994,9 @@ int bsc_vty_init_extra(void)
 	install_element(MSC_NODE, &cfg_net_msc_amr_4_75_cmd);
 	install_element(MSC_NODE, &cfg_msc_acc_lst_name_cmd);
 	install_element(MSC_NODE, &cfg_msc_no_acc_lst_name_cmd);
+	install_element(MSC_NODE, &cfg_net_msc_max_conns_cmd);
+	install_element(MSC_NODE, &cfg_net_msc_nri_add_cmd);
+	install_element(MSC_NODE, &cfg_net_msc_nri_del_cmd);
 
 	install_element_ve(&show_statistics_cmd);
 	install_element_ve(&show_mscs_cmd);
@@ -69,6 +69,23 @@ static const struct rate_ctr_group_desc bsc_cfg_ctrg_desc = {
 	.class_id = OSMO_STATS_CLASS_PEER,
 };
 
+static const struct rate_ctr_desc ussd_gw_ctr_description[] = {
+	[USSD_GW_CTR_CONN]     = { "conn",         "Provider connections     "},
+	[USSD_GW_CTR_SESSIONS] = { "sessions",     "USSD sessions handed over"},
+	[USSD_GW_CTR_MSG_TX]   = { "msgs.tx",      "Messages to the provider "},
+	[USSD_GW_CTR_MSG_RX]   = { "msgs.rx",      "Messages from provider   "},
+	[USSD_GW_CTR_BUSY]     = { "busy",         "Sessions left to the MSC "},
+	[USSD_GW_CTR_DROPPED]  = { "dropped",      "Dropped on a full queue  "},
+};
+
+static const struct rate_ctr_group_desc ussd_gw_ctrg_desc = {
+	.group_name_prefix = "nat.ussd",
+	.group_description = "NAT USSD Gateway Statistics",
+	.num_ctr = ARRAY_SIZE(ussd_gw_ctr_description),
+	.ctr_desc = ussd_gw_ctr_description,
+	.class_id = OSMO_STATS_CLASS_PEER,
+};
+
 struct bsc_nat *bsc_nat_alloc(void)
 {
 	struct bsc_nat *nat = talloc_zero(tall_bsc_ctx, struct bsc_nat);
@@ -93,6 +110,7 @@ struct bsc_nat *bsc_nat_alloc(void)
 	INIT_LLIST_HEAD(&nat->tpdest_match);
 	INIT_LLIST_HEAD(&nat->sms_clear_tp_srr);
 	INIT_LLIST_HEAD(&nat->sms_num_rewr);
+	INIT_LLIST_HEAD(&nat->ussd_gws);
 
 	nat->stats.sccp.conn = osmo_counter_alloc("nat.sccp.conn");
 	nat->stats.sccp.calls = osmo_counter_alloc("nat.sccp.calls");
@@ -115,11 +133,14 @@ void bsc_nat_free(struct bsc_nat *nat)
 {
 	struct bsc_config *cfg, *tmp;
 	struct bsc_msg_acc_lst *lst, *tmp_lst;
+	struct bsc_nat_ussd_gw *gw, *tmp_gw;
 
 	llist_for_each_entry_safe(cfg, tmp, &nat->bsc_configs, entry)
 		bsc_config_free(cfg);
 	llist_for_each_entry_safe(lst, tmp_lst, &nat->access_lists, list)
 		bsc_msg_acc_lst_delete(lst);
+	llist_for_each_entry_safe(gw, tmp_gw, &nat->ussd_gws, entry)
+		bsc_ussd_gw_free(gw);
 
 	bsc_nat_num_rewr_entry_adapt(nat, &nat->num_rewr, NULL);
 	bsc_nat_num_rewr_entry_adapt(nat, &nat->num_rewr_post, NULL);
@@ -210,6 +231,55 @@ void bsc_config_free(struct bsc_config *cfg)
 	talloc_free(cfg);
 }
 
+struct bsc_nat_ussd_gw *bsc_ussd_gw_find(struct bsc_nat *nat, const char *name)
+{
+	struct bsc_nat_ussd_gw *gw;
+
+	llist_for_each_entry(gw, &nat->ussd_gws, entry)
+		if (strcmp(gw->name, name) == 0)
+			return gw;
+
+	return NULL;
+}
+
+struct bsc_nat_ussd_gw *bsc_ussd_gw_alloc(struct bsc_nat *nat, const char *name)
+{
+	struct bsc_nat_ussd_gw *gw, *other;
+
+	gw = talloc_zero(nat, struct bsc_nat_ussd_gw);
+	if (!gw)
+		return NULL;
+
+	gw->nat = nat;
+	gw->name = talloc_strdup(gw, name);
+	gw->max_queue = USSD_GW_DEFAULT_QUEUE;
+
+	/* the counter group index has to stay unique */
+	llist_for_each_entry(other, &nat->ussd_gws, entry)
+		if (other->nr >= gw->nr)
+			gw->nr = other->nr + 1;
+
+	gw->ctrg = rate_ctr_group_alloc(gw, &ussd_gw_ctrg_desc, gw->nr);
+	if (!gw->ctrg) {
+		talloc_free(gw);
+		return NULL;
+	}
+
+	llist_add_tail(&gw->entry, &nat->ussd_gws);
+	return gw;
+}
+
+/* The provider connection has to be gone, see bsc_ussd_gw_disconnect */
+void bsc_ussd_gw_free(struct bsc_nat_ussd_gw *gw)
+{
+	llist_del(&gw->entry);
+	if (gw->con)
+		gw->con->gw = NULL;
+	regfree(&gw->query_re);
+	rate_ctr_group_free(gw->ctrg);
+	talloc_free(gw);
+}
+
 static void _add_lac(void *ctx, struct llist_head *list, int _lac)
 {
 	struct bsc_lac_entry *lac;
@@ -404,6 +474,59 @@ int bsc_write_msg(struct osmo_wqueue *queue, struct msgb *msg)
 	return 0;
 }
 
+void nat_send_rlsd_bsc(struct nat_sccp_connection *conn)
+{
+	struct msgb *msg;
+	struct sccp_connection_released *rel;
+
+	msg = msgb_alloc_headroom(4096, 128, "rlsd");
+	if (!msg) {
+		LOGP(DNAT, LOGL_ERROR, "Failed to allocate clear command.\n");
+		return;
+	}
+
+	msg->l2h = msgb_put(msg, sizeof(*rel));
+	rel = (struct sccp_connection_released *) msg->l2h;
+	rel->type = SCCP_MSG_TYPE_RLSD;
+	rel->release_cause = SCCP_RELEASE_CAUSE_SCCP_FAILURE;
+	rel->destination_local_reference = conn->real_ref;
+	rel->source_local_reference = conn->remote_ref;
+
+	bsc_write(conn->bsc, msg, IPAC_PROTO_SCCP);
+}
+
+struct msgb *nat_creat_clrc(struct nat_sccp_connection *conn, uint8_t cause)
+{
+	struct msgb *msg;
+	struct msgb *sccp;
+
+	msg = gsm0808_create_clear_command(cause);
+	if (!msg) {
+		LOGP(DNAT, LOGL_ERROR, "Failed to allocate clear command.\n");
+		return NULL;
+	}
+
+	sccp = sccp_create_dt1(&conn->real_ref, msg->data, msg->len);
+	if (!sccp) {
+		LOGP(DNAT, LOGL_ERROR, "Failed to allocate SCCP msg.\n");
+		msgb_free(msg);
+		return NULL;
+	}
+
+	msgb_free(msg);
+	return sccp;
+}
+
+int nat_send_clrc_bsc(struct nat_sccp_connection *conn)
+{
+	struct msgb *sccp;
+
+	sccp = nat_creat_clrc(conn, 0x20);
+	if (!sccp)
+		return -1;
+	return bsc_write(conn->bsc, sccp, IPAC_PROTO_SCCP);
+}
+
 struct gsm48_hdr *bsc_unpack_dtap(struct bsc_nat_parsed *parsed,
 				  struct msgb *msg, uint32_t *len)
 {
@@ -86,6 +86,30 @@ static void write_pgroup_lst(struct vty *vty, struct bsc_nat_paging_group *pgrou
 	dump_lac(vty, &pgroup->lists);
 }
 
+static void write_ussd_gws(struct vty *vty)
+{
+	struct bsc_nat_ussd_gw *gw;
+
+	llist_for_each_entry(gw, &_nat->ussd_gws, entry) {
+		if (strcmp(gw->name, "default") == 0) {
+			if (gw->query)
+				vty_out(vty, " ussd-query %s%s", gw->query, VTY_NEWLINE);
+			if (gw->token)
+				vty_out(vty, " ussd-token %s%s", gw->token, VTY_NEWLINE);
+		} else {
+			if (gw->query)
+				vty_out(vty, " ussd-gateway %s query %s%s",
+					gw->name, gw->query, VTY_NEWLINE);
+			if (gw->token)
+				vty_out(vty, " ussd-gateway %s token %s%s",
+					gw->name, gw->token, VTY_NEWLINE);
+		}
+		if (gw->max_queue != USSD_GW_DEFAULT_QUEUE)
+			vty_out(vty, " ussd-gateway %s queue-length %d%s",
+				gw->name, gw->max_queue, VTY_NEWLINE);
+	}
+}
+
 static int config_write_nat(struct vty *vty)
 {
 	struct bsc_msg_acc_lst *lst;
@@ -109,10 +133,7 @@ static int config_write_nat(struct vty *vty)
 			_nat->imsi_black_list_fn, VTY_NEWLINE);
 	if (_nat->ussd_lst_name)
 		vty_out(vty, " ussd-list-name %s%s", _nat->ussd_lst_name, VTY_NEWLINE);
-	if (_nat->ussd_query)
-		vty_out(vty, " ussd-query %s%s", _nat->ussd_query, VTY_NEWLINE);
-	if (_nat->ussd_token)
-		vty_out(vty, " ussd-token %s%s", _nat->ussd_token, VTY_NEWLINE);
+	write_ussd_gws(vty);
 	if (_nat->ussd_local)
 		vty_out(vty, " ussd-local-ip %s%s", _nat->ussd_local, VTY_NEWLINE);
 
@@ -793,13 +814,29 @@ DEFUN(cfg_nat_ussd_lst_name,
 	return CMD_SUCCESS;
 }
 
+static struct bsc_nat_ussd_gw *ussd_gw_get(struct vty *vty, const char *name)
+{
+	struct bsc_nat_ussd_gw *gw;
+
+	gw = bsc_ussd_gw_find(_nat, name);
+	if (!gw)
+		gw = bsc_ussd_gw_alloc(_nat, name);
+	if (!gw)
+		vty_out(vty, "Failed to create USSD gateway %s%s", name, VTY_NEWLINE);
+	return gw;
+}
+
 DEFUN(cfg_nat_ussd_query,
       cfg_nat_ussd_query_cmd,
       "ussd-query REGEXP",
       "Set the USSD query to match with the ussd-list-name\n"
       "The query to match")
 {
-	if (gsm_parse_reg(_nat, &_nat->ussd_query_re, &_nat->ussd_query, argc, argv) != 0)
+	struct bsc_nat_ussd_gw *gw = ussd_gw_get(vty, "default");
+
+	if (!gw)
+		return CMD_WARNING;
+	if (gsm_parse_reg(gw, &gw->query_re, &gw->query, argc, argv) != 0)
 		return CMD_WARNING;
 	return CMD_SUCCESS;
 }
@@ -809,7 +846,77 @@ DEFUN(cfg_nat_ussd_token,
       "ussd-token TOKEN",
       "Set the token used to identify the USSD module\n" "Secret key\n")
 {
-	bsc_replace_string(_nat, &_nat->ussd_token, argv[0]);
+	struct bsc_nat_ussd_gw *gw = ussd_gw_get(vty, "default");
+
+	if (!gw)
+		return CMD_WARNING;
+	bsc_replace_string(gw, &gw->token, argv[0]);
+	return CMD_SUCCESS;
+}
+
+#define USSD_GW_STR "USSD provider selected by its query\n" "Name of the provider\n"
+
+DEFUN(cfg_nat_ussd_gw_query,
+      cfg_nat_ussd_gw_query_cmd,
+      "ussd-gateway NAME query REGEXP",
+      USSD_GW_STR
+      "Set the USSD query handled by this provider\n"
+      "The query to match")
+{
+	struct bsc_nat_ussd_gw *gw = ussd_gw_get(vty, argv[0]);
+
+	if (!gw)
+		return CMD_WARNING;
+	if (gsm_parse_reg(gw, &gw->query_re, &gw->query, argc - 1, &argv[1]) != 0)
+		return CMD_WARNING;
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_nat_ussd_gw_token,
+      cfg_nat_ussd_gw_token_cmd,
+      "ussd-gateway NAME token TOKEN",
+      USSD_GW_STR
+      "Set the token used to identify this provider\n" "Secret key\n")
+{
+	struct bsc_nat_ussd_gw *gw = ussd_gw_get(vty, argv[0]);
+
+	if (!gw)
+		return CMD_WARNING;
+	bsc_replace_string(gw, &gw->token, argv[1]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_nat_ussd_gw_queue,
+      cfg_nat_ussd_gw_queue_cmd,
+      "ussd-gateway NAME queue-length <1-10000>",
+      USSD_GW_STR
+      "Messages queued for the provider before new sessions go to the MSC\n"
+      "Number of messages\n")
+{
+	struct bsc_nat_ussd_gw *gw = ussd_gw_get(vty, argv[0]);
+
+	if (!gw)
+		return CMD_WARNING;
+	gw->max_queue = atoi(argv[1]);
+	if (gw->con && gw->con->authorized)
+		gw->con->queue.max_length = gw->max_queue;
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_nat_no_ussd_gw,
+      cfg_nat_no_ussd_gw_cmd,
+      "no ussd-gateway NAME",
+      NO_STR USSD_GW_STR)
+{
+	struct bsc_nat_ussd_gw *gw = bsc_ussd_gw_find(_nat, argv[0]);
+
+	if (!gw) {
+		vty_out(vty, "No USSD gateway %s%s", argv[0], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	bsc_ussd_gw_disconnect(gw);
+	bsc_ussd_gw_free(gw);
 	return CMD_SUCCESS;
 }
 
@@ -1189,13 +1296,35 @@ DEFUN(show_ussd_connection,
       "show ussd-connection",
       SHOW_STR "USSD connection related information\n")
 {
+	struct bsc_nat_ussd_gw *gw = bsc_ussd_gw_find(_nat, "default");
+	struct bsc_nat_ussd_con *con = gw ? gw->con : NULL;
+
 	vty_out(vty, "The USSD side channel provider is %sconnected and %sauthorized.%s",
-		_nat->ussd_con ? "" : "not ",
-		_nat->ussd_con && _nat->ussd_con->authorized? "" : "not ",
+		con ? "" : "not ",
+		con && con->authorized? "" : "not ",
 		VTY_NEWLINE);
 	return CMD_SUCCESS;
 }
 
+DEFUN(show_ussd_gws,
+      show_ussd_gws_cmd,
+      "show ussd-gateways",
+      SHOW_STR "USSD providers and their statistics\n")
+{
+	struct bsc_nat_ussd_gw *gw;
+
+	llist_for_each_entry(gw, &_nat->ussd_gws, entry) {
+		vty_out(vty, "USSD gateway %s is %sconnected, query %s, queue %d/%d%s",
+			gw->name, gw->con ? "" : "not ",
+			gw->query ? gw->query : "none",
+			gw->con ? (int) gw->con->queue.current_length : 0,
+			gw->max_queue, VTY_NEWLINE);
+		vty_out_rate_ctr_group(vty, " ", gw->ctrg);
+	}
+
+	return CMD_SUCCESS;
+}
+
 #define OSMUX_STR "RTP multiplexing\n"
 DEFUN(cfg_bsc_osmux,
       cfg_bsc_osmux_cmd,
@@ -1250,6 +1379,7 @@ int bsc_nat_vty_init(struct bsc_nat *nat)
 	install_element_ve(&show_bar_lst_cmd);
 	install_element_ve(&show_prefix_tree_cmd);
 	install_element_ve(&show_ussd_connection_cmd);
+	install_element_ve(&show_ussd_gws_cmd);
 
 	install_element(ENABLE_NODE, &set_last_endp_cmd);
 	install_element(ENABLE_NODE, &block_new_conn_cmd);
@@ -1274,6 +1404,10 @@ int bsc_nat_vty_init(struct bsc_nat *nat)
 	install_element(NAT_NODE, &cfg_nat_ussd_lst_name_cmd);
 	install_element(NAT_NODE, &cfg_nat_ussd_query_cmd);
 	install_element(NAT_NODE, &cfg_nat_ussd_token_cmd);
+	install_element(NAT_NODE, &cfg_nat_ussd_gw_query_cmd);
+	install_element(NAT_NODE, &cfg_nat_ussd_gw_token_cmd);
+	install_element(NAT_NODE, &cfg_nat_ussd_gw_queue_cmd);
+	install_element(NAT_NODE, &cfg_nat_no_ussd_gw_cmd);
 	install_element(NAT_NODE, &cfg_nat_ussd_local_cmd);
 	install_element(NAT_NODE, &cfg_nat_use_ipa_for_mgcp_cmd);
 
@@ -36,6 +36,7 @@
 
 #include <osmocom/abis/ipa.h>
 
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <string.h>
 #include <unistd.h>
@@ -43,7 +44,10 @@
 #define USSD_LAC_IE	0
 #define USSD_CI_IE	1
 
-static void ussd_auth_con(struct tlv_parsed *, struct bsc_nat_ussd_con *);
+/* messages taken from a provider before the other fds get their turn */
+#define USSD_READ_BUDGET	16
+
+static int ussd_auth_con(struct tlv_parsed *, struct bsc_nat_ussd_con *);
 
 static struct bsc_nat_ussd_con *bsc_nat_ussd_alloc(struct bsc_nat *nat)
 {
@@ -57,11 +61,37 @@ static struct bsc_nat_ussd_con *bsc_nat_ussd_alloc(struct bsc_nat *nat)
 	return con;
 }
 
+/* Release a connection the MSC never saw, nobody else can serve it */
+void bsc_ussd_close_connection(struct nat_sccp_connection *con)
+{
+	con->ussd_gw = NULL;
+	if (!con->bsc)
+		return;
+
+	nat_send_clrc_bsc(con);
+	nat_send_rlsd_bsc(con);
+}
+
+/* Close all connections handed out to a USSD provider */
+int bsc_ussd_close_connections(struct bsc_nat *nat, struct bsc_nat_ussd_gw *gw)
+{
+	struct nat_sccp_connection *con;
+	llist_for_each_entry(con, &nat->sccp_connections, list_entry) {
+		if (con->con_local != NAT_CON_END_USSD)
+			continue;
+		if (con->ussd_gw != gw)
+			continue;
+		bsc_ussd_close_connection(con);
+	}
+
+	return 0;
+}
+
 static void bsc_nat_ussd_destroy(struct bsc_nat_ussd_con *con)
 {
-	if (con->nat->ussd_con == con) {
-		bsc_ussd_close_connections(con->nat);
-		con->nat->ussd_con = NULL;
+	if (con->gw && con->gw->con == con) {
+		bsc_ussd_close_connections(con->nat, con->gw);
+		con->gw->con = NULL;
 	}
 
 	close(con->queue.bfd.fd);
@@ -73,6 +103,29 @@ static void bsc_nat_ussd_destroy(struct bsc_nat_ussd_con *con)
 	talloc_free(con);
 }
 
+void bsc_ussd_gw_disconnect(struct bsc_nat_ussd_gw *gw)
+{
+	if (gw->con)
+		bsc_nat_ussd_destroy(gw->con);
+	bsc_ussd_close_connections(gw->nat, gw);
+}
+
+static int ussd_gw_full(struct bsc_nat_ussd_gw *gw)
+{
+	return gw->con->queue.current_length >= gw->con->queue.max_length;
+}
+
+static int ussd_gw_write(struct bsc_nat_ussd_gw *gw, struct msgb *msg)
+{
+	if (bsc_write_msg(&gw->con->queue, msg) != 0) {
+		rate_ctr_inc(&gw->ctrg->ctr[USSD_GW_CTR_DROPPED]);
+		return -1;
+	}
+
+	rate_ctr_inc(&gw->ctrg->ctr[USSD_GW_CTR_MSG_TX]);
+	return 0;
+}
+
 static void ussd_pong(struct bsc_nat_ussd_con *conn)
 {
 	struct msgb *msg;
@@ -87,11 +140,13 @@ static void ussd_pong(struct bsc_nat_ussd_con *conn)
 	bsc_do_write(&conn->queue, msg, IPAC_PROTO_IPACCESS);
 }
 
-static int forward_sccp(struct bsc_nat *nat, struct msgb *msg)
+static int forward_sccp(struct bsc_nat_ussd_con *conn, struct msgb *msg)
 {
 	struct nat_sccp_connection *con;
 	struct bsc_nat_parsed *parsed;
 
+	if (conn->gw)
+		rate_ctr_inc(&conn->gw->ctrg->ctr[USSD_GW_CTR_MSG_RX]);
 
 	parsed = bsc_nat_parse(msg);
 	if (!parsed) {
@@ -106,7 +161,7 @@ static int forward_sccp(struct bsc_nat *nat, struct msgb *msg)
 		return -1;
 	}
 
-	con = bsc_nat_find_con_by_bsc(nat, parsed->dest_local_ref);
+	con = bsc_nat_find_con_by_bsc(conn->nat, parsed->dest_local_ref);
 	if (!con || !con->bsc) {
 		LOGP(DNAT, LOGL_ERROR, "No active connection found.\n");
 		msgb_free(msg);
@@ -118,9 +173,10 @@ static int forward_sccp(struct bsc_nat *nat, struct msgb *msg)
 	return 0;
 }
 
-static int ussd_read_cb(struct osmo_fd *bfd)
+/* Handle one message, 1 if it is incomplete and -EBADF once conn is gone */
+static int ussd_read_msg(struct bsc_nat_ussd_con *conn)
 {
-	struct bsc_nat_ussd_con *conn = bfd->data;
+	struct osmo_fd *bfd = &conn->queue.bfd;
 	struct msgb *msg = NULL;
 	struct ipaccess_head *hh;
 	int ret;
@@ -128,20 +184,20 @@ static int ussd_read_cb(struct osmo_fd *bfd)
 	ret = ipa_msg_recv_buffered(bfd->fd, &msg, &conn->pending_msg);
 	if (ret <= 0) {
 		if (ret == -EAGAIN)
-			return 0;
+			return 1;
 		LOGP(DNAT, LOGL_ERROR, "USSD Connection was lost.\n");
 		bsc_nat_ussd_destroy(conn);
-		return -1;
+		return -EBADF;
 	}
 
-	LOGP(DNAT, LOGL_NOTICE, "MSG from USSD: %s proto: %d\n",
+	LOGP(DNAT, LOGL_DEBUG, "MSG from USSD: %s proto: %d\n",
 		osmo_hexdump(msg->data, msg->len), msg->l2h[0]);
 	hh = (struct ipaccess_head *) msg->data;
 
 	if (hh->proto == IPAC_PROTO_IPACCESS) {
+		ret = 0;
 		if (msg->l2h[0] == IPAC_MSGT_ID_RESP) {
 			struct tlv_parsed tvp;
-			int ret;
 			ret = ipa_ccm_idtag_parse(&tvp,
 					     (unsigned char *) msg->l2h + 2,
 					     msgb_l2len(msg) - 2);
@@ -152,7 +208,7 @@ static int ussd_read_cb(struct osmo_fd *bfd)
 				return ret;
 			}
 			if (TLVP_PRESENT(&tvp, IPAC_IDTAG_UNITNAME))
-				ussd_auth_con(&tvp, conn);
+				ret = ussd_auth_con(&tvp, conn);
 		} else if (msg->l2h[0] == IPAC_MSGT_PING) {
 			LOGP(DNAT, LOGL_DEBUG, "Got USSD ping request.\n");
 			ussd_pong(conn);
@@ -161,8 +217,9 @@ static int ussd_read_cb(struct osmo_fd *bfd)
 		}
 
 		msgb_free(msg);
+		return ret;
 	} else if (hh->proto == IPAC_PROTO_SCCP) {
-		forward_sccp(conn->nat, msg);
+		forward_sccp(conn, msg);
 	} else {
 		msgb_free(msg);
 	}
@@ -170,46 +227,73 @@ static int ussd_read_cb(struct osmo_fd *bfd)
 	return 0;
 }
 
+/*
+ * A provider answering many sessions sends in bursts. Work through
+ * what is already buffered by the kernel instead of going back to
+ * select for every message, but only up to a budget.
+ */
+static int ussd_read_cb(struct osmo_fd *bfd)
+{
+	struct bsc_nat_ussd_con *conn = bfd->data;
+	int i, ret, avail;
+
+	for (i = 0; i < USSD_READ_BUDGET; ++i) {
+		ret = ussd_read_msg(conn);
+		if (ret == -EBADF)
+			return ret;
+		if (ret != 0)
+			break;
+		if (ioctl(bfd->fd, FIONREAD, &avail) != 0 || avail <= 0)
+			break;
+	}
+
+	return 0;
+}
+
 static void ussd_auth_cb(void *_data)
 {
 	LOGP(DNAT, LOGL_ERROR, "USSD module didn't authenticate\n");
 	bsc_nat_ussd_destroy((struct bsc_nat_ussd_con *) _data);
 }
 
-static void ussd_auth_con(struct tlv_parsed *tvp, struct bsc_nat_ussd_con *conn)
+static int ussd_auth_con(struct tlv_parsed *tvp, struct bsc_nat_ussd_con *conn)
 {
+	struct bsc_nat_ussd_gw *gw;
 	const char *token;
 	int len;
-	if (!conn->nat->ussd_token) {
-		LOGP(DNAT, LOGL_ERROR, "No USSD token set. Closing\n");
-		bsc_nat_ussd_destroy(conn);
-		return;
-	}
 
 	token = (const char *) TLVP_VAL(tvp, IPAC_IDTAG_UNITNAME);
  	len = TLVP_LEN(tvp, IPAC_IDTAG_UNITNAME);
 
-	/* last byte should be a NULL */
-	if (strlen(conn->nat->ussd_token) != len - 1)
-		goto disconnect;
-	/* compare everything including the null byte */
-	if (memcmp(conn->nat->ussd_token, token, len) != 0)
-		goto disconnect;
-
-	/* it is authenticated now */
-	if (conn->nat->ussd_con && conn->nat->ussd_con != conn)
-		bsc_nat_ussd_destroy(conn->nat->ussd_con);
-
-	LOGP(DNAT, LOGL_ERROR, "USSD token specified. USSD provider is connected.\n");
-	osmo_timer_del(&conn->auth_timeout);
-	conn->authorized = 1;
-	conn->nat->ussd_con = conn;
-	return;
+	llist_for_each_entry(gw, &conn->nat->ussd_gws, entry) {
+		if (!gw->token)
+			continue;
+		/* last byte should be a NULL */
+		if (strlen(gw->token) != len - 1)
+			continue;
+		/* compare everything including the null byte */
+		if (memcmp(gw->token, token, len) != 0)
+			continue;
+
+		/* it is authenticated now */
+		if (gw->con && gw->con != conn)
+			bsc_nat_ussd_destroy(gw->con);
+
+		LOGP(DNAT, LOGL_NOTICE, "USSD provider %s is connected.\n",
+		     gw->name);
+		osmo_timer_del(&conn->auth_timeout);
+		conn->authorized = 1;
+		conn->gw = gw;
+		conn->queue.max_length = gw->max_queue;
+		gw->con = conn;
+		rate_ctr_inc(&gw->ctrg->ctr[USSD_GW_CTR_CONN]);
+		return 0;
+	}
 
-disconnect:
 	LOGP(DNAT, LOGL_ERROR, "Wrong USSD token by client: %d\n",
 		conn->queue.bfd.fd);
 	bsc_nat_ussd_destroy(conn);
+	return -EBADF;
 }
 
 static void ussd_start_auth(struct bsc_nat_ussd_con *conn)
@@ -293,60 +377,54 @@ int bsc_ussd_init(struct bsc_nat *nat)
 
 static int forward_ussd_simple(struct nat_sccp_connection *con, struct msgb *input)
 {
-	struct msgb *copy;
-	struct bsc_nat_ussd_con *ussd;
+	struct bsc_nat_ussd_gw *gw = con->ussd_gw;
+	struct msgb *msg;
+	int len;
 
-	if (!con->bsc->nat->ussd_con)
+	if (!gw || !gw->con)
 		return -1;
 
-	copy = msgb_alloc_headroom(4096, 128, "forward bts");
-	if (!copy) {
+	len = msgb_l2len(input);
+	msg = msgb_alloc_headroom(128 + len, 128, "forward bts");
+	if (!msg) {
 		LOGP(DNAT, LOGL_ERROR, "Allocation failed, not forwarding.\n");
 		return -1;
 	}
 
 	/* copy the data into the copy */
-	copy->l2h = msgb_put(copy, msgb_l2len(input));
-	memcpy(copy->l2h, input->l2h, msgb_l2len(input));
+	msg->l2h = msgb_put(msg, len);
+	memcpy(msg->l2h, input->l2h, len);
 
 	/* send it out */
-	ussd = con->bsc->nat->ussd_con;
-	bsc_do_write(&ussd->queue, copy, IPAC_PROTO_SCCP);
-	return 0;
+	ipa_prepend_header(msg, IPAC_PROTO_SCCP);
+	return ussd_gw_write(gw, msg);
 }
 
-static int forward_ussd(struct nat_sccp_connection *con, const struct ussd_request *req,
-			struct msgb *input)
+static int forward_ussd(struct nat_sccp_connection *con, struct bsc_nat_ussd_gw *gw,
+			const struct ussd_request *req, struct msgb *input)
 {
-	struct msgb *msg, *copy;
+	struct msgb *msg;
+	struct ipaccess_head *hh;
 	struct ipac_msgt_sccp_state *state;
-	struct bsc_nat_ussd_con *ussd;
 	uint16_t lac, ci;
+	int len;
 
-	if (!con->bsc->nat->ussd_con)
-		return -1;
-
-	msg = msgb_alloc_headroom(4096, 128, "forward ussd");
+	/* the state and the SCCP message go out in one buffer */
+	len = msgb_l2len(input);
+	msg = msgb_alloc_headroom(128 + 1 + sizeof(*state) +
+				  2 * (1 + sizeof(uint16_t)) +
+				  sizeof(*hh) + len, 128, "forward ussd");
 	if (!msg) {
 		LOGP(DNAT, LOGL_ERROR, "Allocation failed, not forwarding.\n");
 		return -1;
 	}
 
-	copy = msgb_alloc_headroom(4096, 128, "forward bts");
-	if (!copy) {
-		LOGP(DNAT, LOGL_ERROR, "Allocation failed, not forwarding.\n");
-		msgb_free(msg);
-		return -1;
-	}
-
-	copy->l2h = msgb_put(copy, msgb_l2len(input));
-	memcpy(copy->l2h, input->l2h, msgb_l2len(input));
-
 	msg->l2h = msgb_put(msg, 1);
 	msg->l2h[0] = IPAC_MSGT_SCCP_OLD;
 
 	/* fill out the data */
 	state = (struct ipac_msgt_sccp_state *) msgb_put(msg, sizeof(*state));
+	memset(state, 0, sizeof(*state));
 	state->trans_id = req->transaction_id;
 	state->invoke_id = req->invoke_id;
 	memcpy(&state->src_ref, &con->remote_ref, sizeof(con->remote_ref));
@@ -358,12 +436,57 @@ static int forward_ussd(struct nat_sccp_connection *con, const struct ussd_reque
 	ci = htons(con->ci);
 	msgb_tv_fixed_put(msg, USSD_LAC_IE, sizeof(lac), (const uint8_t *) &lac);
 	msgb_tv_fixed_put(msg, USSD_CI_IE, sizeof(ci), (const uint8_t *) &ci);
+	ipa_prepend_header(msg, IPAC_PROTO_IPACCESS);
 
-	ussd = con->bsc->nat->ussd_con;
-	bsc_do_write(&ussd->queue, msg, IPAC_PROTO_IPACCESS);
-	bsc_do_write(&ussd->queue, copy, IPAC_PROTO_SCCP);
+	/* followed by the message of the BTS */
+	hh = (struct ipaccess_head *) msgb_put(msg, sizeof(*hh));
+	hh->proto = IPAC_PROTO_SCCP;
+	hh->len = htons(len);
+	memcpy(msgb_put(msg, len), input->l2h, len);
 
-	return 0;
+	return ussd_gw_write(gw, msg);
+}
+
+/*
+ * The first provider whose query matches the request and that keeps
+ * up with its queue. When all of them are behind the MSC gets it.
+ */
+static struct bsc_nat_ussd_gw *ussd_gw_select(struct nat_sccp_connection *con,
+					      const char *text)
+{
+	struct bsc_nat_ussd_gw *gw;
+
+	llist_for_each_entry(gw, &con->bsc->nat->ussd_gws, entry) {
+		/* a connection stays with the provider it started with */
+		if (con->ussd_gw && con->ussd_gw != gw)
+			continue;
+		if (!gw->query || !gw->con)
+			continue;
+		if (regexec(&gw->query_re, text, 0, NULL, 0) == REG_NOMATCH)
+			continue;
+		if (ussd_gw_full(gw)) {
+			rate_ctr_inc(&gw->ctrg->ctr[USSD_GW_CTR_BUSY]);
+			continue;
+		}
+		return gw;
+	}
+
+	return NULL;
+}
+
+/*
+ * The MSC never saw a connection that ended at a provider. A message
+ * on it that can not be forwarded would go nowhere, release it instead.
+ */
+static int ussd_unserved(struct nat_sccp_connection *con, uint8_t ti)
+{
+	if (con->con_local != NAT_CON_END_USSD)
+		return 0;
+
+	LOGP(DNAT, LOGL_ERROR, "Can not forward TI: %d of %s, releasing.\n",
+	     ti, con->filter_state.imsi);
+	bsc_ussd_close_connection(con);
+	return 1;
 }
 
 int bsc_ussd_check(struct nat_sccp_connection *con, struct bsc_nat_parsed *parsed,
@@ -375,6 +498,7 @@ int bsc_ussd_check(struct nat_sccp_connection *con, struct bsc_nat_parsed *parse
 	uint8_t ti;
 	struct gsm48_hdr *hdr48;
 	struct bsc_msg_acc_lst *lst;
+	struct bsc_nat_ussd_gw *gw;
 	struct ussd_request req;
 
 	/*
@@ -394,9 +518,13 @@ int bsc_ussd_check(struct nat_sccp_connection *con, struct bsc_nat_parsed *parse
 
 	if (!con->bsc->nat->ussd_lst_name)
 		return 0;
-	if (!con->bsc->nat->ussd_query)
+	if (llist_empty(&con->bsc->nat->ussd_gws))
 		return 0;
 
+	/* released already, wait for the BSC to confirm */
+	if (con->con_local == NAT_CON_END_USSD && !con->ussd_gw)
+		return 1;
+
 	if (parsed->bssap != BSSAP_MSG_DTAP)
 		return 0;
 
@@ -419,34 +547,40 @@ int bsc_ussd_check(struct nat_sccp_connection *con, struct bsc_nat_parsed *parse
 		lst = bsc_msg_acc_lst_find(&con->bsc->nat->access_lists,
 					   con->bsc->nat->ussd_lst_name);
 		if (!lst)
-			return 0;
+			return ussd_unserved(con, ti);
 
 		if (bsc_msg_acc_lst_check_allow(lst, con->filter_state.imsi) != 0)
-			return 0;
+			return ussd_unserved(con, ti);
 
 		/* now decode the message and see if we really want to handle it */
 		memset(&req, 0, sizeof(req));
 		if (gsm0480_decode_ussd_request(hdr48, len, &req) != 1)
-			return 0;
+			return ussd_unserved(con, ti);
 		if (req.text[0] == 0xff)
-			return 0;
+			return ussd_unserved(con, ti);
 
-		if (regexec(&con->bsc->nat->ussd_query_re,
-			    req.text, 0, NULL, 0) == REG_NOMATCH)
-			return 0;
+		gw = ussd_gw_select(con, req.text);
+		if (!gw)
+			return ussd_unserved(con, ti);
 
 		/* found a USSD query for our subscriber */
-		LOGP(DNAT, LOGL_NOTICE, "Found USSD query for %s\n",
-			con->filter_state.imsi);
+		LOGP(DNAT, LOGL_NOTICE, "Found USSD query for %s, provider %s\n",
+			con->filter_state.imsi, gw->name);
+		if (forward_ussd(con, gw, &req, msg) != 0)
+			return ussd_unserved(con, ti);
+		if (!con->ussd_gw)
+			rate_ctr_inc(&gw->ctrg->ctr[USSD_GW_CTR_SESSIONS]);
 		con->ussd_ti[ti] = 1;
-		if (forward_ussd(con, &req, msg) != 0)
-			return 0;
+		con->ussd_gw = gw;
 		return 1;
-	} else if (msg_type == GSM0480_MTYPE_FACILITY && con->ussd_ti[ti]) {
+	} else if (msg_type == GSM0480_MTYPE_FACILITY) {
+		if (!con->ussd_ti[ti])
+			return ussd_unserved(con, ti);
+
 		LOGP(DNAT, LOGL_NOTICE, "Forwarding message part of TI: %d %s\n",
 		     ti, con->filter_state.imsi);
 		if (forward_ussd_simple(con, msg) != 0)
-			return 0;
+			return ussd_unserved(con, ti);
 		return 1;
 	}
 
@@ -107,6 +107,8 @@ static void print_help()
 	printf("  -M --mncc-sock-path PATH   Disable built-in MNCC handler and offer socket.\n");
 	printf("  -m --mncc-sock 	     Same as `-M /tmp/bsc_mncc' (deprecated).\n");
 	printf("  -C --no-dbcounter          Disable regular syncing of counters to database.\n");
+	printf("  -J --db-journal MODE       SQLite journal mode (DELETE, TRUNCATE, PERSIST, MEMORY, WAL, OFF).\n");
+	printf("  -S --db-synchronous MODE   SQLite synchronous mode (OFF, NORMAL, FULL). Default FULL.\n");
 	printf("  -r --rf-ctl PATH           A unix domain socket to listen for cmds.\n");
 	printf("  -p --pcap PATH             Write abis communication to pcap trace file.\n");
 }
@@ -131,11 +133,13 @@ static void handle_options(int argc, char **argv)
 			{"mncc-sock", 0, 0, 'm'},
 			{"mncc-sock-path", 1, 0, 'M'},
 			{"no-dbcounter", 0, 0, 'C'},
+			{"db-journal", 1, 0, 'J'},
+			{"db-synchronous", 1, 0, 'S'},
 			{"rf-ctl", 1, 0, 'r'},
 			{0, 0, 0, 0}
 		};
 
-		c = getopt_long(argc, argv, "hd:Dsl:ar:p:TPVc:e:mCr:M:",
+		c = getopt_long(argc, argv, "hd:Dsl:ar:p:TPVc:e:mCr:M:J:S:",
 				long_options, &option_index);
 		if (c == -1)
 			break;
@@ -181,6 +185,20 @@ static void handle_options(int argc, char **argv)
 		case 'C':
 			use_db_counter = 0;
 			break;
+		case 'J':
+			if (db_set_journal_mode(optarg)) {
+				fprintf(stderr, "Invalid journal mode '%s'.\n",
+					optarg);
+				exit(-1);
+			}
+			break;
+		case 'S':
+			if (db_set_synchronous(optarg)) {
+				fprintf(stderr, "Invalid synchronous mode '%s'.\n",
+					optarg);
+				exit(-1);
+			}
+			break;
 		case 'V':
 			print_version(1);
 			exit(0);
@@ -233,8 +251,19 @@ static int _db_store_counter(struct osmo_counter *counter, void *data)
 
 static void db_sync_timer_cb(void *data)
 {
-	/* store counters to database and re-schedule */
-	osmo_counters_for_each(_db_store_counter, NULL);
+	/* store counters to database in one commit and re-schedule */
+	if (db_begin_transaction() < 0) {
+		LOGP(DDB, LOGL_ERROR, "Failed to begin the counter sync.\n");
+		goto out;
+	}
+	if (osmo_counters_for_each(_db_store_counter, NULL) < 0) {
+		LOGP(DDB, LOGL_ERROR, "Failed to store the counters.\n");
+		db_rollback_transaction();
+	} else if (db_commit_transaction() < 0) {
+		LOGP(DDB, LOGL_ERROR, "Failed to commit the counters.\n");
+		db_rollback_transaction();
+	}
+out:
 	osmo_timer_schedule(&db_sync_timer, DB_SYNC_INTERVAL);
 }
 
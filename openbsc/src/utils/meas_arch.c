@@ -0,0 +1,452 @@
+/* Append-only columnar archive of measurement reports */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <osmocom/core/linuxlist.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+
+#include <openbsc/meas_feed.h>
+
+#include "meas_arch.h"
+
+/* rows kept per partition before they are appended to the files */
+#define ARCH_BUF_ROWS	1024
+
+const struct meas_arch_col_desc meas_arch_cols[_NUM_MEAS_ARCH_COL] = {
+	[MEAS_ARCH_COL_TIME]		= { "time",		4, 0 },
+	[MEAS_ARCH_COL_IMSI]		= { "imsi",		8, 0 },
+	[MEAS_ARCH_COL_CHAN]		= { "chan",		2, 0 },
+	[MEAS_ARCH_COL_UL_RXLEV]	= { "ul_rxlev",		1, 0 },
+	[MEAS_ARCH_COL_UL_RXQUAL]	= { "ul_rxqual",	1, 0 },
+	[MEAS_ARCH_COL_DL_RXLEV]	= { "dl_rxlev",		1, 0 },
+	[MEAS_ARCH_COL_DL_RXQUAL]	= { "dl_rxqual",	1, 0 },
+	[MEAS_ARCH_COL_BS_POWER]	= { "bs_power",		1, 0 },
+	[MEAS_ARCH_COL_MS_TA]		= { "ms_ta",		1, 0 },
+	[MEAS_ARCH_COL_MS_PWR]		= { "ms_pwr",		1, 1 },
+};
+
+struct arch_part {
+	struct llist_head entry;
+	time_t start;
+	uint8_t bts_nr;
+	unsigned int rows;
+	uint8_t *col[_NUM_MEAS_ARCH_COL];
+};
+
+struct meas_arch {
+	char *dir;
+	struct llist_head parts;
+};
+
+int meas_arch_col_by_name(const char *name)
+{
+	int i;
+
+	for (i = 0; i < _NUM_MEAS_ARCH_COL; i++)
+		if (!strcmp(meas_arch_cols[i].name, name))
+			return i;
+	return -EINVAL;
+}
+
+static void part_hour_name(char *buf, size_t len, time_t start)
+{
+	struct tm tm;
+
+	gmtime_r(&start, &tm);
+	strftime(buf, len, "%Y%m%dT%H", &tm);
+}
+
+static int parse_hour_name(const char *name, time_t *start)
+{
+	struct tm tm;
+
+	if (strlen(name) != 11)
+		return -EINVAL;
+
+	memset(&tm, 0, sizeof(tm));
+	if (sscanf(name, "%4d%2d%2dT%2d", &tm.tm_year, &tm.tm_mon,
+		   &tm.tm_mday, &tm.tm_hour) != 4)
+		return -EINVAL;
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+
+	*start = timegm(&tm);
+	return 0;
+}
+
+static int part_path(char *buf, size_t len, const char *dir, time_t start,
+		     int bts_nr, int create)
+{
+	char hour[16];
+
+	part_hour_name(hour, sizeof(hour), start);
+
+	snprintf(buf, len, "%s/%s", dir, hour);
+	if (create && mkdir(buf, 0755) != 0 && errno != EEXIST)
+		return -errno;
+
+	snprintf(buf, len, "%s/%s/bts%d", dir, hour, bts_nr);
+	if (create && mkdir(buf, 0755) != 0 && errno != EEXIST)
+		return -errno;
+
+	return 0;
+}
+
+static int write_all(int fd, const uint8_t *buf, size_t len, off_t off)
+{
+	ssize_t rc;
+
+	while (len > 0) {
+		rc = pwrite(fd, buf, len, off);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0)
+			return rc < 0 ? -errno : -EIO;
+		buf += rc;
+		len -= rc;
+		off += rc;
+	}
+	return 0;
+}
+
+/*
+ * Append the buffered rows to all columns or to none. The files are
+ * first cut to the shortest column, so rows a crashed writer left in
+ * some columns only are dropped, and a failed write is cut off again.
+ * The buffered rows are dropped on error, so the buffer never overruns
+ * and the columns stay aligned.
+ */
+static int part_flush(struct meas_arch *arch, struct arch_part *part)
+{
+	char path[PATH_MAX], fname[PATH_MAX];
+	int fd[_NUM_MEAS_ARCH_COL];
+	struct stat st;
+	size_t disk_rows = SIZE_MAX, rows;
+	unsigned int i;
+	int rc = 0;
+
+	if (part->rows == 0)
+		return 0;
+
+	for (i = 0; i < _NUM_MEAS_ARCH_COL; i++)
+		fd[i] = -1;
+
+	rc = part_path(path, sizeof(path), arch->dir, part->start,
+		       part->bts_nr, 1);
+	if (rc < 0)
+		goto out;
+
+	for (i = 0; i < _NUM_MEAS_ARCH_COL; i++) {
+		snprintf(fname, sizeof(fname), "%s/%s", path,
+			 meas_arch_cols[i].name);
+		fd[i] = open(fname, O_RDWR | O_CREAT, 0644);
+		if (fd[i] < 0 || fstat(fd[i], &st) != 0) {
+			rc = -errno;
+			goto out;
+		}
+
+		rows = st.st_size / meas_arch_cols[i].width;
+		if (rows < disk_rows)
+			disk_rows = rows;
+	}
+
+	for (i = 0; i < _NUM_MEAS_ARCH_COL; i++) {
+		if (ftruncate(fd[i], disk_rows * meas_arch_cols[i].width) != 0) {
+			rc = -errno;
+			break;
+		}
+		rc = write_all(fd[i], part->col[i],
+			       part->rows * meas_arch_cols[i].width,
+			       disk_rows * meas_arch_cols[i].width);
+		if (rc < 0)
+			break;
+	}
+
+out:
+	for (i = 0; i < _NUM_MEAS_ARCH_COL; i++) {
+		if (fd[i] < 0)
+			continue;
+		if (rc < 0 && disk_rows != SIZE_MAX &&
+		    ftruncate(fd[i], disk_rows * meas_arch_cols[i].width) != 0)
+			fprintf(stderr, "Unable to cut %s/%s back: %s\n", path,
+				meas_arch_cols[i].name, strerror(errno));
+		close(fd[i]);
+	}
+
+	if (rc < 0)
+		fprintf(stderr, "Dropping %u reports for %s: %s\n",
+			part->rows, path, strerror(-rc));
+	part->rows = 0;
+	return rc;
+}
+
+static void part_free(struct arch_part *part)
+{
+	llist_del(&part->entry);
+	talloc_free(part);
+}
+
+static struct arch_part *part_get(struct meas_arch *arch, time_t start,
+				  uint8_t bts_nr)
+{
+	struct arch_part *part, *tmp;
+	int i;
+
+	llist_for_each_entry(part, &arch->parts, entry)
+		if (part->start == start && part->bts_nr == bts_nr)
+			return part;
+
+	/* reports arrive roughly in order, an hour that is over is done */
+	llist_for_each_entry_safe(part, tmp, &arch->parts, entry) {
+		if (part->start + 2 * MEAS_ARCH_PART_SECS > start)
+			continue;
+		part_flush(arch, part);
+		part_free(part);
+	}
+
+	part = talloc_zero(arch, struct arch_part);
+	if (!part)
+		return NULL;
+
+	part->start = start;
+	part->bts_nr = bts_nr;
+	for (i = 0; i < _NUM_MEAS_ARCH_COL; i++) {
+		part->col[i] = talloc_size(part,
+				ARCH_BUF_ROWS * meas_arch_cols[i].width);
+		if (!part->col[i]) {
+			talloc_free(part);
+			return NULL;
+		}
+	}
+
+	llist_add(&part->entry, &arch->parts);
+	return part;
+}
+
+struct meas_arch *meas_arch_open(void *ctx, const char *dir)
+{
+	struct meas_arch *arch;
+
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Unable to create %s: %s\n",
+			dir, strerror(errno));
+		return NULL;
+	}
+
+	arch = talloc_zero(ctx, struct meas_arch);
+	if (!arch)
+		return NULL;
+
+	arch->dir = talloc_strdup(arch, dir);
+	INIT_LLIST_HEAD(&arch->parts);
+	return arch;
+}
+
+#define PUT(part, c, type, val)						\
+	((type *) (part)->col[c])[(part)->rows] = (val)
+
+int meas_arch_append(struct meas_arch *arch, time_t t,
+		     const struct meas_feed_meas *mfm)
+{
+	const struct gsm_meas_rep *mr = &mfm->mr;
+	struct arch_part *part;
+
+	part = part_get(arch, t - t % MEAS_ARCH_PART_SECS, mfm->bts_nr);
+	if (!part)
+		return -ENOMEM;
+	if (part->rows >= ARCH_BUF_ROWS)
+		return -ENOSPC;
+
+	PUT(part, MEAS_ARCH_COL_TIME, uint32_t, t);
+	PUT(part, MEAS_ARCH_COL_IMSI, uint64_t, strtoull(mfm->imsi, NULL, 10));
+	PUT(part, MEAS_ARCH_COL_CHAN, uint16_t,
+	    mfm->trx_nr << 8 | (mfm->ts_nr & 7) << 3 | (mfm->ss_nr & 7));
+	PUT(part, MEAS_ARCH_COL_UL_RXLEV, uint8_t, mr->ul.full.rx_lev);
+	PUT(part, MEAS_ARCH_COL_UL_RXQUAL, uint8_t, mr->ul.full.rx_qual);
+	if (mr->flags & MEAS_REP_F_DL_VALID) {
+		PUT(part, MEAS_ARCH_COL_DL_RXLEV, uint8_t, mr->dl.full.rx_lev);
+		PUT(part, MEAS_ARCH_COL_DL_RXQUAL, uint8_t, mr->dl.full.rx_qual);
+	} else {
+		PUT(part, MEAS_ARCH_COL_DL_RXLEV, uint8_t, MEAS_ARCH_INVALID);
+		PUT(part, MEAS_ARCH_COL_DL_RXQUAL, uint8_t, MEAS_ARCH_INVALID);
+	}
+	PUT(part, MEAS_ARCH_COL_BS_POWER, uint8_t, mr->bs_power);
+	if (mr->flags & MEAS_REP_F_MS_L1) {
+		PUT(part, MEAS_ARCH_COL_MS_TA, uint8_t, mr->ms_l1.ta);
+		PUT(part, MEAS_ARCH_COL_MS_PWR, int8_t, mr->ms_l1.pwr);
+	} else {
+		PUT(part, MEAS_ARCH_COL_MS_TA, uint8_t, MEAS_ARCH_INVALID);
+		PUT(part, MEAS_ARCH_COL_MS_PWR, int8_t, INT8_MAX);
+	}
+
+	if (++part->rows == ARCH_BUF_ROWS)
+		return part_flush(arch, part);
+	return 0;
+}
+
+int meas_arch_flush(struct meas_arch *arch)
+{
+	struct arch_part *part;
+	int rc, ret = 0;
+
+	llist_for_each_entry(part, &arch->parts, entry) {
+		rc = part_flush(arch, part);
+		if (rc < 0)
+			ret = rc;
+	}
+
+	return ret;
+}
+
+void meas_arch_close(struct meas_arch *arch)
+{
+	if (meas_arch_flush(arch) < 0)
+		fprintf(stderr, "Unable to write the last reports to %s\n",
+			arch->dir);
+	talloc_free(arch);
+}
+
+static int hour_filter(const struct dirent *d)
+{
+	time_t start;
+
+	return parse_hour_name(d->d_name, &start) == 0;
+}
+
+static int bts_filter(const struct dirent *d)
+{
+	return strncmp(d->d_name, "bts", 3) == 0;
+}
+
+/* Call cb for the partitions that overlap [from, to) in time order */
+int meas_arch_scan(const char *dir, time_t from, time_t to, int bts_nr,
+		   meas_arch_part_cb cb, void *data)
+{
+	struct dirent **hours, **btss;
+	char path[PATH_MAX];
+	time_t start;
+	int num_hours, num_btss, i, j, nr, rc = 0;
+
+	/* the names sort in time order */
+	num_hours = scandir(dir, &hours, hour_filter, alphasort);
+	if (num_hours < 0)
+		return -errno;
+
+	for (i = 0; i < num_hours; i++) {
+		parse_hour_name(hours[i]->d_name, &start);
+		if (rc < 0 || (from && start + MEAS_ARCH_PART_SECS <= from) ||
+		    (to && start >= to))
+			goto next_hour;
+
+		snprintf(path, sizeof(path), "%s/%s", dir, hours[i]->d_name);
+		num_btss = scandir(path, &btss, bts_filter, alphasort);
+		if (num_btss < 0)
+			goto next_hour;
+
+		for (j = 0; j < num_btss; j++) {
+			nr = atoi(btss[j]->d_name + 3);
+			if (rc >= 0 && (bts_nr < 0 || nr == bts_nr)) {
+				part_path(path, sizeof(path), dir, start,
+					  nr, 0);
+				rc = cb(path, start, nr, data);
+			}
+			free(btss[j]);
+		}
+		free(btss);
+next_hour:
+		free(hours[i]);
+	}
+	free(hours);
+
+	return rc;
+}
+
+int meas_arch_part_map(struct meas_arch_part *part, const char *path,
+		       const int *cols, unsigned int num_cols)
+{
+	char fname[PATH_MAX];
+	struct stat st;
+	unsigned int i;
+	size_t rows;
+	int c, fd;
+
+	memset(part, 0, sizeof(*part));
+	part->rows = SIZE_MAX;
+
+	for (i = 0; i < num_cols; i++) {
+		c = cols[i];
+		snprintf(fname, sizeof(fname), "%s/%s", path,
+			 meas_arch_cols[c].name);
+		fd = open(fname, O_RDONLY);
+		if (fd < 0)
+			goto err;
+		if (fstat(fd, &st) != 0) {
+			close(fd);
+			goto err;
+		}
+
+		rows = st.st_size / meas_arch_cols[c].width;
+		if (rows < part->rows)
+			part->rows = rows;
+		if (st.st_size > 0) {
+			part->col[c] = mmap(NULL, st.st_size, PROT_READ,
+					    MAP_SHARED, fd, 0);
+			if (part->col[c] == MAP_FAILED) {
+				part->col[c] = NULL;
+				close(fd);
+				goto err;
+			}
+			part->len[c] = st.st_size;
+		}
+		close(fd);
+	}
+
+	if (part->rows == SIZE_MAX)
+		part->rows = 0;
+	return 0;
+
+err:
+	meas_arch_part_unmap(part);
+	return -errno;
+}
+
+void meas_arch_part_unmap(struct meas_arch_part *part)
+{
+	int i;
+
+	for (i = 0; i < _NUM_MEAS_ARCH_COL; i++) {
+		if (part->col[i])
+			munmap((void *) part->col[i], part->len[i]);
+		part->col[i] = NULL;
+		part->len[i] = 0;
+	}
+	part->rows = 0;
+}
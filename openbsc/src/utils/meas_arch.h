@@ -0,0 +1,73 @@
+#ifndef OPENBSC_MEAS_ARCH_H
+#define OPENBSC_MEAS_ARCH_H
+
+#include <stdint.h>
+#include <time.h>
+
+struct meas_feed_meas;
+struct meas_arch;
+
+/*
+ * The archive is a directory with one directory per hour, named
+ * YYYYMMDDTHH in UTC, and below that one directory per BTS, named
+ * btsN. A partition holds one append-only file per column, so a
+ * query only reads the hours, cells and columns it asks for.
+ */
+#define MEAS_ARCH_PART_SECS	3600
+
+enum meas_arch_col {
+	MEAS_ARCH_COL_TIME,		/* uint32_t, seconds since the epoch */
+	MEAS_ARCH_COL_IMSI,		/* uint64_t, 0 if unknown */
+	MEAS_ARCH_COL_CHAN,		/* uint16_t, trx << 8 | ts << 3 | ss */
+	MEAS_ARCH_COL_UL_RXLEV,		/* uint8_t, full set */
+	MEAS_ARCH_COL_UL_RXQUAL,	/* uint8_t, full set */
+	MEAS_ARCH_COL_DL_RXLEV,		/* uint8_t, full set */
+	MEAS_ARCH_COL_DL_RXQUAL,	/* uint8_t, full set */
+	MEAS_ARCH_COL_BS_POWER,		/* uint8_t */
+	MEAS_ARCH_COL_MS_TA,		/* uint8_t */
+	MEAS_ARCH_COL_MS_PWR,		/* int8_t, dBm, INT8_MAX if unknown */
+	_NUM_MEAS_ARCH_COL
+};
+
+/* an unsigned value that was not part of the report */
+#define MEAS_ARCH_INVALID	0xff
+
+struct meas_arch_col_desc {
+	const char *name;
+	unsigned int width;
+	int is_signed;
+};
+
+extern const struct meas_arch_col_desc meas_arch_cols[_NUM_MEAS_ARCH_COL];
+
+int meas_arch_col_by_name(const char *name);
+
+/* writing */
+struct meas_arch *meas_arch_open(void *ctx, const char *dir);
+int meas_arch_append(struct meas_arch *arch, time_t t,
+		     const struct meas_feed_meas *mfm);
+int meas_arch_flush(struct meas_arch *arch);
+void meas_arch_close(struct meas_arch *arch);
+
+/* reading */
+typedef int (*meas_arch_part_cb)(const char *path, time_t start,
+				 int bts_nr, void *data);
+int meas_arch_scan(const char *dir, time_t from, time_t to, int bts_nr,
+		   meas_arch_part_cb cb, void *data);
+
+/*
+ * Map the columns of a partition read-only. The number of rows is that
+ * of the shortest column, a writer may have been interrupted between
+ * two columns.
+ */
+struct meas_arch_part {
+	size_t rows;
+	const void *col[_NUM_MEAS_ARCH_COL];
+	size_t len[_NUM_MEAS_ARCH_COL];
+};
+
+int meas_arch_part_map(struct meas_arch_part *part, const char *path,
+		       const int *cols, unsigned int num_cols);
+void meas_arch_part_unmap(struct meas_arch_part *part);
+
+#endif
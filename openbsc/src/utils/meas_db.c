@@ -22,6 +22,7 @@
 #include <stdint.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 
 #include <sqlite3.h>
 
@@ -41,6 +42,20 @@ struct meas_db_state {
 	sqlite3_stmt *stmt_ins_ud;
 	sqlite3_stmt *stmt_ins_mr;
 	sqlite3_stmt *stmt_upd_mr;
+
+	/* a transaction opened by meas_db_begin() */
+	int in_user_txn;
+
+	/*
+	 * Reports are grouped into transactions of max_reports or
+	 * max_ms, whichever comes first. Zero for both means one
+	 * transaction per report.
+	 */
+	unsigned int max_reports;
+	unsigned int max_ms;
+	int in_batch;
+	unsigned int batch_reports;
+	struct timespec batch_start;
 };
 
 /* macros to check for SQLite3 result codes */
@@ -80,6 +95,106 @@ err_io:
 	exit(1);
 }
 
+static unsigned int batch_age_ms(struct meas_db_state *st)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - st->batch_start.tv_sec) * 1000 +
+		(now.tv_nsec - st->batch_start.tv_nsec) / 1000000;
+}
+
+static int batch_open(struct meas_db_state *st)
+{
+	if (st->in_user_txn || st->in_batch)
+		return 0;
+	if (!st->max_reports && !st->max_ms)
+		return 0;
+
+	SCK_OK(st->db, sqlite3_exec(st->db, "BEGIN", NULL, NULL, NULL));
+	st->in_batch = 1;
+	st->batch_reports = 0;
+	clock_gettime(CLOCK_MONOTONIC, &st->batch_start);
+	return 0;
+
+err_io:
+	return -EIO;
+}
+
+static int batch_report(struct meas_db_state *st)
+{
+	if (!st->in_batch)
+		return 0;
+
+	st->batch_reports += 1;
+	if (st->max_reports && st->batch_reports >= st->max_reports)
+		return meas_db_flush(st);
+	if (st->max_ms && batch_age_ms(st) >= st->max_ms)
+		return meas_db_flush(st);
+	return 0;
+}
+
+/* Commit the reports of the current batch, if there are any */
+int meas_db_flush(struct meas_db_state *st)
+{
+	if (!st->in_batch)
+		return 0;
+
+	SCK_OK(st->db, sqlite3_exec(st->db, "COMMIT", NULL, NULL, NULL));
+	st->in_batch = 0;
+	return 0;
+
+err_io:
+	/* A busy database keeps the transaction open and the next report
+	 * tries again, other errors may have rolled it back already. */
+	if (sqlite3_get_autocommit(st->db))
+		st->in_batch = 0;
+	return -EIO;
+}
+
+void meas_db_set_batch(struct meas_db_state *st, unsigned int max_reports,
+		       unsigned int max_ms)
+{
+	st->max_reports = max_reports;
+	st->max_ms = max_ms;
+}
+
+static const char *sync_pragmas[] = {
+	[MEAS_DB_SYNC_OFF]	= "PRAGMA synchronous = OFF",
+	[MEAS_DB_SYNC_NORMAL]	= "PRAGMA synchronous = NORMAL",
+	[MEAS_DB_SYNC_FULL]	= "PRAGMA synchronous = FULL",
+};
+
+/*
+ * With WAL and NORMAL a crash can lose the last transactions but not
+ * corrupt the database, which is what a bulk import usually wants.
+ */
+int meas_db_set_durability(struct meas_db_state *st, enum meas_db_sync sync,
+			   int wal)
+{
+	if (wal)
+		SCK_OK(st->db, sqlite3_exec(st->db, "PRAGMA journal_mode = WAL",
+					    NULL, NULL, NULL));
+	if (sync != MEAS_DB_SYNC_DEFAULT)
+		SCK_OK(st->db, sqlite3_exec(st->db, sync_pragmas[sync],
+					    NULL, NULL, NULL));
+	return 0;
+
+err_io:
+	return -EIO;
+}
+
+int meas_db_parse_sync(const char *str)
+{
+	if (!strcmp(str, "off"))
+		return MEAS_DB_SYNC_OFF;
+	if (!strcmp(str, "normal"))
+		return MEAS_DB_SYNC_NORMAL;
+	if (!strcmp(str, "full"))
+		return MEAS_DB_SYNC_FULL;
+	return -EINVAL;
+}
+
 /* insert a measurement report into the database */
 int meas_db_insert(struct meas_db_state *st, const char *imsi,
 		   const char *name, unsigned long timestamp,
@@ -89,6 +204,9 @@ int meas_db_insert(struct meas_db_state *st, const char *imsi,
 	int rc;
 	sqlite3_int64 rowid, ul_rowid, dl_rowid;
 
+	if (batch_open(st) < 0)
+		goto err_io;
+
 	SCK_OK(st->db, sqlite3_bind_int(st->stmt_ins_mr, 1, timestamp));
 
 	if (imsi)
@@ -155,7 +273,7 @@ int meas_db_insert(struct meas_db_state *st, const char *imsi,
 	SCK_DONE(st->db, sqlite3_step(st->stmt_upd_mr));
 	SCK_OK(st->db, sqlite3_reset(st->stmt_upd_mr));
 
-	return 0;
+	return batch_report(st);
 
 err_io:
 	return -EIO;
@@ -163,7 +281,10 @@ err_io:
 
 int meas_db_begin(struct meas_db_state *st)
 {
+	if (meas_db_flush(st) < 0)
+		goto err_io;
 	SCK_OK(st->db, sqlite3_exec(st->db, "BEGIN", NULL, NULL, NULL));
+	st->in_user_txn = 1;
 
 	return 0;
 
@@ -173,6 +294,7 @@ err_io:
 
 int meas_db_commit(struct meas_db_state *st)
 {
+	st->in_user_txn = 0;
 	SCK_OK(st->db, sqlite3_exec(st->db, "COMMIT", NULL, NULL, NULL));
 
 	return 0;
@@ -314,6 +436,13 @@ err_io:
 
 void meas_db_close(struct meas_db_state *st)
 {
+	if (meas_db_flush(st) < 0) {
+		fprintf(stderr, "Unable to commit the last reports: %s\n",
+			sqlite3_errmsg(st->db));
+		if (st->in_batch)
+			sqlite3_exec(st->db, "ROLLBACK", NULL, NULL, NULL);
+		st->in_batch = 0;
+	}
 	if (sqlite3_finalize(st->stmt_ins_mr) != SQLITE_OK)
 		fprintf(stderr, "DB insert measurement report finalize error: %s\n",
 			sqlite3_errmsg(st->db));
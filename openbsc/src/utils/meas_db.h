@@ -3,12 +3,27 @@
 
 struct meas_db_state;
 
+/* what a commit waits for, see PRAGMA synchronous */
+enum meas_db_sync {
+	MEAS_DB_SYNC_DEFAULT,
+	MEAS_DB_SYNC_OFF,
+	MEAS_DB_SYNC_NORMAL,
+	MEAS_DB_SYNC_FULL,
+};
+
 struct meas_db_state *meas_db_open(void *ctx, const char *fname);
 void meas_db_close(struct meas_db_state *st);
 
 int meas_db_begin(struct meas_db_state *st);
 int meas_db_commit(struct meas_db_state *st);
 
+int meas_db_set_durability(struct meas_db_state *st, enum meas_db_sync sync,
+			   int wal);
+int meas_db_parse_sync(const char *str);
+void meas_db_set_batch(struct meas_db_state *st, unsigned int max_reports,
+		       unsigned int max_ms);
+int meas_db_flush(struct meas_db_state *st);
+
 int meas_db_insert(struct meas_db_state *st, const char *imsi,
 		   const char *name, unsigned long timestamp,
 		   const char *scenario,
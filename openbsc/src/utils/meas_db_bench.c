@@ -0,0 +1,148 @@
+/* bulk-load benchmark for the measurement report database */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Inserts synthetic reports the way osmo-meas-pcap2db and
+ * osmo-meas-udp2db do and prints the rate, e.g.
+ *
+ *   meas_db_bench -n 100000 -b 1000 -s normal -w /tmp/bench.sqlite3
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <getopt.h>
+
+#include <openbsc/meas_rep.h>
+
+#include "meas_db.h"
+
+static void fake_meas_rep(struct gsm_meas_rep *mr, unsigned int i)
+{
+	memset(mr, 0, sizeof(*mr));
+	mr->nr = i & 0xff;
+	mr->flags = MEAS_REP_F_MS_TO | MEAS_REP_F_MS_L1;
+	if (i & 1)
+		mr->flags |= MEAS_REP_F_DL_VALID;
+	mr->ul.full.rx_lev = i % 64;
+	mr->ul.sub.rx_lev = (i + 1) % 64;
+	mr->ul.full.rx_qual = i % 8;
+	mr->ul.sub.rx_qual = (i + 1) % 8;
+	mr->dl = mr->ul;
+	mr->bs_power = i % 16;
+	mr->ms_timing_offset = i % 64;
+	mr->ms_l1.pwr = 33;
+	mr->ms_l1.ta = i % 64;
+}
+
+static void print_help(void)
+{
+	printf("Usage: meas_db_bench [OPTIONS] DB_FILE\n");
+	printf("  -n --reports N      Reports to insert (default 10000)\n");
+	printf("  -b --batch N        Reports per transaction, 0 for one each\n");
+	printf("  -s --sync MODE      off, normal or full\n");
+	printf("  -w --wal            Use the write-ahead log\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct meas_db_state *db;
+	struct gsm_meas_rep mr;
+	struct timespec start, end;
+	unsigned int i, num = 10000, batch = 0;
+	int sync = MEAS_DB_SYNC_DEFAULT, wal = 0;
+	char imsi[16];
+	double secs;
+
+	while (1) {
+		int option_index = 0, c;
+		static const struct option long_options[] = {
+			{ "reports", 1, 0, 'n' },
+			{ "batch", 1, 0, 'b' },
+			{ "sync", 1, 0, 's' },
+			{ "wal", 0, 0, 'w' },
+			{ "help", 0, 0, 'h' },
+			{ 0, 0, 0, 0 }
+		};
+
+		c = getopt_long(argc, argv, "n:b:s:wh",
+				long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'n':
+			num = atoi(optarg);
+			break;
+		case 'b':
+			batch = atoi(optarg);
+			break;
+		case 's':
+			sync = meas_db_parse_sync(optarg);
+			if (sync < 0) {
+				fprintf(stderr, "Unknown sync mode %s\n", optarg);
+				exit(2);
+			}
+			break;
+		case 'w':
+			wal = 1;
+			break;
+		case 'h':
+			print_help();
+			exit(0);
+		default:
+			print_help();
+			exit(2);
+		}
+	}
+
+	if (argc - optind < 1) {
+		print_help();
+		exit(2);
+	}
+
+	db = meas_db_open(NULL, argv[optind]);
+	if (!db)
+		exit(1);
+	if (meas_db_set_durability(db, sync, wal) < 0)
+		exit(1);
+	meas_db_set_batch(db, batch, 0);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < num; i++) {
+		/* a few hundred subscribers reporting in turn */
+		snprintf(imsi, sizeof(imsi), "90170%010u", i % 300);
+		fake_meas_rep(&mr, i);
+		if (meas_db_insert(db, imsi, NULL, 1500000000 + i / 300,
+				   NULL, &mr) < 0) {
+			fprintf(stderr, "Insert %u failed\n", i);
+			exit(1);
+		}
+	}
+	meas_db_close(db);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = (end.tv_sec - start.tv_sec) +
+		(end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%u reports, batch %u: %.3f s, %.0f reports/s\n",
+	       num, batch, secs, secs > 0 ? num / secs : 0.0);
+
+	return 0;
+}
@@ -24,6 +24,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <getopt.h>
 
 #include <netinet/in.h>
 #include <netinet/ip.h>
@@ -41,8 +42,10 @@
 #include <pcap/pcap.h>
 
 #include "meas_db.h"
+#include "meas_arch.h"
 
 static struct meas_db_state *db;
+static struct meas_arch *arch;
 
 static void handle_mfm(const struct pcap_pkthdr *h,
 		       const struct meas_feed_meas *mfm)
@@ -54,8 +57,11 @@ static void handle_mfm(const struct pcap_pkthdr *h,
 	else
 		scenario = NULL;
 
-	meas_db_insert(db, mfm->imsi, mfm->name, h->ts.tv_sec,
-			scenario, &mfm->mr);
+	if (db)
+		meas_db_insert(db, mfm->imsi, mfm->name, h->ts.tv_sec,
+				scenario, &mfm->mr);
+	if (arch)
+		meas_arch_append(arch, h->ts.tv_sec, mfm);
 }
 
 static void pcap_cb(u_char *user, const struct pcap_pkthdr *h,
@@ -90,29 +96,88 @@ static void pcap_cb(u_char *user, const struct pcap_pkthdr *h,
 		return;
 
 	udplen = ntohs(udp->len);
-	if (udplen != sizeof(*udp) + sizeof(*mfm))
+	if (udplen < sizeof(*udp) + sizeof(*mfm) ||
+	    (udplen - sizeof(*udp)) % sizeof(*mfm) != 0)
+		return;
+	if (h->caplen < cur - (const char *) bytes + udplen)
 		return;
 	cur += sizeof(*udp);
+	udplen -= sizeof(*udp);
 
-	mfm = (const struct meas_feed_meas *) cur;
+	/* a datagram carries one or more records */
+	for (; udplen > 0; udplen -= sizeof(*mfm), cur += sizeof(*mfm)) {
+		mfm = (const struct meas_feed_meas *) cur;
+		handle_mfm(h, mfm);
+	}
+}
 
-	handle_mfm(h, mfm);
+static void print_help(void)
+{
+	printf("Usage: osmo-meas-pcap2db [OPTIONS] PCAP_FILE DB_FILE\n");
+	printf("  -b --batch N        Reports per transaction (default 10000)\n");
+	printf("  -s --sync MODE      off, normal or full\n");
+	printf("  -w --wal            Use the write-ahead log\n");
+	printf("  -a --archive DIR    Also append to a columnar archive\n");
+	printf("DB_FILE may be - to only write the archive\n");
 }
 
 int main(int argc, char **argv)
 {
 	char errbuf[PCAP_ERRBUF_SIZE+1];
-	char *pcap_fname, *db_fname;
+	char *pcap_fname, *db_fname, *arch_dir = NULL;
+	unsigned int batch = 10000;
+	int sync = MEAS_DB_SYNC_DEFAULT, wal = 0;
 	pcap_t *pc;
-	int rc;
 
-	if (argc < 3) {
+	while (1) {
+		int option_index = 0, c;
+		static const struct option long_options[] = {
+			{ "batch", 1, 0, 'b' },
+			{ "sync", 1, 0, 's' },
+			{ "wal", 0, 0, 'w' },
+			{ "archive", 1, 0, 'a' },
+			{ "help", 0, 0, 'h' },
+			{ 0, 0, 0, 0 }
+		};
+
+		c = getopt_long(argc, argv, "b:s:wa:h",
+				long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'b':
+			batch = atoi(optarg);
+			break;
+		case 's':
+			sync = meas_db_parse_sync(optarg);
+			if (sync < 0) {
+				fprintf(stderr, "Unknown sync mode %s\n", optarg);
+				exit(2);
+			}
+			break;
+		case 'w':
+			wal = 1;
+			break;
+		case 'a':
+			arch_dir = optarg;
+			break;
+		case 'h':
+			print_help();
+			exit(0);
+		default:
+			print_help();
+			exit(2);
+		}
+	}
+
+	if (argc - optind < 2) {
 		fprintf(stderr, "You need to specify PCAP and database file\n");
 		exit(2);
 	}
 
-	pcap_fname = argv[1];
-	db_fname = argv[2];
+	pcap_fname = argv[optind];
+	db_fname = argv[optind + 1];
 
 	pc = pcap_open_offline(pcap_fname, errbuf);
 	if (!pc) {
@@ -120,19 +185,31 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	db = meas_db_open(NULL, db_fname);
-	if (!db)
-		exit(0);
+	if (strcmp(db_fname, "-")) {
+		db = meas_db_open(NULL, db_fname);
+		if (!db)
+			exit(0);
 
-	rc = meas_db_begin(db);
-	if (rc < 0) {
-		fprintf(stderr, "Error during BEGIN\n");
-		exit(1);
+		if (meas_db_set_durability(db, sync, wal) < 0)
+			exit(1);
+		/* bounded transactions keep the journal small on big captures */
+		meas_db_set_batch(db, batch, 0);
+	}
+
+	if (arch_dir) {
+		arch = meas_arch_open(NULL, arch_dir);
+		if (!arch) {
+			fprintf(stderr, "Unable to open archive %s\n", arch_dir);
+			exit(1);
+		}
 	}
 
 	pcap_loop(pc, 0 , pcap_cb, NULL);
 
-	meas_db_commit(db);
+	if (arch)
+		meas_arch_close(arch);
+	if (db)
+		meas_db_close(db);
 
 	exit(0);
 }
@@ -0,0 +1,338 @@
+/* query the columnar archive of measurement reports */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <getopt.h>
+
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+
+#include "meas_arch.h"
+
+enum query_mode {
+	QUERY_HIST,
+	QUERY_SERIES,
+};
+
+struct series_bucket {
+	uint64_t count;
+	int64_t sum;
+	int min, max;
+};
+
+struct query {
+	enum query_mode mode;
+	int col;
+	uint64_t imsi;
+	time_t from, to;
+	unsigned int step;
+
+	/* QUERY_HIST, indexed by the raw byte of the column */
+	uint64_t hist[256];
+
+	/* QUERY_SERIES, buckets of step seconds from base */
+	time_t base;
+	struct series_bucket *buckets;
+	unsigned int num_buckets;
+};
+
+static int col_value(const struct query *q, const struct meas_arch_part *part,
+		     size_t row, int *val)
+{
+	const uint8_t *col = part->col[q->col];
+
+	if (meas_arch_cols[q->col].is_signed) {
+		if ((int8_t) col[row] == INT8_MAX)
+			return 0;
+		*val = (int8_t) col[row];
+	} else {
+		if (col[row] == MEAS_ARCH_INVALID)
+			return 0;
+		*val = col[row];
+	}
+	return 1;
+}
+
+static int series_add(struct query *q, time_t t, int val)
+{
+	struct series_bucket *b;
+	unsigned int idx, num;
+
+	idx = (t - q->base) / q->step;
+	if (idx >= q->num_buckets) {
+		num = idx + 1 > 2 * q->num_buckets ? idx + 1 : 2 * q->num_buckets;
+		b = talloc_realloc(NULL, q->buckets, struct series_bucket, num);
+		if (!b)
+			return -ENOMEM;
+		memset(&b[q->num_buckets], 0,
+		       (num - q->num_buckets) * sizeof(*b));
+		q->buckets = b;
+		q->num_buckets = num;
+	}
+
+	b = &q->buckets[idx];
+	if (b->count == 0 || val < b->min)
+		b->min = val;
+	if (b->count == 0 || val > b->max)
+		b->max = val;
+	b->count += 1;
+	b->sum += val;
+	return 0;
+}
+
+static int query_part(const char *path, time_t start, int bts_nr, void *data)
+{
+	struct query *q = data;
+	struct meas_arch_part part;
+	const uint32_t *times;
+	const uint64_t *imsis;
+	int cols[3], num_cols = 0;
+	size_t i;
+	int rc, val;
+
+	cols[num_cols++] = MEAS_ARCH_COL_TIME;
+	cols[num_cols++] = q->col;
+	if (q->imsi)
+		cols[num_cols++] = MEAS_ARCH_COL_IMSI;
+
+	rc = meas_arch_part_map(&part, path, cols, num_cols);
+	if (rc < 0) {
+		fprintf(stderr, "Skipping %s: %s\n", path, strerror(-rc));
+		return 0;
+	}
+
+	/* the scan is in time order, the first partition starts the series */
+	if (q->mode == QUERY_SERIES && !q->base)
+		q->base = q->from ? q->from : start;
+
+	times = part.col[MEAS_ARCH_COL_TIME];
+	imsis = part.col[MEAS_ARCH_COL_IMSI];
+
+	for (i = 0; i < part.rows; i++) {
+		if (q->from && times[i] < q->from)
+			continue;
+		if (q->to && times[i] >= q->to)
+			continue;
+		if (q->imsi && imsis[i] != q->imsi)
+			continue;
+		if (!col_value(q, &part, i, &val))
+			continue;
+
+		if (q->mode == QUERY_HIST)
+			q->hist[(uint8_t) val] += 1;
+		else if (times[i] >= q->base && series_add(q, times[i], val) < 0)
+			break;
+	}
+
+	meas_arch_part_unmap(&part);
+	return 0;
+}
+
+static void print_hist(const struct query *q)
+{
+	uint64_t total = 0;
+	int64_t sum = 0;
+	int i, val;
+
+	for (i = 0; i < 256; i++) {
+		val = meas_arch_cols[q->col].is_signed ? (int8_t) i : i;
+		total += q->hist[i];
+		sum += q->hist[i] * val;
+	}
+
+	printf("# %s value, count, percent\n", meas_arch_cols[q->col].name);
+	for (i = 0; i < 256; i++) {
+		/* signed columns from the lowest value up */
+		int idx = meas_arch_cols[q->col].is_signed ? (i + 128) & 0xff : i;
+
+		if (!q->hist[idx])
+			continue;
+		val = meas_arch_cols[q->col].is_signed ? (int8_t) idx : idx;
+		printf("%d %" PRIu64 " %.2f\n", val, q->hist[idx],
+		       100.0 * q->hist[idx] / total);
+	}
+	printf("# total %" PRIu64 ", mean %.2f\n", total,
+	       total ? (double) sum / total : 0.0);
+}
+
+static void print_series(const struct query *q)
+{
+	const struct series_bucket *b;
+	char tbuf[32];
+	struct tm tm;
+	time_t t;
+	unsigned int i;
+
+	printf("# time, count, mean, min, max of %s\n",
+	       meas_arch_cols[q->col].name);
+	for (i = 0; i < q->num_buckets; i++) {
+		b = &q->buckets[i];
+		if (!b->count)
+			continue;
+		t = q->base + (time_t) i * q->step;
+		gmtime_r(&t, &tm);
+		strftime(tbuf, sizeof(tbuf), "%Y-%m-%dT%H:%M:%SZ", &tm);
+		printf("%s %" PRIu64 " %.2f %d %d\n", tbuf, b->count,
+		       (double) b->sum / b->count, b->min, b->max);
+	}
+}
+
+static int parse_time(const char *str, time_t *t)
+{
+	struct tm tm;
+	char *end;
+
+	memset(&tm, 0, sizeof(tm));
+	end = strptime(str, "%Y-%m-%dT%H:%M", &tm);
+	if (end && *end == '\0') {
+		*t = timegm(&tm);
+		return 0;
+	}
+
+	*t = strtoul(str, &end, 10);
+	return *end == '\0' ? 0 : -EINVAL;
+}
+
+static void print_help(void)
+{
+	int i;
+
+	printf("Usage: osmo-meas-query [OPTIONS] ARCHIVE_DIR (hist|series)\n");
+	printf("  -b --bts NR         Only this BTS\n");
+	printf("  -i --imsi IMSI      Only this subscriber\n");
+	printf("  -f --from TIME      From YYYY-MM-DDTHH:MM (UTC) or epoch\n");
+	printf("  -t --to TIME        Up to, not including, TIME\n");
+	printf("  -c --column NAME    Column to evaluate (default ul_rxlev)\n");
+	printf("  -s --step SECS      Interval of a series (default 3600)\n");
+	printf("Columns:");
+	for (i = 0; i < _NUM_MEAS_ARCH_COL; i++)
+		if (i != MEAS_ARCH_COL_TIME && i != MEAS_ARCH_COL_IMSI &&
+		    i != MEAS_ARCH_COL_CHAN)
+			printf(" %s", meas_arch_cols[i].name);
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct query q;
+	int bts_nr = -1;
+	int rc;
+
+	memset(&q, 0, sizeof(q));
+	q.col = MEAS_ARCH_COL_UL_RXLEV;
+	q.step = 3600;
+
+	while (1) {
+		int option_index = 0, c;
+		static const struct option long_options[] = {
+			{ "bts", 1, 0, 'b' },
+			{ "imsi", 1, 0, 'i' },
+			{ "from", 1, 0, 'f' },
+			{ "to", 1, 0, 't' },
+			{ "column", 1, 0, 'c' },
+			{ "step", 1, 0, 's' },
+			{ "help", 0, 0, 'h' },
+			{ 0, 0, 0, 0 }
+		};
+
+		c = getopt_long(argc, argv, "b:i:f:t:c:s:h",
+				long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'b':
+			bts_nr = atoi(optarg);
+			break;
+		case 'i':
+			q.imsi = strtoull(optarg, NULL, 10);
+			break;
+		case 'f':
+			if (parse_time(optarg, &q.from) < 0) {
+				fprintf(stderr, "Invalid time %s\n", optarg);
+				exit(2);
+			}
+			break;
+		case 't':
+			if (parse_time(optarg, &q.to) < 0) {
+				fprintf(stderr, "Invalid time %s\n", optarg);
+				exit(2);
+			}
+			break;
+		case 'c':
+			q.col = meas_arch_col_by_name(optarg);
+			if (q.col < 0 || q.col == MEAS_ARCH_COL_TIME ||
+			    q.col == MEAS_ARCH_COL_IMSI ||
+			    q.col == MEAS_ARCH_COL_CHAN) {
+				fprintf(stderr, "Unknown column %s\n", optarg);
+				exit(2);
+			}
+			break;
+		case 's':
+			q.step = atoi(optarg);
+			if (q.step == 0) {
+				fprintf(stderr, "Invalid step %s\n", optarg);
+				exit(2);
+			}
+			break;
+		case 'h':
+			print_help();
+			exit(0);
+		default:
+			print_help();
+			exit(2);
+		}
+	}
+
+	if (argc - optind < 2) {
+		print_help();
+		exit(2);
+	}
+
+	if (!strcmp(argv[optind + 1], "hist"))
+		q.mode = QUERY_HIST;
+	else if (!strcmp(argv[optind + 1], "series"))
+		q.mode = QUERY_SERIES;
+	else {
+		print_help();
+		exit(2);
+	}
+
+	rc = meas_arch_scan(argv[optind], q.from, q.to, bts_nr,
+			    query_part, &q);
+	if (rc < 0) {
+		fprintf(stderr, "Unable to read %s: %s\n",
+			argv[optind], strerror(-rc));
+		exit(1);
+	}
+
+	if (q.mode == QUERY_HIST)
+		print_hist(&q);
+	else
+		print_series(&q);
+
+	talloc_free(q.buckets);
+	return 0;
+}
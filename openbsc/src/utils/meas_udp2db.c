@@ -25,13 +25,18 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <getopt.h>
 
 #include <netinet/in.h>
+#include <sys/mman.h>
 
 #include <osmocom/core/socket.h>
 #include <osmocom/core/utils.h>
 #include <osmocom/core/msgb.h>
 #include <osmocom/core/select.h>
+#include <osmocom/core/timer.h>
 #include <osmocom/core/talloc.h>
 
 #include <osmocom/gsm/gsm_utils.h>
@@ -39,21 +44,38 @@
 #include <openbsc/meas_feed.h>
 
 #include "meas_db.h"
+#include "meas_arch.h"
 
 static struct osmo_fd udp_ofd;
 static struct meas_db_state *db;
+static struct meas_arch *arch;
 
-static int handle_msg(struct msgb *msg)
+/* commit at least this often, also when the feed is idle */
+static struct osmo_timer_list flush_timer;
+static unsigned int flush_ms = 1000;
+
+/* polling the shared memory ring of the NITB instead of UDP */
+#define SHM_POLL_MS	100
+static const struct meas_feed_ring *ring;
+static struct osmo_timer_list ring_timer;
+static uint64_t ring_pos;
+
+/* set from the signal handler, the main loop shuts down */
+static volatile sig_atomic_t quit;
+
+static void signal_handler(int signal)
+{
+	quit = 1;
+}
+
+static int handle_meas(const struct meas_feed_meas *mfm, time_t now)
 {
-	struct meas_feed_hdr *mfh = (struct meas_feed_hdr *) msgb_data(msg);
-	struct meas_feed_meas *mfm = (struct meas_feed_meas *) msgb_data(msg);
 	const char *scenario;
-	time_t now = time(NULL);
 
-	if (mfh->version != MEAS_FEED_VERSION)
+	if (mfm->hdr.version != MEAS_FEED_VERSION)
 		return -EINVAL;
 
-	if (mfh->msg_type != MEAS_FEED_MEAS)
+	if (mfm->hdr.msg_type != MEAS_FEED_MEAS)
 		return -EINVAL;
 
 	if (strlen(mfm->scenario))
@@ -61,8 +83,28 @@ static int handle_msg(struct msgb *msg)
 	else
 		scenario = NULL;
 
-	meas_db_insert(db, mfm->imsi, mfm->name, now,
-			scenario, &mfm->mr);
+	if (db)
+		meas_db_insert(db, mfm->imsi, mfm->name, now,
+				scenario, &mfm->mr);
+	if (arch)
+		meas_arch_append(arch, now, mfm);
+
+	return 0;
+}
+
+/* a datagram carries one or more records */
+static int handle_msg(struct msgb *msg)
+{
+	const uint8_t *cur = msgb_data(msg);
+	unsigned int len = msgb_length(msg);
+	time_t now = time(NULL);
+
+	for (; len >= sizeof(struct meas_feed_meas);
+	     cur += sizeof(struct meas_feed_meas),
+	     len -= sizeof(struct meas_feed_meas)) {
+		if (handle_meas((const struct meas_feed_meas *) cur, now) != 0)
+			return -EINVAL;
+	}
 
 	return 0;
 }
@@ -72,11 +114,14 @@ static int udp_fd_cb(struct osmo_fd *ofd, unsigned int what)
 	int rc;
 
 	if (what & BSC_FD_READ) {
-		struct msgb *msg = msgb_alloc(1024, "UDP Rx");
+		struct msgb *msg = msgb_alloc(MEAS_FEED_MAX_BATCH *
+				sizeof(struct meas_feed_meas), "UDP Rx");
 
 		rc = read(ofd->fd, msgb_data(msg), msgb_tailroom(msg));
-		if (rc < 0)
+		if (rc < 0) {
+			msgb_free(msg);
 			return rc;
+		}
 		msgb_put(msg, rc);
 		handle_msg(msg);
 		msgb_free(msg);
@@ -85,42 +130,185 @@ static int udp_fd_cb(struct osmo_fd *ofd, unsigned int what)
 	return 0;
 }
 
+static void ring_timer_cb(void *data)
+{
+	struct meas_feed_meas mfm;
+	time_t now = time(NULL);
+	int rc;
+
+	while ((rc = meas_feed_ring_read(ring, &ring_pos, &mfm)) != 0) {
+		if (rc > 0)
+			handle_meas(&mfm, now);
+	}
+
+	osmo_timer_schedule(&ring_timer, 0, SHM_POLL_MS * 1000);
+}
+
+static int ring_open(const char *name)
+{
+	struct meas_feed_ring hdr;
+	void *map;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return -errno;
+	if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    !meas_feed_ring_valid(&hdr)) {
+		close(fd);
+		return -EINVAL;
+	}
+
+	map = mmap(NULL, meas_feed_ring_size(hdr.num_slots), PROT_READ,
+		   MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -ENOMEM;
+
+	ring = map;
+	ring_pos = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	ring_timer.cb = ring_timer_cb;
+	osmo_timer_schedule(&ring_timer, 0, SHM_POLL_MS * 1000);
+	return 0;
+}
+
+static void flush_timer_cb(void *data)
+{
+	if (db)
+		meas_db_flush(db);
+	if (arch)
+		meas_arch_flush(arch);
+	osmo_timer_schedule(&flush_timer, flush_ms / 1000,
+			    (flush_ms % 1000) * 1000);
+}
+
+static void print_help(void)
+{
+	printf("Usage: osmo-meas-udp2db [OPTIONS] DB_FILE [SHM_NAME]\n");
+	printf("  -b --batch N        Reports per transaction (default 500)\n");
+	printf("  -t --batch-time MS  Commit at least every MS ms (default 1000)\n");
+	printf("  -s --sync MODE      off, normal or full\n");
+	printf("  -w --wal            Use the write-ahead log\n");
+	printf("  -a --archive DIR    Also append to a columnar archive\n");
+	printf("DB_FILE may be - to only write the archive\n");
+}
+
 int main(int argc, char **argv)
 {
-	char *db_fname;
+	char *db_fname, *arch_dir = NULL;
+	unsigned int batch = 500;
+	int sync = MEAS_DB_SYNC_DEFAULT, wal = 0;
 	int rc;
 
 	msgb_talloc_ctx_init(NULL, 0);
 
-	if (argc < 2) {
-		fprintf(stderr, "You have to specify the database file name\n");
+	while (1) {
+		int option_index = 0, c;
+		static const struct option long_options[] = {
+			{ "batch", 1, 0, 'b' },
+			{ "batch-time", 1, 0, 't' },
+			{ "sync", 1, 0, 's' },
+			{ "wal", 0, 0, 'w' },
+			{ "archive", 1, 0, 'a' },
+			{ "help", 0, 0, 'h' },
+			{ 0, 0, 0, 0 }
+		};
+
+		c = getopt_long(argc, argv, "b:t:s:wa:h",
+				long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'b':
+			batch = atoi(optarg);
+			break;
+		case 't':
+			flush_ms = atoi(optarg);
+			break;
+		case 's':
+			sync = meas_db_parse_sync(optarg);
+			if (sync < 0) {
+				fprintf(stderr, "Unknown sync mode %s\n", optarg);
+				exit(2);
+			}
+			break;
+		case 'w':
+			wal = 1;
+			break;
+		case 'a':
+			arch_dir = optarg;
+			break;
+		case 'h':
+			print_help();
+			exit(0);
+		default:
+			print_help();
+			exit(2);
+		}
+	}
+
+	if (argc - optind < 1) {
+		fprintf(stderr, "You have to specify the database file name "
+			"and optionally the shared memory of the NITB\n");
 		exit(2);
 	}
 
-	db_fname = argv[1];
+	db_fname = argv[optind];
 
-	udp_ofd.cb = udp_fd_cb;
-	rc =  osmo_sock_init_ofd(&udp_ofd, AF_INET, SOCK_DGRAM,
-			 	 IPPROTO_UDP, NULL, 8888, OSMO_SOCK_F_BIND);
-	if (rc < 0) {
-		fprintf(stderr, "Unable to create UDP listen socket\n");
-		exit(1);
+	if (argc - optind > 1) {
+		rc = ring_open(argv[optind + 1]);
+		if (rc < 0) {
+			fprintf(stderr, "Unable to map %s: %s\n",
+				argv[optind + 1], strerror(-rc));
+			exit(1);
+		}
+	} else {
+		udp_ofd.cb = udp_fd_cb;
+		rc =  osmo_sock_init_ofd(&udp_ofd, AF_INET, SOCK_DGRAM,
+				 	 IPPROTO_UDP, NULL, 8888, OSMO_SOCK_F_BIND);
+		if (rc < 0) {
+			fprintf(stderr, "Unable to create UDP listen socket\n");
+			exit(1);
+		}
 	}
 
-	db = meas_db_open(NULL, db_fname);
-	if (!db) {
-		fprintf(stderr, "Unable to open database\n");
-		exit(1);
+	if (strcmp(db_fname, "-")) {
+		db = meas_db_open(NULL, db_fname);
+		if (!db) {
+			fprintf(stderr, "Unable to open database\n");
+			exit(1);
+		}
+
+		if (meas_db_set_durability(db, sync, wal) < 0)
+			exit(1);
+		meas_db_set_batch(db, batch, flush_ms);
+	}
+
+	if (arch_dir) {
+		arch = meas_arch_open(NULL, arch_dir);
+		if (!arch) {
+			fprintf(stderr, "Unable to open archive %s\n", arch_dir);
+			exit(1);
+		}
+	}
+	if (flush_ms) {
+		flush_timer.cb = flush_timer_cb;
+		osmo_timer_schedule(&flush_timer, flush_ms / 1000,
+				    (flush_ms % 1000) * 1000);
 	}
 
-	/* FIXME: timer-based BEGIN/COMMIT */
+	signal(SIGINT, &signal_handler);
+	signal(SIGTERM, &signal_handler);
 
-	while (1) {
+	/* the pending batch is written out below */
+	while (!quit)
 		osmo_select_main(0);
-	};
 
-	meas_db_close(db);
+	if (arch)
+		meas_arch_close(arch);
+	if (db)
+		meas_db_close(db);
 
 	exit(0);
 }
-
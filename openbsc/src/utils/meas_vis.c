@@ -82,11 +82,9 @@ static struct ms_state *find_alloc_ms(const char *imsi)
 	return ms;
 }
 
-static int handle_meas(struct msgb *msg)
+static int handle_meas(const struct meas_feed_meas *mfm, time_t now)
 {
-	struct meas_feed_meas *mfm = (struct meas_feed_meas *) msgb_data(msg);
 	struct ms_state *ms = find_alloc_ms(mfm->imsi);
-	time_t now = time(NULL);
 
 	strncpy(ms->name, mfm->name, sizeof(ms->imsi)-1);
 	memcpy(&ms->mr, &mfm->mr, sizeof(ms->mr));
@@ -101,19 +99,27 @@ static int handle_meas(struct msgb *msg)
 	return 0;
 }
 
+/* a datagram carries one or more records */
 static int handle_msg(struct msgb *msg)
 {
-	struct meas_feed_hdr *mfh = (struct meas_feed_hdr *) msgb_data(msg);
+	const uint8_t *cur = msgb_data(msg);
+	unsigned int len = msgb_length(msg);
+	const struct meas_feed_meas *mfm;
+	time_t now = time(NULL);
+
+	for (; len >= sizeof(*mfm); cur += sizeof(*mfm), len -= sizeof(*mfm)) {
+		mfm = (const struct meas_feed_meas *) cur;
 
-	if (mfh->version != MEAS_FEED_VERSION)
-		return -EINVAL;
+		if (mfm->hdr.version != MEAS_FEED_VERSION)
+			return -EINVAL;
 
-	switch (mfh->msg_type) {
-	case MEAS_FEED_MEAS:
-		handle_meas(msg);
-		break;
-	default:
-		break;
+		switch (mfm->hdr.msg_type) {
+		case MEAS_FEED_MEAS:
+			handle_meas(mfm, now);
+			break;
+		default:
+			break;
+		}
 	}
 
 	return 0;
@@ -124,7 +130,8 @@ static int udp_fd_cb(struct osmo_fd *ofd, unsigned int what)
 	int rc;
 
 	if (what & BSC_FD_READ) {
-		struct msgb *msg = msgb_alloc(1024, "UDP Rx");
+		struct msgb *msg = msgb_alloc(MEAS_FEED_MAX_BATCH *
+				sizeof(struct meas_feed_meas), "UDP Rx");
 
 		rc = read(ofd->fd, msgb_data(msg), msgb_tailroom(msg));
 		if (rc < 0)
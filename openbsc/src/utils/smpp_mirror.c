@@ -3,6 +3,8 @@
 #include <stdint.h>
 #include <errno.h>
 #include <string.h>
+#include <stdlib.h>
+#include <time.h>
 
 #include <netinet/in.h>
 
@@ -42,8 +44,21 @@ struct esme {
 	uint8_t smpp_version;
 	char system_id[SMPP_SYS_ID_LEN+1];
 	char password[SMPP_SYS_ID_LEN+1];
+
+	/* benchmark mode: push SUBMIT-SM and count the responses */
+	struct {
+		unsigned int total;
+		unsigned int sent;
+		unsigned int acked;
+		unsigned int failed;
+		const char *dest;
+		struct timespec start;
+	} bench;
 };
 
+/* SUBMIT-SM in flight in benchmark mode */
+#define BENCH_WINDOW	64
+
 /* FIXME: merge with smpp_smsc.c */
 #define SMPP34_UNPACK(rc, type, str, data, len)		\
 	memset(str, 0, sizeof(*str));			\
@@ -151,6 +166,93 @@ static int smpp_handle_deliver(struct esme *esme, struct msgb *msg)
 	return PACK_AND_SEND(esme, &submit);
 }
 
+static int bench_submit(struct esme *esme)
+{
+	struct submit_sm_t submit;
+	int rc;
+
+	while (esme->bench.sent < esme->bench.total
+	       && esme->bench.sent - esme->bench.acked < BENCH_WINDOW) {
+		memset(&submit, 0, sizeof(submit));
+		submit.command_id = SUBMIT_SM;
+		submit.command_status = ESME_ROK;
+		submit.sequence_number = esme_inc_seq_nr(esme);
+		submit.dest_addr_ton = TON_Network_Specific;
+		submit.dest_addr_npi = NPI_ISDN_E163_E164;
+		snprintf((char *)submit.destination_addr,
+			 sizeof(submit.destination_addr), "%s",
+			 esme->bench.dest);
+		submit.source_addr_ton = TON_Network_Specific;
+		submit.source_addr_npi = NPI_ISDN_E163_E164;
+		snprintf((char *)submit.source_addr,
+			 sizeof(submit.source_addr), "%s", "mirror");
+		submit.sm_length = snprintf((char *)submit.short_message,
+					    sizeof(submit.short_message),
+					    "bench %u", esme->bench.sent);
+
+		rc = PACK_AND_SEND(esme, &submit);
+		if (rc < 0)
+			return rc;
+		esme->bench.sent += 1;
+	}
+
+	return 0;
+}
+
+static int smpp_handle_submit_r(struct esme *esme, struct msgb *msg)
+{
+	struct submit_sm_resp_t submit_r;
+	struct timespec now;
+	double secs;
+	int rc;
+
+	SMPP34_UNPACK(rc, SUBMIT_SM_RESP, &submit_r, msgb_data(msg),
+		      msgb_length(msg));
+	if (rc < 0)
+		return rc;
+
+	if (!esme->bench.total)
+		return 0;
+
+	esme->bench.acked += 1;
+	if (submit_r.command_status != ESME_ROK)
+		esme->bench.failed += 1;
+
+	if (esme->bench.acked < esme->bench.total)
+		return bench_submit(esme);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	secs = (now.tv_sec - esme->bench.start.tv_sec)
+		+ (now.tv_nsec - esme->bench.start.tv_nsec) / 1e9;
+	printf("%u SUBMIT-SM in %.3f s, %.0f/s, %u failed\n",
+	       esme->bench.acked, secs, esme->bench.acked / secs,
+	       esme->bench.failed);
+	exit(0);
+}
+
+static int smpp_handle_bind_r(struct esme *esme, struct msgb *msg)
+{
+	struct bind_transceiver_resp_t bind_r;
+	int rc;
+
+	SMPP34_UNPACK(rc, BIND_TRANSCEIVER_RESP, &bind_r, msgb_data(msg),
+		      msgb_length(msg));
+	if (rc < 0)
+		return rc;
+
+	if (bind_r.command_status != ESME_ROK) {
+		LOGP(DSMPP, LOGL_ERROR, "[%s] BIND failed: 0x%08x\n",
+		     esme->system_id, bind_r.command_status);
+		exit(1);
+	}
+
+	if (!esme->bench.total)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &esme->bench.start);
+	return bench_submit(esme);
+}
+
 static int bind_transceiver(struct esme *esme)
 {
 	struct bind_transceiver_t bind;
@@ -175,6 +277,12 @@ static int smpp_pdu_rx(struct esme *esme, struct msgb *msg)
 	case DELIVER_SM:
 		rc = smpp_handle_deliver(esme, msg);
 		break;
+	case SUBMIT_SM_RESP:
+		rc = smpp_handle_submit_r(esme, msg);
+		break;
+	case BIND_TRANSCEIVER_RESP:
+		rc = smpp_handle_bind_r(esme, msg);
+		break;
 	default:
 		LOGP(DSMPP, LOGL_NOTICE, "unhandled case %d\n", cmd_id);
 		rc = 0;
@@ -281,7 +389,7 @@ static int smpp_esme_init(struct esme *esme, const char *host, uint16_t port)
 
 	esme->own_seq_nr = rand();
 	esme_inc_seq_nr(esme);
-	osmo_wqueue_init(&esme->wqueue, 10);
+	osmo_wqueue_init(&esme->wqueue, BENCH_WINDOW * 2);
 	esme->wqueue.bfd.data = esme;
 	esme->wqueue.read_cb = esme_read_cb;
 	esme->wqueue.write_cb = esme_write_cb;
@@ -316,6 +424,10 @@ int main(int argc, char **argv)
 		host = argv[1];
 	if (argc >= 3)
 		port = atoi(argv[2]);
+	/* smpp_mirror HOST PORT COUNT [DEST] submits COUNT messages */
+	if (argc >= 4)
+		esme.bench.total = atoi(argv[3]);
+	esme.bench.dest = argc >= 5 ? argv[4] : "1000";
 
 	rc = smpp_esme_init(&esme, host, port);
 	if (rc < 0)
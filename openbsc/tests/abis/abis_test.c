@@ -19,9 +19,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #include <osmocom/core/application.h>
 #include <osmocom/core/utils.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/msgb.h>
+#include <osmocom/abis/e1_input.h>
 
 #include <openbsc/gsm_data.h>
 #include <openbsc/abis_nm.h>
@@ -157,6 +164,207 @@ static void test_sw_selection(void)
 	printf("SELECTED: %d\n", pos);
 }
 
+/* The segments of a software load, as sent to the BTS */
+struct sw_seg {
+	uint8_t data[256];
+	int len;
+	int seq;
+};
+
+static struct sw_seg sent_segs[64];
+static int num_sent_segs;
+static int load_end_sent;
+static struct e1inp_sign_link oml_link;
+
+/* Record the segments instead of sending anything */
+int __wrap_abis_sendmsg(struct msgb *msg)
+{
+	struct abis_om_hdr *oh = (struct abis_om_hdr *) msg->data;
+	struct abis_om_fom_hdr *foh = (struct abis_om_fom_hdr *) oh->data;
+	struct gsm_bts *bts = oml_link.trx->bts;
+	struct sw_seg *seg;
+
+	switch (foh->msg_type) {
+	case NM_MT_LOAD_SEG:
+		OSMO_ASSERT(num_sent_segs < ARRAY_SIZE(sent_segs));
+		seg = &sent_segs[num_sent_segs++];
+		if (bts->type == GSM_BTS_TYPE_BS11) {
+			OSMO_ASSERT(foh->data[0] == NM_ATT_BS11_FILE_DATA);
+			seg->len = foh->data[1];
+			seg->seq = foh->data[3];
+			memcpy(seg->data, foh->data + 4, seg->len);
+		} else {
+			OSMO_ASSERT(foh->data[0] == NM_ATT_IPACC_FILE_DATA);
+			seg->len = foh->data[1] << 8 | foh->data[2];
+			seg->seq = -1;
+			memcpy(seg->data, foh->data + 3, seg->len);
+		}
+		break;
+	case NM_MT_LOAD_END:
+		load_end_sent += 1;
+		break;
+	}
+
+	msgb_free(msg);
+	return 0;
+}
+
+static void bts_sends(uint8_t msg_type)
+{
+	struct msgb *msg = msgb_alloc(128, "OML");
+	struct abis_om_hdr *oh;
+	struct abis_om_fom_hdr *foh;
+
+	oh = (struct abis_om_hdr *) msgb_put(msg, sizeof(*oh));
+	oh->mdisc = ABIS_OM_MDISC_FOM;
+	oh->placement = ABIS_OM_PLACEMENT_ONLY;
+	oh->sequence = 0;
+	oh->length = sizeof(*foh);
+	foh = (struct abis_om_fom_hdr *) msgb_put(msg, sizeof(*foh));
+	memset(foh, 0, sizeof(*foh));
+	foh->msg_type = msg_type;
+	msg->l2h = (uint8_t *) oh;
+	msg->dst = &oml_link;
+	abis_nm_rcvmsg(msg);
+}
+
+/* Run a software load to the end, acking every window */
+static void sw_load(struct gsm_bts *bts, const char *fname, uint8_t window)
+{
+	int windows = 0;
+
+	num_sent_segs = 0;
+	load_end_sent = 0;
+
+	OSMO_ASSERT(abis_nm_software_load(bts, 0, fname, window, 0,
+					  NULL, NULL) == 0);
+	bts_sends(NM_MT_LOAD_INIT_ACK);
+	while (!load_end_sent) {
+		OSMO_ASSERT(++windows < ARRAY_SIZE(sent_segs));
+		OSMO_ASSERT(num_sent_segs > 0);
+		bts_sends(NM_MT_LOAD_SEG_ACK);
+	}
+	OSMO_ASSERT(load_end_sent == 1);
+	bts_sends(NM_MT_LOAD_END_ACK);
+	OSMO_ASSERT(abis_nm_software_load_status(bts) == -EINVAL);
+}
+
+static char *write_file(const uint8_t *data, size_t len)
+{
+	static char fname[] = "/tmp/abis_test.XXXXXX";
+	int fd;
+
+	strcpy(fname + strlen(fname) - 6, "XXXXXX");
+	fd = mkstemp(fname);
+	OSMO_ASSERT(fd >= 0);
+	OSMO_ASSERT(write(fd, data, len) == len);
+	close(fd);
+	return fname;
+}
+
+static struct gsm_bts *sw_bts(enum gsm_bts_type type)
+{
+	static struct gsm_network *net;
+	struct gsm_bts *bts;
+
+	if (!net) {
+		net = talloc_zero(NULL, struct gsm_network);
+		INIT_LLIST_HEAD(&net->bts_list);
+	}
+	bts = gsm_bts_alloc_register(net, GSM_BTS_TYPE_UNKNOWN, 63);
+	OSMO_ASSERT(bts);
+	bts->type = type;
+	bts->oml_link = &oml_link;
+	oml_link.trx = bts->c0;
+	return bts;
+}
+
+/* Each line is a segment, as fgets() used to read it */
+static void test_sw_load_bs11(void)
+{
+	struct gsm_bts *bts = sw_bts(GSM_BTS_TYPE_BS11);
+	char file[2048], line[256];
+	char *fname;
+	FILE *f;
+	int i, n;
+
+	printf("Testing the BS11 software load\n");
+
+	n = sprintf(file, "@(#)BTSBMC76.SWI:RA30A\r\n");
+	n += sprintf(file + n, "short line\r\n\n");
+	/* longer than a segment */
+	memset(file + n, 'x', 600);
+	n += 600;
+	file[n++] = '\n';
+	/* exactly a segment with the line feed */
+	memset(file + n, 'y', 252);
+	n += 252;
+	file[n++] = '\n';
+	/* no line feed at the end */
+	n += sprintf(file + n, "last");
+	fname = write_file((uint8_t *) file, n);
+
+	sw_load(bts, fname, 3);
+
+	f = fopen(fname, "r");
+	OSMO_ASSERT(f);
+	for (i = 0; fgets(line, sizeof(line) - 2, f); i++) {
+		OSMO_ASSERT(i < num_sent_segs);
+		OSMO_ASSERT(sent_segs[i].len == strlen(line));
+		OSMO_ASSERT(!memcmp(sent_segs[i].data, line, strlen(line)));
+		if (i + 1 < num_sent_segs)
+			OSMO_ASSERT(sent_segs[i].seq == i % 3 + 1);
+	}
+	fclose(f);
+	unlink(fname);
+	OSMO_ASSERT(i == num_sent_segs);
+	/* the last line is marked as such */
+	OSMO_ASSERT(sent_segs[i - 1].seq == 0);
+	printf("Sent %d segments\n", num_sent_segs);
+}
+
+/* Segments of IPACC_SEGMENT_SIZE, as read() used to return them */
+static void test_sw_load_ipacc(size_t size)
+{
+	struct gsm_bts *bts = sw_bts(GSM_BTS_TYPE_NANOBTS);
+	uint8_t file[2048], seg[256];
+	char *fname;
+	size_t i;
+	int fd, len, n = 0;
+
+	printf("Testing the nanoBTS software load of %zu bytes\n", size);
+
+	OSMO_ASSERT(size <= sizeof(file));
+	for (i = 0; i < size; i++)
+		file[i] = i;
+	memcpy(file, " SDP\x10\x02\x00\x00", 8);
+	file[8] = file[9] = file[10] = 0;
+	file[11] = 16;
+	file[12] = size >> 24;
+	file[13] = size >> 16;
+	file[14] = size >> 8;
+	file[15] = size;
+	fname = write_file(file, size);
+
+	sw_load(bts, fname, 2);
+
+	fd = open(fname, O_RDONLY);
+	OSMO_ASSERT(fd >= 0);
+	do {
+		len = read(fd, seg, 245);
+		OSMO_ASSERT(n < num_sent_segs);
+		OSMO_ASSERT(sent_segs[n].len == len);
+		OSMO_ASSERT(!memcmp(sent_segs[n].data, seg, len));
+		n++;
+	} while (len == 245);
+	close(fd);
+	unlink(fname);
+	/* nothing was sent after the last short or empty read */
+	OSMO_ASSERT(n == num_sent_segs);
+	printf("Sent %d segments, the last one of %d bytes\n",
+	       num_sent_segs, sent_segs[n - 1].len);
+}
+
 int main(int argc, char **argv)
 {
 	osmo_init_logging(&log_info);
@@ -164,6 +372,9 @@ int main(int argc, char **argv)
 	test_simple_sw_short();
 	test_dual_sw_config();
 	test_sw_selection();
+	test_sw_load_bs11();
+	test_sw_load_ipacc(1000);
+	test_sw_load_ipacc(4 * 245);
 
 	return EXIT_SUCCESS;
 }
@@ -273,3 +273,34 @@ static const uint8_t cc_setup_national_again[] = {
 	0x08, 0x81, 0x63, 0x94, 0x71, 0x32, 0x33, 0x66,
 	0xf6, 0x15, 0x02, 0x11, 0x01
 };
+
+/* USSD REGISTER for **321#, BSC -> MSC */
+static const uint8_t ussd_register[] = {
+	0x00, 0x26, 0xfd, 0x06, 0x01, 0x1f, 0xe4, 0x00,
+	0x01, 0x1f, 0x01, 0x00, 0x1c, 0x0b, 0x7b, 0x1c,
+	0x15, 0xa1, 0x13, 0x02, 0x01, 0x03, 0x02, 0x01,
+	0x3b, 0x30, 0x0b, 0x04, 0x01, 0x0f, 0x04, 0x06,
+	0x2a, 0xd5, 0x4c, 0x16, 0x1b, 0x01, 0x7f, 0x01,
+	0x00
+};
+
+/* the state of the connection followed by the REGISTER */
+static const uint8_t ussd_register_fwd[] = {
+	0x00, 0x1f, 0xfe, 0xff, 0x01, 0x1f, 0xe4, 0x00,
+	0x00, 0x15, 0x00, 0x03, 0x39, 0x30, 0x31, 0x37,
+	0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+	0x30, 0x30, 0x31, 0x00, 0x00, 0x00, 0x17, 0x01,
+	0x00, 0x2a, 0x00, 0x26, 0xfd, 0x06, 0x01, 0x1f,
+	0xe4, 0x00, 0x01, 0x1f, 0x01, 0x00, 0x1c, 0x0b,
+	0x7b, 0x1c, 0x15, 0xa1, 0x13, 0x02, 0x01, 0x03,
+	0x02, 0x01, 0x3b, 0x30, 0x0b, 0x04, 0x01, 0x0f,
+	0x04, 0x06, 0x2a, 0xd5, 0x4c, 0x16, 0x1b, 0x01,
+	0x7f, 0x01, 0x00
+};
+
+/* USSD FACILITY of the same transaction, BSC -> MSC */
+static const uint8_t ussd_facility[] = {
+	0x00, 0x0f, 0xfd, 0x06, 0x01, 0x1f, 0xe4, 0x00,
+	0x01, 0x08, 0x01, 0x00, 0x05, 0x0b, 0x3a, 0x02,
+	0xa2, 0x00
+};
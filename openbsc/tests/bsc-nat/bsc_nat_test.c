@@ -37,6 +37,9 @@
 #include <osmocom/gsm/protocol/gsm_08_08.h>
 
 #include <stdio.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
 
 /* test messages for ipa */
 static uint8_t ipa_id[] = {
@@ -1549,6 +1552,179 @@ static void test_nat_extract_lac()
 	bsc_nat_free(nat);
 }
 
+static struct bsc_nat_ussd_gw *ussd_test_gw(struct bsc_nat *nat, const char *name,
+					   const char *query, int max_queue)
+{
+	struct bsc_nat_ussd_gw *gw;
+	struct bsc_nat_ussd_con *ucon;
+	int fds[2];
+
+	gw = bsc_ussd_gw_alloc(nat, name);
+	OSMO_ASSERT(gw);
+	OSMO_ASSERT(gsm_parse_reg(gw, &gw->query_re, &gw->query, 1, &query) == 0);
+	gw->max_queue = max_queue;
+
+	/* an authenticated provider, nothing is written without select */
+	OSMO_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	close(fds[1]);
+
+	ucon = talloc_zero(nat, struct bsc_nat_ussd_con);
+	ucon->nat = nat;
+	ucon->gw = gw;
+	ucon->authorized = 1;
+	osmo_wqueue_init(&ucon->queue, max_queue);
+	ucon->queue.bfd.fd = fds[0];
+	OSMO_ASSERT(osmo_fd_register(&ucon->queue.bfd) == 0);
+	gw->con = ucon;
+	return gw;
+}
+
+static struct nat_sccp_connection *ussd_test_con(struct bsc_connection *bsc)
+{
+	struct nat_sccp_connection *con;
+	static const struct sccp_source_reference real_ref = { 0x00, 0x00, 0x15 };
+	static const struct sccp_source_reference remote_ref = { 0x01, 0x1f, 0xe4 };
+
+	con = talloc_zero(bsc->nat, struct nat_sccp_connection);
+	con->bsc = bsc;
+	con->real_ref = real_ref;
+	con->remote_ref = remote_ref;
+	con->authorized = 1;
+	con->lac = 23;
+	con->ci = 42;
+	con->filter_state.con_type = FLT_CON_TYPE_SSA;
+	con->filter_state.imsi = talloc_strdup(con, "901700000000001");
+	llist_add_tail(&con->list_entry, &bsc->nat->sccp_connections);
+	return con;
+}
+
+static int ussd_test_check(struct nat_sccp_connection *con, const uint8_t *data,
+			   unsigned int length)
+{
+	struct msgb *msg = msgb_alloc(4096, "test_ussd");
+	struct bsc_nat_parsed *parsed;
+	int rc;
+
+	copy_to_msg(msg, data, length);
+	parsed = bsc_nat_parse(msg);
+	OSMO_ASSERT(parsed);
+
+	/* what bsc_nat.c does with the result */
+	rc = bsc_ussd_check(con, parsed, msg);
+	if (rc == 1)
+		con->con_local = NAT_CON_END_USSD;
+
+	msgb_free(msg);
+	return rc;
+}
+
+static struct msgb *ussd_test_last(struct osmo_wqueue *queue)
+{
+	OSMO_ASSERT(!llist_empty(&queue->msg_queue));
+	return llist_entry(queue->msg_queue.prev, struct msgb, list);
+}
+
+static void ussd_test_released(struct bsc_connection *bsc,
+			       struct nat_sccp_connection *con)
+{
+	struct sccp_connection_released *rel;
+	struct msgb *msg;
+
+	/* the clear command followed by the RLSD */
+	msg = ussd_test_last(&bsc->write_queue);
+	rel = (struct sccp_connection_released *) msg->l2h;
+	OSMO_ASSERT(rel->type == SCCP_MSG_TYPE_RLSD);
+	OSMO_ASSERT(memcmp(&rel->destination_local_reference, &con->real_ref,
+			   sizeof(con->real_ref)) == 0);
+	OSMO_ASSERT(!con->ussd_gw);
+}
+
+static void test_ussd(void)
+{
+	struct bsc_nat *nat;
+	struct bsc_connection *bsc;
+	struct bsc_msg_acc_lst *lst;
+	struct bsc_msg_acc_lst_entry *entry;
+	struct bsc_nat_ussd_gw *gw_a, *gw_b, *gw_c;
+	struct nat_sccp_connection *con1, *con2, *con3;
+	const char *allow = "^90170";
+	struct msgb *out;
+
+	printf("Testing USSD provider selection\n");
+
+	nat = bsc_nat_alloc();
+	bsc = bsc_connection_alloc(nat);
+	bsc->cfg = bsc_config_alloc(nat, "foo", 0);
+
+	nat->ussd_lst_name = "ussd";
+	lst = bsc_msg_acc_lst_get(nat, &nat->access_lists, "ussd");
+	entry = bsc_msg_acc_lst_entry_create(lst);
+	OSMO_ASSERT(gsm_parse_reg(entry, &entry->imsi_allow_re,
+				  &entry->imsi_allow, 1, &allow) == 0);
+
+	/* b and c both want the request, a does not */
+	gw_a = ussd_test_gw(nat, "a", "^\\*\\*9", 2);
+	gw_b = ussd_test_gw(nat, "b", "^\\*\\*3", 2);
+	gw_c = ussd_test_gw(nat, "c", "#$", 1);
+
+	/* the first provider with a matching query gets it */
+	con1 = ussd_test_con(bsc);
+	OSMO_ASSERT(ussd_test_check(con1, ussd_register, sizeof(ussd_register)) == 1);
+	OSMO_ASSERT(con1->ussd_gw == gw_b);
+	OSMO_ASSERT(gw_a->con->queue.current_length == 0);
+	OSMO_ASSERT(gw_b->con->queue.current_length == 1);
+	OSMO_ASSERT(gw_b->ctrg->ctr[USSD_GW_CTR_SESSIONS].current == 1);
+
+	/* the state and the SCCP message in one frame */
+	out = ussd_test_last(&gw_b->con->queue);
+	verify_msg(out, ussd_register_fwd, sizeof(ussd_register_fwd));
+
+	/* the rest of the transaction follows it, b is full now */
+	OSMO_ASSERT(ussd_test_check(con1, ussd_facility, sizeof(ussd_facility)) == 1);
+	OSMO_ASSERT(gw_b->con->queue.current_length == 2);
+	out = ussd_test_last(&gw_b->con->queue);
+	verify_msg(out, ussd_facility, sizeof(ussd_facility));
+
+	/* a new session passes the full provider */
+	con2 = ussd_test_con(bsc);
+	OSMO_ASSERT(ussd_test_check(con2, ussd_register, sizeof(ussd_register)) == 1);
+	OSMO_ASSERT(con2->ussd_gw == gw_c);
+	OSMO_ASSERT(gw_b->ctrg->ctr[USSD_GW_CTR_BUSY].current == 1);
+	OSMO_ASSERT(gw_c->con->queue.current_length == 1);
+
+	/* and goes to the MSC once all of them are full */
+	con3 = ussd_test_con(bsc);
+	OSMO_ASSERT(ussd_test_check(con3, ussd_register, sizeof(ussd_register)) == 0);
+	OSMO_ASSERT(!con3->ussd_gw);
+	OSMO_ASSERT(con3->con_local == NAT_CON_END_MSC);
+	OSMO_ASSERT(bsc->write_queue.current_length == 0);
+
+	/* removing a provider only releases its own sessions */
+	printf("  removing provider c\n");
+	bsc_ussd_gw_disconnect(gw_c);
+	bsc_ussd_gw_free(gw_c);
+	OSMO_ASSERT(bsc->write_queue.current_length == 2);
+	ussd_test_released(bsc, con2);
+	OSMO_ASSERT(con1->ussd_gw == gw_b);
+
+	/* the MSC never saw con1, a message b can not take releases it */
+	printf("  provider b is full\n");
+	OSMO_ASSERT(ussd_test_check(con1, ussd_facility, sizeof(ussd_facility)) == 1);
+	OSMO_ASSERT(gw_b->ctrg->ctr[USSD_GW_CTR_DROPPED].current == 1);
+	OSMO_ASSERT(bsc->write_queue.current_length == 4);
+	ussd_test_released(bsc, con1);
+
+	/* and nothing else happens until the BSC confirms it */
+	OSMO_ASSERT(ussd_test_check(con1, ussd_register, sizeof(ussd_register)) == 1);
+	OSMO_ASSERT(bsc->write_queue.current_length == 4);
+	OSMO_ASSERT(gw_b->con->queue.current_length == 2);
+
+	bsc_ussd_gw_disconnect(gw_a);
+	bsc_ussd_gw_disconnect(gw_b);
+	osmo_wqueue_clear(&bsc->write_queue);
+	bsc_nat_free(nat);
+}
+
 int main(int argc, char **argv)
 {
 	msgb_talloc_ctx_init(NULL, 0);
@@ -1572,6 +1748,7 @@ int main(int argc, char **argv)
 	test_mgcp_allocations();
 	test_barr_list_parsing();
 	test_nat_extract_lac();
+	test_ussd();
 
 	printf("Testing execution completed.\n");
 	return 0;
@@ -35,6 +35,10 @@
 #include <osmocom/core/application.h>
 #include <osmocom/core/backtrace.h>
 #include <osmocom/core/talloc.h>
+#include <osmocom/core/rate_ctr.h>
+#include <osmocom/gsm/gsm48.h>
+
+#include <openbsc/bsc_msc.h>
 
 #include <stdio.h>
 #include <search.h>
@@ -196,6 +200,122 @@ out:
 	talloc_free(net);
 }
 
+static struct msgb *lu_request(const uint8_t *mi_tlv)
+{
+	struct msgb *msg = msgb_alloc(256, "lu-request");
+	struct gsm48_hdr *gh;
+	struct gsm48_loc_upd_req *lu;
+
+	msg->l3h = msgb_put(msg, sizeof(*gh) + sizeof(*lu));
+	memset(msg->l3h, 0, msgb_l3len(msg));
+	gh = (struct gsm48_hdr *) msg->l3h;
+	gh->proto_discr = GSM48_PDISC_MM;
+	gh->msg_type = GSM48_MT_MM_LOC_UPD_REQUEST;
+	lu = (struct gsm48_loc_upd_req *) gh->data;
+	lu->mi_len = mi_tlv[1];
+	memcpy(msgb_put(msg, mi_tlv[1]), &mi_tlv[2], mi_tlv[1]);
+	return msg;
+}
+
+static int route(struct gsm_subscriber_connection *conn, struct msgb *msg)
+{
+	struct osmo_msc_data *msc = bsc_find_msc(conn, msg);
+
+	msgb_free(msg);
+	return msc ? msc->nr : -1;
+}
+
+static int route_tmsi(struct gsm_subscriber_connection *conn, unsigned int nri)
+{
+	uint8_t mi[GSM48_MI_SIZE + 2];
+
+	gsm48_generate_mid_from_tmsi(mi, (nri << 16) | 0x1234);
+	return route(conn, lu_request(mi));
+}
+
+static int route_imsi(struct gsm_subscriber_connection *conn, const char *imsi)
+{
+	uint8_t mi[GSM48_MI_SIZE + 2];
+
+	gsm48_generate_mid_from_imsi(mi, imsi);
+	return route(conn, lu_request(mi));
+}
+
+static void test_msc_route(void)
+{
+	struct gsm_network *net;
+	struct osmo_bsc_data *bsc;
+	struct gsm_bts *bts;
+	struct gsm_subscriber_connection *conn;
+	struct osmo_msc_data *mscs[3];
+	const char *imsi = "901700000000001";
+	int i;
+
+	net = talloc_zero(NULL, struct gsm_network);
+	bsc = talloc_zero(net, struct osmo_bsc_data);
+	bts = talloc_zero(net, struct gsm_bts);
+	conn = talloc_zero(net, struct gsm_subscriber_connection);
+
+	net->bsc_data = bsc;
+	bsc->network = net;
+	INIT_LLIST_HEAD(&bsc->mscs);
+	bts->network = net;
+	conn->bts = bts;
+
+	/* the 8 bit NRI of MSC 1 and 2 is 1 and 2, MSC 3 has none */
+	bsc->nri_bitlen = 8;
+	for (i = 0; i < ARRAY_SIZE(mscs); ++i) {
+		mscs[i] = talloc_zero(net, struct osmo_msc_data);
+		mscs[i]->network = net;
+		mscs[i]->nr = i + 1;
+		mscs[i]->allow_emerg = 1;
+		mscs[i]->msc_con = talloc_zero(mscs[i], struct bsc_msc_connection);
+		mscs[i]->msc_con->is_authenticated = 1;
+		osmo_bsc_route_msc_init(mscs[i]);
+		llist_add_tail(&mscs[i]->entry, &bsc->mscs);
+	}
+	mscs[0]->route.nri[0] = 1 << 1;
+	mscs[1]->route.nri[0] = 1 << 2;
+
+	printf("Testing MSC routing.\n");
+
+	printf("TMSI with NRI 1: MSC %d\n", route_tmsi(conn, 1));
+	printf("TMSI with NRI 2: MSC %d\n", route_tmsi(conn, 2));
+
+	mscs[1]->route.max_conns = 1;
+	mscs[1]->route.num_conns = 1;
+	printf("TMSI with NRI 2, MSC 2 full: MSC %d\n", route_tmsi(conn, 2));
+	printf("TMSI with unknown NRI: MSC %d\n", route_tmsi(conn, 7));
+
+	mscs[0]->route.num_conns = 5;
+	mscs[2]->route.cc_delay_ms = 1000;
+	printf("Busy MSC 1, slow MSC 3: MSC %d\n", route_tmsi(conn, 7));
+	mscs[1]->route.max_conns = 0;
+	printf("MSC 2 without limit: MSC %d\n", route_tmsi(conn, 7));
+
+	printf("IMSI: MSC %d\n", route_imsi(conn, imsi));
+	printf("IMSI again: MSC %d\n", route_imsi(conn, imsi));
+	mscs[1]->msc_con->is_authenticated = 0;
+	printf("IMSI, MSC 2 gone: MSC %d\n", route_imsi(conn, imsi));
+	mscs[1]->msc_con->is_authenticated = 1;
+	printf("IMSI, MSC 2 back: MSC %d\n", route_imsi(conn, imsi));
+	mscs[1]->route.max_conns = 1;
+	printf("IMSI, MSC 2 full: MSC %d\n", route_imsi(conn, imsi));
+
+	for (i = 0; i < ARRAY_SIZE(mscs); ++i) {
+		struct rate_ctr *ctr = mscs[i]->route.ctrg->ctr;
+
+		printf("MSC %d: nri %d, imsi %d, load %d, full %d\n",
+		       mscs[i]->nr, (int) ctr[MSC_ROUTE_CTR_NRI].current,
+		       (int) ctr[MSC_ROUTE_CTR_IMSI].current,
+		       (int) ctr[MSC_ROUTE_CTR_LOAD].current,
+		       (int) ctr[MSC_ROUTE_CTR_FULL].current);
+		rate_ctr_group_free(mscs[i]->route.ctrg);
+	}
+
+	talloc_free(net);
+}
+
 
 int main(int argc, char **argv)
 {
@@ -203,6 +323,7 @@ int main(int argc, char **argv)
 	osmo_init_logging(&log_info);
 
 	test_scan();
+	test_msc_route();
 
 	printf("Testing execution completed.\n");
 	return 0;
@@ -30,10 +30,14 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
 
 static struct gsm_network dummy_net;
 static struct gsm_subscriber_group dummy_sgrp;
 
+#define BENCH_DB "db_bench.sqlite3"
+
 #define SUBSCR_PUT(sub) \
 	sub->group = &dummy_sgrp;	\
 	subscr_put(sub);
@@ -160,6 +164,111 @@ static void test_sms_migrate(void)
 	subscr_put(rcv_subscr);
 }
 
+/* Store num SMS for subscr in one transaction */
+static void sms_bulk_store(struct gsm_subscriber *subscr, int num)
+{
+	struct gsm_sms *sms;
+	int i, rc;
+
+	rc = db_begin_transaction();
+	OSMO_ASSERT(rc == 0);
+	for (i = 0; i < num; i++) {
+		sms = sms_alloc();
+		sms->receiver = subscr_get(subscr);
+		memcpy(sms->src.addr, "1234", strlen("1234") + 1);
+		memcpy(sms->dst.addr, subscr->extension,
+		       sizeof(subscr->extension));
+		snprintf(sms->text, sizeof(sms->text), "Bulk %d", i);
+		rc = db_sms_store(sms);
+		sms_free(sms);
+		OSMO_ASSERT(rc == 0);
+	}
+	rc = db_commit_transaction();
+	OSMO_ASSERT(rc == 0);
+}
+
+/* Deliver all unsent SMS of subscr in order, return how many */
+static int sms_bulk_drain(struct gsm_subscriber *subscr)
+{
+	struct gsm_sms *sms;
+	unsigned long long last_id = 0;
+	int count = 0;
+
+	while ((sms = db_sms_get_unsent_for_subscr(subscr))) {
+		OSMO_ASSERT(sms->id > last_id);
+		last_id = sms->id;
+		db_sms_mark_delivered(sms);
+		sms_free(sms);
+		count += 1;
+	}
+	return count;
+}
+
+/*
+ * Store a batch of SMS in one transaction and drain them again, this
+ * goes through the unsent SMS index.
+ */
+static void test_sms_bulk(void)
+{
+	struct gsm_subscriber *subscr;
+
+	printf("Testing bulk SMS storage.\n");
+
+	subscr = db_get_subscriber(GSM_SUBSCRIBER_IMSI, "3693245423445");
+	OSMO_ASSERT(subscr);
+	subscr->group = &dummy_sgrp;
+
+	sms_bulk_store(subscr, 1000);
+	printf("Stored and delivered %d SMS\n", sms_bulk_drain(subscr));
+
+	subscr_put(subscr);
+}
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Timed run of the above on a scratch database, not part of the test */
+static int bench_sms_bulk(int num)
+{
+	struct gsm_subscriber *subscr;
+	struct timespec start;
+	double secs;
+	int count;
+
+	unlink(BENCH_DB);
+	if (db_init(BENCH_DB) || db_prepare()) {
+		printf("DB: Failed to set up %s.\n", BENCH_DB);
+		return 1;
+	}
+
+	subscr = db_create_subscriber("901700000000001", GSM_MIN_EXTEN,
+				      GSM_MAX_EXTEN, true);
+	OSMO_ASSERT(subscr);
+	subscr->group = &dummy_sgrp;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	sms_bulk_store(subscr, num);
+	secs = elapsed(&start);
+	printf("Stored %d SMS in %.3f s, %.0f SMS/s\n", num, secs, num / secs);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	count = sms_bulk_drain(subscr);
+	secs = elapsed(&start);
+	printf("Delivered %d SMS in %.3f s, %.0f SMS/s\n", count, secs,
+	       count / secs);
+
+	subscr_put(subscr);
+	db_fini();
+	unlink(BENCH_DB);
+	return 0;
+}
+
 static void test_subs(const char *imsi, char *imei1, char *imei2, bool make_ext)
 {
 	struct gsm_subscriber *alice = NULL, *alice_db;
@@ -200,15 +309,20 @@ static void test_subs(const char *imsi, char *imei1, char *imei2, bool make_ext)
 	SUBSCR_PUT(alice);
 }
 
-int main()
+int main(int argc, char **argv)
 {
-	printf("Testing subscriber database code.\n");
 	osmo_init_logging(&log_info);
 	log_set_print_filename(osmo_stderr_target, 0);
 
 	dummy_net.subscr_group = &dummy_sgrp;
 	dummy_sgrp.net         = &dummy_net;
 
+	/* -b NUM times storing and delivering NUM SMS instead */
+	if (argc == 3 && !strcmp(argv[1], "-b"))
+		return bench_sms_bulk(atoi(argv[2]));
+
+	printf("Testing subscriber database code.\n");
+
 	if (db_init("hlr.sqlite3")) {
 		printf("DB: Failed to init database. Please check the option settings.\n");
 		return 1;
@@ -245,6 +359,7 @@ int main()
 
 	test_sms();
 	test_sms_migrate();
+	test_sms_bulk();
 
 	db_fini();
 
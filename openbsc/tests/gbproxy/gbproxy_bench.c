@@ -0,0 +1,242 @@
+/* relay throughput benchmark for the Gb proxy */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Feeds NS UNITDATA frames from a BSS and from the SGSN through the NS layer
+ * into the Gb proxy and prints the relay rate, e.g.
+ *
+ *   gbproxy_bench -n 100000 -p
+ *
+ * Nothing is sent on the network, sendto() is replaced below.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/application.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/core/logging.h>
+#include <osmocom/core/rate_ctr.h>
+#include <osmocom/gprs/gprs_msgb.h>
+#include <osmocom/gprs/gprs_ns.h>
+#include <osmocom/gprs/gprs_bssgp.h>
+
+#include <openbsc/gb_proxy.h>
+#include <openbsc/debug.h>
+
+#define REMOTE_BSS_ADDR 0x01020304
+#define REMOTE_SGSN_ADDR 0x05060708
+
+#define BSS_NSEI 0x1000
+#define BSS_NSVCI 0x1001
+#define BSS_BVCI 0x1002
+#define SGSN_NSEI 0x0100
+#define SGSN_NSVCI 0x0101
+
+/* NS UNITDATA, BVCI 0x1002, UL-UNITDATA with a GMM ATTACH REQUEST */
+static const uint8_t attach_req[] = {
+	0x00, 0x00, 0x10, 0x02, 0x01, 0x80, 0x00, 0xde, 0xad, 0x00, 0x00, 0x04,
+	0x08, 0x88, 0x00, 0xf1, 0x99, 0x00, 0x63, 0x60, 0x12, 0x34, 0x00, 0x80,
+	0x0e, 0x00, 0x34, 0x01, 0xc0, 0x01, 0x08, 0x01, 0x02, 0xf5, 0xe0, 0x21,
+	0x08, 0x02, 0x05, 0xf4, 0xfb, 0xc5, 0x46, 0x79, 0x11, 0x22, 0x33, 0x40,
+	0x50, 0x60, 0x19, 0x18, 0xb3, 0x43, 0x2b, 0x25, 0x96, 0x62, 0x00, 0x60,
+	0x80, 0x9a, 0xc2, 0xc6, 0x62, 0x00, 0x60, 0x80, 0xba, 0xc8, 0xc6, 0x62,
+	0x00, 0x60, 0x80, 0x00, 0x16, 0x6d, 0x01,
+};
+
+/* NS UNITDATA, BVCI 0x1002, DL-UNITDATA with a GMM IDENTITY REQUEST */
+static const uint8_t ident_req[] = {
+	0x00, 0x00, 0x10, 0x02, 0x00, 0x80, 0x00, 0xde, 0xad, 0x00, 0x50, 0x20,
+	0x16, 0x82, 0x02, 0x58, 0x0e, 0x89, 0x41, 0xc0, 0x01, 0x08, 0x15, 0x01,
+	0xff, 0x6c, 0xba,
+};
+
+static struct gbproxy_config gbcfg;
+static unsigned long long sent;
+
+/* override, count instead of sending */
+ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
+	       const struct sockaddr *dest_addr, socklen_t addrlen)
+{
+	sent += 1;
+	return len;
+}
+
+static int gprs_ns_callback(enum gprs_ns_evt event, struct gprs_nsvc *nsvc,
+			    struct msgb *msg, uint16_t bvci)
+{
+	switch (event) {
+	case GPRS_NS_EVT_UNIT_DATA:
+		return gbprox_rcvmsg(&gbcfg, msg, nsvc->nsei, bvci,
+				     nsvc->nsvci);
+	default:
+		break;
+	}
+	return 0;
+}
+
+static void add_nsvc(struct gprs_ns_inst *nsi, struct sockaddr_in *addr,
+		     uint32_t host, uint16_t port, uint16_t nsei, uint16_t nsvci)
+{
+	struct gprs_nsvc *nsvc;
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons(port);
+	addr->sin_addr.s_addr = htonl(host);
+
+	nsvc = gprs_nsvc_create(nsi, nsvci);
+	OSMO_ASSERT(nsvc);
+	nsvc->nsei = nsei;
+	nsvc->ll = GPRS_NS_LL_UDP;
+	nsvc->ip.bts_addr = *addr;
+	nsvc->state = NSE_S_ALIVE;
+	nsvc->remote_state = NSE_S_ALIVE;
+}
+
+/* the way the NS layer receives a frame, the msgb is freed afterwards */
+static void rx_frame(struct gprs_ns_inst *nsi, struct sockaddr_in *addr,
+		     const uint8_t *data, size_t len)
+{
+	struct msgb *msg = gprs_ns_msgb_alloc();
+
+	OSMO_ASSERT(msg);
+	memcpy(msgb_put(msg, len), data, len);
+	msg->l2h = msg->data;
+	gprs_ns_rcvmsg(nsi, msg, addr, GPRS_NS_LL_UDP);
+	msgb_free(msg);
+}
+
+static struct log_info_cat gprs_categories[] = {
+	[DGPRS] = {
+		.name = "DGPRS",
+		.description = "GPRS Packet Service",
+		.enabled = 1, .loglevel = LOGL_FATAL,
+	},
+	[DNS] = {
+		.name = "DNS",
+		.description = "GPRS Network Service (NS)",
+		.enabled = 1, .loglevel = LOGL_FATAL,
+	},
+	[DBSSGP] = {
+		.name = "DBSSGP",
+		.description = "GPRS BSS Gateway Protocol (BSSGP)",
+		.enabled = 1, .loglevel = LOGL_FATAL,
+	},
+};
+
+static struct log_info info = {
+	.cat = gprs_categories,
+	.num_cat = ARRAY_SIZE(gprs_categories),
+};
+
+static void print_help(void)
+{
+	printf("Usage: gbproxy_bench [OPTIONS]\n");
+	printf("  -n --frames N       Frames to relay per direction "
+	       "(default 100000)\n");
+	printf("  -p --patch          Patch the RAI to a core network MCC/MNC\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct gprs_ns_inst *nsi;
+	struct gbproxy_peer *peer;
+	struct sockaddr_in bss_addr, sgsn_addr;
+	struct timespec start, end;
+	unsigned int i, num = 100000;
+	int patch = 0;
+	double secs;
+
+	while (1) {
+		int option_index = 0, c;
+		static const struct option long_options[] = {
+			{ "frames", 1, 0, 'n' },
+			{ "patch", 0, 0, 'p' },
+			{ "help", 0, 0, 'h' },
+			{ 0, 0, 0, 0 }
+		};
+
+		c = getopt_long(argc, argv, "n:ph",
+				long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'n':
+			num = atoi(optarg);
+			break;
+		case 'p':
+			patch = 1;
+			break;
+		case 'h':
+			print_help();
+			exit(0);
+		default:
+			print_help();
+			exit(2);
+		}
+	}
+
+	msgb_talloc_ctx_init(NULL, 0);
+	osmo_init_logging(&info);
+	log_set_log_level(osmo_stderr_target, LOGL_FATAL);
+	rate_ctr_init(NULL);
+
+	gbproxy_init_config(&gbcfg);
+	nsi = gprs_ns_instantiate(gprs_ns_callback, NULL);
+	bssgp_nsi = nsi;
+	gbcfg.nsi = nsi;
+	gbcfg.nsip_sgsn_nsei = SGSN_NSEI;
+	if (patch) {
+		gbcfg.core_mcc = 123;
+		gbcfg.core_mnc = 456;
+	}
+
+	add_nsvc(nsi, &bss_addr, REMOTE_BSS_ADDR, 1111, BSS_NSEI, BSS_NSVCI);
+	add_nsvc(nsi, &sgsn_addr, REMOTE_SGSN_ADDR, 32000, SGSN_NSEI,
+		 SGSN_NSVCI);
+	peer = gbproxy_peer_alloc(&gbcfg, BSS_BVCI);
+	OSMO_ASSERT(peer);
+	peer->nsei = BSS_NSEI;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < num; i++) {
+		rx_frame(nsi, &bss_addr, attach_req, sizeof(attach_req));
+		rx_frame(nsi, &sgsn_addr, ident_req, sizeof(ident_req));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = (end.tv_sec - start.tv_sec) +
+		(end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("Relayed %llu of %u frames %s patching in %.3f s, "
+	       "%.0f frames/s\n", sent, 2 * num, patch ? "with" : "without",
+	       secs, sent / secs);
+
+	gbprox_reset(&gbcfg);
+	gprs_ns_destroy(nsi);
+	return 0;
+}
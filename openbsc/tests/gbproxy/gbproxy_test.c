@@ -4501,7 +4501,7 @@ struct gbproxy_link_info *register_tlli(
 		LOGP(DGPRS, LOGL_INFO, "Adding TLLI %08x to list\n", tlli);
 
 	gbproxy_attach_link_info(peer, now, link_info);
-	gbproxy_update_link_info(link_info, imsi, imsi_len);
+	gbproxy_update_link_info(peer, link_info, imsi, imsi_len);
 
 	if (imsi_matches >= 0)
 		link_info->is_matching[GBPROX_MATCH_PATCHING] = imsi_matches;
@@ -0,0 +1,225 @@
+/* GSUP client request tracking test */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <openbsc/gsup_client.h>
+#include <openbsc/debug.h>
+
+#include <osmocom/abis/ipa.h>
+#include <osmocom/gsm/protocol/ipaccess.h>
+#include <osmocom/gsm/protocol/gsm_04_08_gprs.h>
+#include <osmocom/gsm/gsup.h>
+#include <osmocom/core/application.h>
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/select.h>
+#include <osmocom/core/utils.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#define IMSI(n)	"90170000000000" #n
+
+static struct gsup_client *gsupc;
+static struct gsup_client_conn *conns[2];
+
+static int conn_nr(struct ipa_client_conn *link)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(conns); i++)
+		if (conns[i] && conns[i]->link == link)
+			return i;
+	return -1;
+}
+
+static struct msgb *gsup_msg(uint8_t msg_type, const char *imsi)
+{
+	struct osmo_gsup_message gsup = {0};
+	struct msgb *msg = gsup_client_msgb_alloc();
+
+	gsup.message_type = msg_type;
+	strcpy(gsup.imsi, imsi);
+	if (OSMO_GSUP_IS_MSGT_ERROR(msg_type))
+		gsup.cause = GMM_CAUSE_IMSI_UNKNOWN;
+	osmo_gsup_encode(msg, &gsup);
+	return msg;
+}
+
+int __real_ipa_client_conn_open(struct ipa_client_conn *link);
+int __wrap_ipa_client_conn_open(struct ipa_client_conn *link)
+{
+	return 0;
+}
+
+void __real_ipa_client_conn_close(struct ipa_client_conn *link);
+void __wrap_ipa_client_conn_close(struct ipa_client_conn *link)
+{
+}
+
+/* Print the GSUP messages the client sends, drop pings and the like */
+void __real_ipa_client_conn_send(struct ipa_client_conn *link,
+				 struct msgb *msg);
+void __wrap_ipa_client_conn_send(struct ipa_client_conn *link,
+				 struct msgb *msg)
+{
+	struct ipaccess_head *hh = (struct ipaccess_head *) msg->data;
+	struct ipaccess_head_ext *he = (struct ipaccess_head_ext *) hh->data;
+	struct osmo_gsup_message gsup;
+
+	if (hh->proto == IPAC_PROTO_OSMO && he->proto == IPAC_PROTO_EXT_GSUP) {
+		OSMO_ASSERT(osmo_gsup_decode(he->data, ntohs(hh->len) - 1,
+					     &gsup) >= 0);
+		printf("  -> conn %d: 0x%02x %s\n", conn_nr(link),
+		       gsup.message_type, gsup.imsi);
+	}
+	msgb_free(msg);
+}
+
+/* Answers requests from the HLR like the SGSN does */
+static int read_cb(struct gsup_client *gsupc, struct msgb *msg)
+{
+	struct osmo_gsup_message gsup;
+
+	OSMO_ASSERT(osmo_gsup_decode(msgb_l2(msg), msgb_l2len(msg), &gsup) >= 0);
+	if (OSMO_GSUP_IS_MSGT_ERROR(gsup.message_type))
+		printf("  <- 0x%02x %s cause %d\n", gsup.message_type,
+		       gsup.imsi, gsup.cause);
+	else
+		printf("  <- 0x%02x %s\n", gsup.message_type, gsup.imsi);
+
+	if (OSMO_GSUP_IS_MSGT_REQUEST(gsup.message_type))
+		gsup_client_send(gsupc,
+				 gsup_msg(OSMO_GSUP_TO_MSGT_RESULT(gsup.message_type),
+					  gsup.imsi));
+
+	msgb_free(msg);
+	return 0;
+}
+
+static void rx(int nr, uint8_t msg_type, const char *imsi)
+{
+	struct msgb *msg = gsup_msg(msg_type, imsi);
+	struct ipa_client_conn *link = conns[nr]->link;
+
+	ipa_prepend_header_ext(msg, IPAC_PROTO_EXT_GSUP);
+	ipa_msg_push_header(msg, IPAC_PROTO_OSMO);
+	msg->l2h = msg->data + sizeof(struct ipaccess_head);
+	link->read_cb(link, msg);
+}
+
+static void send_req(uint8_t msg_type, const char *imsi)
+{
+	OSMO_ASSERT(gsup_client_send(gsupc, gsup_msg(msg_type, imsi)) == 0);
+}
+
+static void updown(int nr, int up)
+{
+	struct ipa_client_conn *link = conns[nr]->link;
+
+	printf("  conn %d %s\n", nr, up ? "up" : "down");
+	link->updown_cb(link, up);
+}
+
+static void print_state(void)
+{
+	printf("%u outstanding, %u queued, %d answered, %d unmatched, "
+	       "%d timed out\n", gsupc->num_inflight, gsupc->num_queued,
+	       (int) gsupc->stats.answered, (int) gsupc->stats.unmatched,
+	       (int) gsupc->stats.timeouts);
+}
+
+static void test_pipeline(void)
+{
+	printf("Testing request distribution.\n");
+
+	updown(0, 1);
+	updown(1, 1);
+
+	/* the least loaded connection takes the request, until all of
+	 * them have max_inflight outstanding */
+	send_req(OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI(1));
+	send_req(OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI(2));
+	send_req(OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI(3));
+	send_req(OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI(4));
+	send_req(OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI(5));
+	print_state();
+
+	/* an answer makes room for the queued request */
+	rx(0, OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT, IMSI(3));
+	/* the same answer again, and one on the wrong connection */
+	rx(0, OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT, IMSI(3));
+	rx(0, OSMO_GSUP_MSGT_SEND_AUTH_INFO_ERROR, IMSI(2));
+	/* a request from the HLR is answered on its connection */
+	rx(1, OSMO_GSUP_MSGT_INSERT_DATA_REQUEST, IMSI(2));
+	print_state();
+}
+
+static void test_link_loss(void)
+{
+	printf("Testing link loss.\n");
+
+	/* what was sent on the link is failed */
+	updown(1, 0);
+	send_req(OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI(6));
+	print_state();
+
+	updown(1, 1);
+	print_state();
+}
+
+static void test_timeout(void)
+{
+	printf("Testing timeouts.\n");
+
+	gsupc->req_timeout = 0;
+	send_req(OSMO_GSUP_MSGT_UPDATE_LOCATION_REQUEST, IMSI(7));
+	while (gsupc->stats.timeouts == 0)
+		osmo_select_main(0);
+	print_state();
+
+	/* nothing is connected, nothing is sent */
+	updown(0, 0);
+	updown(1, 0);
+	OSMO_ASSERT(gsup_client_send(gsupc,
+				     gsup_msg(OSMO_GSUP_MSGT_PURGE_MS_REQUEST,
+					      IMSI(8))) == -EAGAIN);
+	print_state();
+}
+
+int main(int argc, char **argv)
+{
+	osmo_init_logging(&log_info);
+	log_set_print_filename(osmo_stderr_target, 0);
+	log_set_log_level(osmo_stderr_target, LOGL_FATAL);
+
+	gsupc = gsup_client_create("127.0.0.1", 4222, read_cb, NULL);
+	OSMO_ASSERT(gsupc);
+	OSMO_ASSERT(gsup_client_add_conn(gsupc, "127.0.0.2", 4222) == 0);
+	conns[0] = llist_entry(gsupc->conns.next, struct gsup_client_conn, list);
+	conns[1] = llist_entry(gsupc->conns.prev, struct gsup_client_conn, list);
+	gsupc->max_inflight = 2;
+
+	test_pipeline();
+	test_link_loss();
+	test_timeout();
+
+	gsup_client_destroy(gsupc);
+	printf("Done\n");
+	return 0;
+}
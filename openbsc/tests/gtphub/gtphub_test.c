@@ -24,6 +24,7 @@
 #include <string.h>
 #include <limits.h>
 #include <unistd.h>
+#include <errno.h>
 
 #include <osmocom/core/utils.h>
 #include <osmocom/core/application.h>
@@ -295,6 +296,55 @@ static void test_nr_map_wrap(void)
 		));
 }
 
+static void test_nr_map_collisions(void)
+{
+	struct nr_pool pool;
+	struct nr_map map;
+	struct nr_mapping *m, *dup;
+	nr_t repl[1000];
+	int i;
+
+	/* origin ^ orig is the same for both origins, so every number of
+	 * origin2 lands in the chain of the matching one of origin1. */
+	void *origin1 = (void*)0x1000;
+	void *origin2 = (void*)0x1030;
+
+	nr_pool_init(&pool, 1, 100000);
+	nr_map_init(&map, &pool, NULL);
+
+	for (i = 0; i < ARRAY_SIZE(repl); i++) {
+		repl[i] = nr_map_have(&map, origin1, i, 0)->repl;
+		nr_map_have(&map, origin2, i ^ 0x30, 0);
+	}
+	OSMO_ASSERT(map.count == 2 * ARRAY_SIZE(repl));
+	OSMO_ASSERT(map.count <= (1 << map.hash_bits));
+
+	for (i = 0; i < ARRAY_SIZE(repl); i++) {
+		OSMO_ASSERT(nr_map_verify(&map, origin1, i, repl[i]));
+		OSMO_ASSERT(nr_map_verify_inv(&map, repl[i], origin1, i));
+		m = nr_map_get(&map, origin2, i ^ 0x30);
+		OSMO_ASSERT(m && m->origin == origin2);
+		OSMO_ASSERT(nr_map_verify_inv(&map, m->repl, origin2, i ^ 0x30));
+	}
+	OSMO_ASSERT(!nr_map_get(&map, origin1, ARRAY_SIZE(repl)));
+
+	/* Of two mappings for the same number, the older one is found. */
+	dup = nr_mapping_alloc();
+	dup->origin = origin1;
+	dup->orig = 7;
+	nr_map_add(&map, dup, 0);
+	OSMO_ASSERT(nr_map_verify(&map, origin1, 7, repl[7]));
+	nr_mapping_del(nr_map_get(&map, origin1, 7));
+	OSMO_ASSERT(nr_map_get(&map, origin1, 7) == dup);
+
+	/* The hash tables go away with the last mapping. */
+	nr_map_clear(&map);
+	OSMO_ASSERT(map.count == 0);
+	OSMO_ASSERT(!map.hash && !map.inv_hash);
+	OSMO_ASSERT(!nr_map_get(&map, origin1, 1));
+	OSMO_ASSERT(!nr_map_get_inv(&map, repl[1]));
+}
+
 static void test_expiry(void)
 {
 	struct expiry expiry;
@@ -1310,6 +1360,84 @@ static void test_reused_tei(void)
 	OSMO_ASSERT(clear_test_hub());
 }
 
+/* Send a Create PDP Context Request from SGSN address gsn, with TEIs derived
+ * from i. */
+static int create_pdp_ctx_nr(const char *gsn, int i)
+{
+	static const char *fmt =
+		MSG_PDP_CTX_REQ("0068",
+				"%04x",
+				"60",
+				"42000121436587f9",
+				"%08x",
+				"%08x",
+				"0009""08696e7465726e6574", /* "(8)internet" */
+				"0004""%s",
+				"0004""%s"
+			       );
+	char req[512];
+	struct osmo_fd *ggsn_ofd = NULL;
+	struct osmo_sockaddr ggsn_addr;
+
+	LVL2_ASSERT(snprintf(req, sizeof(req), fmt, 0x1000 + i, 0x100 + i,
+			     0x300 + i, gsn, gsn) < sizeof(req));
+	LVL2_ASSERT(gtphub_handle_buf(hub, GTPH_SIDE_SGSN, GTPH_PLANE_CTRL,
+				      &sgsn_sender, buf, msg(req), now,
+				      &reply_buf, &ggsn_ofd, &ggsn_addr) > 0);
+	return 1;
+}
+
+/* Return how many tunnels use Ctrl TEI tei at the SGSN with address gsn. */
+static int tunnels_with_sgsn_tei(const char *gsn, uint32_t tei)
+{
+	struct gtphub_tunnel *tun;
+	struct gsn_addr addr;
+	int n = 0;
+
+	LVL2_ASSERT(gsn_addr_from_str(&addr, gsn) == 0);
+	llist_for_each_entry(tun, &hub->tunnels, entry) {
+		struct gtphub_tunnel_endpoint *te =
+			&tun->endpoint[GTPH_SIDE_SGSN][GTPH_PLANE_CTRL];
+		if (te->tei_orig == tei && te->peer
+		    && gsn_addr_same(&te->peer->peer_addr->addr, &addr))
+			n ++;
+	}
+	return n;
+}
+
+static void test_many_tunnels(void)
+{
+	int i;
+
+	LOG("test_many_tunnels");
+
+	OSMO_ASSERT(setup_test_hub());
+
+	/* More tunnels than the smallest hash tables have chains */
+	for (i = 0; i < 20; i++)
+		OSMO_ASSERT(create_pdp_ctx_nr("c0a82a17", i));
+	OSMO_ASSERT(hub->tunnels_count == 20);
+	OSMO_ASSERT(hub->tunnels_hash_bits > NR_MAP_HASH_BITS_MIN);
+
+	/* Another SGSN using the same TEIs lands in the same chain, but is
+	 * no reuse. */
+	OSMO_ASSERT(create_pdp_ctx_nr("c0a82a18", 5));
+	OSMO_ASSERT(hub->tunnels_count == 21);
+	OSMO_ASSERT(tunnels_with_sgsn_tei("192.168.42.23", 0x305) == 1);
+	OSMO_ASSERT(tunnels_with_sgsn_tei("192.168.42.24", 0x305) == 1);
+
+	/* The first SGSN reusing its TEIs expires only its own old tunnel. */
+	OSMO_ASSERT(create_pdp_ctx_nr("c0a82a17", 5));
+	OSMO_ASSERT(hub->tunnels_count == 21);
+	OSMO_ASSERT(tunnels_with_sgsn_tei("192.168.42.23", 0x305) == 1);
+	OSMO_ASSERT(tunnels_with_sgsn_tei("192.168.42.24", 0x305) == 1);
+	OSMO_ASSERT(tunnels_with_sgsn_tei("192.168.42.23", 0x304) == 1);
+	OSMO_ASSERT(tunnels_with_sgsn_tei("192.168.42.23", 0x306) == 1);
+
+	OSMO_ASSERT(clear_test_hub());
+	OSMO_ASSERT(!hub->tunnels_by_tei && !hub->tunnels_by_tei_orig);
+}
+
 static void test_peer_restarted(void)
 {
 	LOG("test_peer_restarted");
@@ -1764,6 +1892,66 @@ void test_parallel_context_creation(void)
 }
 
 
+#define SNAPSHOT_FILE "gtphub_test.snapshot"
+#define SNAPSHOT_FILE2 "gtphub_test.snapshot2"
+
+static int files_equal(const char *path_a, const char *path_b)
+{
+	static char a[4096];
+	static char b[4096];
+	size_t len_a, len_b;
+	FILE *f;
+
+	f = fopen(path_a, "r");
+	LVL2_ASSERT(f);
+	len_a = fread(a, 1, sizeof(a), f);
+	fclose(f);
+
+	f = fopen(path_b, "r");
+	LVL2_ASSERT(f);
+	len_b = fread(b, 1, sizeof(b), f);
+	fclose(f);
+
+	return len_a == len_b && memcmp(a, b, len_a) == 0;
+}
+
+static void test_snapshot(void)
+{
+	LOG("test_snapshot");
+
+	OSMO_ASSERT(setup_test_hub());
+	OSMO_ASSERT(create_pdp_ctx());
+	OSMO_ASSERT(gtphub_snapshot_save(hub, SNAPSHOT_FILE, now) == 0);
+
+	/* Drop all state, as if gtphub had been restarted. */
+	OSMO_ASSERT(clear_test_hub());
+	OSMO_ASSERT(setup_test_hub());
+	hub->restart_counter = 0x24;
+
+	OSMO_ASSERT(gtphub_snapshot_load(hub, "nonexistent.snapshot", now)
+		    == -ENOENT);
+	OSMO_ASSERT(gtphub_snapshot_load(hub, SNAPSHOT_FILE, now) == 0);
+
+	/* The peers must not see a restart. */
+	OSMO_ASSERT(hub->restart_counter == 0x23);
+	OSMO_ASSERT(tunnels_are(
+		"TEI=1:"
+		" 192.168.42.23 (TEI C=321 U=123)"
+		" <-> 192.168.43.34 (TEI C=765 U=567)"
+		" @21945\n"));
+
+	/* Saving the restored state yields the same snapshot. */
+	OSMO_ASSERT(gtphub_snapshot_save(hub, SNAPSHOT_FILE2, now) == 0);
+	OSMO_ASSERT(files_equal(SNAPSHOT_FILE, SNAPSHOT_FILE2));
+
+	/* TEIs and sequence numbers are mapped as before the restart. */
+	OSMO_ASSERT(delete_pdp_ctx_from_sgsn());
+
+	OSMO_ASSERT(clear_test_hub());
+	unlink(SNAPSHOT_FILE);
+	unlink(SNAPSHOT_FILE2);
+}
+
 static struct log_info_cat gtphub_categories[] = {
 	[DGTPHUB] = {
 		.name = "DGTPHUB",
@@ -1785,16 +1973,19 @@ int main(int argc, char **argv)
 
 	test_nr_map_basic();
 	test_nr_map_wrap();
+	test_nr_map_collisions();
 	test_expiry();
 	test_echo();
 	test_one_pdp_ctx(GTPH_SIDE_SGSN);
 	test_one_pdp_ctx(GTPH_SIDE_GGSN);
 	test_user_data();
 	test_reused_tei();
+	test_many_tunnels();
 	test_peer_restarted();
 	test_peer_restarted_reusing_tei();
 	test_sgsn_behind_nat();
 	test_parallel_context_creation();
+	test_snapshot();
 	printf("Done\n");
 
 	talloc_report_full(osmo_gtphub_ctx, stderr);
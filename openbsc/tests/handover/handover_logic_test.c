@@ -0,0 +1,279 @@
+/* Handover execution test, checking the lookup of the handover records */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <openbsc/debug.h>
+#include <openbsc/gsm_data.h>
+#include <openbsc/signal.h>
+#include <openbsc/handover.h>
+#include <openbsc/abis_rsl.h>
+
+#include <osmocom/core/application.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/core/signal.h>
+#include <osmocom/core/rate_ctr.h>
+
+#include <stdio.h>
+#include <errno.h>
+
+#define NUM_CALLS	16
+/* free channels in the target BTS */
+#define NUM_TARGETS	12
+
+static struct gsm_network *net;
+static struct gsm_bts *bts[2];
+static struct gsm_subscriber_connection *conns[NUM_CALLS];
+static struct gsm_lchan *old_lchans[NUM_CALLS];
+static struct gsm_lchan *targets[NUM_TARGETS];
+static int target_used[NUM_TARGETS];
+
+/* the new lchan of the ongoing handover of a call, as far as the test
+ * knows */
+static struct gsm_lchan *ho_new[NUM_CALLS];
+
+static int target_nr(struct gsm_lchan *lchan)
+{
+	int i;
+
+	for (i = 0; i < NUM_TARGETS; i++)
+		if (targets[i] == lchan)
+			return i;
+	return -1;
+}
+
+struct gsm_lchan *__wrap_lchan_alloc(struct gsm_bts *bts,
+				     enum gsm_chan_t type, int allow_bigger)
+{
+	int i;
+
+	for (i = 0; i < NUM_TARGETS; i++) {
+		if (target_used[i])
+			continue;
+		target_used[i] = 1;
+		targets[i]->type = type;
+		return targets[i];
+	}
+	return NULL;
+}
+
+void __wrap_lchan_free(struct gsm_lchan *lchan)
+{
+	int nr = target_nr(lchan);
+
+	OSMO_ASSERT(nr >= 0);
+	target_used[nr] = 0;
+}
+
+int __wrap_lchan_release(struct gsm_lchan *lchan, int sacch_deact,
+			 enum rsl_rel_mode mode)
+{
+	int nr = target_nr(lchan);
+
+	lchan->conn = NULL;
+	if (nr >= 0)
+		target_used[nr] = 0;
+	return 1;
+}
+
+int __wrap_rsl_chan_activate_lchan(struct gsm_lchan *lchan, uint8_t act_type,
+				   uint8_t ho_ref)
+{
+	return 0;
+}
+
+int __wrap_gsm48_send_ho_cmd(struct gsm_lchan *old_lchan,
+			     struct gsm_lchan *new_lchan, uint8_t power_command,
+			     uint8_t ho_ref)
+{
+	return 0;
+}
+
+static void lchan_init(struct gsm_bts *bts, struct gsm_lchan *lchan,
+		       int ts_nr, int lchan_nr)
+{
+	struct gsm_bts_trx_ts *ts = &bts->c0->ts[ts_nr];
+
+	ts->trx = bts->c0;
+	ts->nr = ts_nr;
+	lchan->ts = ts;
+	lchan->nr = lchan_nr;
+	lchan->type = GSM_LCHAN_TCH_F;
+}
+
+/* every ongoing handover has to be found from both of its lchans, and
+ * nothing else may be found */
+static int check(void)
+{
+	int i, num = 0;
+
+	for (i = 0; i < NUM_CALLS; i++) {
+		struct gsm_lchan *old = old_lchans[i];
+
+		if (!ho_new[i]) {
+			OSMO_ASSERT(!old->ho);
+			OSMO_ASSERT(!conns[i]->ho_lchan);
+			continue;
+		}
+
+		OSMO_ASSERT(old->ho);
+		OSMO_ASSERT(ho_new[i]->ho == old->ho);
+		OSMO_ASSERT(bsc_handover_pending(ho_new[i]) == old);
+		OSMO_ASSERT(!bsc_handover_pending(old));
+		OSMO_ASSERT(conns[i]->ho_lchan == ho_new[i]);
+		OSMO_ASSERT(ho_new[i]->conn == conns[i]);
+		num++;
+	}
+
+	for (i = 0; i < NUM_TARGETS; i++) {
+		int j, in_ho = 0;
+
+		for (j = 0; j < NUM_CALLS; j++)
+			if (ho_new[j] == targets[i])
+				in_ho = 1;
+		if (!in_ho)
+			OSMO_ASSERT(!bsc_handover_pending(targets[i]));
+	}
+
+	return num;
+}
+
+static void signal_lchan(int signal, struct gsm_lchan *lchan)
+{
+	struct lchan_signal_data sig = { .lchan = lchan };
+
+	osmo_signal_dispatch(SS_LCHAN, signal, &sig);
+}
+
+static void start_all(void)
+{
+	int i, rc, started = 0, no_channel = 0;
+
+	for (i = 0; i < NUM_CALLS; i++) {
+		if (ho_new[i] || old_lchans[i]->ts->trx->bts != bts[0])
+			continue;
+		rc = bsc_handover_start(old_lchans[i], bts[1]);
+		if (rc == -ENOSPC) {
+			no_channel++;
+			continue;
+		}
+		OSMO_ASSERT(rc == 0);
+		ho_new[i] = conns[i]->ho_lchan;
+		started++;
+	}
+	printf("  %d handovers started, %d without a channel\n", started,
+	       no_channel);
+}
+
+static void test_mass_handover(void)
+{
+	int i;
+
+	printf("Testing a TRX failure.\n");
+
+	/* all calls of the failed TRX are handed over at once */
+	start_all();
+	printf("  %d handovers ongoing\n", check());
+
+	printf("  another handover for call 0: %s\n",
+	       bsc_handover_start(old_lchans[0], bts[1]) == -EBUSY ?
+	       "busy" : "started");
+	printf("  %d handovers ongoing\n", check());
+
+	/* the activation of one new lchan fails */
+	signal_lchan(S_LCHAN_ACTIVATE_NACK, ho_new[9]);
+	ho_new[9] = NULL;
+	for (i = 0; i < NUM_CALLS; i++)
+		if (ho_new[i])
+			signal_lchan(S_LCHAN_ACTIVATE_ACK, ho_new[i]);
+	printf("  activation acked, %d handovers ongoing\n", check());
+
+	for (i = 0; i < 6; i++) {
+		struct gsm_lchan *new_lchan = ho_new[i];
+
+		signal_lchan(S_LCHAN_HANDOVER_COMPL, new_lchan);
+		OSMO_ASSERT(conns[i]->lchan == new_lchan);
+		OSMO_ASSERT(!old_lchans[i]->conn);
+		ho_new[i] = NULL;
+		old_lchans[i] = new_lchan;
+	}
+	printf("  6 completed, %d handovers ongoing\n", check());
+
+	for (i = 6; i < 9; i++) {
+		signal_lchan(S_LCHAN_HANDOVER_FAIL, old_lchans[i]);
+		ho_new[i] = NULL;
+	}
+	printf("  3 failed, %d handovers ongoing\n", check());
+
+	/* the call is released during the handover */
+	bsc_clear_handover(conns[10], 1);
+	ho_new[10] = NULL;
+	printf("  1 cleared, %d handovers ongoing\n", check());
+
+	/* the calls still on the failed TRX try again */
+	start_all();
+	printf("  %d handovers ongoing\n", check());
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	osmo_init_logging(&log_info);
+	log_set_print_filename(osmo_stderr_target, 0);
+	log_set_log_level(osmo_stderr_target, LOGL_FATAL);
+
+	net = talloc_zero(NULL, struct gsm_network);
+	INIT_LLIST_HEAD(&net->bts_list);
+	net->bsc_ctrs = rate_ctr_group_alloc(net, &bsc_ctrg_desc, 0);
+
+	for (i = 0; i < ARRAY_SIZE(bts); i++) {
+		bts[i] = talloc_zero(net, struct gsm_bts);
+		bts[i]->network = net;
+		bts[i]->nr = i;
+		bts[i]->c0 = talloc_zero(bts[i], struct gsm_bts_trx);
+		bts[i]->c0->bts = bts[i];
+		llist_add_tail(&bts[i]->list, &net->bts_list);
+	}
+
+	for (i = 0; i < NUM_CALLS; i++) {
+		old_lchans[i] = &bts[0]->c0->ts[i % 8].lchan[i / 8];
+		lchan_init(bts[0], old_lchans[i], i % 8, i / 8);
+
+		conns[i] = talloc_zero(net, struct gsm_subscriber_connection);
+		conns[i]->bts = bts[0];
+		conns[i]->lchan = old_lchans[i];
+		old_lchans[i]->conn = conns[i];
+	}
+
+	for (i = 0; i < NUM_TARGETS; i++) {
+		targets[i] = &bts[1]->c0->ts[i % 8].lchan[i / 8];
+		lchan_init(bts[1], targets[i], i % 8, i / 8);
+	}
+
+	test_mass_handover();
+
+	for (i = 0; i < NUM_CALLS; i++)
+		if (ho_new[i])
+			bsc_clear_handover(conns[i], 1);
+	check();
+
+	rate_ctr_group_free(net->bsc_ctrs);
+	talloc_free(net);
+	printf("Done\n");
+	return 0;
+}
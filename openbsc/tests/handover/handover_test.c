@@ -0,0 +1,307 @@
+/* Handover decision test, replaying measurement report streams */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <openbsc/debug.h>
+#include <openbsc/gsm_data.h>
+#include <openbsc/meas_rep.h>
+#include <openbsc/signal.h>
+#include <openbsc/handover_decision.h>
+
+#include <osmocom/core/application.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/core/signal.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define NUM_LCHANS	4
+
+struct replay_cell {
+	uint16_t arfcn;
+	uint8_t bsic;
+	uint8_t rxlev;
+};
+
+/* a recorded measurement report, the cells end with ARFCN 0 */
+struct replay_rep {
+	int lchan;
+	uint8_t rxlev;
+	uint8_t rxqual;
+	struct replay_cell cell[6];
+};
+
+static struct gsm_network *net;
+static struct gsm_lchan *lchans[NUM_LCHANS];
+static uint8_t meas_nr[NUM_LCHANS];
+
+/* a handover is ongoing on the lchan */
+static int ho_active[NUM_LCHANS];
+/* what bsc_handover_start() returns for a BTS */
+static int bts_rc[4];
+static unsigned int num_ho_start;
+static unsigned int report;
+
+static time_t fake_now = 1000;
+
+int __real_clock_gettime(clockid_t clk_id, struct timespec *tp);
+int __wrap_clock_gettime(clockid_t clk_id, struct timespec *tp)
+{
+	if (clk_id != CLOCK_MONOTONIC)
+		return __real_clock_gettime(clk_id, tp);
+	tp->tv_sec = fake_now;
+	tp->tv_nsec = 0;
+	return 0;
+}
+
+static int lchan_nr(struct gsm_lchan *lchan)
+{
+	int i;
+
+	for (i = 0; i < NUM_LCHANS; i++)
+		if (lchans[i] == lchan)
+			return i;
+	OSMO_ASSERT(0);
+	return -1;
+}
+
+int __wrap_bsc_handover_start(struct gsm_lchan *old_lchan,
+			      struct gsm_bts *bts)
+{
+	int nr = lchan_nr(old_lchan);
+
+	num_ho_start += 1;
+	printf("  report %u, lchan %d: handover to BTS %d", report, nr,
+	       bts->nr);
+
+	if (ho_active[nr]) {
+		printf(": busy\n");
+		return -EBUSY;
+	}
+	if (bts_rc[bts->nr]) {
+		printf(": no channel\n");
+		return bts_rc[bts->nr];
+	}
+
+	printf("\n");
+	ho_active[nr] = 1;
+	return 0;
+}
+
+static struct gsm_bts *bts_alloc(int nr, uint16_t arfcn, uint8_t bsic)
+{
+	struct gsm_bts *bts = talloc_zero(net, struct gsm_bts);
+	struct gsm_bts_trx *trx = talloc_zero(bts, struct gsm_bts_trx);
+
+	bts->network = net;
+	bts->nr = nr;
+	bts->bsic = bsic;
+	bts->c0 = trx;
+	trx->bts = bts;
+	trx->arfcn = arfcn;
+	llist_add_tail(&bts->list, &net->bts_list);
+	return bts;
+}
+
+static void replay(const struct replay_rep *reps, unsigned int num,
+		   unsigned int batch)
+{
+	struct gsm_meas_rep *mrs[16];
+	unsigned int i, j, n = 0;
+
+	OSMO_ASSERT(batch <= ARRAY_SIZE(mrs));
+
+	for (i = 0; i < num; i++) {
+		const struct replay_rep *rep = &reps[i];
+		struct gsm_lchan *lchan = lchans[rep->lchan];
+		struct gsm_meas_rep *mr = lchan_next_meas_rep(lchan);
+
+		mr->nr = meas_nr[rep->lchan]++;
+		mr->dl.full.rx_lev = rep->rxlev;
+		mr->dl.full.rx_qual = rep->rxqual;
+		for (j = 0; j < ARRAY_SIZE(rep->cell) && rep->cell[j].arfcn; j++) {
+			mr->cell[j].arfcn = rep->cell[j].arfcn;
+			mr->cell[j].bsic = rep->cell[j].bsic;
+			mr->cell[j].rxlev = rep->cell[j].rxlev;
+		}
+		mr->num_cell = j;
+
+		mrs[n++] = mr;
+		if (n < batch && i + 1 < num)
+			continue;
+
+		report = i;
+		ho_dec_meas_reps(mrs, n);
+		n = 0;
+	}
+}
+
+/* the running sums must match the windows they stand for */
+static void check_sums(void)
+{
+	unsigned int window = net->handover.win_rxlev_avg_neigh;
+	int i, j, k;
+
+	for (i = 0; i < NUM_LCHANS; i++) {
+		for (j = 0; j < MAX_NEIGH_MEAS; j++) {
+			struct neigh_meas_proc *nmp = &lchans[i]->neigh_meas[j];
+			unsigned int sum = 0;
+
+			if (!nmp->arfcn)
+				continue;
+			OSMO_ASSERT(nmp->rxlev_win == window);
+			for (k = 1; k <= window && k <= nmp->rxlev_cnt; k++)
+				sum += nmp->rxlev[(nmp->rxlev_cnt - k) %
+						  MAX_WIN_NEIGH_AVG];
+			OSMO_ASSERT(sum == nmp->rxlev_sum);
+		}
+	}
+}
+
+/* walking towards BTS 1, with a single strong report from BTS 3 */
+static const struct replay_rep walk[] = {
+	{ 0, 30, 0, { { 10, 1, 20 }, { 20, 2, 15 } } },
+	{ 0, 30, 0, { { 10, 1, 22 }, { 20, 2, 15 } } },
+	{ 0, 28, 0, { { 10, 1, 24 }, { 20, 2, 15 }, { 30, 3, 50 } } },
+	{ 0, 26, 0, { { 10, 1, 26 }, { 20, 2, 15 } } },
+	{ 0, 24, 0, { { 10, 1, 28 }, { 20, 2, 15 } } },
+	{ 0, 22, 0, { { 10, 1, 30 }, { 20, 2, 15 } } },
+	{ 0, 20, 0, { { 10, 1, 32 }, { 20, 2, 15 } } },
+	{ 0, 18, 0, { { 10, 1, 34 }, { 20, 2, 15 } } },
+};
+
+static void test_walk(void)
+{
+	printf("Testing a walk towards BTS 1.\n");
+	replay(walk, ARRAY_SIZE(walk), 1);
+	check_sums();
+}
+
+/* BTS 1 is the better neighbor, BTS 2 the second best */
+static const struct replay_rep ranked[] = {
+	{ 1, 20, 0, { { 10, 1, 40 }, { 20, 2, 36 } } },
+};
+
+static void test_rank_and_penalty(void)
+{
+	struct lchan_signal_data sig = { .lchan = lchans[1] };
+
+	printf("Testing ranking and penalty time.\n");
+
+	/* no room in BTS 1, the call goes to BTS 2 instead */
+	bts_rc[1] = -ENOSPC;
+	replay(ranked, ARRAY_SIZE(ranked), 1);
+	replay(ranked, ARRAY_SIZE(ranked), 1);
+
+	/* the handover to BTS 2 fails as well */
+	printf("  handover fails\n");
+	ho_active[1] = 0;
+	osmo_signal_dispatch(SS_LCHAN, S_LCHAN_HANDOVER_FAIL, &sig);
+	replay(ranked, ARRAY_SIZE(ranked), 1);
+
+	bts_rc[1] = 0;
+	fake_now += net->handover.penalty_time - 1;
+	replay(ranked, ARRAY_SIZE(ranked), 1);
+	printf("  %u seconds later\n", net->handover.penalty_time);
+	fake_now += 1;
+	replay(ranked, ARRAY_SIZE(ranked), 1);
+	check_sums();
+}
+
+static void test_timeout(void)
+{
+	struct lchan_signal_data sig = { .lchan = lchans[1] };
+
+	printf("Testing a handover timeout.\n");
+
+	/* T3103 expires for the handover to BTS 1 started above, BTS 2 is
+	 * no longer penalized */
+	ho_active[1] = 0;
+	osmo_signal_dispatch(SS_LCHAN, S_LCHAN_HANDOVER_TIMEOUT, &sig);
+	replay(ranked, ARRAY_SIZE(ranked), 1);
+	check_sums();
+}
+
+/* two calls reporting a strong BTS 3 */
+static const struct replay_rep interleaved[] = {
+	{ 2, 10, 0, { { 30, 3, 40 } } },
+	{ 3, 10, 0, { { 30, 3, 40 } } },
+	{ 2, 10, 0, { { 30, 3, 41 } } },
+	{ 3, 10, 0, { { 30, 3, 41 } } },
+	{ 2, 10, 0, { { 30, 3, 42 } } },
+	{ 3, 10, 0, { { 30, 3, 42 } } },
+};
+
+static void test_batch(void)
+{
+	printf("Testing a batch of reports.\n");
+	num_ho_start = 0;
+	replay(interleaved, ARRAY_SIZE(interleaved), ARRAY_SIZE(interleaved));
+	printf("  %u decisions\n", num_ho_start);
+	check_sums();
+}
+
+int main(int argc, char **argv)
+{
+	struct gsm_bts *bts;
+	int i;
+
+	osmo_init_logging(&log_info);
+	log_set_print_filename(osmo_stderr_target, 0);
+	log_set_log_level(osmo_stderr_target, LOGL_FATAL);
+
+	net = talloc_zero(NULL, struct gsm_network);
+	INIT_LLIST_HEAD(&net->bts_list);
+	net->handover.active = 1;
+	net->handover.win_rxlev_avg = 4;
+	net->handover.win_rxqual_avg = 1;
+	net->handover.win_rxlev_avg_neigh = 4;
+	net->handover.pwr_interval = 1;
+	net->handover.pwr_hysteresis = 3;
+	net->handover.max_distance = 9999;
+	net->handover.penalty_time = 10;
+
+	/* the calls are on BTS 0, the neighbors are BTS 1 to 3 */
+	bts = bts_alloc(0, 1, 0);
+	bts_alloc(1, 10, 1);
+	bts_alloc(2, 20, 2);
+	bts_alloc(3, 30, 3);
+
+	for (i = 0; i < NUM_LCHANS; i++) {
+		struct gsm_bts_trx_ts *ts = &bts->c0->ts[i + 1];
+
+		ts->trx = bts->c0;
+		ts->nr = i + 1;
+		lchans[i] = &ts->lchan[0];
+		lchans[i]->ts = ts;
+		lchans[i]->type = GSM_LCHAN_TCH_F;
+	}
+
+	on_dso_load_ho_dec();
+
+	test_walk();
+	test_rank_and_penalty();
+	test_timeout();
+	test_batch();
+
+	talloc_free(net);
+	printf("Done\n");
+	return 0;
+}
@@ -0,0 +1,281 @@
+/* test the columnar archive of measurement reports */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <openbsc/meas_feed.h>
+
+#include <osmocom/core/utils.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "meas_arch.h"
+
+/* 2017-07-14T02:00:00Z */
+#define T0		1499997600
+
+static void fake_mfm(struct meas_feed_meas *mfm, unsigned int i,
+		     uint8_t bts_nr)
+{
+	memset(mfm, 0, sizeof(*mfm));
+	snprintf(mfm->imsi, sizeof(mfm->imsi), "90170000000%04u", i % 3);
+	mfm->bts_nr = bts_nr;
+	mfm->trx_nr = 1;
+	mfm->ts_nr = 2;
+	mfm->ss_nr = i % 2;
+	mfm->mr.ul.full.rx_lev = i % 64;
+	mfm->mr.ul.full.rx_qual = i % 8;
+	/* every fourth report without a downlink, every third without L1 */
+	if (i % 4) {
+		mfm->mr.flags |= MEAS_REP_F_DL_VALID;
+		mfm->mr.dl.full.rx_lev = (i + 1) % 64;
+		mfm->mr.dl.full.rx_qual = (i + 1) % 8;
+	}
+	mfm->mr.bs_power = i % 16;
+	if (i % 3) {
+		mfm->mr.flags |= MEAS_REP_F_MS_L1;
+		mfm->mr.ms_l1.ta = i % 64;
+		mfm->mr.ms_l1.pwr = (int) (i % 40) - 10;
+	}
+}
+
+static int rm_cb(const char *path, const struct stat *st, int flag,
+		 struct FTW *ftw)
+{
+	return remove(path);
+}
+
+static void rm_tree(const char *dir)
+{
+	nftw(dir, rm_cb, 8, FTW_DEPTH | FTW_PHYS);
+}
+
+static char *make_dir(void)
+{
+	static char dir[] = "/tmp/meas_arch_test.XXXXXX";
+
+	strcpy(dir + strlen(dir) - 6, "XXXXXX");
+	OSMO_ASSERT(mkdtemp(dir));
+	return dir;
+}
+
+/* Check every column of a partition against what fake_mfm() put in */
+static int check_part(const char *path, time_t start, int bts_nr, void *data)
+{
+	static const int all[] = {
+		MEAS_ARCH_COL_TIME, MEAS_ARCH_COL_IMSI, MEAS_ARCH_COL_CHAN,
+		MEAS_ARCH_COL_UL_RXLEV, MEAS_ARCH_COL_UL_RXQUAL,
+		MEAS_ARCH_COL_DL_RXLEV, MEAS_ARCH_COL_DL_RXQUAL,
+		MEAS_ARCH_COL_BS_POWER, MEAS_ARCH_COL_MS_TA,
+		MEAS_ARCH_COL_MS_PWR,
+	};
+	struct meas_arch_part part;
+	const uint32_t *times;
+	const uint64_t *imsis;
+	const uint16_t *chans;
+	const uint8_t *ul_lev, *ul_qual, *dl_lev, *dl_qual, *bs_pwr, *ta;
+	const int8_t *ms_pwr;
+	unsigned int *total = data;
+	unsigned int i;
+	size_t row;
+
+	OSMO_ASSERT(meas_arch_part_map(&part, path, all, ARRAY_SIZE(all)) == 0);
+	printf("Partition %ld bts%d: %zu rows\n", (long) (start - T0),
+	       bts_nr, part.rows);
+
+	times = part.col[MEAS_ARCH_COL_TIME];
+	imsis = part.col[MEAS_ARCH_COL_IMSI];
+	chans = part.col[MEAS_ARCH_COL_CHAN];
+	ul_lev = part.col[MEAS_ARCH_COL_UL_RXLEV];
+	ul_qual = part.col[MEAS_ARCH_COL_UL_RXQUAL];
+	dl_lev = part.col[MEAS_ARCH_COL_DL_RXLEV];
+	dl_qual = part.col[MEAS_ARCH_COL_DL_RXQUAL];
+	bs_pwr = part.col[MEAS_ARCH_COL_BS_POWER];
+	ta = part.col[MEAS_ARCH_COL_MS_TA];
+	ms_pwr = part.col[MEAS_ARCH_COL_MS_PWR];
+
+	for (row = 0; row < part.rows; row++) {
+		/* the report number is encoded in the time */
+		i = (times[row] - T0) / 2;
+		OSMO_ASSERT(times[row] >= start);
+		OSMO_ASSERT(times[row] < start + MEAS_ARCH_PART_SECS);
+		OSMO_ASSERT(i % 2 == bts_nr);
+		OSMO_ASSERT(imsis[row] == 901700000000000ULL + i % 3);
+		OSMO_ASSERT(chans[row] == (1 << 8 | 2 << 3 | i % 2));
+		OSMO_ASSERT(ul_lev[row] == i % 64);
+		OSMO_ASSERT(ul_qual[row] == i % 8);
+		if (i % 4) {
+			OSMO_ASSERT(dl_lev[row] == (i + 1) % 64);
+			OSMO_ASSERT(dl_qual[row] == (i + 1) % 8);
+		} else {
+			OSMO_ASSERT(dl_lev[row] == MEAS_ARCH_INVALID);
+			OSMO_ASSERT(dl_qual[row] == MEAS_ARCH_INVALID);
+		}
+		OSMO_ASSERT(bs_pwr[row] == i % 16);
+		if (i % 3) {
+			OSMO_ASSERT(ta[row] == i % 64);
+			OSMO_ASSERT(ms_pwr[row] == (int) (i % 40) - 10);
+		} else {
+			OSMO_ASSERT(ta[row] == MEAS_ARCH_INVALID);
+			OSMO_ASSERT(ms_pwr[row] == INT8_MAX);
+		}
+		/* rows are in the order they were appended */
+		OSMO_ASSERT(row == 0 || times[row] > times[row - 1]);
+	}
+
+	*total += part.rows;
+	meas_arch_part_unmap(&part);
+	return 0;
+}
+
+/* one report every two seconds, alternating between two BTS */
+static void write_archive(const char *dir, unsigned int num)
+{
+	struct meas_arch *arch;
+	struct meas_feed_meas mfm;
+	unsigned int i;
+
+	arch = meas_arch_open(NULL, dir);
+	OSMO_ASSERT(arch);
+	for (i = 0; i < num; i++) {
+		fake_mfm(&mfm, i, i % 2);
+		OSMO_ASSERT(meas_arch_append(arch, T0 + 2 * i, &mfm) == 0);
+	}
+	meas_arch_close(arch);
+}
+
+static void test_round_trip(void)
+{
+	char *dir = make_dir();
+	unsigned int total = 0;
+
+	printf("Testing round trip\n");
+
+	/* more than a buffer per partition, three hours */
+	write_archive(dir, 5000);
+
+	OSMO_ASSERT(meas_arch_scan(dir, 0, 0, -1, check_part, &total) == 0);
+	printf("Read %u rows\n", total);
+	OSMO_ASSERT(total == 5000);
+
+	printf("Scanning the second hour of bts1\n");
+	total = 0;
+	OSMO_ASSERT(meas_arch_scan(dir, T0 + 3600, T0 + 7200, 1,
+				   check_part, &total) == 0);
+	OSMO_ASSERT(total == 900);
+
+	rm_tree(dir);
+}
+
+static void test_append_again(void)
+{
+	char *dir = make_dir();
+	char fname[PATH_MAX];
+	struct meas_arch *arch;
+	struct meas_feed_meas mfm;
+	unsigned int total = 0;
+	int fd;
+
+	printf("Testing a second writer and a torn partition\n");
+
+	write_archive(dir, 10);
+
+	/* a writer that died between the columns of its last flush */
+	snprintf(fname, sizeof(fname), "%s/20170714T02/bts0/time", dir);
+	fd = open(fname, O_WRONLY | O_APPEND);
+	OSMO_ASSERT(fd >= 0);
+	OSMO_ASSERT(write(fd, "\x01\x02\x03\x04\x05\x06", 6) == 6);
+	close(fd);
+
+	arch = meas_arch_open(NULL, dir);
+	OSMO_ASSERT(arch);
+	fake_mfm(&mfm, 10, 0);
+	OSMO_ASSERT(meas_arch_append(arch, T0 + 20, &mfm) == 0);
+	meas_arch_close(arch);
+
+	OSMO_ASSERT(meas_arch_scan(dir, 0, 0, -1, check_part, &total) == 0);
+	OSMO_ASSERT(total == 11);
+
+	rm_tree(dir);
+}
+
+static void test_flush_error(void)
+{
+	char *dir = make_dir();
+	char fname[PATH_MAX];
+	struct meas_arch *arch;
+	struct meas_feed_meas mfm;
+	unsigned int i, errors = 0, total = 0;
+	int fd, rc;
+
+	printf("Testing a failing flush\n");
+
+	/* a file in place of the hour directory */
+	snprintf(fname, sizeof(fname), "%s/20170714T02", dir);
+	fd = open(fname, O_WRONLY | O_CREAT, 0644);
+	OSMO_ASSERT(fd >= 0);
+	close(fd);
+
+	arch = meas_arch_open(NULL, dir);
+	OSMO_ASSERT(arch);
+
+	/* the buffered rows are dropped and the buffer is reused */
+	fake_mfm(&mfm, 0, 0);
+	for (i = 0; i < 3000; i++) {
+		rc = meas_arch_append(arch, T0, &mfm);
+		if (rc < 0)
+			errors += 1;
+	}
+	printf("Failed flushes: %u\n", errors);
+	OSMO_ASSERT(meas_arch_flush(arch) < 0);
+
+	/* once the disk is fine again, new reports are stored */
+	unlink(fname);
+	fake_mfm(&mfm, 1000, 0);
+	OSMO_ASSERT(meas_arch_append(arch, T0 + 2000, &mfm) == 0);
+	OSMO_ASSERT(meas_arch_flush(arch) == 0);
+	meas_arch_close(arch);
+
+	OSMO_ASSERT(meas_arch_scan(dir, 0, 0, -1, check_part, &total) == 0);
+	OSMO_ASSERT(total == 1);
+
+	rm_tree(dir);
+}
+
+int main(int argc, char **argv)
+{
+	/* -w DIR leaves an archive behind for osmo-meas-query */
+	if (argc == 3 && !strcmp(argv[1], "-w")) {
+		write_archive(argv[2], 5000);
+		return 0;
+	}
+
+	test_round_trip();
+	test_append_again();
+	test_flush_error();
+
+	printf("Done\n");
+	return 0;
+}
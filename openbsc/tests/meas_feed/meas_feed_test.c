@@ -0,0 +1,242 @@
+/* test the UDP feed and the shared memory ring of measurement reports */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#include <openbsc/meas_rep.h>
+
+static int lap_during_copy;
+static void send_report(void);
+
+#define NUM_SLOTS	4
+
+/* the writer laps the reader while it copies the record */
+static void *copy_and_lap(void *dst, const void *src, size_t len)
+{
+	int i;
+
+	memcpy(dst, src, len);
+	if (lap_during_copy) {
+		lap_during_copy = 0;
+		for (i = 0; i < NUM_SLOTS; ++i)
+			send_report();
+	}
+	return dst;
+}
+
+/* only the reader of the ring copies through the hook */
+#define memcpy(dst, src, len)	copy_and_lap(dst, src, len)
+#include <openbsc/meas_feed.h>
+#undef memcpy
+
+#include <openbsc/gsm_data.h>
+#include <openbsc/gsm_subscriber.h>
+#include <openbsc/signal.h>
+
+#include <osmocom/core/select.h>
+#include <osmocom/core/signal.h>
+#include <osmocom/core/utils.h>
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "meas_feed.h"
+
+#define SHM_NAME	"/meas_feed_test"
+
+static struct gsm_bts bts = { .nr = 1, };
+static struct gsm_bts_trx trx = { .bts = &bts, .nr = 0, };
+static struct gsm_bts_trx_ts ts = { .trx = &trx, .nr = 2, };
+static struct gsm_subscriber subscr = { .imsi = "901700000000001", };
+static struct gsm_subscriber_connection conn = { .subscr = &subscr, };
+static struct gsm_lchan lchan = { .ts = &ts, .conn = &conn, .nr = 1, };
+static uint8_t report_nr;
+
+/* reports are numbered from one, the nth record in the ring has nr n + 1 */
+static void send_report(void)
+{
+	struct gsm_meas_rep mr;
+	struct lchan_signal_data sig;
+
+	memset(&mr, 0, sizeof(mr));
+	mr.lchan = &lchan;
+	mr.nr = ++report_nr;
+
+	sig.lchan = &lchan;
+	sig.mr = &mr;
+	osmo_signal_dispatch(SS_LCHAN, S_LCHAN_MEAS_REP, &sig);
+}
+
+static void verify_mfm(const struct meas_feed_meas *mfm, uint8_t nr)
+{
+	OSMO_ASSERT(mfm->hdr.msg_type == MEAS_FEED_MEAS);
+	OSMO_ASSERT(mfm->hdr.version == MEAS_FEED_VERSION);
+	OSMO_ASSERT(strcmp(mfm->imsi, subscr.imsi) == 0);
+	OSMO_ASSERT(mfm->mr.nr == nr);
+	OSMO_ASSERT(mfm->bts_nr == 1);
+	OSMO_ASSERT(mfm->ts_nr == 2);
+	OSMO_ASSERT(mfm->ss_nr == 1);
+}
+
+static const struct meas_feed_ring *map_ring(void)
+{
+	const struct meas_feed_ring *ring;
+	size_t size = meas_feed_ring_size(NUM_SLOTS);
+	int fd;
+
+	/* like any other reader */
+	fd = shm_open(SHM_NAME, O_RDONLY, 0);
+	OSMO_ASSERT(fd >= 0);
+	ring = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	OSMO_ASSERT(ring != MAP_FAILED);
+	OSMO_ASSERT(meas_feed_ring_valid(ring));
+	OSMO_ASSERT(ring->num_slots == NUM_SLOTS);
+	return ring;
+}
+
+static void test_ring(void)
+{
+	const struct meas_feed_ring *ring;
+	struct meas_feed_meas mfm;
+	uint64_t pos;
+	int i, num;
+
+	printf("Testing the ring\n");
+
+	/* the number of slots is rounded up to a power of two */
+	OSMO_ASSERT(meas_feed_shm_set(SHM_NAME, NUM_SLOTS - 1) == 0);
+	ring = map_ring();
+	pos = ring->head;
+	OSMO_ASSERT(pos == 0);
+	OSMO_ASSERT(meas_feed_ring_read(ring, &pos, &mfm) == 0);
+
+	/* what goes in comes out */
+	send_report();
+	OSMO_ASSERT(meas_feed_ring_read(ring, &pos, &mfm) == 1);
+	verify_mfm(&mfm, 1);
+	OSMO_ASSERT(meas_feed_ring_read(ring, &pos, &mfm) == 0);
+	printf("  read 1 of 1\n");
+
+	/* a reader lapped by the writer continues with the oldest slot */
+	for (i = 0; i < NUM_SLOTS + 2; ++i)
+		send_report();
+	for (num = 0; meas_feed_ring_read(ring, &pos, &mfm) == 1; ++num)
+		verify_mfm(&mfm, pos);
+	OSMO_ASSERT(pos == ring->head);
+	printf("  read %d of %d after being lapped\n", num, NUM_SLOTS + 2);
+
+	/* a slot rewritten during the copy is skipped */
+	send_report();
+	lap_during_copy = 1;
+	OSMO_ASSERT(meas_feed_ring_read(ring, &pos, &mfm) == -EAGAIN);
+	OSMO_ASSERT(!lap_during_copy);
+	for (num = 0; meas_feed_ring_read(ring, &pos, &mfm) == 1; ++num)
+		verify_mfm(&mfm, pos);
+	OSMO_ASSERT(num == NUM_SLOTS);
+	OSMO_ASSERT(pos == ring->head);
+	printf("  rewritten during the copy\n");
+
+	munmap((void *) ring, meas_feed_ring_size(NUM_SLOTS));
+	meas_feed_shm_del();
+}
+
+/* let the write queue and the timers run once, then look for a datagram */
+static int recv_feed(int sock, uint8_t *buf, size_t len)
+{
+	osmo_select_main(1);
+	return recv(sock, buf, len, MSG_DONTWAIT);
+}
+
+static void verify_datagram(const uint8_t *buf, int len, int num, uint8_t nr)
+{
+	int i;
+
+	OSMO_ASSERT(len == num * sizeof(struct meas_feed_meas));
+	for (i = 0; i < num; ++i)
+		verify_mfm(((const struct meas_feed_meas *) buf) + i, nr + i);
+}
+
+static void test_udp(void)
+{
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	uint8_t buf[MEAS_FEED_MAX_BATCH * sizeof(struct meas_feed_meas)];
+	uint8_t nr;
+	int sock, rc, i;
+
+	printf("Testing the UDP feed\n");
+
+	sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	OSMO_ASSERT(sock >= 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	OSMO_ASSERT(bind(sock, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+	OSMO_ASSERT(getsockname(sock, (struct sockaddr *) &addr, &addr_len) == 0);
+	OSMO_ASSERT(meas_feed_cfg_set("127.0.0.1", ntohs(addr.sin_port)) == 0);
+
+	/* one report per datagram by default */
+	send_report();
+	rc = recv_feed(sock, buf, sizeof(buf));
+	verify_datagram(buf, rc, 1, report_nr);
+
+	/* a full batch goes out as one datagram */
+	meas_feed_batch_set(3);
+	nr = report_nr + 1;
+	send_report();
+	send_report();
+	OSMO_ASSERT(recv_feed(sock, buf, sizeof(buf)) < 0);
+	send_report();
+	rc = recv_feed(sock, buf, sizeof(buf));
+	verify_datagram(buf, rc, 3, nr);
+	printf("  datagram of %d records\n", rc / (int) sizeof(struct meas_feed_meas));
+
+	/* the rest of a batch waits for the timer */
+	nr = report_nr + 1;
+	send_report();
+	send_report();
+	OSMO_ASSERT(recv_feed(sock, buf, sizeof(buf)) < 0);
+	for (i = 0; i < 10; ++i) {
+		/* block until the timer fires */
+		osmo_select_main(0);
+		rc = recv_feed(sock, buf, sizeof(buf));
+		if (rc >= 0)
+			break;
+	}
+	verify_datagram(buf, rc, 2, nr);
+	printf("  datagram of %d records after the timer\n",
+	       rc / (int) sizeof(struct meas_feed_meas));
+
+	close(sock);
+}
+
+int main(int argc, char **argv)
+{
+	test_ring();
+	test_udp();
+
+	printf("Done\n");
+	return 0;
+}
@@ -0,0 +1,261 @@
+/* MNCC socket queueing and throughput test */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <openbsc/debug.h>
+#include <openbsc/gsm_data.h>
+#include <openbsc/mncc.h>
+#include <openbsc/gsm_subscriber.h>
+#include <openbsc/transaction.h>
+
+#include <osmocom/core/application.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/select.h>
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define SOCK_PATH	"mncc_sock_test.sock"
+#define NUM_FRAMES	100000
+#define FRAMES_PER_ROUND 64
+#define NUM_REQUESTS	1000
+
+static struct gsm_network *net;
+static int peer_fd = -1;
+
+/* what the dummy call control application has seen */
+static unsigned int peer_frames;
+static unsigned int peer_rel_ind;
+static unsigned int peer_rel_cnf;
+static unsigned int peer_disc_ind;
+static unsigned int peer_hello;
+static uint32_t peer_last_callref;
+static int peer_order_ok = 1;
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static uint64_t ctr(int idx)
+{
+	return net->msc_ctrs->ctr[idx].current;
+}
+
+static void peer_drain(void)
+{
+	uint8_t buf[sizeof(struct gsm_mncc) + 256];
+	struct gsm_mncc *mncc = (struct gsm_mncc *) buf;
+	int rc;
+
+	while ((rc = recv(peer_fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		switch (mncc->msg_type) {
+		case MNCC_SOCKET_HELLO:
+			peer_hello += 1;
+			break;
+		case GSM_TCHF_FRAME:
+			peer_frames += 1;
+			break;
+		case MNCC_REL_IND:
+			if (mncc->callref != peer_last_callref + 1)
+				peer_order_ok = 0;
+			peer_last_callref = mncc->callref;
+			peer_rel_ind += 1;
+			break;
+		case MNCC_REL_CNF:
+			peer_rel_cnf += 1;
+			break;
+		case MNCC_DISC_IND:
+			peer_disc_ind += 1;
+			break;
+		}
+	}
+}
+
+/* one non-blocking round of the main loop plus the peer */
+static void service(void)
+{
+	osmo_select_main(1);
+	peer_drain();
+}
+
+static void queue_frame(uint32_t callref)
+{
+	struct gsm_data_frame *frame;
+	struct msgb *msg;
+
+	msg = msgb_alloc(sizeof(*frame) + 33, "frame");
+	frame = (struct gsm_data_frame *) msgb_put(msg, sizeof(*frame) + 33);
+	memset(frame, 0, sizeof(*frame) + 33);
+	frame->msg_type = GSM_TCHF_FRAME;
+	frame->callref = callref;
+	mncc_sock_from_cc(net, msg);
+}
+
+static void queue_prim(int msg_type, uint32_t callref)
+{
+	struct gsm_mncc *mncc;
+	struct msgb *msg;
+
+	msg = msgb_alloc(sizeof(*mncc), "prim");
+	mncc = (struct gsm_mncc *) msgb_put(msg, sizeof(*mncc));
+	memset(mncc, 0, sizeof(*mncc));
+	mncc->msg_type = msg_type;
+	mncc->callref = callref;
+	mncc_sock_from_cc(net, msg);
+}
+
+static void peer_connect(void)
+{
+	struct sockaddr_un addr;
+	int i;
+
+	peer_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	OSMO_ASSERT(peer_fd >= 0);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, SOCK_PATH);
+	OSMO_ASSERT(connect(peer_fd, (struct sockaddr *) &addr,
+			    sizeof(addr)) == 0);
+
+	for (i = 0; i < 100 && !peer_hello; i++)
+		service();
+	printf("Peer connected, hello %s\n", peer_hello ? "received" : "MISSING");
+}
+
+static void test_queue_limit(void)
+{
+	struct gsm_subscriber *subscr;
+	int i;
+
+	printf("Testing the queue limit.\n");
+	net->mncc_sock_queue_max = 100;
+
+	/* the peer is stuck, nothing gets written */
+	for (i = 0; i < 1000; i++)
+		queue_frame(1);
+	printf("Dropped %"PRIu64" frames\n", ctr(MSC_CTR_MNCC_QUEUE_DROP));
+
+	/* a new call is refused, its release is not announced either */
+	subscr = subscr_alloc();
+	OSMO_ASSERT(subscr);
+	subscr->group = net->subscr_group;
+	OSMO_ASSERT(trans_alloc(net, subscr, GSM48_PDISC_CC, 0, 0x1000));
+	subscr_put(subscr);
+	queue_prim(MNCC_SETUP_IND, 0x1000);
+	OSMO_ASSERT(!trans_find_by_callref(net, 0x1000));
+	/* existing calls push out a voice frame */
+	queue_prim(MNCC_DISC_IND, 0x1001);
+	printf("Rejected %"PRIu64" calls, dropped %"PRIu64" frames\n",
+	       ctr(MSC_CTR_MNCC_QUEUE_REJECT), ctr(MSC_CTR_MNCC_QUEUE_DROP));
+
+	peer_last_callref = 0x1000 - 1;
+	for (i = 0; i < 100; i++)
+		service();
+	printf("Peer got %u frames, %u REL_IND, %u REL_CNF, %u DISC_IND\n",
+	       peer_frames, peer_rel_ind, peer_rel_cnf, peer_disc_ind);
+
+	net->mncc_sock_queue_max = MNCC_SOCK_QUEUE_DEFAULT;
+}
+
+static void test_throughput(bool batch)
+{
+	struct timespec start;
+	unsigned int sent = 0;
+	uint64_t drops = ctr(MSC_CTR_MNCC_QUEUE_DROP);
+	int i;
+
+	printf("Testing throughput, batch-write %s.\n", batch ? "on" : "off");
+	net->mncc_sock_batch = batch;
+	peer_frames = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (sent < NUM_FRAMES) {
+		for (i = 0; i < FRAMES_PER_ROUND; i++)
+			queue_frame(sent++);
+		service();
+	}
+	for (i = 0; i < 10000 && peer_frames < sent; i++)
+		service();
+
+	printf("Sent %u frames, peer got %u, dropped %"PRIu64"\n",
+	       sent, peer_frames, ctr(MSC_CTR_MNCC_QUEUE_DROP) - drops);
+	fprintf(stderr, "batch-write %s: %.0f frames/s\n",
+		batch ? "on" : "off", sent / elapsed(&start));
+}
+
+static void test_requests(void)
+{
+	uint8_t buf[sizeof(struct gsm_mncc)];
+	struct gsm_mncc *mncc = (struct gsm_mncc *) buf;
+	int i;
+
+	printf("Testing requests from the peer.\n");
+	peer_rel_ind = 0;
+	peer_last_callref = 0;
+
+	/* every unknown callref is answered with a release */
+	for (i = 0; i < NUM_REQUESTS; i++) {
+		memset(buf, 0, sizeof(buf));
+		mncc->msg_type = MNCC_DISC_REQ;
+		mncc->callref = i + 1;
+		OSMO_ASSERT(send(peer_fd, buf, sizeof(buf), 0) == sizeof(buf));
+		if (i % 10 == 9)
+			service();
+	}
+	for (i = 0; i < 1000 && peer_rel_ind < NUM_REQUESTS; i++)
+		service();
+
+	printf("Peer got %u REL_IND, %s\n", peer_rel_ind,
+	       peer_order_ok ? "in order" : "OUT OF ORDER");
+}
+
+int main(int argc, char **argv)
+{
+	osmo_init_logging(&log_info);
+	log_set_print_filename(osmo_stderr_target, 0);
+	log_set_log_level(osmo_stderr_target, LOGL_FATAL);
+
+	net = gsm_network_init(tall_bsc_ctx, 1, 1, mncc_sock_from_cc);
+	OSMO_ASSERT(net);
+
+	unlink(SOCK_PATH);
+	OSMO_ASSERT(mncc_sock_init(net, SOCK_PATH) == 0);
+
+	peer_connect();
+	test_queue_limit();
+	test_throughput(false);
+	test_throughput(true);
+	test_requests();
+
+	close(peer_fd);
+	unlink(SOCK_PATH);
+	printf("Done\n");
+	return 0;
+}
@@ -36,8 +36,10 @@
 #include <osmocom/core/application.h>
 #include <osmocom/core/msgb.h>
 #include <osmocom/core/rate_ctr.h>
+#include <osmocom/core/select.h>
 
 #include <stdio.h>
+#include <inttypes.h>
 
 void *tall_bsc_ctx;
 static struct sgsn_instance sgsn_inst = {
@@ -151,6 +153,15 @@ int __real_gsup_client_send(struct gsup_client *gsupc, struct msgb *msg);
 int (*gsup_client_send_cb)(struct gsup_client *gsupc, struct msgb *msg) =
 	&__real_gsup_client_send;
 
+/* override, requires '-Wl,--wrap=sgsn_pdp_tx_dl' */
+int __wrap_sgsn_pdp_tx_dl(struct sgsn_pdp_ctx *pdp, const uint8_t *data,
+			  unsigned int len)
+{
+	printf("  - sent N-PDU %u of %u bytes on NSAPI %u\n",
+	       data[0], len, pdp->nsapi);
+	return 0;
+}
+
 int __wrap_gsup_client_send(struct gsup_client *gsupc, struct msgb *msg)
 {
 	return (*gsup_client_send_cb)(gsupc, msg);
@@ -2418,6 +2429,185 @@ static struct log_info info = {
 	.num_cat = ARRAY_SIZE(gprs_categories),
 };
 
+static void test_dl_buffer(void)
+{
+	struct gprs_ra_id raid = { 0, };
+	struct sgsn_mm_ctx *ctx;
+	struct sgsn_pdp_ctx *pdp5, *pdp6;
+	uint8_t data[1000];
+	int i, page = 0;
+
+	printf("Testing downlink buffering during paging\n");
+
+	sgsn_inst.cfg.paging_buffer.max_bytes = 4000;
+	sgsn_inst.cfg.paging_buffer.max_age = 10;
+
+	ctx = alloc_mm_ctx(0xc0001234, &raid);
+	ctx->mm_state = GMM_REGISTERED_SUSPENDED;
+	pdp5 = sgsn_pdp_ctx_alloc(ctx, 5);
+	pdp6 = sgsn_pdp_ctx_alloc(ctx, 6);
+
+	/* only the first N-PDU pages, those beyond the limit are lost */
+	for (i = 0; i < 6; i++) {
+		memset(data, i, sizeof(data));
+		page += sgsn_mm_ctx_dl_enqueue(ctx, i % 2 ? 6 : 5,
+					       data, sizeof(data));
+	}
+	printf("  - paged %d times, kept %u bytes, %" PRIu64 " dropped\n",
+	       page, ctx->dl_buf_bytes,
+	       ctx->ctrg->ctr[GMM_CTR_DL_BUF_DROPPED].current);
+
+	/* a RAB comes back for a single NSAPI */
+	printf("  - flush NSAPI 6\n");
+	OSMO_ASSERT(sgsn_mm_ctx_dl_flush(ctx, 6) == 2);
+
+	/* nothing to send if the PDP context went away meanwhile */
+	sgsn_pdp_ctx_free(pdp5);
+	printf("  - flush all\n");
+	OSMO_ASSERT(sgsn_mm_ctx_dl_flush(ctx, -1) == 0);
+	printf("  - kept %u bytes, %" PRIu64 " flushed, %" PRIu64 " dropped\n",
+	       ctx->dl_buf_bytes,
+	       ctx->ctrg->ctr[GMM_CTR_DL_BUF_FLUSHED].current,
+	       ctx->ctrg->ctr[GMM_CTR_DL_BUF_DROPPED].current);
+
+	/* the next N-PDU pages again, and is freed along with the MS */
+	OSMO_ASSERT(sgsn_mm_ctx_dl_enqueue(ctx, 6, data, sizeof(data)) == 1);
+	sgsn_pdp_ctx_free(pdp6);
+	sgsn_mm_ctx_cleanup_free(ctx);
+
+	cleanup_test();
+}
+
+static int auth_info_requests = 0;
+
+int my_gsup_client_send_auth_count(struct gsup_client *gsupc, struct msgb *msg)
+{
+	struct osmo_gsup_message gsup_msg = {0};
+
+	OSMO_ASSERT(osmo_gsup_decode(msgb_data(msg), msgb_length(msg),
+				     &gsup_msg) >= 0);
+	if (gsup_msg.message_type == OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST)
+		auth_info_requests += 1;
+	msgb_free(msg);
+	return 0;
+}
+
+static unsigned unused_tuples(struct gsm_subscriber *subscr)
+{
+	struct sgsn_subscriber_data *sdata = subscr->sgsn_data;
+	unsigned idx, count = 0;
+
+	for (idx = 0; idx < ARRAY_SIZE(sdata->auth_triplets); idx++)
+		if (sdata->auth_triplets[idx].key_seq != GSM_KEY_SEQ_INVAL &&
+		    sdata->auth_triplets[idx].use_count == 0)
+			count += 1;
+	return count;
+}
+
+static void test_auth_prefetch(void)
+{
+	static const uint8_t send_auth_info_res[] = {
+		0x0a,
+		TEST_GSUP_IMSI1_IE,
+		0x03, 0x22, /* Auth tuple */
+			0x20, 0x10,
+				0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+				0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10,
+			0x21, 0x04,
+				0x21, 0x22, 0x23, 0x24,
+			0x22, 0x08,
+				0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38,
+		0x03, 0x22, /* Auth tuple */
+			0x20, 0x10,
+				0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88,
+				0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f, 0x90,
+			0x21, 0x04,
+				0xa1, 0xa2, 0xa3, 0xa4,
+			0x22, 0x08,
+				0xb1, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8,
+	};
+	struct gprs_ra_id raid = { 0, };
+	struct gsm_subscriber *s1, *s2;
+	struct sgsn_mm_ctx *ctx1, *ctx2;
+
+	printf("Testing background refill of auth tuples\n");
+
+	sgsn_inst.cfg.auth_prefetch.low_water = 1;
+	sgsn_inst.cfg.auth_prefetch.max_pending = 1;
+	sgsn_inst.cfg.auth_prefetch.max_subscribers = 2;
+	gsup_client_send_cb = my_gsup_client_send_auth_count;
+	sgsn->gsup_client = talloc_zero(tall_bsc_ctx, struct gsup_client);
+
+	s1 = gprs_subscr_get_or_create("123456789012345");
+	ctx1 = alloc_mm_ctx(0xc0000001, &raid);
+	ctx1->subscr = subscr_get(s1);
+	s1->sgsn_data->mm = ctx1;
+	s1->sgsn_data->auth_triplets[0].key_seq = 0;
+	s1->sgsn_data->auth_triplets[1].key_seq = 1;
+
+	s2 = gprs_subscr_get_or_create("1234567890");
+	ctx2 = alloc_mm_ctx(0xc0000002, &raid);
+	ctx2->subscr = subscr_get(s2);
+	s2->sgsn_data->mm = ctx2;
+	s2->sgsn_data->auth_triplets[0].key_seq = 0;
+	s2->sgsn_data->auth_triplets[1].key_seq = 1;
+
+	/* the refill is sent from the main loop */
+	ctx1->auth_triplet = *sgsn_auth_get_tuple(ctx1, GSM_KEY_SEQ_INVAL);
+	printf("  - s1 has %u unused, %d requests\n",
+	       unused_tuples(s1), auth_info_requests);
+	osmo_select_main(1);
+	printf("  - %d requests, %u pending\n",
+	       auth_info_requests, sgsn_auth_prefetch_pending());
+
+	/* only one refill may be outstanding */
+	ctx2->auth_triplet = *sgsn_auth_get_tuple(ctx2, GSM_KEY_SEQ_INVAL);
+	osmo_select_main(1);
+	printf("  - s2 waits, %d requests, %u pending\n",
+	       auth_info_requests, sgsn_auth_prefetch_pending());
+
+	/* the answer adds to the unused tuples, the authorization is not
+	 * touched, and the next refill goes out */
+	my_subscr_request_auth_info_gsup_auth(NULL);
+	OSMO_ASSERT(!s1->sgsn_data->auth_triplets_updated);
+	osmo_select_main(1);
+	printf("  - s1 has %u unused, %d requests, %u pending\n",
+	       unused_tuples(s1), auth_info_requests,
+	       sgsn_auth_prefetch_pending());
+
+	OSMO_ASSERT(rx_gsup_message(send_auth_info_res,
+				    sizeof(send_auth_info_res)) >= 0);
+	OSMO_ASSERT(!s2->sgsn_data->auth_triplets_updated);
+	OSMO_ASSERT(s2->sgsn_data->auth_triplets[0].use_count == 1);
+	printf("  - s2 has %u unused, %u pending\n",
+	       unused_tuples(s2), sgsn_auth_prefetch_pending());
+
+	/* s2 has been authenticated less recently and loses its tuples */
+	sgsn_inst.cfg.auth_prefetch.max_subscribers = 1;
+	ctx1->auth_triplet = *sgsn_auth_get_tuple(ctx1,
+						  ctx1->auth_triplet.key_seq);
+	osmo_select_main(1);
+	printf("  - s2 has %u unused, %" PRIu64 " evicted, %d requests\n",
+	       unused_tuples(s2),
+	       sgsn->rate_ctrs->ctr[CTR_AUTH_PREFETCH_EVICTED].current,
+	       auth_info_requests);
+
+	/* the outstanding refill goes away with the subscriber */
+	subscr_put(s1);
+	sgsn_mm_ctx_cleanup_free(ctx1);
+	subscr_put(s2);
+	sgsn_mm_ctx_cleanup_free(ctx2);
+	OSMO_ASSERT(sgsn_auth_prefetch_pending() == 0);
+	assert_no_subscrs();
+
+	sgsn_inst.cfg.auth_prefetch.low_water = 0;
+	gsup_client_send_cb = __real_gsup_client_send;
+	talloc_free(sgsn->gsup_client);
+	sgsn->gsup_client = NULL;
+
+	cleanup_test();
+}
+
 int main(int argc, char **argv)
 {
 	void *osmo_sgsn_ctx;
@@ -2454,6 +2644,8 @@ int main(int argc, char **argv)
 	test_gmm_routing_areas();
 	test_apn_matching();
 	test_ggsn_selection();
+	test_dl_buffer();
+	test_auth_prefetch();
 	printf("Done\n");
 
 	talloc_report_full(osmo_sgsn_ctx, stderr);
@@ -0,0 +1,271 @@
+/* GRX DNS answer cache test, with a stub resolver */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <openbsc/sgsn_ares_cache.h>
+#include <openbsc/debug.h>
+
+#include <osmocom/core/application.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/core/rate_ctr.h>
+#include <osmocom/core/select.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+
+static void *ctx;
+static struct sgsn_ares_cache *cache;
+static time_t fake_now = 1000;
+
+/* the queries the stub resolver has been asked, answered by the test */
+static struct sgsn_ares_cache_entry *outstanding[8];
+static unsigned int num_outstanding;
+static unsigned int num_resolved;
+
+/* answer synchronously from within the resolver, like the hosts file */
+static int answer_at_once;
+
+static unsigned int num_answers;
+
+static time_t stub_now(void)
+{
+	return fake_now;
+}
+
+static void stub_answer(struct sgsn_ares_cache_entry *entry, int status,
+			const char *addr, unsigned int ttl)
+{
+	struct in_addr ia;
+
+	inet_aton(addr ? addr : "0.0.0.0", &ia);
+	sgsn_ares_cache_complete(entry, status, 0, &ia, addr ? 1 : 0, ttl);
+}
+
+static int stub_resolve(struct sgsn_ares_cache *c,
+			struct sgsn_ares_cache_entry *entry)
+{
+	printf("  resolver: query %s\n", entry->name);
+	num_resolved += 1;
+
+	if (answer_at_once) {
+		stub_answer(entry, ARES_SUCCESS, "10.0.0.1", 300);
+		return 0;
+	}
+
+	OSMO_ASSERT(num_outstanding < ARRAY_SIZE(outstanding));
+	outstanding[num_outstanding++] = entry;
+	return 0;
+}
+
+/* answer the oldest outstanding query */
+static void answer(int status, const char *addr, unsigned int ttl)
+{
+	struct sgsn_ares_cache_entry *entry;
+
+	OSMO_ASSERT(num_outstanding > 0);
+	entry = outstanding[0];
+	num_outstanding -= 1;
+	memmove(&outstanding[0], &outstanding[1],
+		num_outstanding * sizeof(outstanding[0]));
+	stub_answer(entry, status, addr, ttl);
+}
+
+static void print_cb(void *arg, int status, int timeouts,
+		     struct hostent *hostent)
+{
+	num_answers += 1;
+
+	if (status != ARES_SUCCESS) {
+		printf("  %s: %s\n", (char *) arg, ares_strerror(status));
+		OSMO_ASSERT(!hostent);
+		return;
+	}
+
+	OSMO_ASSERT(hostent->h_length == 4);
+	printf("  %s: %s -> %s\n", (char *) arg, hostent->h_name,
+	       inet_ntoa(*(struct in_addr *) hostent->h_addr_list[0]));
+}
+
+static void query(const char *name, const char *who)
+{
+	OSMO_ASSERT(sgsn_ares_cache_query(cache, name, print_cb,
+					  (void *) who) == 0);
+}
+
+/* run the main loop until all answers are delivered */
+static void deliver(void)
+{
+	while (!llist_empty(&cache->deliver))
+		osmo_select_main(0);
+}
+
+static uint64_t ctr(int idx)
+{
+	return cache->ctrg->ctr[idx].current;
+}
+
+static void test_coalesce_and_ttl(void)
+{
+	printf("Testing coalescing and TTL.\n");
+
+	query("ggsn.apn.example", "A");
+	query("ggsn.apn.example", "B");
+	query("GGSN.apn.example", "C");
+	printf("%u queries sent\n", num_resolved);
+
+	/* nothing is delivered before the main loop runs */
+	answer(ARES_SUCCESS, "192.168.0.1", 30);
+	printf("%u answers before the main loop\n", num_answers);
+	deliver();
+
+	/* within the TTL, the resolver is not asked */
+	fake_now += 29;
+	query("ggsn.apn.example", "D");
+	deliver();
+
+	fake_now += 1;
+	query("ggsn.apn.example", "E");
+	answer(ARES_SUCCESS, "192.168.0.2", 100000);
+	deliver();
+
+	/* the TTL is capped */
+	fake_now += cache->max_ttl - 1;
+	query("ggsn.apn.example", "F");
+	deliver();
+	fake_now += 1;
+	query("ggsn.apn.example", "G");
+	answer(ARES_SUCCESS, "192.168.0.3", 60);
+	deliver();
+
+	printf("%u queries sent\n", num_resolved);
+}
+
+static void test_negative(void)
+{
+	printf("Testing negative answers.\n");
+	num_resolved = 0;
+
+	query("no.such.apn", "A");
+	answer(ARES_ENOTFOUND, NULL, 0);
+	deliver();
+
+	fake_now += cache->neg_ttl - 1;
+	query("no.such.apn", "B");
+	deliver();
+
+	fake_now += 1;
+	query("no.such.apn", "C");
+	answer(ARES_ENOTFOUND, NULL, 0);
+	deliver();
+
+	/* a timeout is not cached */
+	query("slow.apn", "D");
+	answer(ARES_ETIMEOUT, NULL, 0);
+	deliver();
+	query("slow.apn", "E");
+	answer(ARES_SUCCESS, "192.168.1.1", 60);
+	deliver();
+
+	printf("%u queries sent\n", num_resolved);
+}
+
+static void retry_cb(void *arg, int status, int timeouts,
+		     struct hostent *hostent)
+{
+	print_cb(arg, status, timeouts, hostent);
+
+	/* retry with a different name, like the GGSN lookup does with a
+	 * three digit MNC */
+	if (status != ARES_SUCCESS)
+		query("mnc001.retry.apn", "retry");
+}
+
+static void test_sync_and_retry(void)
+{
+	printf("Testing answers from within the resolver.\n");
+	num_resolved = 0;
+	num_answers = 0;
+
+	answer_at_once = 1;
+	query("hosts.apn", "A");
+	printf("%u answers before the main loop\n", num_answers);
+	deliver();
+	answer_at_once = 0;
+
+	OSMO_ASSERT(sgsn_ares_cache_query(cache, "mnc01.retry.apn", retry_cb,
+					  "first") == 0);
+	answer(ARES_ENOTFOUND, NULL, 0);
+	deliver();
+	answer(ARES_SUCCESS, "192.168.2.1", 60);
+	deliver();
+
+	printf("%u queries sent\n", num_resolved);
+}
+
+static void test_evict(void)
+{
+	unsigned int entries;
+
+	printf("Testing eviction.\n");
+	num_resolved = 0;
+	cache->max_entries = cache->num_entries + 1;
+	entries = cache->num_entries;
+
+	/* the oldest entry makes room, not the outstanding query */
+	query("one.apn", "A");
+	query("two.apn", "B");
+	answer(ARES_SUCCESS, "192.168.3.1", 60);
+	answer(ARES_SUCCESS, "192.168.3.2", 60);
+	deliver();
+
+	printf("%u entries, evicted %d\n", cache->num_entries - entries,
+	       (int) ctr(ARES_CACHE_CTR_EVICTED));
+	printf("%u queries sent\n", num_resolved);
+}
+
+int main(int argc, char **argv)
+{
+	osmo_init_logging(&log_info);
+	log_set_print_filename(osmo_stderr_target, 0);
+	log_set_log_level(osmo_stderr_target, LOGL_FATAL);
+
+	ctx = talloc_named_const(NULL, 0, "sgsn_ares_cache_test");
+	rate_ctr_init(ctx);
+
+	cache = sgsn_ares_cache_alloc(ctx, stub_resolve, NULL);
+	cache->now = stub_now;
+	cache->max_ttl = 600;
+	cache->neg_ttl = 10;
+
+	test_coalesce_and_ttl();
+	test_negative();
+	test_sync_and_retry();
+	test_evict();
+
+	printf("hit %d, neg_hit %d, miss %d, coalesced %d, expired %d\n",
+	       (int) ctr(ARES_CACHE_CTR_HIT), (int) ctr(ARES_CACHE_CTR_NEG_HIT),
+	       (int) ctr(ARES_CACHE_CTR_MISS),
+	       (int) ctr(ARES_CACHE_CTR_COALESCED),
+	       (int) ctr(ARES_CACHE_CTR_EXPIRED));
+
+	sgsn_ares_cache_free(cache);
+	printf("Done\n");
+	return 0;
+}
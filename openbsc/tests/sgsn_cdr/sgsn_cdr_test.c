@@ -0,0 +1,335 @@
+/* SGSN CDR record format and writer test */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <openbsc/sgsn_cdr.h>
+
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CDR_FILE	"sgsn_cdr_test.cdr"
+#define NUM_RECORDS	20000
+
+static void *ctx;
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void fill_rec(struct sgsn_cdr_rec *rec, unsigned int nr)
+{
+	memset(rec, 0, sizeof(*rec));
+	rec->is_pdp = nr % 2;
+	rec->ev = rec->is_pdp ? SGSN_CDR_EV_PDP_PERIODIC : SGSN_CDR_EV_ATTACH;
+	/* 2016-10-01 12:34:56.789 */
+	rec->timestamp_ms = 1475325296789ULL;
+	snprintf(rec->imsi, sizeof(rec->imsi), "9017000000%05u", nr % 100000);
+	strcpy(rec->imei, "3540210000000000");
+	strcpy(rec->msisdn, "12345");
+	strcpy(rec->hlr, "N/A");
+	rec->cell_id = 23;
+	rec->lac = 42;
+	if (!rec->is_pdp)
+		return;
+	rec->duration = 600;
+	strcpy(rec->ggsn_addr, "192.168.100.1");
+	strcpy(rec->sgsn_addr, "192.168.100.239");
+	strcpy(rec->apni, "internet");
+	strcpy(rec->eua_addr, "10.0.0.2");
+	rec->vol_in = 1234567890123ULL;
+	rec->vol_out = 42;
+	rec->charging_id = nr;
+}
+
+static void test_formats(void)
+{
+	struct sgsn_cdr_rec rec, dec;
+	uint8_t bin[SGSN_CDR_BIN_MAX_LEN];
+	char csv[SGSN_CDR_BIN_MAX_LEN];
+	char csv2[SGSN_CDR_BIN_MAX_LEN];
+	int len;
+	int i;
+
+	printf("Testing record formats.\n");
+
+	for (i = 0; i < 2; i++) {
+		fill_rec(&rec, i);
+		sgsn_cdr_rec_to_csv(&rec, csv, sizeof(csv));
+		printf("CSV: %s", csv);
+
+		len = sgsn_cdr_rec_encode(&rec, bin, sizeof(bin));
+		printf("binary: %d bytes, %s\n", len, osmo_hexdump(bin, 12));
+
+		OSMO_ASSERT(sgsn_cdr_rec_decode(&dec, bin, len) == len);
+		sgsn_cdr_rec_to_csv(&dec, csv2, sizeof(csv2));
+		printf("decoded %s\n", strcmp(csv, csv2) ? "DIFFERS" : "same");
+
+		/* a record cut short is not complete yet */
+		OSMO_ASSERT(sgsn_cdr_rec_decode(&dec, bin, len - 1) == 0);
+		/* a length that doesn't match the content is rejected */
+		bin[1] -= 1;
+		OSMO_ASSERT(sgsn_cdr_rec_decode(&dec, bin, len) == -EINVAL);
+	}
+}
+
+/* Read back the current and all rotated binary files */
+static unsigned int read_back(unsigned int *files, int *in_order)
+{
+	struct sgsn_cdr_rec rec;
+	struct dirent *de;
+	unsigned int nr = 0;
+	uint32_t last_id = 0;
+	DIR *dir;
+
+	*files = 0;
+	*in_order = 1;
+
+	dir = opendir(".");
+	OSMO_ASSERT(dir);
+	while ((de = readdir(dir))) {
+		uint8_t *buf;
+		size_t len, off;
+		FILE *f;
+
+		if (strncmp(de->d_name, CDR_FILE, strlen(CDR_FILE)))
+			continue;
+
+		f = fopen(de->d_name, "rb");
+		OSMO_ASSERT(f);
+		buf = malloc(16 * 1024 * 1024);
+		len = fread(buf, 1, 16 * 1024 * 1024, f);
+		fclose(f);
+		unlink(de->d_name);
+
+		OSMO_ASSERT(len >= SGSN_CDR_BIN_MAGIC_LEN);
+		OSMO_ASSERT(!memcmp(buf, SGSN_CDR_BIN_MAGIC,
+				    SGSN_CDR_BIN_MAGIC_LEN));
+		*files += 1;
+
+		/* only the order within one file is known here */
+		last_id = 0;
+		for (off = SGSN_CDR_BIN_MAGIC_LEN; off < len;) {
+			int rc = sgsn_cdr_rec_decode(&rec, buf + off, len - off);
+			OSMO_ASSERT(rc > 0);
+			off += rc;
+			nr += 1;
+			if (!rec.is_pdp)
+				continue;
+			if (rec.charging_id < last_id)
+				*in_order = 0;
+			last_id = rec.charging_id;
+		}
+		free(buf);
+	}
+	closedir(dir);
+
+	return nr;
+}
+
+static void test_writer(void)
+{
+	struct sgsn_cdr_writer_cfg cfg = {
+		.filename = CDR_FILE,
+		.format = SGSN_CDR_FMT_BINARY,
+		.rotate_size = 256 * 1024,
+	};
+	struct sgsn_cdr_writer_stats stats;
+	struct sgsn_cdr_writer *w;
+	struct sgsn_cdr_rec rec;
+	struct timespec start;
+	unsigned int files, nr, queued = 0;
+	int in_order;
+	int i;
+
+	printf("Testing the writer.\n");
+
+	w = sgsn_cdr_writer_alloc(ctx, 4 * 1024 * 1024);
+	OSMO_ASSERT(sgsn_cdr_writer_configure(w, &cfg) == 0);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < NUM_RECORDS; i++) {
+		fill_rec(&rec, i);
+		if (sgsn_cdr_writer_add(w, &rec) == 0)
+			queued += 1;
+	}
+	fprintf(stderr, "queued %u CDRs at %.0f CDRs/s\n", queued,
+		queued / elapsed(&start));
+
+	sgsn_cdr_writer_flush(w);
+	sgsn_cdr_writer_stats(w, &stats);
+	printf("%" PRIu64 " records, %" PRIu64 " dropped, %" PRIu64
+	       " write errors, rotated: %s\n",
+	       stats.records, stats.dropped, stats.write_errors,
+	       stats.rotations > 0 ? "yes" : "no");
+	sgsn_cdr_writer_free(w);
+
+	nr = read_back(&files, &in_order);
+	printf("Read back %u records, %s, files %s\n", nr,
+	       in_order ? "in order" : "OUT OF ORDER",
+	       files == stats.rotations + 1 ? "complete" : "MISSING");
+}
+
+static void test_ring_full(void)
+{
+	struct sgsn_cdr_writer_cfg cfg = {
+		.filename = CDR_FILE,
+		.format = SGSN_CDR_FMT_CSV,
+	};
+	struct sgsn_cdr_writer_stats stats;
+	struct sgsn_cdr_writer *w;
+	struct sgsn_cdr_rec rec;
+	char line[SGSN_CDR_BIN_MAX_LEN];
+	unsigned int lines = 0;
+	FILE *f;
+	int i;
+
+	printf("Testing a full buffer.\n");
+
+	/* not started yet, so nothing is written out */
+	w = sgsn_cdr_writer_alloc(ctx, 4096);
+	fill_rec(&rec, 1);
+	for (i = 0; i < 100; i++)
+		sgsn_cdr_writer_add(w, &rec);
+	sgsn_cdr_writer_stats(w, &stats);
+	printf("%" PRIu64 " records, %" PRIu64 " dropped\n",
+	       stats.records, stats.dropped);
+
+	/* the queued records go to the file configured later */
+	OSMO_ASSERT(sgsn_cdr_writer_configure(w, &cfg) == 0);
+	sgsn_cdr_writer_free(w);
+
+	f = fopen(CDR_FILE, "r");
+	OSMO_ASSERT(f);
+	OSMO_ASSERT(fgets(line, sizeof(line), f));
+	printf("header %s\n", strcmp(line, sgsn_cdr_csv_header) ? "MISSING" : "ok");
+	while (fgets(line, sizeof(line), f))
+		lines += 1;
+	fclose(f);
+	unlink(CDR_FILE);
+	printf("%u lines\n", lines);
+}
+
+static void test_format_change(void)
+{
+	struct sgsn_cdr_writer_cfg cfg = {
+		.filename = CDR_FILE,
+		.format = SGSN_CDR_FMT_CSV,
+	};
+	struct sgsn_cdr_writer *w;
+	struct sgsn_cdr_rec rec;
+	struct dirent *de;
+	unsigned int files = 0, csv = 0, bin = 0, bad = 0;
+	char line[SGSN_CDR_BIN_MAX_LEN];
+	DIR *dir;
+	int i;
+
+	printf("Testing format changes.\n");
+
+	/* the changes follow each other faster than the thread writes */
+	w = sgsn_cdr_writer_alloc(ctx, 64 * 1024);
+	OSMO_ASSERT(sgsn_cdr_writer_configure(w, &cfg) == 0);
+	for (i = 0; i < 10; i++) {
+		fill_rec(&rec, i);
+		sgsn_cdr_writer_add(w, &rec);
+	}
+	cfg.format = SGSN_CDR_FMT_BINARY;
+	OSMO_ASSERT(sgsn_cdr_writer_configure(w, &cfg) == 0);
+	for (i = 0; i < 10; i++) {
+		fill_rec(&rec, i);
+		sgsn_cdr_writer_add(w, &rec);
+	}
+	cfg.format = SGSN_CDR_FMT_CSV;
+	OSMO_ASSERT(sgsn_cdr_writer_configure(w, &cfg) == 0);
+	for (i = 0; i < 5; i++) {
+		fill_rec(&rec, i);
+		sgsn_cdr_writer_add(w, &rec);
+	}
+	sgsn_cdr_writer_free(w);
+
+	/* every file holds one format only */
+	dir = opendir(".");
+	OSMO_ASSERT(dir);
+	while ((de = readdir(dir))) {
+		uint8_t buf[4096];
+		size_t len, off;
+		FILE *f;
+
+		if (strncmp(de->d_name, CDR_FILE, strlen(CDR_FILE)))
+			continue;
+
+		f = fopen(de->d_name, "rb");
+		OSMO_ASSERT(f);
+		len = fread(buf, 1, sizeof(buf), f);
+		files += 1;
+
+		if (len >= SGSN_CDR_BIN_MAGIC_LEN &&
+		    !memcmp(buf, SGSN_CDR_BIN_MAGIC, SGSN_CDR_BIN_MAGIC_LEN)) {
+			for (off = SGSN_CDR_BIN_MAGIC_LEN; off < len; bin++) {
+				int rc = sgsn_cdr_rec_decode(&rec, buf + off,
+							     len - off);
+				if (rc <= 0) {
+					bad += 1;
+					break;
+				}
+				off += rc;
+			}
+		} else {
+			rewind(f);
+			if (!fgets(line, sizeof(line), f) ||
+			    strcmp(line, sgsn_cdr_csv_header))
+				bad += 1;
+			while (fgets(line, sizeof(line), f)) {
+				if (line[0] < '0' || line[0] > '9')
+					bad += 1;
+				csv += 1;
+			}
+		}
+		fclose(f);
+		unlink(de->d_name);
+	}
+	closedir(dir);
+
+	printf("%u files, %u CSV records, %u binary records, %u bad\n",
+	       files, csv, bin, bad);
+}
+
+int main(int argc, char **argv)
+{
+	ctx = talloc_named_const(NULL, 0, "sgsn_cdr_test");
+
+	test_formats();
+	test_writer();
+	test_ring_full();
+	test_format_change();
+
+	printf("Done\n");
+	return 0;
+}
@@ -0,0 +1,206 @@
+/* SMS queue delivery test against a simulated MS population */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <openbsc/debug.h>
+#include <openbsc/db.h>
+#include <openbsc/gsm_data.h>
+#include <openbsc/gsm_subscriber.h>
+#include <openbsc/gsm_04_11.h>
+#include <openbsc/signal.h>
+#include <openbsc/sms_queue.h>
+
+#include <osmocom/core/application.h>
+#include <osmocom/core/select.h>
+#include <osmocom/core/talloc.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#define NUM_SUBSCR	50
+#define NUM_SMS		10
+#define MAX_PENDING	20
+#define DB_FILE		"sms_queue_test.sqlite3"
+
+/* an SMS the simulated MS has not acknowledged yet */
+struct in_flight {
+	struct llist_head entry;
+	struct gsm_sms *sms;
+};
+
+static LLIST_HEAD(in_flight_list);
+static struct osmo_timer_list ack_timer;
+
+static int delivered;
+static int nr_in_flight, max_in_flight;
+static int subscr_in_flight[NUM_SUBSCR + 1];
+static int max_subscr_in_flight;
+
+/* the simulated MS acknowledge everything sent in the previous round */
+static void ack_cb(void *data)
+{
+	LLIST_HEAD(round);
+	struct in_flight *f, *tmp;
+
+	llist_splice_init(&in_flight_list, &round);
+
+	llist_for_each_entry_safe(f, tmp, &round, entry) {
+		struct sms_signal_data sig;
+
+		llist_del(&f->entry);
+		nr_in_flight -= 1;
+		subscr_in_flight[f->sms->receiver->id] -= 1;
+
+		db_sms_mark_delivered(f->sms);
+		delivered += 1;
+
+		memset(&sig, 0, sizeof(sig));
+		sig.sms = f->sms;
+		osmo_signal_dispatch(SS_SMS, S_SMS_DELIVERED, &sig);
+
+		sms_free(f->sms);
+		talloc_free(f);
+	}
+}
+
+int __wrap_gsm411_send_sms_subscr(struct gsm_subscriber *subscr,
+				  struct gsm_sms *sms)
+{
+	struct in_flight *f;
+
+	OSMO_ASSERT(subscr->id <= NUM_SUBSCR);
+
+	f = talloc_zero(NULL, struct in_flight);
+	OSMO_ASSERT(f);
+	f->sms = sms;
+	llist_add_tail(&f->entry, &in_flight_list);
+
+	nr_in_flight += 1;
+	if (nr_in_flight > max_in_flight)
+		max_in_flight = nr_in_flight;
+	subscr_in_flight[subscr->id] += 1;
+	if (subscr_in_flight[subscr->id] > max_subscr_in_flight)
+		max_subscr_in_flight = subscr_in_flight[subscr->id];
+
+	if (!osmo_timer_pending(&ack_timer))
+		osmo_timer_schedule(&ack_timer, 0, 0);
+	return 0;
+}
+
+static void create_sms(struct gsm_network *net)
+{
+	struct gsm_subscriber *subscr;
+	char imsi[16];
+	int i, j;
+
+	for (i = 0; i < NUM_SUBSCR; i++) {
+		snprintf(imsi, sizeof(imsi), "90170000000%04d", i);
+		subscr = db_create_subscriber(imsi, GSM_MIN_EXTEN,
+					      GSM_MAX_EXTEN, true);
+		OSMO_ASSERT(subscr);
+		subscr->group = net->subscr_group;
+		subscr->lac = 23;
+		db_sync_subscriber(subscr);
+
+		for (j = 0; j < NUM_SMS; j++) {
+			struct gsm_sms *sms = sms_alloc();
+
+			OSMO_ASSERT(sms);
+			strcpy(sms->src.addr, "1234");
+			strcpy(sms->dst.addr, subscr->extension);
+			snprintf(sms->text, sizeof(sms->text), "SMS %d", j);
+			sms->user_data_len = strlen(sms->text);
+			memcpy(sms->user_data, sms->text, sms->user_data_len);
+			OSMO_ASSERT(db_sms_store(sms) == 0);
+			sms_free(sms);
+		}
+	}
+}
+
+static void check_all_sent(struct gsm_network *net)
+{
+	struct gsm_subscriber *subscr;
+	int i, unsent = 0;
+
+	for (i = 1; i <= NUM_SUBSCR; i++) {
+		struct gsm_sms *sms;
+
+		subscr = subscr_get_by_id(net->subscr_group, i);
+		OSMO_ASSERT(subscr);
+		sms = db_sms_get_unsent_for_subscr(subscr);
+		if (sms) {
+			unsent += 1;
+			sms_free(sms);
+		}
+		subscr_put(subscr);
+	}
+	printf("Subscribers with unsent SMS: %d\n", unsent);
+}
+
+int main(int argc, char **argv)
+{
+	struct gsm_network *net;
+	struct timespec start, now;
+	double secs = 0;
+
+	printf("Testing the SMS queue.\n");
+	osmo_init_logging(&log_info);
+	log_set_print_filename(osmo_stderr_target, 0);
+	log_set_log_level(osmo_stderr_target, LOGL_ERROR);
+
+	net = gsm_network_init(NULL, 1, 1, NULL);
+	OSMO_ASSERT(net);
+	net->subscr_group->keep_subscr = 1;
+
+	unlink(DB_FILE);
+	if (db_init(DB_FILE) || db_prepare()) {
+		printf("DB: Failed to set up the database.\n");
+		return 1;
+	}
+
+	create_sms(net);
+	printf("Stored %d SMS for %d subscribers\n",
+	       NUM_SUBSCR * NUM_SMS, NUM_SUBSCR);
+
+	ack_timer.cb = ack_cb;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	OSMO_ASSERT(sms_queue_start(net, MAX_PENDING) == 0);
+
+	while (delivered < NUM_SUBSCR * NUM_SMS && secs < 60) {
+		osmo_select_main(1);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		secs = (now.tv_sec - start.tv_sec) +
+			(now.tv_nsec - start.tv_nsec) / 1e9;
+	}
+
+	printf("Delivered %d SMS\n", delivered);
+	printf("Max in flight: %d, per subscriber: %d\n",
+	       max_in_flight, max_subscr_in_flight);
+	fprintf(stderr, "%.3f s, %.0f SMS/s\n", secs,
+		secs > 0 ? delivered / secs : 0);
+
+	check_all_sent(net);
+
+	db_fini();
+	unlink(DB_FILE);
+
+	printf("Done\n");
+	return 0;
+}
@@ -0,0 +1,255 @@
+/* Test SNDCP header and data compression throughput */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <openbsc/gprs_sndcp_xid.h>
+#include <openbsc/gprs_sndcp_comp.h>
+#include <openbsc/gprs_sndcp_pcomp.h>
+#include <openbsc/gprs_sndcp_dcomp.h>
+#include <openbsc/debug.h>
+
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/core/application.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#define NUM_PACKETS	20000
+#define PAYLOAD_LEN	400
+#define PACKET_LEN	(20 + 20 + PAYLOAD_LEN)
+#define NSAPI		5
+
+static void *ctx;
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static uint16_t ip_csum(const uint8_t *data, int len)
+{
+	uint32_t sum = 0;
+	int i;
+
+	for (i = 0; i < len; i += 2)
+		sum += (data[i] << 8) | data[i + 1];
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+/* Generate the nth segment of a TCP stream carrying text, the kind of
+ * traffic that both RFC1144 and V.42bis do well on */
+static void gen_packet(uint8_t *pkt, unsigned int n)
+{
+	static const char text[] = "GET /index.html HTTP/1.1\r\n"
+				   "Host: www.osmocom.org\r\n"
+				   "Accept: text/html\r\n\r\n";
+	uint32_t seq = 0x1000 + n * PAYLOAD_LEN;
+	uint16_t csum;
+	int i;
+
+	memset(pkt, 0, PACKET_LEN);
+
+	/* IPv4 header */
+	pkt[0] = 0x45;
+	pkt[2] = PACKET_LEN >> 8;
+	pkt[3] = PACKET_LEN & 0xff;
+	pkt[4] = (n >> 8) & 0xff;	/* ID */
+	pkt[5] = n & 0xff;
+	pkt[6] = 0x40;			/* DF */
+	pkt[8] = 64;			/* TTL */
+	pkt[9] = 6;			/* TCP */
+	memcpy(pkt + 12, "\x0a\x09\x01\x65", 4);
+	memcpy(pkt + 16, "\x0a\x09\x17\x01", 4);
+	csum = ip_csum(pkt, 20);
+	pkt[10] = csum >> 8;
+	pkt[11] = csum & 0xff;
+
+	/* TCP header */
+	pkt[20] = 0xad;			/* source port */
+	pkt[21] = 0x8b;
+	pkt[23] = 80;			/* destination port */
+	pkt[24] = seq >> 24;
+	pkt[25] = (seq >> 16) & 0xff;
+	pkt[26] = (seq >> 8) & 0xff;
+	pkt[27] = seq & 0xff;
+	pkt[31] = 0x01;			/* ack */
+	pkt[32] = 0x50;			/* data offset */
+	pkt[33] = 0x18;			/* ACK, PSH */
+	pkt[34] = 0x72;			/* window */
+	pkt[35] = 0x10;
+	pkt[36] = n & 0xff;		/* checksum, carried as is */
+	pkt[37] = (n >> 8) & 0xff;
+
+	for (i = 0; i < PAYLOAD_LEN; i++)
+		pkt[40 + i] = text[i % (sizeof(text) - 1)];
+}
+
+static struct llist_head *comp_entities_alloc(int compclass)
+{
+	struct llist_head *comp_entities = gprs_sndcp_comp_alloc(ctx);
+	struct gprs_sndcp_comp_field comp_field;
+	struct gprs_sndcp_pcomp_rfc1144_params rfc1144_params;
+	struct gprs_sndcp_dcomp_v42bis_params v42bis_params;
+
+	memset(&comp_field, 0, sizeof(comp_field));
+
+	if (compclass == SNDCP_XID_PROTOCOL_COMPRESSION) {
+		memset(&rfc1144_params, 0, sizeof(rfc1144_params));
+		rfc1144_params.nsapi_len = 1;
+		rfc1144_params.nsapi[0] = NSAPI;
+		rfc1144_params.s01 = 15;
+		comp_field.algo = RFC_1144;
+		comp_field.comp_len = RFC1144_PCOMP_NUM;
+		comp_field.comp[RFC1144_PCOMP1] = 1;
+		comp_field.comp[RFC1144_PCOMP2] = 2;
+		comp_field.rfc1144_params = &rfc1144_params;
+	} else {
+		memset(&v42bis_params, 0, sizeof(v42bis_params));
+		v42bis_params.nsapi_len = 1;
+		v42bis_params.nsapi[0] = NSAPI;
+		v42bis_params.p0 = 3;
+		v42bis_params.p1 = 2048;
+		v42bis_params.p2 = 20;
+		comp_field.algo = V42BIS;
+		comp_field.comp_len = V42BIS_DCOMP_NUM;
+		comp_field.comp[V42BIS_DCOMP1] = 1;
+		comp_field.v42bis_params = &v42bis_params;
+	}
+
+	OSMO_ASSERT(gprs_sndcp_comp_add(ctx, comp_entities, &comp_field));
+	return comp_entities;
+}
+
+static void test_compression_speed(void)
+{
+	/* Both ends of the link keep their own compression state */
+	struct llist_head *tx_proto = comp_entities_alloc(SNDCP_XID_PROTOCOL_COMPRESSION);
+	struct llist_head *tx_data = comp_entities_alloc(SNDCP_XID_DATA_COMPRESSION);
+	struct llist_head *rx_proto = comp_entities_alloc(SNDCP_XID_PROTOCOL_COMPRESSION);
+	struct llist_head *rx_data = comp_entities_alloc(SNDCP_XID_DATA_COMPRESSION);
+	uint8_t pkt[PACKET_LEN];
+	uint8_t buf[PACKET_LEN];
+	uint8_t *rx_buf = NULL;
+	unsigned int pcomp_count = 0, dcomp_count = 0, ok_count = 0;
+	size_t blocks, tx_allocs = 0, rx_allocs = 0, tx_bytes = 0;
+	struct timespec start;
+	unsigned int i;
+	int rc;
+
+	printf("Testing compression speed.\n");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < NUM_PACKETS; i++) {
+		uint8_t pcomp, dcomp;
+
+		gen_packet(pkt, i);
+		memcpy(buf, pkt, PACKET_LEN);
+
+		blocks = talloc_total_blocks(ctx);
+
+		rc = gprs_sndcp_pcomp_compress(buf, PACKET_LEN, &pcomp,
+					       tx_proto, NSAPI);
+		OSMO_ASSERT(rc > 0);
+		rc = gprs_sndcp_dcomp_compress(buf, rc, &dcomp, tx_data,
+					       NSAPI);
+		OSMO_ASSERT(rc > 0);
+		tx_bytes += rc;
+		if (pcomp)
+			pcomp_count++;
+		if (dcomp)
+			dcomp_count++;
+		tx_allocs += talloc_total_blocks(ctx) - blocks;
+
+		/* the receive buffer is allocated with the first N-PDU */
+		blocks = talloc_total_blocks(ctx);
+		rc = gprs_sndcp_comp_expand(ctx, &rx_buf, buf, rc, pcomp,
+					    dcomp, rx_proto, rx_data);
+		OSMO_ASSERT(rc > 0);
+		if (i > 0)
+			rx_allocs += talloc_total_blocks(ctx) - blocks;
+		if (rc == PACKET_LEN && memcmp(rx_buf, pkt, PACKET_LEN) == 0)
+			ok_count++;
+	}
+
+	printf("%u packets: %u header compressed, %u data compressed,"
+	       " %u restored\n", NUM_PACKETS, pcomp_count, dcomp_count,
+	       ok_count);
+	printf("Allocations while compressing: %zu\n", tx_allocs);
+	printf("Allocations while expanding: %zu\n", rx_allocs);
+	fprintf(stderr, "%.0f packets/s, %zu of %u octets sent\n",
+		NUM_PACKETS / elapsed(&start), tx_bytes,
+		NUM_PACKETS * PACKET_LEN);
+
+	gprs_sndcp_comp_free(tx_proto);
+	gprs_sndcp_comp_free(tx_data);
+	gprs_sndcp_comp_free(rx_proto);
+	gprs_sndcp_comp_free(rx_data);
+	talloc_free(rx_buf);
+}
+
+static struct log_info_cat gprs_categories[] = {
+	[DSNDCP] = {
+		.name = "DSNDCP",
+		.description = "GPRS Sub-Network Dependent Control Protocol (SNDCP)",
+		.enabled = 1, .loglevel = LOGL_FATAL,
+	},
+	[DSLHC] = {
+		.name = "DSLHC",
+		.description = "SLHC (RFC1144) header compression",
+		.enabled = 1, .loglevel = LOGL_FATAL,
+	},
+	[DV42BIS] = {
+		.name = "DV42BIS",
+		.description = "V.42bis data compression (SNDCP)",
+		.enabled = 1, .loglevel = LOGL_FATAL,
+	},
+};
+
+static struct log_info info = {
+	.cat = gprs_categories,
+	.num_cat = ARRAY_SIZE(gprs_categories),
+};
+
+int main(int argc, char **argv)
+{
+	osmo_init_logging(&info);
+
+	ctx = talloc_named_const(NULL, 0, "sndcp_test");
+
+	test_compression_speed();
+
+	printf("Done\n");
+	talloc_report_full(ctx, stderr);
+	OSMO_ASSERT(talloc_total_blocks(ctx) == 1);
+	return 0;
+}
+
+/* stubs */
+struct osmo_prim_hdr;
+int bssgp_prim_cb(struct osmo_prim_hdr *oph, void *ctx)
+{
+	abort();
+}
@@ -0,0 +1,210 @@
+/* Transaction lookup load test */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <openbsc/debug.h>
+#include <openbsc/gsm_data.h>
+#include <openbsc/gsm_subscriber.h>
+#include <openbsc/gsm_04_08.h>
+#include <openbsc/transaction.h>
+#include <openbsc/mncc.h>
+
+#include <osmocom/core/application.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/msgb.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define NUM_CALLS	5000
+#define NUM_ROUNDS	50
+
+static struct gsm_bts dummy_bts;
+static struct gsm_bts_trx dummy_trx;
+static struct gsm_bts_trx_ts dummy_ts;
+static struct gsm_lchan dummy_lchan;
+
+static struct gsm_subscriber_connection *conns[NUM_CALLS];
+static struct gsm_trans *mo_trans[NUM_CALLS];
+static struct gsm_trans *mt_trans[NUM_CALLS];
+
+static unsigned int rel_ind_count;
+
+static int mncc_recv_count(struct gsm_network *net, struct msgb *msg)
+{
+	struct gsm_mncc *data = (struct gsm_mncc *) msgb_data(msg);
+
+	if (data->msg_type == MNCC_REL_IND)
+		rel_ind_count++;
+	msgb_free(msg);
+	return 0;
+}
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void setup_calls(struct gsm_network *net)
+{
+	struct timespec start;
+	int i, tid;
+
+	printf("Setting up %d calls\n", NUM_CALLS);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < NUM_CALLS; i++) {
+		struct gsm_subscriber *subscr;
+		struct gsm_subscriber_connection *conn;
+
+		subscr = subscr_alloc();
+		OSMO_ASSERT(subscr);
+		subscr->group = net->subscr_group;
+		snprintf(subscr->extension, sizeof(subscr->extension),
+			 "%d", 10000 + i);
+
+		conn = msc_subscr_con_allocate(net);
+		OSMO_ASSERT(conn);
+		conn->subscr = subscr;
+		conn->bts = &dummy_bts;
+		conn->lchan = &dummy_lchan;
+		conns[i] = conn;
+
+		/* mobile originated leg, as from a CC SETUP */
+		tid = trans_assign_trans_id(net, subscr, GSM48_PDISC_CC, 0);
+		OSMO_ASSERT(tid == 0);
+		mo_trans[i] = trans_alloc(net, subscr, GSM48_PDISC_CC, tid,
+					  0x80000001 + i);
+		OSMO_ASSERT(mo_trans[i]);
+		trans_set_conn(mo_trans[i], conn);
+
+		/* mobile terminated leg, as from a MNCC_SETUP_REQ */
+		mt_trans[i] = trans_alloc(net, subscr, GSM48_PDISC_CC, 0xff,
+					  0x00000001 + i);
+		OSMO_ASSERT(mt_trans[i]);
+		tid = trans_assign_trans_id(net, subscr, GSM48_PDISC_CC, 0);
+		OSMO_ASSERT(tid == 1);
+		trans_set_trans_id(mt_trans[i], tid);
+		trans_set_conn(mt_trans[i], conn);
+	}
+
+	fprintf(stderr, "setup: %.3f s\n", elapsed(&start));
+}
+
+static void verify_lookups(struct gsm_network *net)
+{
+	int i;
+
+	printf("Verifying lookups\n");
+
+	for (i = 0; i < NUM_CALLS; i++) {
+		OSMO_ASSERT(trans_find_by_id(conns[i], GSM48_PDISC_CC, 0) == mo_trans[i]);
+		OSMO_ASSERT(trans_find_by_id(conns[i], GSM48_PDISC_CC, 1) == mt_trans[i]);
+		OSMO_ASSERT(!trans_find_by_id(conns[i], GSM48_PDISC_CC, 2));
+		OSMO_ASSERT(!trans_find_by_id(conns[i], GSM48_PDISC_SMS, 0));
+		OSMO_ASSERT(trans_find_by_callref(net, 0x80000001 + i) == mo_trans[i]);
+		OSMO_ASSERT(trans_find_by_callref(net, 0x00000001 + i) == mt_trans[i]);
+		OSMO_ASSERT(trans_has_conn(conns[i]));
+	}
+	OSMO_ASSERT(!trans_find_by_callref(net, 0x00000001 + NUM_CALLS));
+	OSMO_ASSERT(!trans_find_by_callref(net, 0));
+}
+
+static void drive_tch_frames(struct gsm_network *net)
+{
+	uint8_t buf[sizeof(struct gsm_data_frame) + 33];
+	struct gsm_data_frame *frame = (struct gsm_data_frame *) buf;
+	struct timespec start;
+	unsigned int ok = 0, unknown = 0;
+	double secs;
+	int i, r;
+
+	printf("Driving TCH frames through MNCC\n");
+	memset(buf, 0, sizeof(buf));
+	frame->msg_type = GSM_TCHF_FRAME;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (r = 0; r < NUM_ROUNDS; r++) {
+		for (i = 0; i < NUM_CALLS; i++) {
+			frame->callref = 0x80000001 + i;
+			if (mncc_tx_to_cc(net, GSM_TCHF_FRAME, frame) == 0)
+				ok++;
+			frame->callref = 0x00000001 + i;
+			if (mncc_tx_to_cc(net, GSM_TCHF_FRAME, frame) == 0)
+				ok++;
+		}
+		frame->callref = 0x00000001 + NUM_CALLS;
+		if (mncc_tx_to_cc(net, GSM_TCHF_FRAME, frame) == -EIO)
+			unknown++;
+	}
+	secs = elapsed(&start);
+
+	printf("Delivered %u frames, rejected %u unknown\n", ok, unknown);
+	fprintf(stderr, "tch frames: %.3f s, %.0f frames/s\n", secs,
+		secs > 0 ? ok / secs : 0);
+}
+
+static void release_calls(struct gsm_network *net)
+{
+	struct timespec start;
+	int i;
+
+	printf("Releasing %d calls\n", NUM_CALLS);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < NUM_CALLS; i++) {
+		gsm0408_clear_request(conns[i], 0);
+		OSMO_ASSERT(!trans_has_conn(conns[i]));
+		OSMO_ASSERT(!trans_find_by_id(conns[i], GSM48_PDISC_CC, 0));
+		OSMO_ASSERT(!trans_find_by_callref(net, 0x80000001 + i));
+		msc_subscr_con_free(conns[i]);
+	}
+
+	fprintf(stderr, "release: %.3f s\n", elapsed(&start));
+	printf("Got %u MNCC_REL_IND\n", rel_ind_count);
+	OSMO_ASSERT(llist_empty(&net->trans_list));
+}
+
+int main(int argc, char **argv)
+{
+	struct gsm_network *net;
+
+	osmo_init_logging(&log_info);
+	log_set_print_filename(osmo_stderr_target, 0);
+	log_set_log_level(osmo_stderr_target, LOGL_ERROR);
+
+	net = gsm_network_init(NULL, 1, 1, mncc_recv_count);
+	OSMO_ASSERT(net);
+
+	dummy_trx.bts = &dummy_bts;
+	dummy_ts.trx = &dummy_trx;
+	dummy_lchan.ts = &dummy_ts;
+
+	setup_calls(net);
+	verify_lookups(net);
+	drive_tch_frames(net);
+	release_calls(net);
+
+	printf("Done\n");
+	return 0;
+}